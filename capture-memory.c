@@ -0,0 +1,119 @@
+#include "capture-memory.h"
+
+#include <obs-module.h>
+#include <util/bmem.h>
+#include <util/threading.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+struct budget {
+	const void *owner;
+	uint64_t bytes;
+	struct budget *next;
+};
+
+static volatile uint64_t used[CAPTURE_MEMORY_KIND_COUNT];
+static volatile uint64_t budget_bytes;
+
+/* the budgets of the filters, only used to find the smallest one */
+static pthread_mutex_t budget_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct budget *budgets;
+
+static const char *kind_names[CAPTURE_MEMORY_KIND_COUNT] = {
+	"staging", "frames", "shmem", "history",
+};
+
+static inline void atomic_add(volatile uint64_t *ptr, uint64_t val)
+{
+#ifdef _MSC_VER
+	_InterlockedExchangeAdd64((volatile __int64 *)ptr, (__int64)val);
+#else
+	__atomic_fetch_add(ptr, val, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline uint64_t atomic_load(const volatile uint64_t *ptr)
+{
+#ifdef _MSC_VER
+	return (uint64_t)_InterlockedCompareExchange64(
+		(volatile __int64 *)ptr, 0, 0);
+#else
+	return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline void atomic_store(volatile uint64_t *ptr, uint64_t val)
+{
+#ifdef _MSC_VER
+	_InterlockedExchange64((volatile __int64 *)ptr, (__int64)val);
+#else
+	__atomic_store_n(ptr, val, __ATOMIC_RELAXED);
+#endif
+}
+
+void capture_memory_add(enum capture_memory_kind kind, int64_t bytes)
+{
+	// unsigned wrap around subtracts negative amounts
+	atomic_add(&used[kind], (uint64_t)bytes);
+}
+
+uint64_t capture_memory_used(enum capture_memory_kind kind)
+{
+	return atomic_load(&used[kind]);
+}
+
+uint64_t capture_memory_total(void)
+{
+	uint64_t total = 0;
+	for (int i = 0; i < CAPTURE_MEMORY_KIND_COUNT; i++)
+		total += atomic_load(&used[i]);
+	return total;
+}
+
+uint64_t capture_memory_set_budget(const void *owner, uint64_t bytes)
+{
+	pthread_mutex_lock(&budget_mutex);
+
+	struct budget **p = &budgets;
+	while (*p && (*p)->owner != owner)
+		p = &(*p)->next;
+	if (!*p && bytes) {
+		*p = bzalloc(sizeof(struct budget));
+		(*p)->owner = owner;
+	}
+	if (*p && bytes) {
+		(*p)->bytes = bytes;
+	} else if (*p) {
+		struct budget *removed = *p;
+		*p = removed->next;
+		bfree(removed);
+	}
+
+	uint64_t smallest = 0;
+	for (struct budget *budget = budgets; budget; budget = budget->next) {
+		if (!smallest || budget->bytes < smallest)
+			smallest = budget->bytes;
+	}
+	atomic_store(&budget_bytes, smallest);
+
+	pthread_mutex_unlock(&budget_mutex);
+	return smallest;
+}
+
+uint64_t capture_memory_budget(void)
+{
+	return atomic_load(&budget_bytes);
+}
+
+bool capture_memory_over_budget(void)
+{
+	uint64_t budget = atomic_load(&budget_bytes);
+	return budget && capture_memory_total() > budget;
+}
+
+const char *capture_memory_kind_name(enum capture_memory_kind kind)
+{
+	return kind < CAPTURE_MEMORY_KIND_COUNT ? kind_names[kind] : "unknown";
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Memory held by all screenshot filters together, and the budget for it.
+ *
+ * Every allocation that lives longer than a frame is accounted here by kind:
+ * staging surfaces, frame buffers (in use or idle in their pools), shared
+ * memory rings and the encoded images of histories.  Accounting is a single
+ * atomic add, so any thread can do it.
+ *
+ * Each filter can set a budget, the smallest one set on any filter applies to
+ * all of them.  Over the budget, nothing is refused: frame pools stop keeping
+ * idle buffers and filters release what they are not using sooner, see the
+ * filter's idle release.
+ */
+
+enum capture_memory_kind {
+	CAPTURE_MEMORY_STAGING,
+	CAPTURE_MEMORY_FRAMES,
+	CAPTURE_MEMORY_SHMEM,
+	CAPTURE_MEMORY_HISTORY,
+	CAPTURE_MEMORY_KIND_COUNT,
+};
+
+/* bytes is negative for memory that is freed */
+extern void capture_memory_add(enum capture_memory_kind kind, int64_t bytes);
+extern uint64_t capture_memory_used(enum capture_memory_kind kind);
+extern uint64_t capture_memory_total(void);
+
+/* sets the budget of owner, 0 removes it.  returns the budget in effect */
+extern uint64_t capture_memory_set_budget(const void *owner, uint64_t bytes);
+/* the smallest budget set, 0 if there is none */
+extern uint64_t capture_memory_budget(void);
+extern bool capture_memory_over_budget(void);
+
+extern const char *capture_memory_kind_name(enum capture_memory_kind kind);
@@ -0,0 +1,1126 @@
+#include "capture-output.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <obs-module.h>
+#include <util/bmem.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+
+#include "capture-memory.h"
+#include "capture-stats.h"
+#include "delta-frame.h"
+#include "encode-pool.h"
+#include "file-sink.h"
+#include "frame-log.h"
+#include "frame-pool.h"
+#include "http-client.h"
+#include "http-server.h"
+#include "raw-frame.h"
+#include "shmem-ring.h"
+
+#define do_log(level, format, ...) \
+	blog(level, "[screenshot-filter] " format, ##__VA_ARGS__)
+
+#define warn(format, ...) do_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define info(format, ...) do_log(LOG_INFO, format, ##__VA_ARGS__)
+#define debug(format, ...) do_log(LOG_DEBUG, format, ##__VA_ARGS__)
+
+struct output_data;
+
+static bool write_data(struct capture_output *output,
+		       struct capture_frame *frame, uint32_t level, bool sync,
+		       struct output_data *data);
+static bool put_data(struct http_client *http, const char *url, uint8_t *buf,
+		     size_t len, const char *content_type, int width,
+		     int height, uint64_t timestamp, uint64_t frame_number);
+
+// an image or delta frame to write, release(opaque) frees it once it is
+// written.  without release it is copied if it needs to outlive the call.
+// header is written to files before data and always copied
+struct output_data {
+	const void *header;
+	size_t header_size;
+	const uint8_t *data;
+	size_t size;
+	const char *content_type;
+	const char *extension;
+	uint32_t width;
+	uint32_t height;
+	void (*release)(void *opaque);
+	void *opaque;
+};
+
+static int64_t shmem_size(struct shmem_ring *ring)
+{
+	return ring ? (int64_t)(shmem_ring_capacity(ring) *
+				shmem_ring_slot_count(ring))
+		    : 0;
+}
+
+static void destroy_ring(struct shmem_ring *ring)
+{
+	capture_memory_add(CAPTURE_MEMORY_SHMEM, -shmem_size(ring));
+	shmem_ring_destroy(ring);
+}
+
+// (re)creates a level's shared memory ring when the name, slot count or
+// frame size changes
+static void update_shmem(struct capture_output *output, uint32_t level,
+			 const char *name, uint32_t slots, uint64_t size)
+{
+	struct shmem_ring *ring = output->shmem[level];
+	if (ring && name && strcmp(shmem_ring_name(ring), name) == 0 &&
+	    shmem_ring_slot_count(ring) == slots &&
+	    shmem_ring_capacity(ring) >= size)
+		return;
+
+	destroy_ring(ring);
+	output->shmem[level] = shmem_ring_create(name, slots, size);
+	capture_memory_add(CAPTURE_MEMORY_SHMEM,
+			   shmem_size(output->shmem[level]));
+}
+
+static void destroy_shmem(struct capture_output *output, uint32_t first_level)
+{
+	for (uint32_t i = first_level; i < IMAGE_MAX_LEVELS; i++) {
+		destroy_ring(output->shmem[i]);
+		output->shmem[i] = NULL;
+	}
+}
+
+// fills in the frame's levels, scaling each level from the one before so the
+// full image is only read once
+static void make_levels(struct capture_output *output,
+			struct capture_frame *frame,
+			struct image_encoder *encoder)
+{
+	if (!frame->resample) {
+		frame->levels[0].buffer = frame_buffer_addref(frame->buffer);
+		frame->levels[0].width = frame->buffer->width;
+		frame->levels[0].height = frame->buffer->height;
+		frame->level_count = 1;
+		return;
+	}
+
+	enum pixel_format format = frame->pixel_format;
+	struct frame_buffer *src = frame_buffer_addref(frame->buffer);
+	uint32_t i;
+
+	for (i = 0; i < frame->level_count; i++) {
+		uint32_t width, height;
+		image_level_size(frame->output_width, frame->output_height, i,
+				 &width, &height);
+
+		struct frame_buffer *rgba;
+		if (width == src->width && height == src->height) {
+			rgba = frame_buffer_addref(src);
+		} else {
+			rgba = frame_pool_get(output->scale_pools[i],
+					      PIXEL_FORMAT_RGBA, width, height,
+					      width * 4,
+					      (size_t)width * 4 * height);
+			if (!image_encoder_scale(encoder, src->data,
+						 src->linesize, src->width,
+						 src->height, rgba->data,
+						 rgba->linesize, width,
+						 height)) {
+				frame_buffer_release(rgba);
+				break;
+			}
+		}
+		frame_buffer_release(src);
+		src = rgba;
+		frame->levels[i].width = width;
+		frame->levels[i].height = height;
+
+		if (format == PIXEL_FORMAT_RGBA) {
+			frame->levels[i].buffer = frame_buffer_addref(rgba);
+		} else {
+			struct frame_buffer *out = frame_pool_get(
+				output->convert_pools[i], format, width, height,
+				pixel_format_linesize(format, width),
+				pixel_format_size(format, width, height));
+			pixel_format_convert(format, rgba->data, rgba->linesize,
+					     width, height, out->data);
+			frame->levels[i].buffer = out;
+		}
+	}
+
+	frame_buffer_release(src);
+	frame->level_count = i;
+}
+
+// whether the frame differs enough from the last one encoded, keeps it to
+// compare the next one with if so
+static bool frame_changed(struct capture_output *output,
+			  struct capture_frame *frame)
+{
+	struct frame_buffer *buffer = frame->buffer;
+	struct frame_buffer *reference = output->change_reference;
+
+	if (!frame->change_detect) {
+		frame_buffer_release(reference);
+		output->change_reference = NULL;
+		return true;
+	}
+
+	bool changed = frame->forced || !reference ||
+		       reference->format != buffer->format ||
+		       reference->width != buffer->width ||
+		       reference->height != buffer->height ||
+		       reference->linesize != buffer->linesize ||
+		       (frame->change_max_silence &&
+			frame->timestamp - output->change_time >=
+				frame->change_max_silence);
+	if (!changed) {
+		uint64_t start = os_gettime_ns();
+		// planar formats are compared by their luma plane
+		uint32_t bytes_per_pixel =
+			pixel_format_bytes_per_pixel(buffer->format);
+		changed = frame_diff_changed(
+			reference->data, buffer->data, buffer->linesize,
+			buffer->width, buffer->height,
+			bytes_per_pixel ? bytes_per_pixel : 1,
+			&frame->change_mask, frame->x, frame->y,
+			frame->change_threshold);
+		capture_stats_record(output->stats, CAPTURE_STAGE_COMPARE,
+				     os_gettime_ns() - start);
+	}
+	if (!changed)
+		return false;
+
+	// buffers are not written to once they are filled, so a reference
+	// is as good as a copy
+	frame_buffer_release(reference);
+	output->change_reference = frame_buffer_addref(buffer);
+	output->change_time = frame->timestamp;
+	return true;
+}
+
+// runs on an encoder thread for one frame at a time, in the order they were
+// submitted, so that frames are compared with the one before them
+static bool prepare_frame(void *param, void *data)
+{
+	struct capture_output *output = param;
+	struct capture_frame *frame = data;
+	capture_stats_record(output->stats, CAPTURE_STAGE_QUEUE,
+			     os_gettime_ns() - frame->submit_time);
+
+	if (!frame_changed(output, frame)) {
+		capture_stats_add(output->stats, CAPTURE_COUNTER_UNCHANGED, 1);
+		return false;
+	}
+	capture_stats_add(output->stats, CAPTURE_COUNTER_CAPTURED, 1);
+	return true;
+}
+
+static void encode_frame(void *param, void *data,
+			 struct image_encoder *encoder)
+{
+	struct capture_output *output = param;
+	struct capture_frame *frame = data;
+	uint64_t start = os_gettime_ns();
+
+	make_levels(output, frame, encoder);
+
+	// raw frames only need their levels, images at least one encoded
+	bool encoded = frame->level_count > 0;
+	if (frame->destination_type != CAPTURE_DESTINATION_SHMEM &&
+	    !frame->raw) {
+		encoded = false;
+		for (uint32_t i = 0; i < frame->level_count; i++) {
+			struct capture_level *level = &frame->levels[i];
+			level->encoded = image_encoder_encode(
+				encoder, &frame->codec, level->buffer->data,
+				level->buffer->linesize, level->buffer->width,
+				level->buffer->height, &level->image);
+			if (level->encoded)
+				encoded = true;
+			else
+				capture_stats_add(output->stats,
+						  CAPTURE_COUNTER_FAILED, 1);
+		}
+	}
+
+	capture_stats_record(output->stats, CAPTURE_STAGE_ENCODE,
+			     os_gettime_ns() - start);
+	if (encoded)
+		capture_stats_add(output->stats, CAPTURE_COUNTER_ENCODED, 1);
+	else if (!frame->level_count)
+		// scaling the first level failed, there is nothing to write
+		capture_stats_add(output->stats, CAPTURE_COUNTER_FAILED, 1);
+}
+
+// delta encodes the first level into output->delta_buffer and returns its size
+static size_t encode_delta(struct capture_output *output,
+			   struct frame_buffer *buffer)
+{
+	size_t max_size = delta_encoder_max_size(
+		output->delta_encoder, buffer->width, buffer->height);
+	if (output->delta_buffer_size < max_size) {
+		bfree(output->delta_buffer);
+		output->delta_buffer = bmalloc(max_size);
+		output->delta_buffer_size = max_size;
+	}
+
+	return delta_encoder_encode(output->delta_encoder, buffer->data,
+				    buffer->linesize, buffer->width,
+				    buffer->height, output->index,
+				    output->delta_buffer);
+}
+
+// publishes a level to its shared memory ring, named after the destination
+// plus the level suffix
+static void write_shmem_level(struct capture_output *output,
+			      struct capture_frame *frame, uint32_t i)
+{
+	struct frame_buffer *buffer = frame->levels[i].buffer;
+	struct dstr name = {0};
+	if (frame->destination && *frame->destination)
+		dstr_printf(&name, "%s%s", frame->destination,
+			    image_level_suffix(i));
+
+	update_shmem(output, i, name.array, frame->shmem_slots, buffer->size);
+	dstr_free(&name);
+
+	struct shmem_ring_frame info = {
+		.width = buffer->width,
+		.height = buffer->height,
+		.linesize = buffer->linesize,
+		.index = output->index,
+		.size = (uint64_t)buffer->size,
+		.timestamp = frame->timestamp,
+		.format = buffer->format,
+		.frame = frame->frame_number,
+	};
+	shmem_ring_publish(output->shmem[i], &info, buffer->data);
+	if (output->shmem[i])
+		capture_stats_add(output->stats, CAPTURE_COUNTER_BYTES,
+				  info.size);
+}
+
+static void release_buffer(void *opaque)
+{
+	frame_buffer_release(opaque);
+}
+
+static void release_image(void *opaque)
+{
+	encoded_image_free(opaque);
+	bfree(opaque);
+}
+
+static void release_data(struct output_data *data)
+{
+	if (data->release)
+		data->release(data->opaque);
+}
+
+// whether this frame is flushed to disk.  single files are their own
+// segment, so the per segment policy flushes every one of them
+static bool sync_due(struct capture_output *output,
+		     struct capture_frame *frame)
+{
+	if (frame->fsync_policy == CAPTURE_FSYNC_SEGMENT)
+		return frame->destination_type != CAPTURE_DESTINATION_LOG;
+	if (frame->fsync_policy != CAPTURE_FSYNC_FRAMES)
+		return false;
+
+	if (++output->unsynced_frames < frame->fsync_frames)
+		return false;
+	output->unsynced_frames = 0;
+	return true;
+}
+
+// (re)creates the frame log when the directory changes, a new one starts a
+// new segment
+static void update_log(struct capture_output *output,
+		       struct capture_frame *frame)
+{
+	const char *directory = frame_log_directory(output->log);
+	if (!directory || strcmp(directory, frame->destination) != 0) {
+		frame_log_destroy(output->log);
+		output->log = frame_log_create(frame->destination,
+					       output->sink);
+	}
+	frame_log_set_rotation(output->log, frame->log_segment_size,
+			       frame->log_segment_duration);
+	frame_log_set_durability(
+		output->log, frame->log_preallocate,
+		frame->fsync_policy == CAPTURE_FSYNC_SEGMENT);
+}
+
+static void close_log(struct capture_output *output)
+{
+	frame_log_destroy(output->log);
+	output->log = NULL;
+}
+
+static bool append_log(struct capture_output *output,
+		       struct capture_frame *frame, uint32_t level,
+		       uint32_t flags, bool sync, struct output_data *data)
+{
+	// frames kept for the history only have their encoded images left,
+	// which decode to packed RGBA
+	struct capture_level *info = &frame->levels[level];
+	struct frame_buffer *buffer = info->buffer;
+	struct frame_log_entry entry = {
+		.timestamp = frame->timestamp,
+		.index = output->index,
+		.flags = flags,
+		.width = info->width,
+		.height = info->height,
+		.linesize = (flags & FRAME_LOG_FLAG_RAW) ? buffer->linesize
+							 : info->width * 4,
+		.pixel_format = buffer ? buffer->format : PIXEL_FORMAT_RGBA,
+		.level = level,
+		.frame = frame->frame_number,
+	};
+	snprintf(entry.extension, sizeof(entry.extension), "%s",
+		 data->extension);
+	return frame_log_append(output->log, &entry, data->data, data->size,
+				sync, data->release, data->opaque);
+}
+
+static void init_raw_header(struct raw_frame_header *header,
+			    struct capture_output *output,
+			    struct capture_frame *frame,
+			    struct frame_buffer *buffer)
+{
+	*header = (struct raw_frame_header){
+		.magic = RAW_FRAME_MAGIC,
+		.version = RAW_FRAME_VERSION,
+		.header_size = sizeof(*header),
+		.width = buffer->width,
+		.height = buffer->height,
+		.linesize = buffer->linesize,
+		.pixel_format = buffer->format,
+		.data_size = buffer->size,
+		.index = output->index,
+		.timestamp = frame->timestamp,
+		.frame = frame->frame_number,
+	};
+	if (frame->raw_checksum) {
+		header->flags |= RAW_FRAME_FLAG_CHECKSUM;
+		header->checksum =
+			raw_frame_checksum(buffer->data, buffer->size);
+	}
+}
+
+// writes a level to a file, folder, URL or frame log, as a delta frame if
+// delta is set
+static void write_level(struct capture_output *output,
+			struct capture_frame *frame, uint32_t i, bool delta,
+			bool sync)
+{
+	struct capture_level *level = &frame->levels[i];
+	struct frame_buffer *buffer = level->buffer;
+	struct output_data data = {
+		.width = level->width,
+		.height = level->height,
+	};
+	struct raw_frame_header raw_header;
+	uint32_t flags;
+
+	// images are handed to the file sink by reference, only the delta
+	// buffer is copied because the next frame reuses it
+	if (delta) {
+		data.size = encode_delta(output, buffer);
+		data.data = output->delta_buffer;
+		data.content_type = "application/x-screenshot-delta";
+		data.extension = "delta";
+		flags = FRAME_LOG_FLAG_DELTA;
+	} else if (frame->raw) {
+		data.data = buffer->data;
+		data.size = buffer->size;
+		data.content_type = pixel_format_content_type(buffer->format);
+		data.extension = "raw";
+		data.release = release_buffer;
+		data.opaque = frame_buffer_addref(buffer);
+		flags = FRAME_LOG_FLAG_RAW;
+
+		// .raw files describe themselves, uploads and the frame log
+		// carry the same fields in their own metadata
+		if (frame->destination_type == CAPTURE_DESTINATION_PATH ||
+		    frame->destination_type == CAPTURE_DESTINATION_FOLDER) {
+			init_raw_header(&raw_header, output, frame, buffer);
+			data.header = &raw_header;
+			data.header_size = sizeof(raw_header);
+		}
+	} else if (level->encoded) {
+		struct encoded_image *image =
+			bmemdup(&level->image, sizeof(level->image));
+		memset(&level->image, 0, sizeof(level->image));
+		level->encoded = false;
+
+		data.data = image->data;
+		data.size = image->size;
+		data.content_type = image->content_type;
+		data.extension = image->extension;
+		data.release = release_image;
+		data.opaque = image;
+		flags = 0;
+	} else {
+		return;
+	}
+
+	// data may be released by the time the write returns
+	size_t size = data.header_size + data.size;
+	bool written;
+	if (frame->destination_type == CAPTURE_DESTINATION_LOG)
+		written = append_log(output, frame, i, flags, sync, &data);
+	else
+		written = write_data(output, frame, i, sync, &data);
+
+	if (written)
+		capture_stats_add(output->stats, CAPTURE_COUNTER_BYTES, size);
+	else
+		capture_stats_add(output->stats, CAPTURE_COUNTER_FAILED, 1);
+
+	// the receiver missed this frame
+	if (delta && !written)
+		delta_encoder_force_keyframe(output->delta_encoder);
+}
+
+// bytes of the images a frame published to the HTTP server
+static uint64_t published_size(struct capture_frame *frame, size_t delta_size)
+{
+	uint64_t size = 0;
+	for (uint32_t i = 0; i < frame->level_count; i++) {
+		struct capture_level *level = &frame->levels[i];
+		if (i == 0 && delta_size)
+			size += delta_size;
+		else if (level->encoded)
+			size += level->image.size;
+		else
+			size += level->buffer->size;
+	}
+	return size;
+}
+
+static uint64_t history_size(struct capture_frame *frame)
+{
+	uint64_t size = 0;
+	for (uint32_t i = 0; i < frame->level_count; i++)
+		size += frame->levels[i].image.size;
+	return size;
+}
+
+static void update_history_gauges(struct capture_output *output)
+{
+	capture_stats_set(output->stats, CAPTURE_GAUGE_HISTORY_FRAMES,
+			  output->history_frames);
+	capture_stats_set(output->stats, CAPTURE_GAUGE_HISTORY_BYTES,
+			  output->history_bytes);
+}
+
+static struct capture_frame *pop_history(struct capture_output *output)
+{
+	struct capture_frame *frame = output->history_first;
+	output->history_first = frame->next;
+	if (!output->history_first)
+		output->history_last = NULL;
+	output->history_frames -= 1;
+	output->history_bytes -= history_size(frame);
+	capture_memory_add(CAPTURE_MEMORY_HISTORY,
+			   -(int64_t)history_size(frame));
+	return frame;
+}
+
+static void clear_history(struct capture_output *output)
+{
+	if (!output->history_first)
+		return;
+	while (output->history_first)
+		capture_frame_free(pop_history(output));
+	update_history_gauges(output);
+}
+
+// frames are only written to where they were kept for
+static bool history_matches(struct capture_output *output,
+			    struct capture_frame *frame)
+{
+	struct capture_frame *first = output->history_first;
+	if (!first)
+		return true;
+	return first->destination_type == frame->destination_type &&
+	       strcmp(first->destination ? first->destination : "",
+		      frame->destination ? frame->destination : "") == 0;
+}
+
+// moves the frame's encoded images to the end of the history, the frame
+// itself is left empty for the encode pool to free.  the oldest frames are
+// dropped to stay within the memory and duration limits
+static void keep_history(struct capture_output *output,
+			 struct capture_frame *frame)
+{
+	struct capture_frame *kept = bmemdup(frame, sizeof(*frame));
+	memset(frame->levels, 0, sizeof(frame->levels));
+	frame->buffer = NULL;
+	frame->destination = NULL;
+
+	// the pixels go back to the pools, only the compressed images stay
+	frame_buffer_release(kept->buffer);
+	kept->buffer = NULL;
+	for (uint32_t i = 0; i < IMAGE_MAX_LEVELS; i++) {
+		frame_buffer_release(kept->levels[i].buffer);
+		kept->levels[i].buffer = NULL;
+	}
+
+	kept->next = NULL;
+	if (output->history_last)
+		output->history_last->next = kept;
+	else
+		output->history_first = kept;
+	output->history_last = kept;
+	output->history_frames += 1;
+	output->history_bytes += history_size(kept);
+	capture_memory_add(CAPTURE_MEMORY_HISTORY,
+			   (int64_t)history_size(kept));
+
+	while (output->history_first &&
+	       (output->history_bytes > frame->history_max_bytes ||
+		kept->timestamp - output->history_first->timestamp >
+			frame->history_duration))
+		capture_frame_free(pop_history(output));
+
+	update_history_gauges(output);
+}
+
+// writes the history before the frame that triggered it, in the order the
+// frames were captured
+static void write_history(struct capture_output *output)
+{
+	if (!output->history_first)
+		return;
+
+	info("Writing %llu frames of history",
+	     (unsigned long long)output->history_frames);
+	while (output->history_first) {
+		struct capture_frame *kept = pop_history(output);
+		bool sync = sync_due(output, kept);
+		for (uint32_t i = 0; i < kept->level_count; i++)
+			write_level(output, kept, i, false, sync);
+		output->index += 1;
+		capture_frame_free(kept);
+	}
+	update_history_gauges(output);
+}
+
+static void write_frame(void *param, void *data)
+{
+	struct capture_output *output = param;
+	struct capture_frame *frame = data;
+	uint64_t start = os_gettime_ns();
+
+	if (!frame->history_max_bytes || !history_matches(output, frame))
+		clear_history(output);
+
+	if (!frame->level_count) {
+		output->index += 1;
+		return;
+	}
+
+	if (frame->history_keep) {
+		keep_history(output, frame);
+		capture_stats_record(output->stats, CAPTURE_STAGE_WRITE,
+				     os_gettime_ns() - start);
+		return;
+	}
+
+	struct frame_buffer *buffer = frame->levels[0].buffer;
+	uint32_t width = buffer->width;
+	uint32_t height = buffer->height;
+
+	// deltas replace the raw image of the first level, encoded images are
+	// sent as they are.  tiles are 4 bytes per pixel so only RGBA and BGRA
+	// frames qualify
+	bool delta = frame->delta &&
+		     (frame->destination_type == CAPTURE_DESTINATION_SHMEM ||
+		      frame->raw) &&
+		     pixel_format_bytes_per_pixel(buffer->format) == 4;
+	if (delta)
+		delta_encoder_set_keyframe_interval(
+			output->delta_encoder, frame->delta_keyframe_interval);
+	else
+		// start over with a keyframe when deltas are turned back on
+		delta_encoder_force_keyframe(output->delta_encoder);
+
+	if (capture_destination_is_file(frame->destination_type) &&
+	    !output->sink) {
+		output->sink = file_sink_create();
+		info("Writing files with the %s backend",
+		     file_sink_backend(output->sink));
+	}
+
+	if (frame->destination_type == CAPTURE_DESTINATION_LOG)
+		update_log(output, frame);
+	else
+		close_log(output);
+
+	if (frame->destination_type == CAPTURE_DESTINATION_SHMEM) {
+		if (!delta) {
+			write_shmem_level(output, frame, 0);
+		} else {
+			struct shmem_ring *old_ring = output->shmem[0];
+			size_t max_size = delta_encoder_max_size(
+				output->delta_encoder, width, height);
+			update_shmem(output, 0, frame->destination,
+				     frame->shmem_slots, max_size);
+
+			if (output->shmem[0]) {
+				// readers of a new ring need a keyframe to
+				// start from
+				if (output->shmem[0] != old_ring)
+					delta_encoder_force_keyframe(
+						output->delta_encoder);
+
+				// encoded straight into the slot
+				struct shmem_ring_frame info = {
+					.width = width,
+					.height = height,
+					.linesize = width * 4,
+					.index = output->index,
+					.timestamp = frame->timestamp,
+					.flags = SHMEM_RING_FLAG_DELTA,
+					.format = buffer->format,
+					.frame = frame->frame_number,
+				};
+				uint8_t *slot_data =
+					shmem_ring_begin(output->shmem[0]);
+				info.size = delta_encoder_encode(
+					output->delta_encoder, buffer->data,
+					buffer->linesize, width, height,
+					output->index, slot_data);
+				shmem_ring_commit(output->shmem[0], &info);
+				capture_stats_add(output->stats,
+						  CAPTURE_COUNTER_BYTES,
+						  info.size);
+			}
+		}
+
+		for (uint32_t i = 1; i < frame->level_count; i++)
+			write_shmem_level(output, frame, i);
+		destroy_shmem(output, frame->level_count);
+	} else {
+		destroy_shmem(output, 0);
+
+		// only touched by this client's writer, which is never run
+		// concurrently.  NULL if sockets could not be initialized,
+		// put_data() fails the upload then
+		if (output->http)
+			http_client_set_chunk_threshold(
+				output->http, frame->url_chunked
+						      ? HTTP_CLIENT_CHUNK_SIZE
+						      : 0);
+
+		if (frame->destination_type == CAPTURE_DESTINATION_SERVER) {
+			size_t delta_size = delta ? encode_delta(output, buffer)
+						  : 0;
+			// publishing takes over the encoded images
+			capture_stats_add(output->stats, CAPTURE_COUNTER_BYTES,
+					  published_size(frame, delta_size));
+
+			// every viewer is sent this one encoded image
+			for (uint32_t i = 0; i < IMAGE_MAX_LEVELS; i++) {
+				struct capture_level *level = &frame->levels[i];
+				http_server_publish(
+					output->server, i,
+					i < frame->level_count ? level->buffer
+							       : NULL,
+					level->encoded ? &level->image : NULL,
+					delta && i == 0 ? output->delta_buffer
+							: NULL,
+					delta_size, output->index,
+					frame->timestamp, frame->frame_number);
+			}
+		} else {
+			if (frame->history_dump)
+				write_history(output);
+
+			bool sync = sync_due(output, frame);
+			for (uint32_t i = 0; i < frame->level_count; i++)
+				write_level(output, frame, i, delta && i == 0,
+					    sync);
+		}
+	}
+	output->index += 1;
+
+	uint64_t end = os_gettime_ns();
+	capture_stats_record(output->stats, CAPTURE_STAGE_WRITE, end - start);
+	capture_stats_record(output->stats, CAPTURE_STAGE_TOTAL,
+			     end - frame->timestamp);
+}
+
+void capture_frame_free(struct capture_frame *frame)
+{
+	for (size_t i = 0; i < IMAGE_MAX_LEVELS; i++) {
+		encoded_image_free(&frame->levels[i].image);
+		frame_buffer_release(frame->levels[i].buffer);
+	}
+	bfree(frame->destination);
+	frame_buffer_release(frame->buffer);
+	bfree(frame);
+}
+
+static void free_frame(void *param, void *data)
+{
+	UNUSED_PARAMETER(param);
+	capture_frame_free(data);
+}
+
+static const struct encode_client_callbacks encode_callbacks = {
+	.prepare = prepare_frame,
+	.encode = encode_frame,
+	.write = write_frame,
+	.free = free_frame,
+};
+
+void capture_output_init(struct capture_output *output, bool server,
+			 struct capture_stats *stats)
+{
+	output->stats = stats;
+	output->encode_client = encode_client_create(&encode_callbacks, output);
+	output->frame_pool = frame_pool_create(ENCODE_QUEUE_MAX_DEPTH);
+	for (size_t i = 0; i < IMAGE_MAX_LEVELS; i++) {
+		output->scale_pools[i] =
+			frame_pool_create(ENCODE_QUEUE_MAX_DEPTH);
+		output->convert_pools[i] =
+			frame_pool_create(ENCODE_QUEUE_MAX_DEPTH);
+	}
+	output->http = http_client_create();
+	if (server)
+		output->server = http_server_create();
+	output->delta_encoder =
+		delta_encoder_create(DELTA_FRAME_DEFAULT_TILE_SIZE);
+}
+
+void capture_output_stop(struct capture_output *output)
+{
+	encode_client_destroy(output->encode_client);
+	output->encode_client = NULL;
+}
+
+void capture_output_free(struct capture_output *output)
+{
+	destroy_shmem(output, 0);
+	// the log queues its last writes, the sink waits for them
+	close_log(output);
+	file_sink_destroy(output->sink);
+	for (size_t i = 0; i < IMAGE_MAX_LEVELS; i++)
+		bfree(output->folder_names[i]);
+	http_client_destroy(output->http);
+	http_server_destroy(output->server);
+	delta_encoder_destroy(output->delta_encoder);
+	bfree(output->delta_buffer);
+	frame_buffer_release(output->change_reference);
+	clear_history(output);
+	frame_pool_release(output->frame_pool);
+	for (size_t i = 0; i < IMAGE_MAX_LEVELS; i++) {
+		frame_pool_release(output->scale_pools[i]);
+		frame_pool_release(output->convert_pools[i]);
+	}
+}
+
+// partial rectangles such as regions are packed and only their own rows and
+// columns are read.  other formats are converted instead of copied, unless
+// the image is scaled first
+void capture_output_copy(struct capture_output *output,
+			 struct capture_frame *frame, const uint8_t *data,
+			 uint32_t linesize, bool whole)
+{
+	enum pixel_format format = frame->resample ? PIXEL_FORMAT_RGBA
+						   : frame->pixel_format;
+	uint32_t width = frame->width;
+	uint32_t height = frame->height;
+	uint64_t start = os_gettime_ns();
+
+	data += (size_t)frame->y * linesize + (size_t)frame->x * 4;
+
+	if (format == PIXEL_FORMAT_RGBA && whole) {
+		frame->buffer = frame_pool_get(output->frame_pool, format,
+					       width, height, linesize,
+					       (size_t)linesize * height);
+		memcpy(frame->buffer->data, data, frame->buffer->size);
+	} else if (format == PIXEL_FORMAT_RGBA) {
+		uint32_t row_size = width * 4;
+		frame->buffer = frame_pool_get(output->frame_pool, format,
+					       width, height, row_size,
+					       (size_t)row_size * height);
+		for (uint32_t y = 0; y < height; y++)
+			memcpy(frame->buffer->data + (size_t)y * row_size,
+			       data + (size_t)y * linesize, row_size);
+	} else {
+		frame->buffer = frame_pool_get(
+			output->frame_pool, format, width, height,
+			pixel_format_linesize(format, width),
+			pixel_format_size(format, width, height));
+		pixel_format_convert(format, data, linesize, width, height,
+				     frame->buffer->data);
+	}
+
+	capture_stats_record(output->stats, CAPTURE_STAGE_COPY,
+			     os_gettime_ns() - start);
+}
+
+bool capture_output_trim(struct capture_output *output)
+{
+	frame_pool_trim(output->frame_pool);
+	for (size_t i = 0; i < IMAGE_MAX_LEVELS; i++) {
+		frame_pool_trim(output->scale_pools[i]);
+		frame_pool_trim(output->convert_pools[i]);
+	}
+
+	// the image kept to detect changes stays, or the next frame would
+	// always count as changed
+
+	// the rest belongs to the writer, which can only run for frames that
+	// are in flight, and frames are only submitted by this thread
+	if (!encode_client_idle(output->encode_client))
+		return false;
+
+	destroy_shmem(output, 0);
+	bfree(output->delta_buffer);
+	output->delta_buffer = NULL;
+	output->delta_buffer_size = 0;
+	// the receiver needs a keyframe to start from in a new ring
+	delta_encoder_force_keyframe(output->delta_encoder);
+	return true;
+}
+
+bool capture_output_share(struct capture_frame *frame,
+			  const struct capture_frame *copied)
+{
+	enum pixel_format format = frame->resample ? PIXEL_FORMAT_RGBA
+						   : frame->pixel_format;
+	const struct frame_buffer *buffer = copied->buffer;
+
+	// frames are only ever copied packed or whole, and a whole copy has
+	// the linesize of the staging surface
+	if (!buffer || buffer->format != format || copied->x != frame->x ||
+	    copied->y != frame->y || buffer->width != frame->width ||
+	    buffer->height != frame->height ||
+	    buffer->linesize != pixel_format_linesize(format, frame->width))
+		return false;
+
+	frame->buffer = frame_buffer_addref(copied->buffer);
+	return true;
+}
+
+void capture_output_reserve(struct capture_output *output,
+			    const struct capture_frame *frame, uint32_t count)
+{
+	enum pixel_format format = frame->resample ? PIXEL_FORMAT_RGBA
+						   : frame->pixel_format;
+	frame_pool_reserve(output->frame_pool,
+			   pixel_format_size(format, frame->width,
+					     frame->height),
+			   count);
+}
+
+void capture_output_submit(struct capture_output *output,
+			   struct capture_frame *frame)
+{
+	frame->submit_time = os_gettime_ns();
+	encode_client_submit(output->encode_client, frame);
+}
+
+// localtime() shares its result between threads, and frames are written on
+// all encoder threads
+static void local_time(const time_t *now, struct tm *tm)
+{
+#ifdef _WIN32
+	localtime_s(tm, now);
+#else
+	localtime_r(now, tm);
+#endif
+}
+
+// inserts suffix before the extension of a file path or URL path, e.g.
+// shot.png -> shot-half.png
+static void add_suffix(struct dstr *out, const char *destination,
+		       const char *suffix)
+{
+	const char *end = destination + strcspn(destination, "?#");
+	const char *start = destination;
+	const char *scheme = strstr(destination, "://");
+	if (scheme && scheme < end) {
+		start = strchr(scheme + 3, '/');
+		if (!start || start > end)
+			start = end;
+	}
+
+	const char *insert = end;
+	for (const char *p = start; p < end; p++) {
+		if (*p == '.')
+			insert = p;
+		else if (*p == '/' || *p == '\\')
+			insert = end;
+	}
+
+	dstr_ncopy(out, destination, insert - destination);
+	if (scheme && start == end && *suffix)
+		dstr_cat(out, "/");
+	dstr_cat(out, suffix);
+	dstr_cat(out, insert);
+}
+
+// files are queued on the output's file sink, which takes over data.  URLs
+// are uploaded before this returns
+static bool write_data(struct capture_output *output,
+		       struct capture_frame *frame, uint32_t level, bool sync,
+		       struct output_data *data)
+{
+	const char *destination = frame->destination;
+	const char *suffix = image_level_suffix(level);
+	int destination_type = frame->destination_type;
+	uint32_t sync_flag = sync ? FILE_SINK_SYNC : 0;
+	bool success = false;
+
+	if (!destination || !*destination) {
+		release_data(data);
+		return false;
+	}
+
+	if (destination_type == CAPTURE_DESTINATION_PATH) {
+		struct dstr path = {0};
+		add_suffix(&path, destination, suffix);
+		// readers of the file only ever see a whole image
+		uint32_t flags = sync_flag |
+				 (frame->atomic_write ? FILE_SINK_ATOMIC : 0);
+		success = file_sink_write(output->sink, path.array, flags,
+					  data->header, data->header_size,
+					  data->data, data->size,
+					  data->release, data->opaque);
+		dstr_free(&path);
+		return success;
+	}
+	if (destination_type == CAPTURE_DESTINATION_URL) {
+		if (strstr(destination, "http://") != NULL ||
+		    strstr(destination, "https://") != NULL) {
+			//info("PUT %s (%d bytes)", destination, len);
+			struct dstr url = {0};
+			add_suffix(&url, destination, suffix);
+			uint64_t start = os_gettime_ns();
+			success = put_data(output->http, url.array,
+					   (uint8_t *)data->data, data->size,
+					   data->content_type, data->width,
+					   data->height, frame->timestamp,
+					   frame->frame_number);
+			capture_stats_record(output->stats,
+					     CAPTURE_STAGE_UPLOAD,
+					     os_gettime_ns() - start);
+			dstr_free(&url);
+		}
+	}
+	if (destination_type == CAPTURE_DESTINATION_FOLDER) {
+		FILE *of = fopen(destination, "rb");
+
+		if (of != NULL) {
+			fclose(of);
+		} else {
+			time_t nowunixtime = time(NULL);
+			struct tm tm;
+			struct tm *nowtime = &tm;
+			local_time(&nowunixtime, nowtime);
+			char _file_destination[260];
+			char file_destination[260];
+			// bursts and histories have many frames a second
+			char frame_name[32] = "";
+			if (frame->numbered)
+				snprintf(frame_name, sizeof(frame_name),
+					 "_%llu",
+					 (unsigned long long)
+						 frame->frame_number);
+
+			int dest_length = snprintf(
+				_file_destination, 259,
+				"%s/%d-%02d-%02d_%02d-%02d-%02d%s%s",
+				destination, nowtime->tm_year + 1900,
+				nowtime->tm_mon + 1, nowtime->tm_mday,
+				nowtime->tm_hour, nowtime->tm_min,
+				nowtime->tm_sec, frame_name, suffix);
+
+			// files that are still queued do not exist yet, so
+			// carry on counting from the last name used
+			int repeat_count = 0;
+			char **last_name = &output->folder_names[level];
+			int *last_repeat = &output->folder_repeats[level];
+			if (*last_name &&
+			    strcmp(*last_name, _file_destination) == 0)
+				repeat_count = *last_repeat + 1;
+			while (true) {
+				if (repeat_count > 5) {
+					break;
+				}
+				if (repeat_count > 0) {
+					dest_length = snprintf(
+						file_destination, 259,
+						"%s_%d.%s", _file_destination,
+						repeat_count, data->extension);
+				} else {
+					dest_length = snprintf(
+						file_destination, 259, "%s.%s",
+						_file_destination,
+						data->extension);
+				}
+				repeat_count++;
+
+				if (dest_length <= 0) {
+					break;
+				}
+
+				of = fopen(file_destination, "rb");
+				if (of != NULL) {
+					fclose(of);
+					continue;
+				}
+
+				bfree(*last_name);
+				*last_name = bstrdup(_file_destination);
+				*last_repeat = repeat_count - 1;
+				return file_sink_write(
+					output->sink, file_destination,
+					sync_flag, data->header,
+					data->header_size, data->data,
+					data->size, data->release,
+					data->opaque);
+			}
+		}
+	}
+
+	release_data(data);
+	return success;
+}
+
+static bool put_data(struct http_client *http, const char *url, uint8_t *buf,
+		     size_t len, const char *content_type, int width,
+		     int height, uint64_t timestamp, uint64_t frame_number)
+{
+	if (!http)
+		return false;
+
+	struct dstr headers = {0};
+	dstr_printf(&headers,
+		    "Content-Type: %s\r\nImage-Width: %d\r\nImage-Height: %d\r\n"
+		    "Image-Timestamp: %llu\r\nImage-Frame: %llu\r\n",
+		    content_type, width, height, (unsigned long long)timestamp,
+		    (unsigned long long)frame_number);
+
+	// the connection is kept open and reused for the next upload
+	int status = http_client_request(http, "PUT", url, headers.array, buf,
+					 len);
+	dstr_free(&headers);
+
+	if (status >= 200 && status < 300) {
+		info("Uploaded file to %s", url);
+		return true;
+	}
+
+	if (status >= 0)
+		warn("Failed to upload file to %s - HTTP %d", url, status);
+	return false;
+}
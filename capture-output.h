@@ -0,0 +1,236 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frame-diff.h"
+#include "image-encoder.h"
+#include "pixel-format.h"
+
+/*
+ * The pipeline a captured frame goes through once it has been read back.
+ *
+ * capture_output_copy() copies the frame out of the mapped staging surface
+ * and capture_output_submit() hands it to the encoder threads, which compare
+ * it with the frame before it, scale it into its levels, convert and encode
+ * them.  The levels are then written
+ * to the frame's destination in the order the frames were submitted.
+ *
+ * Nothing here depends on OBS sources, the graphics thread or Win32, the
+ * filter is one driver of it and tools/capture-bench.c another.
+ */
+
+/* values of the destination type setting, stored in scene collections */
+enum capture_destination {
+	CAPTURE_DESTINATION_PATH = 0,
+	CAPTURE_DESTINATION_URL = 1,
+	CAPTURE_DESTINATION_SHMEM = 2,
+	CAPTURE_DESTINATION_FOLDER = 3,
+	CAPTURE_DESTINATION_SERVER = 4,
+	CAPTURE_DESTINATION_LOG = 5,
+};
+
+/* whether frames to the destination go through the file sink */
+static inline bool capture_destination_is_file(int type)
+{
+	return type == CAPTURE_DESTINATION_PATH ||
+	       type == CAPTURE_DESTINATION_FOLDER ||
+	       type == CAPTURE_DESTINATION_LOG;
+}
+
+/* how often files and frame logs are flushed to disk */
+enum capture_fsync {
+	CAPTURE_FSYNC_NONE = 0,
+	/* every fsync_frames frames */
+	CAPTURE_FSYNC_FRAMES = 1,
+	/* every file, or when a frame log segment is closed */
+	CAPTURE_FSYNC_SEGMENT = 2,
+};
+
+struct capture_stats;
+struct delta_encoder;
+struct encode_client;
+struct file_sink;
+struct frame_buffer;
+struct frame_log;
+struct frame_pool;
+struct http_client;
+struct http_server;
+struct shmem_ring;
+
+/* a stream of frames and the state of writing it.  the filter's own output
+ * and each region have one, so that they are encoded and written
+ * independently */
+struct capture_output {
+	struct encode_client *encode_client;
+	uint64_t dropped_reported;
+	uint64_t dropped_report_time;
+	uint64_t dropped_counted;
+	/* shared by all outputs of a filter, may be NULL */
+	struct capture_stats *stats;
+
+	/* read back images, then scaled levels and their conversions, one pool
+	 * per level so each only ever holds buffers of one size */
+	struct frame_pool *frame_pool;
+	struct frame_pool *scale_pools[IMAGE_MAX_LEVELS];
+	struct frame_pool *convert_pools[IMAGE_MAX_LEVELS];
+
+	uint32_t index;
+	struct shmem_ring *shmem[IMAGE_MAX_LEVELS];
+	struct http_client *http;
+	/* created on the first write to a file, folder or frame log */
+	struct file_sink *sink;
+	struct frame_log *log;
+	uint32_t unsynced_frames;
+	/* the last name of each level written to in a folder and its repeat
+	 * count, the file may still be queued */
+	char *folder_names[IMAGE_MAX_LEVELS];
+	int folder_repeats[IMAGE_MAX_LEVELS];
+	/* only outputs created with a server can be served over HTTP */
+	struct http_server *server;
+
+	/* delta encoding state, only used by the writer */
+	struct delta_encoder *delta_encoder;
+	uint8_t *delta_buffer;
+	size_t delta_buffer_size;
+
+	/* capture on change state, only used by the in order step of the
+	 * encoders before encoding: the image last encoded and when it was
+	 * captured */
+	struct frame_buffer *change_reference;
+	uint64_t change_time;
+
+	/* frames held back for the history before the hotkey, oldest first,
+	 * only used by the writer */
+	struct capture_frame *history_first;
+	struct capture_frame *history_last;
+	uint64_t history_frames;
+	uint64_t history_bytes;
+};
+
+/* one output image of a frame, the frame itself or a level of its pyramid */
+struct capture_level {
+	struct frame_buffer *buffer;
+	/* of the buffer, kept when it is released for the history */
+	uint32_t width;
+	uint32_t height;
+	struct encoded_image image;
+	bool encoded;
+};
+
+/* a captured frame and the settings it was captured with, owned by the
+ * encode pool once submitted */
+struct capture_frame {
+	/* the read back image, RGBA if it is scaled afterwards */
+	struct frame_buffer *buffer;
+	/* the rectangle of the source that is captured */
+	uint32_t x;
+	uint32_t y;
+	uint32_t width;
+	uint32_t height;
+	/* time and number of the video frame the frame was captured in */
+	uint64_t timestamp;
+	uint64_t frame_number;
+	/* named by the frame number in folders, for bursts and histories that
+	 * have several frames a second */
+	bool numbered;
+	/* when it was handed to the encoders */
+	uint64_t submit_time;
+
+	char *destination;
+	enum capture_destination destination_type;
+	bool raw;
+	bool raw_checksum;
+	/* what the buffer is converted to, always RGBA for encoded images */
+	enum pixel_format pixel_format;
+	struct image_codec_settings codec;
+	bool url_chunked;
+	bool delta;
+	uint32_t delta_keyframe_interval;
+	uint32_t shmem_slots;
+	uint64_t log_segment_size;
+	uint64_t log_segment_duration;
+	bool log_preallocate;
+	bool atomic_write;
+	enum capture_fsync fsync_policy;
+	uint32_t fsync_frames;
+
+	/* only encoded if it differs from the last image encoded, or
+	 * change_max_silence ns of video passed since.  forced frames, such as
+	 * those of the hotkey, are encoded either way */
+	bool change_detect;
+	bool forced;
+	uint32_t change_threshold;
+	uint64_t change_max_silence;
+	struct frame_diff_mask change_mask;
+
+	/* a kept frame is held back for the history before the hotkey instead
+	 * of being written, the history is limited to history_max_bytes of
+	 * encoded images and history_duration ns of video.  a dump frame
+	 * writes the whole history before itself.  only encoded images are
+	 * kept, so kept frames are never raw and are written to a file,
+	 * folder, URL or frame log.  frames of outputs without a history
+	 * have a history_max_bytes of 0, which frees it */
+	bool history_keep;
+	bool history_dump;
+	uint64_t history_max_bytes;
+	uint64_t history_duration;
+	/* private, links the frames of the history */
+	struct capture_frame *next;
+
+	/* size of the first level, the others halve it */
+	uint32_t output_width;
+	uint32_t output_height;
+	uint32_t level_count;
+	bool resample;
+
+	struct capture_level levels[IMAGE_MAX_LEVELS];
+};
+
+/* stats may be NULL */
+extern void capture_output_init(struct capture_output *output, bool server,
+				struct capture_stats *stats);
+/* drops every frame that has not been written yet, even if it was already
+ * encoded, and waits for the one being written */
+extern void capture_output_stop(struct capture_output *output);
+/* after capture_output_stop(), waits for queued file writes */
+extern void capture_output_free(struct capture_output *output);
+
+/*
+ * Copies the frame's rectangle out of a mapped RGBA image of linesize bytes
+ * per row into frame->buffer.  whole is true if the rectangle is the whole
+ * image, its row padding is kept then so that it is a single copy.
+ */
+extern void capture_output_copy(struct capture_output *output,
+				struct capture_frame *frame,
+				const uint8_t *data, uint32_t linesize,
+				bool whole);
+/*
+ * Releases what the output holds between frames: idle buffers, shared
+ * memory rings and the delta buffer.  They are created again by the next
+ * frame.  Must be called on the thread that
+ * submits frames.  Returns false if frames are still in flight, the rings
+ * and delta buffer are kept then.
+ */
+extern bool capture_output_trim(struct capture_output *output);
+/* gives frame the image already copied for another frame of the same
+ * capture, if it covers the same rectangle in the same layout.  returns
+ * false if it has to be copied */
+extern bool capture_output_share(struct capture_frame *frame,
+				 const struct capture_frame *copied);
+/*
+ * Preallocates count buffers for frames like frame copied with whole false,
+ * in the background, so that a burst of count frames does not allocate any
+ * on the thread copying them.
+ */
+extern void capture_output_reserve(struct capture_output *output,
+				   const struct capture_frame *frame,
+				   uint32_t count);
+/* hands a copied frame to the encoder threads, which free it.  a frame
+ * that did not change is freed there without being encoded */
+extern void capture_output_submit(struct capture_output *output,
+				  struct capture_frame *frame);
+
+/* frees a frame that was never submitted */
+extern void capture_frame_free(struct capture_frame *frame);
@@ -0,0 +1,67 @@
+#include "capture-schedule.h"
+
+void capture_schedule_set(struct capture_schedule *schedule,
+			  enum capture_schedule_mode mode, uint64_t period)
+{
+	if (schedule->mode == mode && schedule->period == period)
+		return;
+
+	schedule->mode = mode;
+	schedule->period = period;
+	schedule->next = 0;
+}
+
+void capture_schedule_reset(struct capture_schedule *schedule)
+{
+	schedule->next = 0;
+}
+
+static bool interval_due(struct capture_schedule *schedule,
+			 uint64_t frame_time, uint64_t frame_interval)
+{
+	uint64_t half_frame = frame_interval / 2;
+
+	if (!schedule->next) {
+		schedule->next = frame_time + schedule->period;
+		return false;
+	}
+	if (frame_time + half_frame < schedule->next)
+		return false;
+
+	schedule->next += schedule->period;
+	// more than a period behind, e.g. after a stall, starts over from
+	// this frame instead of capturing every frame until it catches up
+	if (schedule->next + half_frame <= frame_time)
+		schedule->next = frame_time + schedule->period;
+	return true;
+}
+
+static bool frames_due(struct capture_schedule *schedule, uint64_t frame_time,
+		       uint64_t frame_interval)
+{
+	uint64_t frame =
+		capture_schedule_frame_number(frame_time, frame_interval);
+	uint64_t next_multiple =
+		(frame / schedule->period + 1) * schedule->period;
+
+	if (!schedule->next) {
+		schedule->next = next_multiple;
+		return false;
+	}
+	if (frame < schedule->next)
+		return false;
+
+	schedule->next = next_multiple;
+	return true;
+}
+
+bool capture_schedule_due(struct capture_schedule *schedule,
+			  uint64_t frame_time, uint64_t frame_interval)
+{
+	if (!schedule->period || !frame_interval)
+		return false;
+
+	if (schedule->mode == CAPTURE_SCHEDULE_FRAMES)
+		return frames_due(schedule, frame_time, frame_interval);
+	return interval_due(schedule, frame_time, frame_interval);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Decides which video frames are captured.
+ *
+ * It is driven by the timestamps of OBS video frames rather than by adding up
+ * tick times, which do not add up to the frame times exactly.  OBS renders
+ * frames at multiples of the frame interval, so a frame's timestamp divided
+ * by the interval is its frame number, the same for every filter and source
+ * that renders it, counting any frames OBS skipped.
+ *
+ * In interval mode captures are due every period ns.  Each capture is taken
+ * on the frame closest to its due time and the next one is due a period
+ * after that due time, not after the frame, so captures never drift and are
+ * at most half a frame off.  In frames mode every frame whose number is a
+ * multiple of period is captured, or the next one if that frame was skipped.
+ */
+
+enum capture_schedule_mode {
+	CAPTURE_SCHEDULE_INTERVAL,
+	CAPTURE_SCHEDULE_FRAMES,
+};
+
+struct capture_schedule {
+	enum capture_schedule_mode mode;
+	/* ns in interval mode, frames in frames mode */
+	uint64_t period;
+
+	/* private, the time or frame number the next capture is due at, 0 if
+	 * the schedule has not started yet */
+	uint64_t next;
+};
+
+static inline uint64_t capture_schedule_frame_number(uint64_t frame_time,
+						     uint64_t frame_interval)
+{
+	return frame_interval ? frame_time / frame_interval : 0;
+}
+
+/* starts the schedule over if mode or period changed */
+extern void capture_schedule_set(struct capture_schedule *schedule,
+				 enum capture_schedule_mode mode,
+				 uint64_t period);
+/* the schedule starts over with the next frame, the first capture is due a
+ * period after it */
+extern void capture_schedule_reset(struct capture_schedule *schedule);
+
+/* called once for every video frame, returns whether it is captured */
+extern bool capture_schedule_due(struct capture_schedule *schedule,
+				 uint64_t frame_time, uint64_t frame_interval);
@@ -0,0 +1,132 @@
+#include "capture-share.h"
+
+#include <util/bmem.h>
+
+struct capture_share_member {
+	const struct capture_share_callbacks *callbacks;
+	void *param;
+	void *job;
+	struct capture_share_member *next;
+};
+
+struct capture_share {
+	const void *source;
+	uint64_t timestamp;
+	uint32_t width;
+	uint32_t height;
+	struct capture_share_member *members;
+	struct capture_share *next;
+};
+
+// every share that is staged and not collected yet, only touched inside the
+// graphics context so it needs no lock of its own
+static struct capture_share *shares;
+
+struct capture_share *capture_share_open(const void *source,
+					 uint64_t timestamp, uint32_t width,
+					 uint32_t height)
+{
+	struct capture_share *share = bzalloc(sizeof(struct capture_share));
+	share->source = source;
+	share->timestamp = timestamp;
+	share->width = width;
+	share->height = height;
+	share->next = shares;
+	shares = share;
+	return share;
+}
+
+struct capture_share *capture_share_find(const void *source,
+					 uint64_t timestamp, uint32_t width,
+					 uint32_t height)
+{
+	for (struct capture_share *share = shares; share; share = share->next) {
+		if (share->source == source && share->timestamp == timestamp &&
+		    share->width == width && share->height == height)
+			return share;
+	}
+	return NULL;
+}
+
+void capture_share_join(struct capture_share *share,
+			const struct capture_share_callbacks *callbacks,
+			void *param, void *job)
+{
+	struct capture_share_member *member =
+		bmalloc(sizeof(struct capture_share_member));
+	member->callbacks = callbacks;
+	member->param = param;
+	member->job = job;
+	member->next = share->members;
+	share->members = member;
+}
+
+bool capture_share_empty(const struct capture_share *share)
+{
+	return !share->members;
+}
+
+static void remove_share(struct capture_share *share)
+{
+	for (struct capture_share **p = &shares; *p; p = &(*p)->next) {
+		if (*p == share) {
+			*p = share->next;
+			break;
+		}
+	}
+}
+
+uint32_t capture_share_collect(struct capture_share *share,
+			       const uint8_t *data, uint32_t linesize)
+{
+	if (!share)
+		return 0;
+
+	// the callbacks may stage and open shares of their own, so it is
+	// taken out of the list first
+	remove_share(share);
+
+	uint32_t count = 0;
+	while (share->members) {
+		struct capture_share_member *member = share->members;
+		share->members = member->next;
+		member->callbacks->collect(member->param, member->job, data,
+					   linesize);
+		bfree(member);
+		count++;
+	}
+	bfree(share);
+	return count;
+}
+
+void capture_share_close(struct capture_share *share)
+{
+	if (!share)
+		return;
+
+	remove_share(share);
+	while (share->members) {
+		struct capture_share_member *member = share->members;
+		share->members = member->next;
+		member->callbacks->discard(member->param, member->job);
+		bfree(member);
+	}
+	bfree(share);
+}
+
+void capture_share_leave(void *param)
+{
+	for (struct capture_share *share = shares; share; share = share->next) {
+		struct capture_share_member **p = &share->members;
+		while (*p) {
+			struct capture_share_member *member = *p;
+			if (member->param != param) {
+				p = &member->next;
+				continue;
+			}
+			*p = member->next;
+			member->callbacks->discard(member->param, member->job);
+			bfree(member);
+		}
+	}
+}
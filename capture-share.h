@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Captures shared between the screenshot filters of one source.
+ *
+ * Filters that capture the same image, such as several filters on the same
+ * source with different destinations, render and read it back only once per
+ * video frame.  The first filter that captures a frame stages it and opens a
+ * share of it, the others capturing the same frame join the share with their
+ * own job instead of rendering.  When the owner collects the frame every
+ * joined job is handed the mapped image to copy, so the image crosses the bus
+ * once however many filters want it.
+ *
+ * Shares are found by the source, video frame time and size they were opened
+ * for, so they are only joined in the frame they were staged in.  Everything
+ * here must be called inside the graphics context.
+ */
+
+struct capture_share;
+
+struct capture_share_callbacks {
+	/* copies the image for job, which is owned by the callee afterwards */
+	void (*collect)(void *param, void *job, const uint8_t *data,
+			uint32_t linesize);
+	/* the image will never be read back, frees job */
+	void (*discard)(void *param, void *job);
+};
+
+/* opens a share of a frame that is about to be staged, source is only
+ * compared and never dereferenced */
+extern struct capture_share *capture_share_open(const void *source,
+						uint64_t timestamp,
+						uint32_t width,
+						uint32_t height);
+
+/* the share opened for this frame of source, NULL if there is none */
+extern struct capture_share *capture_share_find(const void *source,
+						uint64_t timestamp,
+						uint32_t width,
+						uint32_t height);
+
+/* hands job to callbacks once the frame is read back, param identifies the
+ * joining filter for capture_share_leave */
+extern void capture_share_join(struct capture_share *share,
+			       const struct capture_share_callbacks *callbacks,
+			       void *param, void *job);
+
+/* whether no job has joined the share yet */
+extern bool capture_share_empty(const struct capture_share *share);
+
+/* hands the read back image to every joined job and frees the share,
+ * returns how many jobs were joined.  NULL does nothing */
+extern uint32_t capture_share_collect(struct capture_share *share,
+				      const uint8_t *data, uint32_t linesize);
+
+/* discards the joined jobs and frees the share, for frames that were never
+ * read back.  NULL does nothing */
+extern void capture_share_close(struct capture_share *share);
+
+/* discards every job param joined to any share, before it is destroyed */
+extern void capture_share_leave(void *param);
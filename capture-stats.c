@@ -0,0 +1,252 @@
+#include "capture-stats.h"
+
+#include <string.h>
+
+#include <obs-module.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/* buckets 0-3 are 0-3us, then 4 per power of two up to ~2^40us */
+#define SUB_BUCKETS 4
+#define BUCKET_COUNT 160
+
+struct capture_stats {
+	volatile uint64_t buckets[CAPTURE_STAGE_COUNT][BUCKET_COUNT];
+	volatile uint64_t sum[CAPTURE_STAGE_COUNT];
+	volatile uint64_t max[CAPTURE_STAGE_COUNT];
+	volatile uint64_t counters[CAPTURE_COUNTER_COUNT];
+	volatile uint64_t gauges[CAPTURE_GAUGE_COUNT];
+
+	/* what was reported last time, only used by the collecting thread */
+	uint64_t last_buckets[CAPTURE_STAGE_COUNT][BUCKET_COUNT];
+	uint64_t last_sum[CAPTURE_STAGE_COUNT];
+	uint64_t last_counters[CAPTURE_COUNTER_COUNT];
+	uint64_t last_time;
+};
+
+static const char *stage_names[CAPTURE_STAGE_COUNT] = {
+	"render", "stage",  "map",    "copy",  "compare",
+	"queue",  "encode", "write",  "upload", "total",
+};
+
+static const char *counter_names[CAPTURE_COUNTER_COUNT] = {
+	"captured",  "encoded", "dropped", "failed",
+	"unchanged", "shared",  "bytes",
+};
+
+static const char *gauge_names[CAPTURE_GAUGE_COUNT] = {
+	"history_frames", "history_bytes",
+};
+
+static inline void atomic_add(volatile uint64_t *ptr, uint64_t val)
+{
+#ifdef _MSC_VER
+	_InterlockedExchangeAdd64((volatile __int64 *)ptr, (__int64)val);
+#else
+	__atomic_fetch_add(ptr, val, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline uint64_t atomic_load(const volatile uint64_t *ptr)
+{
+#ifdef _MSC_VER
+	return (uint64_t)_InterlockedCompareExchange64(
+		(volatile __int64 *)ptr, 0, 0);
+#else
+	return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline uint64_t atomic_exchange(volatile uint64_t *ptr, uint64_t val)
+{
+#ifdef _MSC_VER
+	return (uint64_t)_InterlockedExchange64((volatile __int64 *)ptr,
+						(__int64)val);
+#else
+	return __atomic_exchange_n(ptr, val, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline bool atomic_cas(volatile uint64_t *ptr, uint64_t expected,
+			      uint64_t val)
+{
+#ifdef _MSC_VER
+	return (uint64_t)_InterlockedCompareExchange64(
+		       (volatile __int64 *)ptr, (__int64)val,
+		       (__int64)expected) == expected;
+#else
+	return __atomic_compare_exchange_n(ptr, &expected, val, false,
+					   __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline uint32_t highest_bit(uint64_t val)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, val);
+	return (uint32_t)index;
+#else
+	return 63 - (uint32_t)__builtin_clzll(val);
+#endif
+}
+
+static uint32_t bucket_index(uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	if (us < SUB_BUCKETS)
+		return (uint32_t)us;
+
+	uint32_t bit = highest_bit(us);
+	uint32_t sub = (uint32_t)(us >> (bit - 2)) & (SUB_BUCKETS - 1);
+	uint32_t index = (bit - 1) * SUB_BUCKETS + sub;
+	return index < BUCKET_COUNT ? index : BUCKET_COUNT - 1;
+}
+
+/* the middle of a bucket in ns */
+static uint64_t bucket_value(uint32_t index)
+{
+	if (index < SUB_BUCKETS)
+		return index * 1000 + 500;
+
+	uint32_t bit = index / SUB_BUCKETS + 1;
+	uint64_t width = 1ULL << (bit - 2);
+	uint64_t start = (SUB_BUCKETS + index % SUB_BUCKETS) * width;
+	return (start * 2 + width) * 500;
+}
+
+struct capture_stats *capture_stats_create(void)
+{
+	struct capture_stats *stats = bzalloc(sizeof(struct capture_stats));
+	stats->last_time = os_gettime_ns();
+	return stats;
+}
+
+void capture_stats_destroy(struct capture_stats *stats)
+{
+	bfree(stats);
+}
+
+void capture_stats_record(struct capture_stats *stats,
+			  enum capture_stage stage, uint64_t ns)
+{
+	if (!stats)
+		return;
+
+	atomic_add(&stats->buckets[stage][bucket_index(ns)], 1);
+	atomic_add(&stats->sum[stage], ns);
+
+	uint64_t max = atomic_load(&stats->max[stage]);
+	while (ns > max && !atomic_cas(&stats->max[stage], max, ns))
+		max = atomic_load(&stats->max[stage]);
+}
+
+void capture_stats_add(struct capture_stats *stats,
+		       enum capture_counter counter, uint64_t value)
+{
+	if (stats && value)
+		atomic_add(&stats->counters[counter], value);
+}
+
+void capture_stats_set(struct capture_stats *stats,
+		       enum capture_gauge gauge, uint64_t value)
+{
+	if (stats)
+		atomic_exchange(&stats->gauges[gauge], value);
+}
+
+static uint64_t percentile(const uint64_t *buckets, uint64_t count,
+			   uint32_t percent)
+{
+	// the rank of the percentile, rounded up so p99 of 10 values is the
+	// largest
+	uint64_t rank = (count * percent + 99) / 100;
+	uint64_t seen = 0;
+	for (uint32_t i = 0; i < BUCKET_COUNT; i++) {
+		seen += buckets[i];
+		if (seen >= rank)
+			return bucket_value(i);
+	}
+	return bucket_value(BUCKET_COUNT - 1);
+}
+
+static void collect_stage(struct capture_stats *stats,
+			  enum capture_stage stage,
+			  struct capture_stage_summary *summary)
+{
+	uint64_t buckets[BUCKET_COUNT];
+	uint64_t count = 0;
+
+	for (uint32_t i = 0; i < BUCKET_COUNT; i++) {
+		uint64_t total = atomic_load(&stats->buckets[stage][i]);
+		buckets[i] = total - stats->last_buckets[stage][i];
+		stats->last_buckets[stage][i] = total;
+		count += buckets[i];
+	}
+
+	uint64_t sum = atomic_load(&stats->sum[stage]);
+	uint64_t period_sum = sum - stats->last_sum[stage];
+	stats->last_sum[stage] = sum;
+
+	memset(summary, 0, sizeof(*summary));
+	// a value recorded while collecting may only show up in the maximum,
+	// it is counted next time
+	uint64_t max = atomic_exchange(&stats->max[stage], 0);
+	if (!count)
+		return;
+
+	summary->count = count;
+	summary->mean_ns = period_sum / count;
+	summary->p50_ns = percentile(buckets, count, 50);
+	summary->p90_ns = percentile(buckets, count, 90);
+	summary->p99_ns = percentile(buckets, count, 99);
+	summary->max_ns = max;
+}
+
+bool capture_stats_collect(struct capture_stats *stats,
+			   struct capture_stats_summary *summary)
+{
+	memset(summary, 0, sizeof(*summary));
+	if (!stats)
+		return false;
+
+	uint64_t now = os_gettime_ns();
+	summary->period_ns = now - stats->last_time;
+	stats->last_time = now;
+
+	bool recorded = false;
+	for (int i = 0; i < CAPTURE_STAGE_COUNT; i++) {
+		collect_stage(stats, i, &summary->stages[i]);
+		recorded = recorded || summary->stages[i].count;
+	}
+	for (int i = 0; i < CAPTURE_COUNTER_COUNT; i++) {
+		uint64_t total = atomic_load(&stats->counters[i]);
+		summary->counters[i] = total - stats->last_counters[i];
+		summary->totals[i] = total;
+		stats->last_counters[i] = total;
+		recorded = recorded || summary->counters[i];
+	}
+	for (int i = 0; i < CAPTURE_GAUGE_COUNT; i++)
+		summary->gauges[i] = atomic_load(&stats->gauges[i]);
+	return recorded;
+}
+
+const char *capture_stage_name(enum capture_stage stage)
+{
+	return stage < CAPTURE_STAGE_COUNT ? stage_names[stage] : "unknown";
+}
+
+const char *capture_counter_name(enum capture_counter counter)
+{
+	return counter < CAPTURE_COUNTER_COUNT ? counter_names[counter]
+					       : "unknown";
+}
+
+const char *capture_gauge_name(enum capture_gauge gauge)
+{
+	return gauge < CAPTURE_GAUGE_COUNT ? gauge_names[gauge] : "unknown";
+}
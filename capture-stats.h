@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Per filter latency histograms and counters.
+ *
+ * Every stage a frame goes through records how long it took into a
+ * histogram of 4 buckets per power of two from 1us up, and events such as
+ * captured or dropped frames are counted.  Gauges hold the current value of
+ * something, such as the memory in use.  Recording is a couple of atomic
+ * adds, it never takes a lock, so the render thread and all encoder threads
+ * can record at once.  capture_stats_collect() summarizes everything that
+ * was recorded since it was last called, percentiles are accurate to the
+ * bucket they fall in, within 25%.
+ */
+
+enum capture_stage {
+	/* render thread: rendering the source into the capture texture */
+	CAPTURE_STAGE_RENDER,
+	/* render thread: queuing the copy to a staging surface */
+	CAPTURE_STAGE_STAGE,
+	/* render thread: mapping a staging surface once the copy is due */
+	CAPTURE_STAGE_MAP,
+	/* render thread: copying or converting out of the mapped surface */
+	CAPTURE_STAGE_COPY,
+	/* encoder threads, one frame at a time: comparing with the last image
+	 * output, if only changes are captured */
+	CAPTURE_STAGE_COMPARE,
+	/* from being handed to the encoder threads until one starts on it */
+	CAPTURE_STAGE_QUEUE,
+	/* scaling, converting and encoding */
+	CAPTURE_STAGE_ENCODE,
+	/* writing to the destination, or queuing it for the file sink */
+	CAPTURE_STAGE_WRITE,
+	/* uploading to a URL, part of the write */
+	CAPTURE_STAGE_UPLOAD,
+	/* from the video frame the image was captured in until it was
+	 * written */
+	CAPTURE_STAGE_TOTAL,
+	CAPTURE_STAGE_COUNT,
+};
+
+enum capture_counter {
+	/* frames read back and handed to the encoder threads, other than those
+	 * left out as unchanged or dropped before they were compared */
+	CAPTURE_COUNTER_CAPTURED,
+	/* frames the encoder threads finished, raw frames are only converted */
+	CAPTURE_COUNTER_ENCODED,
+	/* frames dropped because the staging surfaces or encoders were busy */
+	CAPTURE_COUNTER_DROPPED,
+	/* images that could not be encoded, written or uploaded, including
+	 * writes dropped because the disk fell behind */
+	CAPTURE_COUNTER_FAILED,
+	/* frames left out because they did not change */
+	CAPTURE_COUNTER_UNCHANGED,
+	/* frames read back once for several filters, counted by the filters
+	 * that did not render them */
+	CAPTURE_COUNTER_SHARED,
+	/* bytes handed to destinations */
+	CAPTURE_COUNTER_BYTES,
+	CAPTURE_COUNTER_COUNT,
+};
+
+enum capture_gauge {
+	/* frames and encoded bytes held in the history before the hotkey */
+	CAPTURE_GAUGE_HISTORY_FRAMES,
+	CAPTURE_GAUGE_HISTORY_BYTES,
+	CAPTURE_GAUGE_COUNT,
+};
+
+struct capture_stage_summary {
+	uint64_t count;
+	uint64_t mean_ns;
+	uint64_t p50_ns;
+	uint64_t p90_ns;
+	uint64_t p99_ns;
+	uint64_t max_ns;
+};
+
+struct capture_stats_summary {
+	/* time covered by the summary */
+	uint64_t period_ns;
+	struct capture_stage_summary stages[CAPTURE_STAGE_COUNT];
+	/* counts since the last summary, and since the stats were created */
+	uint64_t counters[CAPTURE_COUNTER_COUNT];
+	uint64_t totals[CAPTURE_COUNTER_COUNT];
+	/* the values of the gauges when the summary was made */
+	uint64_t gauges[CAPTURE_GAUGE_COUNT];
+};
+
+struct capture_stats;
+
+extern struct capture_stats *capture_stats_create(void);
+extern void capture_stats_destroy(struct capture_stats *stats);
+
+/* stats may be NULL for both, nothing is recorded then */
+extern void capture_stats_record(struct capture_stats *stats,
+				 enum capture_stage stage, uint64_t ns);
+extern void capture_stats_add(struct capture_stats *stats,
+			      enum capture_counter counter, uint64_t value);
+extern void capture_stats_set(struct capture_stats *stats,
+			      enum capture_gauge gauge, uint64_t value);
+
+/* summarizes what was recorded since the last call, must only be called by
+ * one thread at a time.  returns false if nothing was recorded */
+extern bool capture_stats_collect(struct capture_stats *stats,
+				  struct capture_stats_summary *summary);
+
+extern const char *capture_stage_name(enum capture_stage stage);
+extern const char *capture_counter_name(enum capture_counter counter);
+extern const char *capture_gauge_name(enum capture_gauge gauge);
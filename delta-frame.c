@@ -0,0 +1,224 @@
+#include "delta-frame.h"
+
+#include <obs-module.h>
+#include <util/bmem.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DELTA_SSE2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define DELTA_NEON
+#endif
+
+struct delta_encoder {
+	uint32_t tile_size;
+	uint32_t keyframe_interval;
+	uint32_t since_keyframe;
+	bool force_keyframe;
+
+	/* the image as the consumer has it after applying the last frame */
+	uint8_t *prev;
+	uint32_t width;
+	uint32_t height;
+
+	/* one byte per tile in the current tile row */
+	uint8_t *dirty;
+};
+
+struct delta_encoder *delta_encoder_create(uint32_t tile_size)
+{
+	struct delta_encoder *encoder = bzalloc(sizeof(struct delta_encoder));
+	encoder->tile_size = tile_size ? tile_size
+				       : DELTA_FRAME_DEFAULT_TILE_SIZE;
+	encoder->force_keyframe = true;
+	return encoder;
+}
+
+void delta_encoder_destroy(struct delta_encoder *encoder)
+{
+	if (!encoder)
+		return;
+
+	bfree(encoder->prev);
+	bfree(encoder->dirty);
+	bfree(encoder);
+}
+
+void delta_encoder_set_keyframe_interval(struct delta_encoder *encoder,
+					 uint32_t interval)
+{
+	encoder->keyframe_interval = interval;
+}
+
+void delta_encoder_force_keyframe(struct delta_encoder *encoder)
+{
+	encoder->force_keyframe = true;
+}
+
+size_t delta_encoder_max_size(const struct delta_encoder *encoder,
+			      uint32_t width, uint32_t height)
+{
+	struct delta_frame_header header = {0};
+	header.width = width;
+	header.height = height;
+	header.tile_size = encoder->tile_size;
+
+	return sizeof(header) + delta_frame_map_size(&header) +
+	       (size_t)width * height * 4;
+}
+
+// compares one tile row, tiles are a few hundred bytes wide so this is
+// mostly unrolled SIMD
+static bool row_equal(const uint8_t *a, const uint8_t *b, size_t size)
+{
+#if defined(DELTA_SSE2)
+	for (; size >= 64; size -= 64, a += 64, b += 64) {
+		__m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a),
+					     _mm_loadu_si128((const __m128i *)b));
+		__m128i eq1 = _mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(a + 16)),
+			_mm_loadu_si128((const __m128i *)(b + 16)));
+		__m128i eq2 = _mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(a + 32)),
+			_mm_loadu_si128((const __m128i *)(b + 32)));
+		__m128i eq3 = _mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(a + 48)),
+			_mm_loadu_si128((const __m128i *)(b + 48)));
+		__m128i eq = _mm_and_si128(_mm_and_si128(eq0, eq1),
+					   _mm_and_si128(eq2, eq3));
+		if (_mm_movemask_epi8(eq) != 0xFFFF)
+			return false;
+	}
+	for (; size >= 16; size -= 16, a += 16, b += 16) {
+		__m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a),
+					    _mm_loadu_si128((const __m128i *)b));
+		if (_mm_movemask_epi8(eq) != 0xFFFF)
+			return false;
+	}
+#elif defined(DELTA_NEON)
+	for (; size >= 64; size -= 64, a += 64, b += 64) {
+		uint8x16_t eq0 = vceqq_u8(vld1q_u8(a), vld1q_u8(b));
+		uint8x16_t eq1 = vceqq_u8(vld1q_u8(a + 16), vld1q_u8(b + 16));
+		uint8x16_t eq2 = vceqq_u8(vld1q_u8(a + 32), vld1q_u8(b + 32));
+		uint8x16_t eq3 = vceqq_u8(vld1q_u8(a + 48), vld1q_u8(b + 48));
+		uint8x16_t eq = vandq_u8(vandq_u8(eq0, eq1),
+					 vandq_u8(eq2, eq3));
+		if (vminvq_u8(eq) != 0xFF)
+			return false;
+	}
+	for (; size >= 16; size -= 16, a += 16, b += 16) {
+		if (vminvq_u8(vceqq_u8(vld1q_u8(a), vld1q_u8(b))) != 0xFF)
+			return false;
+	}
+#endif
+	return size == 0 || memcmp(a, b, size) == 0;
+}
+
+static void reset_reference(struct delta_encoder *encoder, uint32_t width,
+			    uint32_t height)
+{
+	bfree(encoder->prev);
+	bfree(encoder->dirty);
+	encoder->prev = bmalloc((size_t)width * height * 4);
+	encoder->dirty = bmalloc((width + encoder->tile_size - 1) /
+				 encoder->tile_size);
+	encoder->width = width;
+	encoder->height = height;
+}
+
+size_t delta_encoder_encode(struct delta_encoder *encoder,
+			    const uint8_t *data, uint32_t linesize,
+			    uint32_t width, uint32_t height, uint32_t index,
+			    uint8_t *out)
+{
+	bool keyframe = encoder->force_keyframe || !encoder->prev ||
+			encoder->width != width || encoder->height != height ||
+			(encoder->keyframe_interval &&
+			 encoder->since_keyframe + 1 >=
+				 encoder->keyframe_interval);
+
+	if (encoder->width != width || encoder->height != height ||
+	    !encoder->prev)
+		reset_reference(encoder, width, height);
+
+	struct delta_frame_header *header = (struct delta_frame_header *)out;
+	memset(header, 0, sizeof(*header));
+	header->magic = DELTA_FRAME_MAGIC;
+	header->version = DELTA_FRAME_VERSION;
+	header->flags = keyframe ? DELTA_FRAME_KEYFRAME : 0;
+	header->header_size = sizeof(*header);
+	header->width = width;
+	header->height = height;
+	header->tile_size = encoder->tile_size;
+	header->index = index;
+
+	uint32_t tile_size = encoder->tile_size;
+	uint32_t tiles_x = delta_frame_tiles_x(header);
+	uint32_t tiles_y = delta_frame_tiles_y(header);
+	size_t prev_linesize = (size_t)width * 4;
+	uint8_t *map = out + sizeof(*header);
+	uint8_t *dst = map + delta_frame_map_size(header);
+
+	memset(map, 0, delta_frame_map_size(header));
+
+	for (uint32_t ty = 0; ty < tiles_y; ty++) {
+		uint32_t y0 = ty * tile_size;
+		uint32_t rows = height - y0 < tile_size ? height - y0
+							: tile_size;
+
+		memset(encoder->dirty, keyframe ? 1 : 0, tiles_x);
+
+		// row by row so that both images are read sequentially, a tile
+		// stops being compared once it differs
+		for (uint32_t y = 0; !keyframe && y < rows; y++) {
+			const uint8_t *cur = data + (size_t)(y0 + y) * linesize;
+			const uint8_t *prev =
+				encoder->prev + (y0 + y) * prev_linesize;
+
+			for (uint32_t tx = 0; tx < tiles_x; tx++) {
+				if (encoder->dirty[tx])
+					continue;
+
+				size_t x0 = (size_t)tx * tile_size * 4;
+				size_t row_size = prev_linesize - x0 <
+								  tile_size * 4
+							  ? prev_linesize - x0
+							  : tile_size * 4;
+				if (!row_equal(cur + x0, prev + x0, row_size))
+					encoder->dirty[tx] = 1;
+			}
+		}
+
+		for (uint32_t tx = 0; tx < tiles_x; tx++) {
+			if (!encoder->dirty[tx])
+				continue;
+
+			size_t tile = (size_t)ty * tiles_x + tx;
+			size_t x0 = (size_t)tx * tile_size * 4;
+			size_t row_size =
+				prev_linesize - x0 < tile_size * 4
+					? prev_linesize - x0
+					: tile_size * 4;
+
+			map[tile / 8] |= (uint8_t)(1 << (tile % 8));
+			header->changed_tiles++;
+
+			for (uint32_t y = 0; y < rows; y++) {
+				const uint8_t *cur = data +
+						     (size_t)(y0 + y) * linesize +
+						     x0;
+				memcpy(dst, cur, row_size);
+				memcpy(encoder->prev +
+					       (y0 + y) * prev_linesize + x0,
+				       cur, row_size);
+				dst += row_size;
+			}
+		}
+	}
+
+	encoder->force_keyframe = false;
+	encoder->since_keyframe = keyframe ? 0 : encoder->since_keyframe + 1;
+	return (size_t)(dst - out);
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+/*
+ * Dirty tile delta frames.
+ *
+ * The image is split into tile_size x tile_size pixel tiles, with the tiles
+ * on the right and bottom edges clipped to the image.  A delta frame is a
+ * header, a bitmap with one bit per tile (row-major, least significant bit
+ * first) and the RGBA pixels of every tile whose bit is set, in tile order,
+ * each tile packed row by row without padding.
+ *
+ * Keyframes have every bit set and can be decoded on their own.  Any other
+ * frame only holds the tiles that changed since the previous frame, so a
+ * consumer must start at a keyframe and apply every following frame in order
+ * to the same image.  A consumer that misses a frame has to wait for the next
+ * keyframe.  delta_frame_apply() is the reference decoder.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DELTA_FRAME_MAGIC 0x46445353 /* "SSDF" */
+#define DELTA_FRAME_VERSION 1
+
+#define DELTA_FRAME_DEFAULT_TILE_SIZE 32
+
+/* header flags */
+#define DELTA_FRAME_KEYFRAME 0x1
+
+struct delta_frame_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t flags;
+	/* offset of the tile bitmap from the start of the frame */
+	uint32_t header_size;
+	uint32_t width;
+	uint32_t height;
+	uint32_t tile_size;
+	uint32_t changed_tiles;
+	uint32_t index;
+};
+
+static inline uint32_t
+delta_frame_tiles_x(const struct delta_frame_header *header)
+{
+	return (header->width + header->tile_size - 1) / header->tile_size;
+}
+
+static inline uint32_t
+delta_frame_tiles_y(const struct delta_frame_header *header)
+{
+	return (header->height + header->tile_size - 1) / header->tile_size;
+}
+
+static inline size_t
+delta_frame_map_size(const struct delta_frame_header *header)
+{
+	return ((size_t)delta_frame_tiles_x(header) *
+			delta_frame_tiles_y(header) +
+		7) / 8;
+}
+
+static inline const struct delta_frame_header *
+delta_frame_get_header(const void *data, size_t size)
+{
+	const struct delta_frame_header *header = data;
+	if (size < sizeof(*header) || header->magic != DELTA_FRAME_MAGIC ||
+	    header->version != DELTA_FRAME_VERSION ||
+	    header->header_size < sizeof(*header) || !header->tile_size ||
+	    size < header->header_size + delta_frame_map_size(header))
+		return NULL;
+	return header;
+}
+
+/*
+ * Applies a delta frame to an RGBA image of the frame's size.  Returns false
+ * if the frame is invalid or truncated, the image may then have been
+ * partially updated.
+ */
+static inline bool delta_frame_apply(const void *data, size_t size,
+				     uint8_t *image, uint32_t linesize)
+{
+	const struct delta_frame_header *header =
+		delta_frame_get_header(data, size);
+	if (!header || linesize < header->width * 4)
+		return false;
+
+	const uint8_t *map = (const uint8_t *)data + header->header_size;
+	const uint8_t *src = map + delta_frame_map_size(header);
+	const uint8_t *end = (const uint8_t *)data + size;
+	uint32_t tiles_x = delta_frame_tiles_x(header);
+	uint32_t tiles_y = delta_frame_tiles_y(header);
+	uint32_t tile_size = header->tile_size;
+
+	for (uint32_t ty = 0; ty < tiles_y; ty++) {
+		uint32_t y0 = ty * tile_size;
+		uint32_t rows = header->height - y0 < tile_size
+					? header->height - y0
+					: tile_size;
+
+		for (uint32_t tx = 0; tx < tiles_x; tx++) {
+			size_t tile = (size_t)ty * tiles_x + tx;
+			if (!(map[tile / 8] & (1 << (tile % 8))))
+				continue;
+
+			uint32_t x0 = tx * tile_size;
+			size_t row_size = (size_t)(header->width - x0 < tile_size
+							   ? header->width - x0
+							   : tile_size) *
+					  4;
+			if ((size_t)(end - src) < row_size * rows)
+				return false;
+
+			for (uint32_t y = 0; y < rows; y++) {
+				memcpy(image + (size_t)(y0 + y) * linesize +
+					       (size_t)x0 * 4,
+				       src, row_size);
+				src += row_size;
+			}
+		}
+	}
+	return true;
+}
+
+/* encoder, implemented in delta-frame.c */
+struct delta_encoder;
+
+extern struct delta_encoder *delta_encoder_create(uint32_t tile_size);
+extern void delta_encoder_destroy(struct delta_encoder *encoder);
+
+/* a keyframe is sent every interval frames, 0 only sends the first one */
+extern void delta_encoder_set_keyframe_interval(struct delta_encoder *encoder,
+						uint32_t interval);
+/* makes the next frame a keyframe, e.g. after a frame failed to be sent */
+extern void delta_encoder_force_keyframe(struct delta_encoder *encoder);
+
+/* the largest frame delta_encoder_encode() can produce */
+extern size_t delta_encoder_max_size(const struct delta_encoder *encoder,
+				     uint32_t width, uint32_t height);
+
+/* encodes an RGBA image into out, which must hold delta_encoder_max_size()
+ * bytes, and returns the size of the frame */
+extern size_t delta_encoder_encode(struct delta_encoder *encoder,
+				   const uint8_t *data, uint32_t linesize,
+				   uint32_t width, uint32_t height,
+				   uint32_t index, uint8_t *out);
+
+#ifdef __cplusplus
+}
+#endif
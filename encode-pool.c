@@ -0,0 +1,443 @@
+#include "encode-pool.h"
+#include "image-encoder.h"
+
+#include <obs-module.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#define do_log(level, format, ...) \
+	blog(level, "[screenshot-filter] " format, ##__VA_ARGS__)
+
+#define warn(format, ...) do_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define info(format, ...) do_log(LOG_INFO, format, ##__VA_ARGS__)
+
+struct encode_job {
+	struct encode_job *next;
+	struct encode_client *client;
+	uint64_t seq;
+	/* the order workers took the client's jobs in, see prepare_job() */
+	uint64_t prepare_seq;
+	void *frame;
+	/* dropped by the queue policy or left out by prepare, not written */
+	bool dropped;
+};
+
+struct encode_client {
+	struct encode_client_callbacks callbacks;
+	void *param;
+
+	pthread_mutex_t mutex;
+	/* signalled whenever a job of this client has been freed */
+	pthread_cond_t changed;
+	uint32_t queue_depth;
+	enum encode_queue_policy queue_policy;
+	uint64_t dropped;
+
+	uint64_t next_seq;
+	uint64_t next_write;
+	/* next_take is only used with the pool mutex held */
+	uint64_t next_take;
+	uint64_t next_prepare;
+	/* signalled whenever prepare has been called for a job */
+	pthread_cond_t prepared;
+	/* encoded jobs waiting for their turn to be written, sorted by seq */
+	struct encode_job *done;
+	bool writing;
+	bool discard;
+	long pending;
+};
+
+struct encode_worker {
+	pthread_t thread;
+	struct image_encoder *encoder;
+};
+
+static struct {
+	bool initialized;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct encode_job *first;
+	struct encode_job *last;
+	bool exit;
+
+	struct encode_worker workers[ENCODE_POOL_MAX_THREADS];
+	uint32_t num_workers;
+} pool;
+
+static void free_job(struct encode_job *job)
+{
+	struct encode_client *client = job->client;
+
+	client->callbacks.free(client->param, job->frame);
+	bfree(job);
+}
+
+/* must be called with the client mutex held */
+static void finish_jobs(struct encode_client *client, long count)
+{
+	client->pending -= count;
+	pthread_cond_broadcast(&client->changed);
+}
+
+/*
+ * Queues the encoded job for writing.  Whichever worker finds the next job in
+ * sequence ready writes it and any that follow, so writes for a client never
+ * overlap and always happen in submission order.
+ */
+static void complete_job(struct encode_job *job)
+{
+	struct encode_client *client = job->client;
+
+	pthread_mutex_lock(&client->mutex);
+	if (client->discard) {
+		pthread_mutex_unlock(&client->mutex);
+		free_job(job);
+
+		pthread_mutex_lock(&client->mutex);
+		finish_jobs(client, 1);
+		pthread_mutex_unlock(&client->mutex);
+		return;
+	}
+
+	struct encode_job **pos = &client->done;
+	while (*pos && (*pos)->seq < job->seq)
+		pos = &(*pos)->next;
+	job->next = *pos;
+	*pos = job;
+
+	if (client->writing) {
+		pthread_mutex_unlock(&client->mutex);
+		return;
+	}
+
+	client->writing = true;
+	while (client->done && client->done->seq == client->next_write) {
+		job = client->done;
+		client->done = job->next;
+		client->next_write++;
+		pthread_mutex_unlock(&client->mutex);
+
+		if (!job->dropped)
+			client->callbacks.write(client->param, job->frame);
+		free_job(job);
+
+		pthread_mutex_lock(&client->mutex);
+		finish_jobs(client, 1);
+	}
+	client->writing = false;
+	pthread_mutex_unlock(&client->mutex);
+}
+
+/*
+ * Calls prepare for the job once it has been called for every job of the
+ * client taken before it.  Workers take the jobs of a client in submission
+ * order, the only gaps are the jobs dropped from the queue, so prepare sees
+ * the frames in order too.  Returns false if the job is not to be encoded.
+ */
+static bool prepare_job(struct encode_job *job)
+{
+	struct encode_client *client = job->client;
+	if (!client->callbacks.prepare)
+		return true;
+
+	pthread_mutex_lock(&client->mutex);
+	while (client->next_prepare != job->prepare_seq)
+		pthread_cond_wait(&client->prepared, &client->mutex);
+	pthread_mutex_unlock(&client->mutex);
+
+	bool keep = client->callbacks.prepare(client->param, job->frame);
+
+	pthread_mutex_lock(&client->mutex);
+	client->next_prepare++;
+	pthread_cond_broadcast(&client->prepared);
+	pthread_mutex_unlock(&client->mutex);
+
+	job->dropped = !keep;
+	return keep;
+}
+
+static void *encode_thread(void *data)
+{
+	struct encode_worker *worker = data;
+
+	os_set_thread_name("screenshot-filter: encoder");
+	worker->encoder = image_encoder_create();
+
+	for (;;) {
+		pthread_mutex_lock(&pool.mutex);
+		while (!pool.first && !pool.exit)
+			pthread_cond_wait(&pool.cond, &pool.mutex);
+
+		struct encode_job *job = pool.first;
+		if (!job) {
+			pthread_mutex_unlock(&pool.mutex);
+			break;
+		}
+		pool.first = job->next;
+		if (!pool.first)
+			pool.last = NULL;
+		job->prepare_seq = job->client->next_take++;
+		pthread_mutex_unlock(&pool.mutex);
+
+		struct encode_client *client = job->client;
+		if (prepare_job(job))
+			client->callbacks.encode(client->param, job->frame,
+						 worker->encoder);
+		complete_job(job);
+	}
+
+	image_encoder_destroy(worker->encoder);
+	worker->encoder = NULL;
+	return NULL;
+}
+
+bool encode_pool_init(void)
+{
+	if (pthread_mutex_init(&pool.mutex, NULL) != 0)
+		return false;
+	if (pthread_cond_init(&pool.cond, NULL) != 0) {
+		pthread_mutex_destroy(&pool.mutex);
+		return false;
+	}
+
+	pool.initialized = true;
+	return true;
+}
+
+void encode_pool_free(void)
+{
+	if (!pool.initialized)
+		return;
+
+	pthread_mutex_lock(&pool.mutex);
+	pool.exit = true;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.mutex);
+
+	for (uint32_t i = 0; i < pool.num_workers; i++)
+		pthread_join(pool.workers[i].thread, NULL);
+
+	pthread_cond_destroy(&pool.cond);
+	pthread_mutex_destroy(&pool.mutex);
+	memset(&pool, 0, sizeof(pool));
+}
+
+void encode_pool_reserve_threads(uint32_t threads)
+{
+	if (threads == 0) {
+		int cores = os_get_logical_cores();
+		threads = cores > 2 ? (uint32_t)cores - 1 : 1;
+	}
+	if (threads > ENCODE_POOL_MAX_THREADS)
+		threads = ENCODE_POOL_MAX_THREADS;
+
+	pthread_mutex_lock(&pool.mutex);
+	while (pool.num_workers < threads) {
+		struct encode_worker *worker = &pool.workers[pool.num_workers];
+		if (pthread_create(&worker->thread, NULL, encode_thread,
+				   worker) != 0) {
+			warn("Failed to create encoder thread");
+			break;
+		}
+		pool.num_workers++;
+		info("Started encoder thread %u", pool.num_workers);
+	}
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+struct encode_client *
+encode_client_create(const struct encode_client_callbacks *callbacks,
+		     void *param)
+{
+	struct encode_client *client = bzalloc(sizeof(struct encode_client));
+	client->callbacks = *callbacks;
+	client->param = param;
+	client->queue_depth = 4;
+	client->queue_policy = ENCODE_QUEUE_DROP_OLDEST;
+	pthread_mutex_init(&client->mutex, NULL);
+	pthread_cond_init(&client->changed, NULL);
+	pthread_cond_init(&client->prepared, NULL);
+	return client;
+}
+
+void encode_client_destroy(struct encode_client *client)
+{
+	if (!client)
+		return;
+
+	pthread_mutex_lock(&client->mutex);
+	client->discard = true;
+	struct encode_job *done = client->done;
+	client->done = NULL;
+	pthread_cond_broadcast(&client->changed);
+	pthread_mutex_unlock(&client->mutex);
+
+	/* drop frames of this client that no worker has picked up yet */
+	struct encode_job *queued = NULL;
+	pthread_mutex_lock(&pool.mutex);
+	struct encode_job **pos = &pool.first;
+	pool.last = NULL;
+	while (*pos) {
+		struct encode_job *job = *pos;
+		if (job->client == client) {
+			*pos = job->next;
+			job->next = queued;
+			queued = job;
+		} else {
+			pool.last = job;
+			pos = &job->next;
+		}
+	}
+	pthread_mutex_unlock(&pool.mutex);
+
+	long count = 0;
+	while (done) {
+		struct encode_job *job = done;
+		done = job->next;
+		free_job(job);
+		count++;
+	}
+	while (queued) {
+		struct encode_job *job = queued;
+		queued = job->next;
+		free_job(job);
+		count++;
+	}
+
+	pthread_mutex_lock(&client->mutex);
+	finish_jobs(client, count);
+	while (client->pending > 0)
+		pthread_cond_wait(&client->changed, &client->mutex);
+	pthread_mutex_unlock(&client->mutex);
+
+	pthread_cond_destroy(&client->changed);
+	pthread_cond_destroy(&client->prepared);
+	pthread_mutex_destroy(&client->mutex);
+	bfree(client);
+}
+
+void encode_client_set_queue(struct encode_client *client, uint32_t depth,
+			     enum encode_queue_policy policy)
+{
+	if (depth < 1)
+		depth = 1;
+	if (depth > ENCODE_QUEUE_MAX_DEPTH)
+		depth = ENCODE_QUEUE_MAX_DEPTH;
+
+	pthread_mutex_lock(&client->mutex);
+	client->queue_depth = depth;
+	client->queue_policy = policy;
+	pthread_cond_broadcast(&client->changed);
+	pthread_mutex_unlock(&client->mutex);
+}
+
+/* removes the oldest job of the client that no worker has picked up yet */
+static struct encode_job *take_oldest_queued(struct encode_client *client)
+{
+	struct encode_job *job = NULL;
+
+	pthread_mutex_lock(&pool.mutex);
+	struct encode_job *prev = NULL;
+	for (struct encode_job *cur = pool.first; cur; cur = cur->next) {
+		if (cur->client == client) {
+			job = cur;
+			break;
+		}
+		prev = cur;
+	}
+	if (job) {
+		if (prev)
+			prev->next = job->next;
+		else
+			pool.first = job->next;
+		if (pool.last == job)
+			pool.last = prev;
+		job->next = NULL;
+	}
+	pthread_mutex_unlock(&pool.mutex);
+
+	return job;
+}
+
+bool encode_client_submit(struct encode_client *client, void *frame)
+{
+	struct encode_job *oldest = NULL;
+	bool accepted = true;
+
+	pthread_mutex_lock(&client->mutex);
+	while (client->pending >= client->queue_depth && !client->discard) {
+		if (client->queue_policy == ENCODE_QUEUE_BLOCK) {
+			pthread_cond_wait(&client->changed, &client->mutex);
+			continue;
+		}
+
+		if (client->queue_policy == ENCODE_QUEUE_DROP_OLDEST)
+			oldest = take_oldest_queued(client);
+		/* every frame in flight is already being encoded, so the
+		 * oldest can't be dropped anymore and the new one is */
+		if (!oldest)
+			accepted = false;
+		client->dropped++;
+		break;
+	}
+
+	if (client->discard)
+		accepted = false;
+
+	struct encode_job *job = NULL;
+	if (accepted) {
+		job = bzalloc(sizeof(struct encode_job));
+		job->client = client;
+		job->frame = frame;
+		job->seq = client->next_seq++;
+		client->pending++;
+	}
+	pthread_mutex_unlock(&client->mutex);
+
+	if (oldest) {
+		/* still goes through the sequencer so that the frames
+		 * after it are not held back waiting for it */
+		oldest->dropped = true;
+		complete_job(oldest);
+	}
+
+	if (!job) {
+		client->callbacks.free(client->param, frame);
+		return false;
+	}
+
+	pthread_mutex_lock(&pool.mutex);
+	if (pool.last)
+		pool.last->next = job;
+	else
+		pool.first = job;
+	pool.last = job;
+	pthread_cond_signal(&pool.cond);
+	pthread_mutex_unlock(&pool.mutex);
+	return true;
+}
+
+void encode_client_flush(struct encode_client *client)
+{
+	pthread_mutex_lock(&client->mutex);
+	while (client->pending > 0)
+		pthread_cond_wait(&client->changed, &client->mutex);
+	pthread_mutex_unlock(&client->mutex);
+}
+
+bool encode_client_idle(struct encode_client *client)
+{
+	pthread_mutex_lock(&client->mutex);
+	bool idle = client->pending == 0;
+	pthread_mutex_unlock(&client->mutex);
+	return idle;
+}
+
+uint64_t encode_client_dropped(struct encode_client *client)
+{
+	pthread_mutex_lock(&client->mutex);
+	uint64_t dropped = client->dropped;
+	pthread_mutex_unlock(&client->mutex);
+	return dropped;
+}
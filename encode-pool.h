@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Pool of encoder threads shared by all screenshot filters.
+ *
+ * Each filter registers a client and submits captured frames to it.  Frames
+ * are encoded in parallel on whichever worker is free, using that worker's
+ * image encoder, but the prepare and write callbacks of a client are always
+ * called one frame at a time and in the order the frames were submitted.
+ *
+ * Every client has a bounded number of frames in flight.  When it is reached
+ * the queue policy decides whether the oldest frame that has not started
+ * encoding is dropped, the new frame is dropped, or the submitting thread
+ * waits for a frame to be written.
+ */
+
+#define ENCODE_POOL_MAX_THREADS 16
+#define ENCODE_QUEUE_MAX_DEPTH 64
+
+enum encode_queue_policy {
+	ENCODE_QUEUE_DROP_OLDEST,
+	ENCODE_QUEUE_DROP_NEWEST,
+	ENCODE_QUEUE_BLOCK,
+};
+
+struct image_encoder;
+struct encode_client;
+
+struct encode_client_callbacks {
+	/* called for one frame at a time, in submission order, before the
+	 * frame is encoded.  frames it returns false for are neither encoded
+	 * nor written.  skipped for frames dropped by the queue policy, may
+	 * be NULL */
+	bool (*prepare)(void *param, void *frame);
+	/* called on any worker thread, possibly for several frames at once */
+	void (*encode)(void *param, void *frame, struct image_encoder *encoder);
+	/* called for one frame at a time, in submission order, skipped for
+	 * frames dropped by the queue policy or left out by prepare */
+	void (*write)(void *param, void *frame);
+	/* called once for every submitted frame, after write */
+	void (*free)(void *param, void *frame);
+};
+
+extern bool encode_pool_init(void);
+extern void encode_pool_free(void);
+
+/* starts more workers if fewer than threads are running, 0 picks a count
+ * based on the number of cores */
+extern void encode_pool_reserve_threads(uint32_t threads);
+
+extern struct encode_client *
+encode_client_create(const struct encode_client_callbacks *callbacks,
+		     void *param);
+/* discards every frame that has not been written yet, including encoded
+ * frames waiting for an earlier one to be written.  waits for the frame
+ * being written and for those being encoded, which are discarded too */
+extern void encode_client_destroy(struct encode_client *client);
+
+extern void encode_client_set_queue(struct encode_client *client,
+				    uint32_t depth,
+				    enum encode_queue_policy policy);
+
+/* returns false if the frame was dropped, it is freed either way */
+extern bool encode_client_submit(struct encode_client *client, void *frame);
+
+/* waits until every frame submitted so far has been written or dropped */
+extern void encode_client_flush(struct encode_client *client);
+
+/* whether every frame submitted so far has been written or dropped, the
+ * write callback is not running then until the next submit */
+extern bool encode_client_idle(struct encode_client *client);
+
+/* number of frames dropped because the queue was full */
+extern uint64_t encode_client_dropped(struct encode_client *client);
@@ -0,0 +1,709 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "file-sink.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <obs-module.h>
+#include <util/bmem.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#define do_log(level, format, ...) \
+	blog(level, "[screenshot-filter] " format, ##__VA_ARGS__)
+
+#define warn(format, ...) do_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define info(format, ...) do_log(LOG_INFO, format, ##__VA_ARGS__)
+
+/* every operation is at most a header write, a write and an fsync */
+#define RING_ENTRIES (FILE_SINK_MAX_QUEUED * 3)
+
+enum file_op_type {
+	FILE_OP_WRITE,
+	FILE_OP_OPEN,
+	FILE_OP_APPEND,
+	FILE_OP_CLOSE,
+};
+
+struct file_sink_file {
+	char *path;
+	uint64_t preallocate;
+	/* size once everything queued is written, only used by the thread
+	 * that queues */
+	uint64_t size;
+	volatile long failed;
+
+	/* only used by the I/O thread */
+	FILE *fp;
+};
+
+struct file_op {
+	struct file_op *next;
+	enum file_op_type type;
+	uint32_t flags;
+
+	/* FILE_OP_WRITE writes path, through tmp_path if it is atomic, starting
+	 * with a copy of header */
+	char *path;
+	char *tmp_path;
+	FILE *fp;
+	bool replaced;
+	uint8_t *header;
+	size_t header_size;
+
+	struct file_sink_file *file;
+	uint64_t offset;
+	const uint8_t *data;
+	size_t size;
+	file_sink_release_t release;
+	void *opaque;
+
+	/* what has been done so far, whatever io_uring did not get to is
+	 * finished by hand */
+	bool header_written;
+	size_t written;
+	bool synced;
+};
+
+struct file_sink {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct file_op *first;
+	struct file_op *last;
+	uint32_t queued;
+	size_t queued_bytes;
+	bool exit;
+	/* set while writes are dropped, so it is only reported once */
+	bool full;
+
+#ifdef HAVE_LIBURING
+	/* only used by the I/O thread once it runs */
+	bool uring;
+	struct io_uring ring;
+#endif
+};
+
+static bool sync_file(FILE *fp)
+{
+#ifdef _WIN32
+	return _commit(_fileno(fp)) == 0;
+#else
+	return fsync(fileno(fp)) == 0;
+#endif
+}
+
+/* reserves disk space without changing the size of the file */
+static void reserve_space(FILE *fp, uint64_t size)
+{
+#if defined(_WIN32)
+	FILE_ALLOCATION_INFO allocation = {0};
+	allocation.AllocationSize.QuadPart = (LONGLONG)size;
+	SetFileInformationByHandle((HANDLE)_get_osfhandle(_fileno(fp)),
+				   FileAllocationInfo, &allocation,
+				   sizeof(allocation));
+#elif defined(__linux__)
+	fallocate(fileno(fp), FALLOC_FL_KEEP_SIZE, 0, (off_t)size);
+#elif defined(__APPLE__)
+	fstore_t store = {F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, (off_t)size, 0};
+	if (fcntl(fileno(fp), F_PREALLOCATE, &store) == -1) {
+		store.fst_flags = F_ALLOCATEALL;
+		fcntl(fileno(fp), F_PREALLOCATE, &store);
+	}
+#else
+	UNUSED_PARAMETER(fp);
+	UNUSED_PARAMETER(size);
+#endif
+}
+
+/* gives back space reserved past size */
+static void truncate_file(FILE *fp, uint64_t size)
+{
+#ifdef _WIN32
+	_chsize_s(_fileno(fp), (__int64)size);
+#else
+	if (ftruncate(fileno(fp), (off_t)size) != 0)
+		warn("Failed to release preallocated file space");
+#endif
+}
+
+static bool write_at(FILE *fp, uint64_t offset, const uint8_t *data,
+		     size_t size)
+{
+	return os_fseeki64(fp, (int64_t)offset, SEEK_SET) == 0 &&
+	       fwrite(data, 1, size, fp) == size;
+}
+
+static FILE *open_file(const char *path)
+{
+	FILE *fp = os_fopen(path, "wb");
+	if (fp)
+		// every write goes straight to the file at an explicit offset
+		setvbuf(fp, NULL, _IONBF, 0);
+	return fp;
+}
+
+static void fail_file(struct file_sink_file *file, const char *action)
+{
+	if (!os_atomic_set_long(&file->failed, 1))
+		warn("Failed to %s %s", action, file->path);
+}
+
+static bool file_ok(struct file_sink_file *file)
+{
+	return file->fp && !os_atomic_load_long(&file->failed);
+}
+
+/* the part of an operation that must happen before its data is written */
+static void prepare_op(struct file_op *op)
+{
+	if (op->type == FILE_OP_OPEN) {
+		op->file->fp = open_file(op->file->path);
+		if (!op->file->fp)
+			fail_file(op->file, "create");
+		else if (op->file->preallocate)
+			reserve_space(op->file->fp, op->file->preallocate);
+	} else if (op->type == FILE_OP_WRITE && !op->replaced) {
+		const char *path = op->tmp_path ? op->tmp_path : op->path;
+		op->fp = open_file(path);
+		if (!op->fp)
+			warn("Failed to create %s", path);
+	}
+}
+
+/* the file op->data goes to, NULL if there is nothing to write */
+static FILE *op_file(struct file_op *op)
+{
+	if (op->type == FILE_OP_WRITE)
+		return op->fp;
+	if ((op->type == FILE_OP_OPEN || op->type == FILE_OP_APPEND) &&
+	    file_ok(op->file))
+		return op->file->fp;
+	return NULL;
+}
+
+static bool finish_data(struct file_op *op, FILE *fp)
+{
+	if (op->header_size && !op->header_written) {
+		if (!write_at(fp, op->offset, op->header, op->header_size))
+			return false;
+		op->header_written = true;
+	}
+
+	uint64_t offset = op->offset + op->header_size;
+	if (op->written < op->size &&
+	    !write_at(fp, offset + op->written, op->data + op->written,
+		      op->size - op->written))
+		return false;
+	op->written = op->size;
+
+	if ((op->flags & FILE_SINK_SYNC) && !op->synced)
+		op->synced = sync_file(fp);
+	return !(op->flags & FILE_SINK_SYNC) || op->synced;
+}
+
+static void finish_write(struct file_op *op)
+{
+	if (!op->fp)
+		return;
+
+	bool success = finish_data(op, op->fp);
+	fclose(op->fp);
+	op->fp = NULL;
+
+	if (success && op->tmp_path && os_rename(op->tmp_path, op->path) != 0)
+		success = false;
+	if (!success) {
+		warn("Failed to write %s", op->path);
+		if (op->tmp_path)
+			os_unlink(op->tmp_path);
+	}
+}
+
+static void close_file(struct file_op *op)
+{
+	struct file_sink_file *file = op->file;
+
+	if (file->fp) {
+		if (file->preallocate)
+			truncate_file(file->fp, op->offset);
+		if ((op->flags & FILE_SINK_SYNC) && file_ok(file) &&
+		    !sync_file(file->fp))
+			fail_file(file, "flush");
+		fclose(file->fp);
+	}
+	bfree(file->path);
+	bfree(file);
+}
+
+/* the part of an operation that is left once its data has been written */
+static void complete_op(struct file_op *op)
+{
+	switch (op->type) {
+	case FILE_OP_WRITE:
+		finish_write(op);
+		break;
+	case FILE_OP_OPEN:
+	case FILE_OP_APPEND:
+		if (file_ok(op->file) && !finish_data(op, op->file->fp))
+			fail_file(op->file, "write to");
+		break;
+	case FILE_OP_CLOSE:
+		close_file(op);
+		break;
+	}
+}
+
+static void free_op(struct file_op *op)
+{
+	if (op->release)
+		op->release(op->opaque);
+	bfree(op->path);
+	bfree(op->tmp_path);
+	bfree(op->header);
+	bfree(op);
+}
+
+#ifdef HAVE_LIBURING
+static bool init_uring(struct io_uring *ring)
+{
+	if (io_uring_queue_init(RING_ENTRIES, ring, 0) < 0)
+		return false;
+
+	struct io_uring_probe *probe = io_uring_get_probe_ring(ring);
+	bool supported = probe &&
+			 io_uring_opcode_supported(probe, IORING_OP_WRITE) &&
+			 io_uring_opcode_supported(probe, IORING_OP_FSYNC);
+	if (probe)
+		io_uring_free_probe(probe);
+
+	if (!supported)
+		io_uring_queue_exit(ring);
+	return supported;
+}
+
+#define SQE_FSYNC 1
+#define SQE_HEADER 2
+#define SQE_TAGS 3
+
+static unsigned op_sqe_count(const struct file_op *op)
+{
+	return (op->header_size ? 1 : 0) + (op->size ? 1 : 0) +
+	       ((op->flags & FILE_SINK_SYNC) ? 1 : 0);
+}
+
+static bool queue_entry(struct io_uring *ring, struct io_uring_sqe **last,
+			int fd, const void *data, size_t size, uint64_t offset,
+			uintptr_t user_data)
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+	if (!sqe)
+		return false;
+	if (user_data & SQE_FSYNC)
+		io_uring_prep_fsync(sqe, fd, 0);
+	else
+		io_uring_prep_write(sqe, fd, data, (unsigned)size, offset);
+	io_uring_sqe_set_data(sqe, (void *)user_data);
+	io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+	*last = sqe;
+	return true;
+}
+
+/* returns the number of entries queued, the low bits of the user data mark
+ * the header write and the fsync of an operation */
+static unsigned queue_sqe(struct io_uring *ring, struct io_uring_sqe **last,
+			  struct file_op *op, FILE *fp)
+{
+	int fd = fileno(fp);
+	uintptr_t data = (uintptr_t)op;
+	unsigned count = 0;
+
+	if (op->header_size) {
+		if (!queue_entry(ring, last, fd, op->header, op->header_size,
+				 op->offset, data | SQE_HEADER))
+			return count;
+		count++;
+	}
+	if (op->size) {
+		if (!queue_entry(ring, last, fd, op->data, op->size,
+				 op->offset + op->header_size, data))
+			return count;
+		count++;
+	}
+	if (op->flags & FILE_SINK_SYNC) {
+		if (!queue_entry(ring, last, fd, NULL, 0, 0,
+				 data | SQE_FSYNC))
+			return count;
+		count++;
+	}
+	return count;
+}
+
+/*
+ * Writes the batch with one linked chain, so it is done in order.  A failed
+ * or short write cancels the rest of the chain, complete_op() then finishes
+ * those operations by hand, in order as well.  So does everything after an
+ * operation that does not fit in the chain.
+ */
+static void run_uring(struct file_sink *sink, struct file_op *ops)
+{
+	struct io_uring *ring = &sink->ring;
+	struct io_uring_sqe *last = NULL;
+	unsigned count = 0;
+	bool chained = true;
+
+	for (struct file_op *op = ops; op; op = op->next) {
+		prepare_op(op);
+
+		FILE *fp = op_file(op);
+		if (!fp || (!op->size && !op->header_size) || !chained)
+			continue;
+
+		unsigned expected = op_sqe_count(op);
+		unsigned queued = op->size <= UINT_MAX
+					  ? queue_sqe(ring, &last, op, fp)
+					  : 0;
+		count += queued;
+		chained = queued == expected;
+	}
+
+	unsigned submitted = 0;
+	if (count) {
+		io_uring_sqe_set_flags(last, 0);
+
+		int ret;
+		do
+			ret = io_uring_submit(ring);
+		while (ret == -EINTR);
+		submitted = ret > 0 ? (unsigned)ret : 0;
+	}
+
+	unsigned completed = 0;
+	while (completed < submitted) {
+		struct io_uring_cqe *cqe;
+		int ret = io_uring_wait_cqe(ring, &cqe);
+		if (ret == -EINTR)
+			continue;
+		if (ret < 0)
+			break;
+
+		uintptr_t data = (uintptr_t)io_uring_cqe_get_data(cqe);
+		struct file_op *op =
+			(struct file_op *)(data & ~(uintptr_t)SQE_TAGS);
+		if (data & SQE_FSYNC)
+			op->synced = cqe->res == 0;
+		else if (data & SQE_HEADER)
+			op->header_written = cqe->res > 0 &&
+					     (size_t)cqe->res ==
+						     op->header_size;
+		else if (cqe->res > 0)
+			op->written = (size_t)cqe->res;
+		io_uring_cqe_seen(ring, cqe);
+		completed++;
+	}
+
+	// a ring that lost track of its operations cannot be used again
+	if (submitted < count || completed < submitted) {
+		warn("io_uring failed, writing files without it from now on");
+		io_uring_queue_exit(ring);
+		sink->uring = false;
+	}
+
+	for (struct file_op *op = ops; op; op = op->next)
+		complete_op(op);
+}
+#endif
+
+/* marks whole file writes that a later write to the same path replaces */
+static void mark_replaced(struct file_op *ops)
+{
+	for (struct file_op *op = ops; op; op = op->next) {
+		if (op->type != FILE_OP_WRITE)
+			continue;
+
+		for (struct file_op *later = op->next; later;
+		     later = later->next) {
+			if (later->type == FILE_OP_WRITE &&
+			    strcmp(later->path, op->path) == 0) {
+				op->replaced = true;
+				break;
+			}
+		}
+	}
+}
+
+static void run_batch(struct file_sink *sink, struct file_op *ops)
+{
+	mark_replaced(ops);
+
+#ifdef HAVE_LIBURING
+	if (sink->uring) {
+		run_uring(sink, ops);
+		return;
+	}
+#else
+	UNUSED_PARAMETER(sink);
+#endif
+
+	for (struct file_op *op = ops; op; op = op->next) {
+		prepare_op(op);
+		complete_op(op);
+	}
+}
+
+static void *sink_thread(void *data)
+{
+	struct file_sink *sink = data;
+
+	os_set_thread_name("screenshot-filter: file sink");
+
+	for (;;) {
+		pthread_mutex_lock(&sink->mutex);
+		while (!sink->first && !sink->exit)
+			pthread_cond_wait(&sink->cond, &sink->mutex);
+
+		// everything queued so far is one batch
+		struct file_op *ops = sink->first;
+		sink->first = NULL;
+		sink->last = NULL;
+		pthread_mutex_unlock(&sink->mutex);
+
+		if (!ops)
+			break;
+
+		run_batch(sink, ops);
+
+		uint32_t count = 0;
+		size_t bytes = 0;
+		while (ops) {
+			struct file_op *next = ops->next;
+			count++;
+			bytes += ops->size;
+			free_op(ops);
+			ops = next;
+		}
+
+		pthread_mutex_lock(&sink->mutex);
+		sink->queued -= count;
+		sink->queued_bytes -= bytes;
+		pthread_mutex_unlock(&sink->mutex);
+	}
+
+	return NULL;
+}
+
+struct file_sink *file_sink_create(void)
+{
+	struct file_sink *sink = bzalloc(sizeof(struct file_sink));
+
+#ifdef HAVE_LIBURING
+	sink->uring = init_uring(&sink->ring);
+#endif
+
+	if (pthread_mutex_init(&sink->mutex, NULL) != 0)
+		goto fail_mutex;
+	if (pthread_cond_init(&sink->cond, NULL) != 0)
+		goto fail_cond;
+	if (pthread_create(&sink->thread, NULL, sink_thread, sink) != 0)
+		goto fail_thread;
+	return sink;
+
+fail_thread:
+	pthread_cond_destroy(&sink->cond);
+fail_cond:
+	pthread_mutex_destroy(&sink->mutex);
+fail_mutex:
+#ifdef HAVE_LIBURING
+	if (sink->uring)
+		io_uring_queue_exit(&sink->ring);
+#endif
+	warn("Failed to start file sink thread");
+	bfree(sink);
+	return NULL;
+}
+
+void file_sink_destroy(struct file_sink *sink)
+{
+	if (!sink)
+		return;
+
+	pthread_mutex_lock(&sink->mutex);
+	sink->exit = true;
+	pthread_cond_signal(&sink->cond);
+	pthread_mutex_unlock(&sink->mutex);
+	pthread_join(sink->thread, NULL);
+
+	pthread_cond_destroy(&sink->cond);
+	pthread_mutex_destroy(&sink->mutex);
+#ifdef HAVE_LIBURING
+	if (sink->uring)
+		io_uring_queue_exit(&sink->ring);
+#endif
+	bfree(sink);
+}
+
+const char *file_sink_backend(const struct file_sink *sink)
+{
+#ifdef HAVE_LIBURING
+	if (sink && sink->uring)
+		return "io_uring";
+#else
+	UNUSED_PARAMETER(sink);
+#endif
+	return "thread";
+}
+
+static struct file_op *create_op(enum file_op_type type, uint32_t flags,
+				 const uint8_t *data, size_t size,
+				 file_sink_release_t release, void *opaque)
+{
+	struct file_op *op = bzalloc(sizeof(struct file_op));
+	op->type = type;
+	op->flags = flags;
+	op->size = size;
+
+	if (size && !release) {
+		void *copy = bmemdup(data, size);
+		op->data = copy;
+		op->release = bfree;
+		op->opaque = copy;
+	} else {
+		op->data = data;
+		op->release = release;
+		op->opaque = opaque;
+	}
+	return op;
+}
+
+/* opening and closing files is never dropped, they are always balanced */
+static bool queue_op(struct file_sink *sink, struct file_op *op, bool force)
+{
+	pthread_mutex_lock(&sink->mutex);
+	if (!force && sink->queued &&
+	    (sink->queued >= FILE_SINK_MAX_QUEUED ||
+	     sink->queued_bytes + op->size > FILE_SINK_MAX_QUEUED_BYTES)) {
+		bool reported = sink->full;
+		sink->full = true;
+		pthread_mutex_unlock(&sink->mutex);
+
+		if (!reported)
+			warn("File writes fell behind, dropping writes until they catch up");
+		free_op(op);
+		return false;
+	}
+
+	if (!force)
+		sink->full = false;
+	if (sink->last)
+		sink->last->next = op;
+	else
+		sink->first = op;
+	sink->last = op;
+	sink->queued++;
+	sink->queued_bytes += op->size;
+	pthread_cond_signal(&sink->cond);
+	pthread_mutex_unlock(&sink->mutex);
+	return true;
+}
+
+bool file_sink_write(struct file_sink *sink, const char *path, uint32_t flags,
+		     const void *header, size_t header_size,
+		     const uint8_t *data, size_t size,
+		     file_sink_release_t release, void *opaque)
+{
+	if (!sink || !path || !*path) {
+		if (release)
+			release(opaque);
+		return false;
+	}
+
+	struct file_op *op = create_op(FILE_OP_WRITE, flags, data, size,
+				       release, opaque);
+	op->path = bstrdup(path);
+	if (header_size) {
+		op->header = bmemdup(header, header_size);
+		op->header_size = header_size;
+	}
+	if (flags & FILE_SINK_ATOMIC) {
+		struct dstr tmp_path = {0};
+		dstr_printf(&tmp_path, "%s.tmp", path);
+		op->tmp_path = tmp_path.array;
+	}
+	return queue_op(sink, op, false);
+}
+
+struct file_sink_file *file_sink_open(struct file_sink *sink, const char *path,
+				      uint64_t preallocate, const void *header,
+				      size_t header_size)
+{
+	if (!sink)
+		return NULL;
+
+	struct file_sink_file *file = bzalloc(sizeof(struct file_sink_file));
+	file->path = bstrdup(path);
+	file->preallocate = preallocate;
+	file->size = header_size;
+
+	struct file_op *op = create_op(FILE_OP_OPEN, 0, header, header_size,
+				       NULL, NULL);
+	op->file = file;
+	queue_op(sink, op, true);
+	return file;
+}
+
+bool file_sink_append(struct file_sink *sink, struct file_sink_file *file,
+		      uint32_t flags, const uint8_t *data, size_t size,
+		      file_sink_release_t release, void *opaque)
+{
+	if (!sink || !file || file_sink_file_failed(file)) {
+		if (release)
+			release(opaque);
+		return false;
+	}
+
+	struct file_op *op = create_op(FILE_OP_APPEND, flags, data, size,
+				       release, opaque);
+	op->file = file;
+	op->offset = file->size;
+	if (!queue_op(sink, op, false))
+		return false;
+
+	file->size += size;
+	return true;
+}
+
+bool file_sink_file_failed(const struct file_sink_file *file)
+{
+	return os_atomic_load_long(&file->failed) != 0;
+}
+
+void file_sink_close(struct file_sink *sink, struct file_sink_file *file,
+		     uint32_t flags)
+{
+	if (!sink || !file)
+		return;
+
+	struct file_op *op =
+		create_op(FILE_OP_CLOSE, flags, NULL, 0, NULL, NULL);
+	op->file = file;
+	op->offset = file->size;
+	queue_op(sink, op, true);
+}
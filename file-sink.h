@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Asynchronous file writer.
+ *
+ * Writes are queued and carried out by the sink's own I/O thread, in the
+ * order they were queued, so a slow disk holds up neither rendering nor the
+ * encoder threads.  On Linux, when built with liburing and the kernel allows
+ * it, the thread submits everything that queued up since its last batch as
+ * one linked io_uring chain.  Otherwise it makes the calls itself.
+ *
+ * Data is not copied: release(opaque) is called once the sink is done with
+ * it, which may be before the call that queued it returns, e.g. when the
+ * queue is full.  Data queued without a release callback is copied.
+ *
+ * Whole files replaced by a newer write to the same path before they were
+ * started are skipped, only the newest is written.
+ */
+
+#define FILE_SINK_MAX_QUEUED 64
+#define FILE_SINK_MAX_QUEUED_BYTES (256 * 1024 * 1024)
+
+/* flags */
+/* file_sink_write() writes to path.tmp and renames it over path once it is
+ * complete, so readers of path never see a partial file */
+#define FILE_SINK_ATOMIC 0x1
+/* flushes the data to disk before the file is closed or renamed, or before
+ * the append completes */
+#define FILE_SINK_SYNC 0x2
+
+struct file_sink;
+struct file_sink_file;
+
+typedef void (*file_sink_release_t)(void *opaque);
+
+extern struct file_sink *file_sink_create(void);
+/* waits for everything that has been queued to be written */
+extern void file_sink_destroy(struct file_sink *sink);
+
+/* "io_uring" or "thread" */
+extern const char *file_sink_backend(const struct file_sink *sink);
+
+/* creates or replaces path with a copy of header, which may be NULL,
+ * followed by data.  returns false if the queue is full */
+extern bool file_sink_write(struct file_sink *sink, const char *path,
+			    uint32_t flags, const void *header,
+			    size_t header_size, const uint8_t *data,
+			    size_t size, file_sink_release_t release,
+			    void *opaque);
+
+/* creates path for appending, starting with a copy of header.  preallocate
+ * bytes of disk space are reserved up front where the file system supports
+ * it, without growing the file, readers only ever see what has been
+ * appended.  opening and closing is never dropped when the queue is full */
+extern struct file_sink_file *file_sink_open(struct file_sink *sink,
+					     const char *path,
+					     uint64_t preallocate,
+					     const void *header,
+					     size_t header_size);
+/* returns false if the queue is full or the file has failed, the file does
+ * not grow then */
+extern bool file_sink_append(struct file_sink *sink,
+			     struct file_sink_file *file, uint32_t flags,
+			     const uint8_t *data, size_t size,
+			     file_sink_release_t release, void *opaque);
+/* whether opening or writing the file failed, it should be closed */
+extern bool file_sink_file_failed(const struct file_sink_file *file);
+/* releases unused preallocated space and closes the file once everything
+ * before it has been written, file must not be used afterwards */
+extern void file_sink_close(struct file_sink *sink,
+			    struct file_sink_file *file, uint32_t flags);
@@ -0,0 +1,176 @@
+#include "frame-diff.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DIFF_SSE2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define DIFF_NEON
+#endif
+
+#define SEPARATORS " ;\t\r\n"
+
+static bool parse_rect(const char **text, struct frame_diff_rect *rect)
+{
+	const char *p = *text;
+	uint32_t values[4];
+
+	rect->ignore = *p == '-';
+	if (rect->ignore)
+		p++;
+
+	for (int i = 0; i < 4; i++) {
+		if (*p < '0' || *p > '9')
+			return false;
+		char *end;
+		unsigned long value = strtoul(p, &end, 10);
+		if (value > UINT32_MAX)
+			return false;
+		values[i] = (uint32_t)value;
+		p = end;
+		if (i < 3 && *p++ != ',')
+			return false;
+	}
+	if (*p && !strchr(SEPARATORS, *p))
+		return false;
+
+	rect->x = values[0];
+	rect->y = values[1];
+	rect->width = values[2];
+	rect->height = values[3];
+	*text = p;
+	return true;
+}
+
+bool frame_diff_mask_parse(struct frame_diff_mask *mask, const char *text)
+{
+	memset(mask, 0, sizeof(*mask));
+	if (!text)
+		return true;
+
+	while (*text) {
+		if (strchr(SEPARATORS, *text)) {
+			text++;
+			continue;
+		}
+		if (mask->count == FRAME_DIFF_MAX_RECTS ||
+		    !parse_rect(&text, &mask->rects[mask->count])) {
+			memset(mask, 0, sizeof(*mask));
+			return false;
+		}
+		mask->count++;
+	}
+	return true;
+}
+
+static bool in_rect(const struct frame_diff_rect *rect, uint32_t x,
+		    uint32_t y)
+{
+	// like regions, a width or height of 0 extends to the edge
+	return x >= rect->x && y >= rect->y &&
+	       (!rect->width || x - rect->x < rect->width) &&
+	       (!rect->height || y - rect->y < rect->height);
+}
+
+static bool block_compared(const struct frame_diff_mask *mask, uint32_t x,
+			   uint32_t y)
+{
+	if (!mask)
+		return true;
+
+	bool any_compared = false;
+	bool compared = false;
+	for (uint32_t i = 0; i < mask->count; i++) {
+		const struct frame_diff_rect *rect = &mask->rects[i];
+		bool inside = in_rect(rect, x, y);
+		if (rect->ignore && inside)
+			return false;
+		if (!rect->ignore) {
+			any_compared = true;
+			compared = compared || inside;
+		}
+	}
+	return !any_compared || compared;
+}
+
+// sum of absolute differences of a block, the accumulators hold it for all
+// rows so there is only one horizontal add per block
+static uint64_t block_sad(const uint8_t *a, const uint8_t *b,
+			  uint32_t linesize, size_t row_size, uint32_t rows)
+{
+	uint64_t sad = 0;
+	size_t vector_size = row_size & ~(size_t)15;
+
+#if defined(DIFF_SSE2)
+	__m128i acc = _mm_setzero_si128();
+	for (uint32_t y = 0; y < rows; y++) {
+		const uint8_t *pa = a + (size_t)y * linesize;
+		const uint8_t *pb = b + (size_t)y * linesize;
+		for (size_t i = 0; i < vector_size; i += 16) {
+			__m128i va = _mm_loadu_si128((const __m128i *)(pa + i));
+			__m128i vb = _mm_loadu_si128((const __m128i *)(pb + i));
+			acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+		}
+	}
+	sad = (uint32_t)_mm_cvtsi128_si32(acc) +
+	      (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#elif defined(DIFF_NEON)
+	// each lane adds at most 510 per vector, a block has 4 per row
+	uint32x4_t acc = vdupq_n_u32(0);
+	for (uint32_t y = 0; y < rows; y++) {
+		const uint8_t *pa = a + (size_t)y * linesize;
+		const uint8_t *pb = b + (size_t)y * linesize;
+		uint16x8_t row = vdupq_n_u16(0);
+		for (size_t i = 0; i < vector_size; i += 16)
+			row = vpadalq_u8(row, vabdq_u8(vld1q_u8(pa + i),
+						       vld1q_u8(pb + i)));
+		acc = vpadalq_u16(acc, row);
+	}
+	sad = vaddvq_u32(acc);
+#else
+	vector_size = 0;
+#endif
+
+	for (uint32_t y = 0; y < rows && vector_size < row_size; y++) {
+		const uint8_t *pa = a + (size_t)y * linesize;
+		const uint8_t *pb = b + (size_t)y * linesize;
+		for (size_t i = vector_size; i < row_size; i++)
+			sad += (uint64_t)abs((int)pa[i] - (int)pb[i]);
+	}
+	return sad;
+}
+
+bool frame_diff_changed(const uint8_t *a, const uint8_t *b,
+			uint32_t linesize, uint32_t width, uint32_t height,
+			uint32_t bytes_per_pixel,
+			const struct frame_diff_mask *mask, uint32_t x,
+			uint32_t y, uint32_t threshold)
+{
+	for (uint32_t y0 = 0; y0 < height; y0 += FRAME_DIFF_BLOCK_SIZE) {
+		uint32_t rows = height - y0 < FRAME_DIFF_BLOCK_SIZE
+					? height - y0
+					: FRAME_DIFF_BLOCK_SIZE;
+
+		for (uint32_t x0 = 0; x0 < width; x0 += FRAME_DIFF_BLOCK_SIZE) {
+			uint32_t columns = width - x0 < FRAME_DIFF_BLOCK_SIZE
+						   ? width - x0
+						   : FRAME_DIFF_BLOCK_SIZE;
+			if (!block_compared(mask, x + x0 + columns / 2,
+					    y + y0 + rows / 2))
+				continue;
+
+			size_t row_size = (size_t)columns * bytes_per_pixel;
+			size_t offset = (size_t)y0 * linesize +
+					(size_t)x0 * bytes_per_pixel;
+			uint64_t sad = block_sad(a + offset, b + offset,
+						 linesize, row_size, rows);
+			if (sad > (uint64_t)threshold * row_size * rows)
+				return true;
+		}
+	}
+	return false;
+}
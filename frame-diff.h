@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Change detection between two images of the same size and layout.
+ *
+ * The image is split into FRAME_DIFF_BLOCK_SIZE square blocks of pixels and
+ * the sum of absolute differences of every block's bytes is computed with
+ * SSE2 or NEON.  A block has changed when the mean difference per byte is
+ * above a threshold, so noise from video sources or scaling can be ignored.
+ *
+ * A mask restricts the comparison to rectangles of the image and can leave
+ * out others, such as a clock.  It applies to whole blocks: a block is
+ * compared when its centre is in a compared rectangle, or there are none,
+ * and not in an ignored one.
+ */
+
+#define FRAME_DIFF_BLOCK_SIZE 16
+#define FRAME_DIFF_MAX_RECTS 16
+
+struct frame_diff_rect {
+	uint32_t x;
+	uint32_t y;
+	uint32_t width;
+	uint32_t height;
+	bool ignore;
+};
+
+struct frame_diff_mask {
+	uint32_t count;
+	struct frame_diff_rect rects[FRAME_DIFF_MAX_RECTS];
+};
+
+/*
+ * Parses rectangles of "x,y,width,height" separated by spaces or
+ * semicolons, those starting with '-' are ignored.  Like regions, a width
+ * or height of 0 extends the rectangle to the edge.  Returns false and
+ * leaves an empty mask if any of them is malformed.
+ */
+extern bool frame_diff_mask_parse(struct frame_diff_mask *mask,
+				  const char *text);
+
+/*
+ * Whether any compared block of a width x height image differs between a
+ * and b.  The images have bytes_per_pixel bytes per pixel and rows of
+ * linesize bytes, a planar image can be compared by its first plane.  x
+ * and y are the position of the image in the coordinates of the mask, and
+ * threshold is the mean difference per byte a block may have, 0 finds any
+ * difference.
+ */
+extern bool frame_diff_changed(const uint8_t *a, const uint8_t *b,
+			       uint32_t linesize, uint32_t width,
+			       uint32_t height, uint32_t bytes_per_pixel,
+			       const struct frame_diff_mask *mask, uint32_t x,
+			       uint32_t y, uint32_t threshold);
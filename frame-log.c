@@ -0,0 +1,254 @@
+#include "frame-log.h"
+#include "file-sink.h"
+
+#include <string.h>
+#include <time.h>
+
+#include <obs-module.h>
+#include <util/bmem.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#define do_log(level, format, ...) \
+	blog(level, "[screenshot-filter] " format, ##__VA_ARGS__)
+
+#define warn(format, ...) do_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define info(format, ...) do_log(LOG_INFO, format, ##__VA_ARGS__)
+
+#define MAX_SEGMENT_PROBES 10000
+/* wait before starting over after a segment failed, e.g. on a full disk */
+#define RETRY_DELAY_NS 1000000000ULL
+
+/* segment numbers are shared by all frame logs, so that two outputs logging
+ * to the same directory in the same second never pick the same name */
+static volatile long segment_counter;
+
+struct frame_log {
+	char *directory;
+	struct file_sink *sink;
+	uint64_t max_size;
+	uint64_t max_duration;
+	bool preallocate;
+	bool sync_segments;
+
+	/* the open segment, both NULL if none */
+	struct file_sink_file *data;
+	struct file_sink_file *index;
+	uint32_t segment;
+	uint64_t data_size;
+	uint64_t started;
+	uint64_t last_timestamp;
+	uint64_t retry_time;
+};
+
+struct frame_log *frame_log_create(const char *directory,
+				   struct file_sink *sink)
+{
+	if (!directory || !*directory || !sink)
+		return NULL;
+
+	struct frame_log *log = bzalloc(sizeof(struct frame_log));
+	log->directory = bstrdup(directory);
+	log->sink = sink;
+	return log;
+}
+
+static void close_segment(struct frame_log *log)
+{
+	uint32_t flags = log->sync_segments ? FILE_SINK_SYNC : 0;
+	file_sink_close(log->sink, log->data, flags);
+	file_sink_close(log->sink, log->index, flags);
+	log->data = NULL;
+	log->index = NULL;
+}
+
+void frame_log_destroy(struct frame_log *log)
+{
+	if (!log)
+		return;
+
+	close_segment(log);
+	bfree(log->directory);
+	bfree(log);
+}
+
+const char *frame_log_directory(const struct frame_log *log)
+{
+	return log ? log->directory : NULL;
+}
+
+void frame_log_set_rotation(struct frame_log *log, uint64_t max_size,
+			    uint64_t max_duration)
+{
+	if (!log)
+		return;
+
+	log->max_size = max_size;
+	log->max_duration = max_duration;
+}
+
+void frame_log_set_durability(struct frame_log *log, bool preallocate,
+			      bool sync_segments)
+{
+	if (!log)
+		return;
+
+	log->preallocate = preallocate;
+	log->sync_segments = sync_segments;
+}
+
+static uint64_t wall_time_ns(void)
+{
+	struct timespec ts;
+	if (timespec_get(&ts, TIME_UTC) != TIME_UTC)
+		return (uint64_t)time(NULL) * 1000000000ULL;
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// localtime() shares its result between threads, and logs are written on
+// all encoder threads
+static void local_time(const time_t *now, struct tm *tm)
+{
+#ifdef _WIN32
+	localtime_s(tm, now);
+#else
+	localtime_r(now, tm);
+#endif
+}
+
+static struct file_sink_file *open_file(struct frame_log *log,
+					const char *base,
+					const char *extension,
+					uint64_t preallocate,
+					const void *header,
+					size_t header_size)
+{
+	struct dstr path = {0};
+	dstr_printf(&path, "%s.%s", base, extension);
+	struct file_sink_file *file = file_sink_open(
+		log->sink, path.array, preallocate, header, header_size);
+	dstr_free(&path);
+	return file;
+}
+
+static bool open_segment(struct frame_log *log)
+{
+	if (os_mkdirs(log->directory) == MKDIR_ERROR) {
+		warn("Failed to create frame log directory %s", log->directory);
+		return false;
+	}
+
+	time_t now = time(NULL);
+	struct tm tm;
+	local_time(&now, &tm);
+	struct dstr base = {0};
+	struct dstr index_path = {0};
+
+	// a name that is not taken yet, the counter keeps segments started in
+	// the same second in order, and skips those of an earlier session
+	for (uint32_t i = 0; i < MAX_SEGMENT_PROBES; i++) {
+		log->segment = (uint32_t)os_atomic_inc_long(&segment_counter);
+		dstr_printf(&base, "%s/%d-%02d-%02d_%02d-%02d-%02d_%04u",
+			    log->directory, tm.tm_year + 1900, tm.tm_mon + 1,
+			    tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+			    log->segment);
+		dstr_printf(&index_path, "%s.%s", base.array,
+			    FRAME_LOG_INDEX_EXTENSION);
+		if (!os_file_exists(index_path.array))
+			break;
+	}
+	dstr_free(&index_path);
+
+	struct frame_log_data_header data_header = {
+		.magic = FRAME_LOG_DATA_MAGIC,
+		.version = FRAME_LOG_VERSION,
+		.header_size = sizeof(data_header),
+		.segment = log->segment,
+	};
+	struct frame_log_index_header index_header = {
+		.magic = FRAME_LOG_INDEX_MAGIC,
+		.version = FRAME_LOG_VERSION,
+		.header_size = sizeof(index_header),
+		.entry_size = sizeof(struct frame_log_entry),
+		.segment = log->segment,
+		.wall_time = wall_time_ns(),
+		.monotonic_time = os_gettime_ns(),
+	};
+
+	// only the data is preallocated, the size of the index is what tells
+	// readers how many entries there are
+	log->data = open_file(log, base.array, FRAME_LOG_DATA_EXTENSION,
+			      log->preallocate ? log->max_size : 0,
+			      &data_header, sizeof(data_header));
+	log->index = open_file(log, base.array, FRAME_LOG_INDEX_EXTENSION, 0,
+			       &index_header, sizeof(index_header));
+
+	info("Started frame log segment %s", base.array);
+	dstr_free(&base);
+
+	log->data_size = sizeof(data_header);
+	log->started = index_header.monotonic_time;
+	return true;
+}
+
+static bool should_rotate(const struct frame_log *log, uint64_t timestamp)
+{
+	// a segment always holds at least one frame, and all levels of a frame
+	if (log->data_size == sizeof(struct frame_log_data_header) ||
+	    timestamp == log->last_timestamp)
+		return false;
+	if (log->max_size && log->data_size >= log->max_size)
+		return true;
+	return log->max_duration && timestamp >= log->started &&
+	       timestamp - log->started >= log->max_duration;
+}
+
+bool frame_log_append(struct frame_log *log, struct frame_log_entry *entry,
+		      const uint8_t *data, size_t size, bool sync,
+		      void (*release)(void *opaque), void *opaque)
+{
+	if (!log) {
+		if (release)
+			release(opaque);
+		return false;
+	}
+
+	// a segment that could not be written to is abandoned
+	if (log->data && (file_sink_file_failed(log->data) ||
+			  file_sink_file_failed(log->index))) {
+		close_segment(log);
+		log->retry_time = os_gettime_ns() + RETRY_DELAY_NS;
+	}
+
+	if (log->data && should_rotate(log, entry->timestamp))
+		close_segment(log);
+	if (!log->data && os_gettime_ns() >= log->retry_time &&
+	    !open_segment(log))
+		log->retry_time = os_gettime_ns() + RETRY_DELAY_NS;
+	if (!log->data) {
+		if (release)
+			release(opaque);
+		return false;
+	}
+
+	entry->offset = log->data_size;
+	entry->size = size;
+
+	// the sink writes in order, so the entry is only written once its data
+	// is and readers never see an entry without data.  if the entry is
+	// dropped the data is never referenced
+	uint32_t flags = sync ? FILE_SINK_SYNC : 0;
+	if (!file_sink_append(log->sink, log->data, flags, data, size, release,
+			      opaque))
+		return false;
+	log->data_size += size;
+
+	if (!file_sink_append(log->sink, log->index, flags,
+			      (const uint8_t *)entry, sizeof(*entry), NULL,
+			      NULL))
+		return false;
+
+	log->last_timestamp = entry->timestamp;
+	return true;
+}
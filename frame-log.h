@@ -0,0 +1,189 @@
+#pragma once
+
+/*
+ * Append-only frame log.
+ *
+ * Frames are appended to segments in a directory.  Each segment is a pair of
+ * files with the same name: a .sslog data file that holds the frames back to
+ * back after a small header, and a .ssidx index file that holds a header
+ * followed by one fixed size entry per frame with its offset and size in the
+ * data file, timestamp and dimensions.  Segments are named after the time they
+ * were started plus a counter, e.g. 2020-04-27_23-29-34_0001, so they sort in
+ * the order they were written.
+ *
+ * A frame's data is always written before its index entry, and only whole
+ * entries count, so a reader can mmap a segment that is still being written
+ * and use every entry it sees.  Entries are in timestamp order, which makes
+ * frame_log_find() a binary search.  To follow a live segment, map it again
+ * once the index file has grown.  The writer is implemented in frame-log.c.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_LOG_DATA_MAGIC 0x4C465353  /* "SSFL" */
+#define FRAME_LOG_INDEX_MAGIC 0x49465353 /* "SSFI" */
+#define FRAME_LOG_VERSION 1
+
+#define FRAME_LOG_DATA_EXTENSION "sslog"
+#define FRAME_LOG_INDEX_EXTENSION "ssidx"
+
+/* entry flags */
+/* the data is a delta frame (delta-frame.h), not an image */
+#define FRAME_LOG_FLAG_DELTA 0x1
+/* the data is raw pixels in pixel_format, otherwise an encoded image */
+#define FRAME_LOG_FLAG_RAW 0x2
+
+struct frame_log_data_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t segment;
+};
+
+struct frame_log_index_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t entry_size;
+	uint32_t segment;
+	uint32_t reserved;
+	/* wall clock time in ns since the unix epoch at monotonic_time, to
+	 * convert entry timestamps */
+	uint64_t wall_time;
+	uint64_t monotonic_time;
+	uint64_t reserved2;
+};
+
+struct frame_log_entry {
+	/* offset of the frame from the start of the data file */
+	uint64_t offset;
+	uint64_t size;
+	/* monotonic time in ns of the video frame it was captured in */
+	uint64_t timestamp;
+	uint32_t index;
+	uint32_t flags;
+	uint32_t width;
+	uint32_t height;
+	uint32_t linesize;
+	/* enum pixel_format of raw frames, see SHMEM_RING_FORMAT_* */
+	uint32_t pixel_format;
+	/* file extension of the data, e.g. "png", "raw" or "delta" */
+	char extension[8];
+	/* pyramid level, 0 for the full size image */
+	uint32_t level;
+	uint32_t reserved;
+	/* number of that video frame, see capture-schedule.h */
+	uint64_t frame;
+};
+
+static inline const struct frame_log_index_header *
+frame_log_index_get_header(const void *index, size_t size)
+{
+	const struct frame_log_index_header *header = index;
+	if (size < sizeof(*header) || header->magic != FRAME_LOG_INDEX_MAGIC ||
+	    header->version != FRAME_LOG_VERSION ||
+	    header->header_size < sizeof(*header) ||
+	    header->entry_size < sizeof(struct frame_log_entry) ||
+	    size < header->header_size)
+		return NULL;
+	return header;
+}
+
+/* number of complete entries in a mapped index */
+static inline size_t frame_log_entry_count(const void *index, size_t size)
+{
+	const struct frame_log_index_header *header =
+		frame_log_index_get_header(index, size);
+	if (!header)
+		return 0;
+	return (size - header->header_size) / header->entry_size;
+}
+
+static inline const struct frame_log_entry *
+frame_log_get_entry(const void *index, size_t n)
+{
+	const struct frame_log_index_header *header = index;
+	return (const struct frame_log_entry *)((const uint8_t *)index +
+						header->header_size +
+						n * header->entry_size);
+}
+
+/*
+ * Returns the position of the latest frame at or before timestamp, or of the
+ * first frame if timestamp is older than every entry.  The levels of a
+ * pyramid share their frame's timestamp, the position is that of the first
+ * of them.  Returns -1 if the index has no entries.
+ */
+static inline ptrdiff_t frame_log_find(const void *index, size_t size,
+				       uint64_t timestamp)
+{
+	size_t count = frame_log_entry_count(index, size);
+	if (!count)
+		return -1;
+
+	size_t lo = 0;
+	size_t hi = count;
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (frame_log_get_entry(index, mid)->timestamp <= timestamp)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	uint64_t found = frame_log_get_entry(index, lo)->timestamp;
+	while (lo > 0 && frame_log_get_entry(index, lo - 1)->timestamp == found)
+		lo--;
+	return (ptrdiff_t)lo;
+}
+
+/* the entry's data in a mapped data file, NULL if the file is too short */
+static inline const uint8_t *
+frame_log_entry_data(const struct frame_log_entry *entry, const void *data,
+		     size_t size)
+{
+	if (entry->offset > size || entry->size > size - entry->offset)
+		return NULL;
+	return (const uint8_t *)data + entry->offset;
+}
+
+/* writer, implemented in frame-log.c */
+struct frame_log;
+struct file_sink;
+
+/* frames are appended to segments in directory, which is created if needed.
+ * the files are written by sink, which must outlive the log */
+extern struct frame_log *frame_log_create(const char *directory,
+					  struct file_sink *sink);
+extern void frame_log_destroy(struct frame_log *log);
+
+extern const char *frame_log_directory(const struct frame_log *log);
+
+/* a new segment is started once the current one holds max_size bytes of
+ * frames or is max_duration ns old, 0 disables either limit */
+extern void frame_log_set_rotation(struct frame_log *log, uint64_t max_size,
+				   uint64_t max_duration);
+
+/* preallocate reserves the maximum segment size when a segment is started,
+ * sync_segments flushes segments to disk when they are closed */
+extern void frame_log_set_durability(struct frame_log *log, bool preallocate,
+				     bool sync_segments);
+
+/* queues a frame, entry->offset and entry->size are filled in.  sync flushes
+ * it to disk once written.  data is not copied, release(opaque) is called
+ * once it has been written or was dropped, data is copied if release is
+ * NULL */
+extern bool frame_log_append(struct frame_log *log,
+			     struct frame_log_entry *entry, const uint8_t *data,
+			     size_t size, bool sync,
+			     void (*release)(void *opaque), void *opaque);
+
+#ifdef __cplusplus
+}
+#endif
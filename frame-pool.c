@@ -0,0 +1,268 @@
+#include "frame-pool.h"
+
+#include <string.h>
+
+#include <obs-module.h>
+#include <util/bmem.h>
+#include <util/threading.h>
+
+#include "capture-memory.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/* the idle list is a lock free stack so that the render thread never waits
+ * for an encoder or sink thread releasing a buffer.  buffers are only ever
+ * pushed one at a time or as a chain, and taken by swapping out the whole
+ * list, so a buffer being reused while a thread looks at it (ABA) can't
+ * corrupt the list */
+struct frame_pool {
+	volatile long refs;
+
+	struct frame_buffer *volatile idle;
+	volatile long num_idle;
+	long max_idle;
+};
+
+static inline struct frame_buffer *take_idle(struct frame_pool *pool)
+{
+#ifdef _MSC_VER
+	return _InterlockedExchangePointer((void *volatile *)&pool->idle,
+					   NULL);
+#else
+	return __atomic_exchange_n(&pool->idle, NULL, __ATOMIC_ACQ_REL);
+#endif
+}
+
+/* pushes the chain from first to last */
+static inline void push_idle(struct frame_pool *pool,
+			     struct frame_buffer *first,
+			     struct frame_buffer *last)
+{
+#ifdef _MSC_VER
+	for (;;) {
+		struct frame_buffer *head = pool->idle;
+		last->next = head;
+		if (_InterlockedCompareExchangePointer(
+			    (void *volatile *)&pool->idle, first, head) == head)
+			return;
+	}
+#else
+	struct frame_buffer *head = __atomic_load_n(&pool->idle,
+						    __ATOMIC_RELAXED);
+	do {
+		last->next = head;
+	} while (!__atomic_compare_exchange_n(&pool->idle, &head, first, true,
+					      __ATOMIC_RELEASE,
+					      __ATOMIC_RELAXED));
+#endif
+}
+
+static void free_buffer(struct frame_buffer *buffer)
+{
+	capture_memory_add(CAPTURE_MEMORY_FRAMES, -(int64_t)buffer->size);
+	bfree(buffer->data);
+	bfree(buffer);
+}
+
+static void pool_release(struct frame_pool *pool)
+{
+	if (os_atomic_dec_long(&pool->refs) != 0)
+		return;
+
+	struct frame_buffer *buffer = take_idle(pool);
+	while (buffer) {
+		struct frame_buffer *next = buffer->next;
+		free_buffer(buffer);
+		buffer = next;
+	}
+	bfree(pool);
+}
+
+struct frame_pool *frame_pool_create(uint32_t max_idle)
+{
+	struct frame_pool *pool = bzalloc(sizeof(struct frame_pool));
+	pool->refs = 1;
+	pool->max_idle = (long)max_idle;
+	return pool;
+}
+
+void frame_pool_release(struct frame_pool *pool)
+{
+	if (pool)
+		pool_release(pool);
+}
+
+// takes the idle list and pushes back the buffers of size bytes, except one
+// that is taken if taken is not NULL.  buffers of other sizes are left over
+// from a different resolution and returned to be freed.  another thread
+// taking a buffer meanwhile finds the list empty and allocates one, the extra
+// buffer is freed on release if the pool is full by then
+static uint32_t sort_idle(struct frame_pool *pool, size_t size,
+			  struct frame_buffer **taken,
+			  struct frame_buffer **stale)
+{
+	struct frame_buffer *keep = NULL;
+	struct frame_buffer *keep_last = NULL;
+	uint32_t kept = 0;
+
+	*stale = NULL;
+	struct frame_buffer *cur = take_idle(pool);
+	while (cur) {
+		struct frame_buffer *next = cur->next;
+		if (taken && !*taken && cur->size == size) {
+			*taken = cur;
+			os_atomic_dec_long(&pool->num_idle);
+		} else if (cur->size != size) {
+			cur->next = *stale;
+			*stale = cur;
+			os_atomic_dec_long(&pool->num_idle);
+		} else {
+			cur->next = NULL;
+			if (keep_last)
+				keep_last->next = cur;
+			else
+				keep = cur;
+			keep_last = cur;
+			kept++;
+		}
+		cur = next;
+	}
+	if (keep)
+		push_idle(pool, keep, keep_last);
+	return kept;
+}
+
+static void free_list(struct frame_buffer *buffer)
+{
+	while (buffer) {
+		struct frame_buffer *next = buffer->next;
+		free_buffer(buffer);
+		buffer = next;
+	}
+}
+
+static struct frame_buffer *alloc_buffer(size_t size)
+{
+	struct frame_buffer *buffer = bzalloc(sizeof(struct frame_buffer));
+	buffer->data = bmalloc(size);
+	buffer->size = size;
+	capture_memory_add(CAPTURE_MEMORY_FRAMES, (int64_t)size);
+	return buffer;
+}
+
+struct frame_buffer *frame_pool_get(struct frame_pool *pool,
+				    enum pixel_format format, uint32_t width,
+				    uint32_t height, uint32_t linesize,
+				    size_t size)
+{
+	struct frame_buffer *buffer = NULL;
+	struct frame_buffer *stale;
+
+	sort_idle(pool, size, &buffer, &stale);
+	free_list(stale);
+	if (!buffer)
+		buffer = alloc_buffer(size);
+
+	buffer->width = width;
+	buffer->height = height;
+	buffer->linesize = linesize;
+	buffer->format = format;
+	buffer->refs = 1;
+	buffer->pool = pool;
+	buffer->next = NULL;
+	os_atomic_inc_long(&pool->refs);
+	return buffer;
+}
+
+struct reserve_request {
+	struct frame_pool *pool;
+	size_t size;
+	uint32_t count;
+};
+
+static void reserve(struct reserve_request *request)
+{
+	struct frame_pool *pool = request->pool;
+	struct frame_buffer *stale;
+
+	uint32_t idle = sort_idle(pool, request->size, NULL, &stale);
+	free_list(stale);
+
+	for (; idle < request->count; idle++) {
+		if (capture_memory_over_budget())
+			break;
+		if (os_atomic_inc_long(&pool->num_idle) > pool->max_idle) {
+			os_atomic_dec_long(&pool->num_idle);
+			break;
+		}
+		struct frame_buffer *buffer = alloc_buffer(request->size);
+		// the pages are faulted in here rather than by the first copy
+		// into the buffer
+		memset(buffer->data, 0, request->size);
+		push_idle(pool, buffer, buffer);
+	}
+
+	pool_release(pool);
+	bfree(request);
+}
+
+static void *reserve_thread(void *data)
+{
+	os_set_thread_name("screenshot-filter: frame pool");
+	reserve(data);
+	return NULL;
+}
+
+void frame_pool_reserve(struct frame_pool *pool, size_t size, uint32_t count)
+{
+	struct reserve_request *request =
+		bzalloc(sizeof(struct reserve_request));
+	request->pool = pool;
+	request->size = size;
+	request->count = count;
+	os_atomic_inc_long(&pool->refs);
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, reserve_thread, request) == 0)
+		pthread_detach(thread);
+	else
+		reserve(request);
+}
+
+void frame_pool_trim(struct frame_pool *pool)
+{
+	struct frame_buffer *buffer = take_idle(pool);
+	while (buffer) {
+		struct frame_buffer *next = buffer->next;
+		os_atomic_dec_long(&pool->num_idle);
+		free_buffer(buffer);
+		buffer = next;
+	}
+}
+
+struct frame_buffer *frame_buffer_addref(struct frame_buffer *buffer)
+{
+	if (buffer)
+		os_atomic_inc_long(&buffer->refs);
+	return buffer;
+}
+
+void frame_buffer_release(struct frame_buffer *buffer)
+{
+	if (!buffer || os_atomic_dec_long(&buffer->refs) != 0)
+		return;
+
+	struct frame_pool *pool = buffer->pool;
+
+	if (capture_memory_over_budget()) {
+		free_buffer(buffer);
+	} else if (os_atomic_inc_long(&pool->num_idle) <= pool->max_idle) {
+		push_idle(pool, buffer, buffer);
+	} else {
+		os_atomic_dec_long(&pool->num_idle);
+		free_buffer(buffer);
+	}
+	pool_release(pool);
+}
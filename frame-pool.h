@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pixel-format.h"
+
+/*
+ * Reference counted frame buffers, recycled by a pool.
+ *
+ * The render thread fills a buffer once when a capture is read back and
+ * everything after that (encoders, sinks, other filters) takes a reference
+ * instead of copying it.  When the last reference is released the buffer goes
+ * back to its pool and is reused for the next frame of the same size.  Idle
+ * buffers of any other size are freed when a buffer of a new size is
+ * requested, so a resolution change does not keep the old buffers around.
+ * Getting and releasing buffers never takes a lock.  Buffers count as frame
+ * memory in capture-memory.h, over the budget released buffers are freed
+ * instead of kept idle.
+ */
+
+struct frame_pool;
+
+struct frame_buffer {
+	uint8_t *data;
+	size_t size;
+	uint32_t width;
+	uint32_t height;
+	uint32_t linesize;
+	enum pixel_format format;
+
+	/* private */
+	volatile long refs;
+	struct frame_pool *pool;
+	struct frame_buffer *next;
+};
+
+extern struct frame_pool *frame_pool_create(uint32_t max_idle);
+/* the pool is freed once every buffer taken from it has been released */
+extern void frame_pool_release(struct frame_pool *pool);
+
+/* returns a buffer of size bytes with a single reference */
+extern struct frame_buffer *frame_pool_get(struct frame_pool *pool,
+					   enum pixel_format format,
+					   uint32_t width, uint32_t height,
+					   uint32_t linesize, size_t size);
+
+/*
+ * Makes sure count buffers of size bytes are idle, up to the pool's
+ * max_idle, so that taking them later does not wait for the memory.  The
+ * buffers are allocated and those of other sizes freed on a background
+ * thread, this returns right away.
+ */
+extern void frame_pool_reserve(struct frame_pool *pool, size_t size,
+			       uint32_t count);
+
+/* frees the idle buffers, those in use go back to the pool as usual */
+extern void frame_pool_trim(struct frame_pool *pool);
+
+extern struct frame_buffer *frame_buffer_addref(struct frame_buffer *buffer);
+extern void frame_buffer_release(struct frame_buffer *buffer);
@@ -0,0 +1,560 @@
+#include "http-client.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <obs-module.h>
+#include <util/bmem.h>
+#include <util/dstr.h>
+
+#define do_log(level, format, ...) \
+	blog(level, "[screenshot-filter] " format, ##__VA_ARGS__)
+
+#define warn(format, ...) do_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define info(format, ...) do_log(LOG_INFO, format, ##__VA_ARGS__)
+
+#ifdef _WIN32
+typedef SOCKET socket_t;
+#define close_socket closesocket
+#define socket_error() WSAGetLastError()
+#define SEND_FLAGS 0
+#else
+typedef int socket_t;
+#define INVALID_SOCKET (-1)
+#define close_socket close
+#define socket_error() errno
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+#endif
+
+#define TIMEOUT_MS 5000
+#define MAX_LINE 2048
+
+struct http_client {
+	/* cached endpoint, parsed from url */
+	struct dstr url;
+	struct dstr host;
+	struct dstr path;
+	int port;
+	bool valid;
+
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+
+	socket_t sock;
+	size_t chunk_threshold;
+
+	/* response bytes received but not parsed yet */
+	char buf[4096];
+	size_t buf_pos;
+	size_t buf_len;
+};
+
+struct http_client *http_client_create(void)
+{
+#ifdef _WIN32
+	WSADATA wsa_data;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+		warn("WSAStartup failed");
+		return NULL;
+	}
+#endif
+	struct http_client *client = bzalloc(sizeof(struct http_client));
+	client->sock = INVALID_SOCKET;
+	return client;
+}
+
+static void close_connection(struct http_client *client)
+{
+	if (client->sock != INVALID_SOCKET)
+		close_socket(client->sock);
+	client->sock = INVALID_SOCKET;
+	client->buf_pos = 0;
+	client->buf_len = 0;
+}
+
+void http_client_destroy(struct http_client *client)
+{
+	if (!client)
+		return;
+
+	close_connection(client);
+	dstr_free(&client->url);
+	dstr_free(&client->host);
+	dstr_free(&client->path);
+	bfree(client);
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+void http_client_set_chunk_threshold(struct http_client *client,
+				     size_t threshold)
+{
+	client->chunk_threshold = threshold;
+}
+
+/* ------------------------------------------------------------------------- */
+/* endpoint                                                                   */
+
+static bool parse_url(struct http_client *client, const char *url)
+{
+	if (strncmp(url, "http://", 7) != 0) {
+		if (strncmp(url, "https://", 8) == 0)
+			warn("https unsupported");
+		else
+			warn("Invalid URL %s", url);
+		return false;
+	}
+
+	const char *host = url + 7;
+	const char *path = strchr(host, '/');
+	if (!path)
+		path = host + strlen(host);
+
+	const char *host_end = path;
+	int port = 80;
+
+	const char *port_start = memchr(host, ':', path - host);
+	if (port_start) {
+		host_end = port_start;
+		port = 0;
+		for (const char *p = port_start + 1; p < path; p++) {
+			if (!isdigit((unsigned char)*p) || port > 65535)
+				return false;
+			port = port * 10 + (*p - '0');
+		}
+		if (port <= 0 || port > 65535)
+			return false;
+	}
+	if (host_end == host)
+		return false;
+
+	dstr_ncopy(&client->host, host, host_end - host);
+	dstr_copy(&client->path, *path ? path : "/");
+	client->port = port;
+	return true;
+}
+
+/* re-parses the URL only when it changes */
+static bool set_url(struct http_client *client, const char *url)
+{
+	if (client->url.array && strcmp(client->url.array, url) == 0)
+		return client->valid;
+
+	struct dstr old_host = {0};
+	int old_port = client->port;
+	dstr_copy(&old_host, client->host.array ? client->host.array : "");
+
+	dstr_copy(&client->url, url);
+	client->valid = parse_url(client, url);
+
+	/* a different path on the same server can reuse the connection */
+	if (!client->valid || old_port != client->port ||
+	    strcmp(old_host.array, client->host.array) != 0) {
+		close_connection(client);
+		client->addr_len = 0;
+	}
+	dstr_free(&old_host);
+	return client->valid;
+}
+
+static void set_blocking(socket_t sock, bool blocking)
+{
+#ifdef _WIN32
+	u_long mode = blocking ? 0 : 1;
+	ioctlsocket(sock, FIONBIO, &mode);
+#else
+	int flags = fcntl(sock, F_GETFL, 0);
+	fcntl(sock, F_SETFL,
+	      blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+#endif
+}
+
+static void set_timeouts(socket_t sock)
+{
+#ifdef _WIN32
+	DWORD timeout = TIMEOUT_MS;
+#else
+	struct timeval timeout = {TIMEOUT_MS / 1000,
+				  (TIMEOUT_MS % 1000) * 1000};
+#endif
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout,
+		   sizeof(timeout));
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout,
+		   sizeof(timeout));
+}
+
+static socket_t connect_addr(const struct sockaddr *addr, socklen_t len)
+{
+	socket_t sock = socket(addr->sa_family, SOCK_STREAM, IPPROTO_TCP);
+	if (sock == INVALID_SOCKET)
+		return INVALID_SOCKET;
+
+#ifdef SO_NOSIGPIPE
+	int one = 1;
+	setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+	/* connect with a timeout instead of the system's, which can be
+	 * minutes */
+	set_blocking(sock, false);
+	if (connect(sock, addr, len) != 0) {
+#ifdef _WIN32
+		bool in_progress = WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+		bool in_progress = errno == EINPROGRESS;
+#endif
+		fd_set write_set;
+		fd_set error_set;
+		struct timeval timeout = {TIMEOUT_MS / 1000,
+					  (TIMEOUT_MS % 1000) * 1000};
+		int error = 0;
+		socklen_t error_len = sizeof(error);
+
+		FD_ZERO(&write_set);
+		FD_SET(sock, &write_set);
+		FD_ZERO(&error_set);
+		FD_SET(sock, &error_set);
+
+		if (!in_progress ||
+		    select((int)sock + 1, NULL, &write_set, &error_set,
+			   &timeout) <= 0 ||
+		    getsockopt(sock, SOL_SOCKET, SO_ERROR, (char *)&error,
+			       &error_len) != 0 ||
+		    error != 0) {
+			close_socket(sock);
+			return INVALID_SOCKET;
+		}
+	}
+	set_blocking(sock, true);
+
+	/* headers and chunks are sent in separate calls */
+	int nodelay = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&nodelay,
+		   sizeof(nodelay));
+	set_timeouts(sock);
+	return sock;
+}
+
+static bool connect_endpoint(struct http_client *client)
+{
+	if (client->addr_len) {
+		client->sock = connect_addr((struct sockaddr *)&client->addr,
+					    client->addr_len);
+		if (client->sock != INVALID_SOCKET)
+			return true;
+	}
+
+	/* first connection, or the cached address stopped working */
+	struct addrinfo hints = {0};
+	struct addrinfo *result = NULL;
+	char port[8];
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(port, sizeof(port), "%d", client->port);
+
+	int ret = getaddrinfo(client->host.array, port, &hints, &result);
+	if (ret != 0) {
+		warn("Failed to resolve %s: %d", client->host.array, ret);
+		return false;
+	}
+
+	for (struct addrinfo *ai = result; ai; ai = ai->ai_next) {
+		client->sock = connect_addr(ai->ai_addr,
+					    (socklen_t)ai->ai_addrlen);
+		if (client->sock != INVALID_SOCKET) {
+			memcpy(&client->addr, ai->ai_addr, ai->ai_addrlen);
+			client->addr_len = (socklen_t)ai->ai_addrlen;
+			break;
+		}
+	}
+	freeaddrinfo(result);
+
+	if (client->sock == INVALID_SOCKET) {
+		warn("Failed to connect to %s:%d - %d", client->host.array,
+		     client->port, socket_error());
+		client->addr_len = 0;
+		return false;
+	}
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+/* request                                                                    */
+
+static bool send_all(struct http_client *client, const void *data, size_t size)
+{
+	const char *ptr = data;
+	while (size) {
+		int chunk = size > INT_MAX ? INT_MAX : (int)size;
+		int sent = send(client->sock, ptr, chunk, SEND_FLAGS);
+		if (sent <= 0)
+			return false;
+		ptr += sent;
+		size -= (size_t)sent;
+	}
+	return true;
+}
+
+static bool send_request(struct http_client *client, const char *method,
+			 const char *headers, const uint8_t *body, size_t size)
+{
+	bool chunked = client->chunk_threshold &&
+		       size >= client->chunk_threshold;
+	struct dstr request = {0};
+	bool success;
+
+	dstr_printf(&request, "%s %s HTTP/1.1\r\nHost: %s", method,
+		    client->path.array, client->host.array);
+	if (client->port != 80)
+		dstr_catf(&request, ":%d", client->port);
+	dstr_cat(&request, "\r\nUser-Agent: OBS Screenshot Plugin/1.4.0\r\n");
+	if (chunked)
+		dstr_cat(&request, "Transfer-Encoding: chunked\r\n");
+	else
+		dstr_catf(&request, "Content-Length: %llu\r\n",
+			  (unsigned long long)size);
+	if (headers)
+		dstr_cat(&request, headers);
+	dstr_cat(&request, "\r\n");
+
+	if (!chunked) {
+		/* small bodies go out with the headers in one packet */
+		if (size < 64 * 1024) {
+			dstr_ncat(&request, (const char *)body, size);
+			success = send_all(client, request.array, request.len);
+		} else {
+			success = send_all(client, request.array,
+					   request.len) &&
+				  send_all(client, body, size);
+		}
+		dstr_free(&request);
+		return success;
+	}
+
+	success = send_all(client, request.array, request.len);
+	dstr_free(&request);
+
+	while (success && size) {
+		size_t chunk = size < HTTP_CLIENT_CHUNK_SIZE
+				       ? size
+				       : HTTP_CLIENT_CHUNK_SIZE;
+		char chunk_header[24];
+		int len = snprintf(chunk_header, sizeof(chunk_header),
+				   "%llx\r\n", (unsigned long long)chunk);
+
+		success = send_all(client, chunk_header, len) &&
+			  send_all(client, body, chunk) &&
+			  send_all(client, "\r\n", 2);
+		body += chunk;
+		size -= chunk;
+	}
+	return success && send_all(client, "0\r\n\r\n", 5);
+}
+
+/* ------------------------------------------------------------------------- */
+/* response                                                                   */
+
+static bool fill_buffer(struct http_client *client)
+{
+	if (client->buf_pos == client->buf_len) {
+		client->buf_pos = 0;
+		client->buf_len = 0;
+	}
+
+	int received = recv(client->sock, client->buf + client->buf_len,
+			    (int)(sizeof(client->buf) - client->buf_len), 0);
+	if (received <= 0)
+		return false;
+
+	client->buf_len += (size_t)received;
+	return true;
+}
+
+/* reads a line without its line ending, lines longer than MAX_LINE are
+ * truncated */
+static bool read_line(struct http_client *client, char *line)
+{
+	size_t len = 0;
+
+	for (;;) {
+		while (client->buf_pos < client->buf_len) {
+			char c = client->buf[client->buf_pos++];
+			if (c == '\n') {
+				if (len && line[len - 1] == '\r')
+					len--;
+				line[len] = 0;
+				return true;
+			}
+			if (len < MAX_LINE - 1)
+				line[len++] = c;
+		}
+		if (!fill_buffer(client))
+			return false;
+	}
+}
+
+static bool skip_bytes(struct http_client *client, uint64_t size)
+{
+	while (size) {
+		if (client->buf_pos == client->buf_len &&
+		    !fill_buffer(client))
+			return false;
+
+		size_t available = client->buf_len - client->buf_pos;
+		size_t skip = size < available ? (size_t)size : available;
+		client->buf_pos += skip;
+		size -= skip;
+	}
+	return true;
+}
+
+static bool skip_chunked_body(struct http_client *client, char *line)
+{
+	for (;;) {
+		if (!read_line(client, line))
+			return false;
+
+		uint64_t size = strtoull(line, NULL, 16);
+		if (size == 0)
+			break;
+		if (!skip_bytes(client, size) || !read_line(client, line))
+			return false;
+	}
+
+	/* trailers */
+	do {
+		if (!read_line(client, line))
+			return false;
+	} while (*line);
+	return true;
+}
+
+static bool header_is(const char *line, const char *name, const char **value)
+{
+	size_t len = strlen(name);
+	if (astrcmpi_n(line, name, len) != 0 || line[len] != ':')
+		return false;
+
+	*value = line + len + 1;
+	while (**value == ' ' || **value == '\t')
+		(*value)++;
+	return true;
+}
+
+/* returns the status code, or -1 when the connection failed before a status
+ * line was received.  the body is discarded */
+static int read_response(struct http_client *client, bool *keep_alive)
+{
+	char line[MAX_LINE];
+	int status;
+	int minor;
+
+	do {
+		if (!read_line(client, line))
+			return -1;
+		if (sscanf(line, "HTTP/1.%d %d", &minor, &status) != 2)
+			return -1;
+
+		bool chunked = false;
+		bool has_length = false;
+		uint64_t length = 0;
+		*keep_alive = minor >= 1;
+
+		for (;;) {
+			const char *value;
+			if (!read_line(client, line))
+				return -1;
+			if (!*line)
+				break;
+
+			if (header_is(line, "Content-Length", &value)) {
+				length = strtoull(value, NULL, 10);
+				has_length = true;
+			} else if (header_is(line, "Transfer-Encoding",
+					     &value)) {
+				chunked = strstr(value, "chunked") != NULL;
+			} else if (header_is(line, "Connection", &value)) {
+				if (astrcmpi_n(value, "close", 5) == 0)
+					*keep_alive = false;
+				else if (astrcmpi_n(value, "keep-alive", 10) ==
+					 0)
+					*keep_alive = true;
+			}
+		}
+
+		bool has_body = status >= 200 && status != 204 &&
+				status != 304;
+		if (!has_body)
+			continue;
+
+		if (chunked) {
+			if (!skip_chunked_body(client, line))
+				return -1;
+		} else if (has_length) {
+			if (!skip_bytes(client, length))
+				return -1;
+		} else {
+			/* the body ends when the server closes the
+			 * connection */
+			while (fill_buffer(client))
+				client->buf_pos = client->buf_len;
+			*keep_alive = false;
+		}
+	} while (status < 200);
+
+	return status;
+}
+
+int http_client_request(struct http_client *client, const char *method,
+			const char *url, const char *headers,
+			const uint8_t *body, size_t size)
+{
+	if (!set_url(client, url))
+		return -1;
+
+	int status = -1;
+	for (int attempt = 0; attempt < 2; attempt++) {
+		bool reused = client->sock != INVALID_SOCKET;
+		if (!reused && !connect_endpoint(client))
+			return -1;
+
+		bool keep_alive = false;
+		if (send_request(client, method, headers, body, size))
+			status = read_response(client, &keep_alive);
+
+		if (status < 0 || !keep_alive)
+			close_connection(client);
+
+		/* a fresh connection that fails is not worth retrying */
+		if (status >= 0 || !reused)
+			break;
+	}
+
+	if (status < 0)
+		warn("%s %s failed - %d", method, url, socket_error());
+	return status;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Minimal HTTP/1.1 client for uploading images.
+ *
+ * The parsed URL and the resolved address are cached, and the connection is
+ * kept alive between requests, so repeated uploads to the same endpoint only
+ * cost a request/response round trip.  A request that fails on a reused
+ * connection (usually because the server closed it while it was idle) is
+ * retried once on a new one.
+ *
+ * Only http:// URLs are supported.  A client must only be used by one thread
+ * at a time.
+ */
+
+/* size of the chunks bodies are sent in with chunked transfer encoding */
+#define HTTP_CLIENT_CHUNK_SIZE (256 * 1024)
+
+struct http_client;
+
+extern struct http_client *http_client_create(void);
+extern void http_client_destroy(struct http_client *client);
+
+/* bodies of at least threshold bytes are sent with chunked transfer encoding,
+ * 0 always sends a Content-Length */
+extern void http_client_set_chunk_threshold(struct http_client *client,
+					    size_t threshold);
+
+/* headers are extra "Name: value\r\n" lines and may be NULL.  returns the
+ * response status code, or -1 if no response was received */
+extern int http_client_request(struct http_client *client, const char *method,
+			       const char *url, const char *headers,
+			       const uint8_t *body, size_t size);
@@ -0,0 +1,713 @@
+#include "http-server.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <obs-module.h>
+#include <util/bmem.h>
+#include <util/dstr.h>
+#include <util/threading.h>
+
+#include "delta-frame.h"
+#include "frame-pool.h"
+#include "image-encoder.h"
+#include "pixel-format.h"
+
+#define do_log(level, format, ...) \
+	blog(level, "[screenshot-filter] " format, ##__VA_ARGS__)
+
+#define warn(format, ...) do_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define info(format, ...) do_log(LOG_INFO, format, ##__VA_ARGS__)
+
+#ifdef _WIN32
+typedef SOCKET socket_t;
+#define close_socket closesocket
+#define SHUT_RDWR SD_BOTH
+#define SEND_FLAGS 0
+#else
+typedef int socket_t;
+#define INVALID_SOCKET (-1)
+#define close_socket close
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+#endif
+
+#define TIMEOUT_MS 5000
+#define ACCEPT_POLL_MS 250
+#define MAX_REQUEST 4096
+#define BOUNDARY "screenshotframe"
+#define DELTA_CONTENT_TYPE "application/x-screenshot-delta"
+
+/* a published frame, shared by every client that sends it */
+struct shared_frame {
+	volatile long refs;
+	/* numbers the frames of a level, see http_server.seq */
+	uint64_t seq;
+	uint32_t index;
+	uint64_t timestamp;
+	uint64_t frame_number;
+
+	struct frame_buffer *buffer;
+	struct encoded_image image;
+	bool encoded;
+
+	uint8_t *delta;
+	size_t delta_size;
+	bool keyframe;
+};
+
+struct server_client {
+	struct http_server *server;
+	socket_t sock;
+	pthread_t thread;
+	bool active;
+	volatile bool done;
+
+	char request[MAX_REQUEST];
+	size_t request_len;
+};
+
+struct http_server {
+	pthread_mutex_t mutex;
+	pthread_cond_t frame_cond;
+	struct shared_frame *latest[IMAGE_MAX_LEVELS];
+	/* counted per level, so that a stream of level 0 can tell whether it
+	 * skipped a frame */
+	uint64_t seq[IMAGE_MAX_LEVELS];
+	volatile bool stopping;
+
+	socket_t listen_sock;
+	pthread_t accept_thread;
+	bool running;
+	int port;
+	bool local_only;
+
+	/* only touched by the accept thread while it is running */
+	struct server_client clients[HTTP_SERVER_MAX_CLIENTS];
+};
+
+/* ------------------------------------------------------------------------- */
+/* frames                                                                     */
+
+static void frame_release(struct shared_frame *frame)
+{
+	if (!frame || os_atomic_dec_long(&frame->refs) != 0)
+		return;
+
+	encoded_image_free(&frame->image);
+	frame_buffer_release(frame->buffer);
+	bfree(frame->delta);
+	bfree(frame);
+}
+
+static struct shared_frame *frame_addref(struct shared_frame *frame)
+{
+	if (frame)
+		os_atomic_inc_long(&frame->refs);
+	return frame;
+}
+
+static struct shared_frame *get_latest(struct http_server *server,
+				       uint32_t level)
+{
+	pthread_mutex_lock(&server->mutex);
+	struct shared_frame *frame = frame_addref(server->latest[level]);
+	pthread_mutex_unlock(&server->mutex);
+	return frame;
+}
+
+/* waits for a frame of level 0 newer than seq, returns NULL when the server
+ * stops */
+static struct shared_frame *wait_frame(struct http_server *server,
+				       uint64_t seq)
+{
+	struct shared_frame *frame = NULL;
+
+	pthread_mutex_lock(&server->mutex);
+	while (!server->stopping &&
+	       (!server->latest[0] || server->latest[0]->seq <= seq))
+		pthread_cond_wait(&server->frame_cond, &server->mutex);
+	if (!server->stopping)
+		frame = frame_addref(server->latest[0]);
+	pthread_mutex_unlock(&server->mutex);
+	return frame;
+}
+
+void http_server_publish(struct http_server *server, uint32_t level,
+			 struct frame_buffer *buffer,
+			 struct encoded_image *image, const uint8_t *delta,
+			 size_t delta_size, uint32_t index, uint64_t timestamp,
+			 uint64_t frame_number)
+{
+	if (!server || level >= IMAGE_MAX_LEVELS)
+		return;
+
+	if (!buffer) {
+		pthread_mutex_lock(&server->mutex);
+		struct shared_frame *old = server->latest[level];
+		server->latest[level] = NULL;
+		pthread_mutex_unlock(&server->mutex);
+
+		frame_release(old);
+		return;
+	}
+
+	struct shared_frame *frame = bzalloc(sizeof(struct shared_frame));
+	frame->refs = 1;
+	frame->index = index;
+	frame->timestamp = timestamp;
+	frame->frame_number = frame_number;
+	frame->buffer = frame_buffer_addref(buffer);
+	if (image) {
+		frame->image = *image;
+		frame->encoded = true;
+		memset(image, 0, sizeof(*image));
+	}
+	if (delta) {
+		const struct delta_frame_header *header =
+			delta_frame_get_header(delta, delta_size);
+		frame->delta = bmemdup(delta, delta_size);
+		frame->delta_size = delta_size;
+		frame->keyframe = header &&
+				  (header->flags & DELTA_FRAME_KEYFRAME) != 0;
+	}
+
+	pthread_mutex_lock(&server->mutex);
+	struct shared_frame *old = server->latest[level];
+	frame->seq = ++server->seq[level];
+	server->latest[level] = frame;
+	pthread_cond_broadcast(&server->frame_cond);
+	pthread_mutex_unlock(&server->mutex);
+
+	frame_release(old);
+}
+
+/* ------------------------------------------------------------------------- */
+/* responses                                                                  */
+
+static bool send_all(socket_t sock, const void *data, size_t size)
+{
+	const char *ptr = data;
+	while (size) {
+		int chunk = size > INT_MAX ? INT_MAX : (int)size;
+		int sent = send(sock, ptr, chunk, SEND_FLAGS);
+		if (sent <= 0)
+			return false;
+		ptr += sent;
+		size -= (size_t)sent;
+	}
+	return true;
+}
+
+static bool send_response(socket_t sock, const char *status,
+			  const char *content_type, const char *headers,
+			  const void *body, size_t size, bool keep_alive,
+			  bool head_only)
+{
+	struct dstr response = {0};
+	dstr_printf(&response,
+		    "HTTP/1.1 %s\r\n"
+		    "Content-Type: %s\r\n"
+		    "Content-Length: %llu\r\n"
+		    "Cache-Control: no-cache, no-store\r\n"
+		    "Access-Control-Allow-Origin: *\r\n"
+		    "Connection: %s\r\n",
+		    status, content_type, (unsigned long long)size,
+		    keep_alive ? "keep-alive" : "close");
+	if (headers)
+		dstr_cat(&response, headers);
+	dstr_cat(&response, "\r\n");
+
+	bool success = send_all(sock, response.array, response.len) &&
+		       (head_only || send_all(sock, body, size));
+	dstr_free(&response);
+	return success;
+}
+
+static bool send_error(socket_t sock, const char *status, bool keep_alive,
+		       bool head_only)
+{
+	return send_response(sock, status, "text/plain", NULL, status,
+			     strlen(status), keep_alive, head_only);
+}
+
+static bool send_index(socket_t sock, bool keep_alive, bool head_only)
+{
+	static const char index[] =
+		"<!DOCTYPE html><html><head><title>Screenshot Filter</title>"
+		"</head><body style=\"margin:0;background:#000\">"
+		"<img src=\"/stream\" style=\"max-width:100%\"></body></html>";
+	return send_response(sock, "200 OK", "text/html", NULL, index,
+			     sizeof(index) - 1, keep_alive, head_only);
+}
+
+static bool send_latest(socket_t sock, struct http_server *server,
+			uint32_t level, const char *extension, bool keep_alive,
+			bool head_only)
+{
+	struct shared_frame *frame = get_latest(server, level);
+	if (!frame)
+		return send_error(sock, "503 Service Unavailable", keep_alive,
+				  head_only);
+
+	struct frame_buffer *buffer = frame->buffer;
+	struct dstr headers = {0};
+	bool success;
+
+	dstr_printf(&headers,
+		    "Image-Width: %u\r\nImage-Height: %u\r\nImage-Index: %u\r\n"
+		    "Image-Timestamp: %llu\r\nImage-Frame: %llu\r\n",
+		    buffer->width, buffer->height, frame->index,
+		    (unsigned long long)frame->timestamp,
+		    (unsigned long long)frame->frame_number);
+
+	if (strcmp(extension, "raw") == 0) {
+		dstr_catf(&headers, "Image-Linesize: %u\r\nImage-Format: %s\r\n",
+			  buffer->linesize, pixel_format_name(buffer->format));
+		success = send_response(
+			sock, "200 OK", pixel_format_content_type(buffer->format),
+			headers.array, buffer->data, buffer->size, keep_alive,
+			head_only);
+	} else if (frame->encoded &&
+		   strcmp(extension, frame->image.extension) == 0) {
+		success = send_response(sock, "200 OK",
+					frame->image.content_type,
+					headers.array, frame->image.data,
+					frame->image.size, keep_alive,
+					head_only);
+	} else {
+		success = send_error(sock, "404 Not Found", keep_alive,
+				     head_only);
+	}
+
+	dstr_free(&headers);
+	frame_release(frame);
+	return success;
+}
+
+static bool send_part(socket_t sock, const char *content_type,
+		      const uint8_t *data, size_t size,
+		      const struct shared_frame *frame)
+{
+	char part[256];
+	int len = snprintf(part, sizeof(part),
+			   "--" BOUNDARY "\r\n"
+			   "Content-Type: %s\r\n"
+			   "Content-Length: %llu\r\n"
+			   "Image-Index: %u\r\n"
+			   "Image-Timestamp: %llu\r\n"
+			   "Image-Frame: %llu\r\n\r\n",
+			   content_type, (unsigned long long)size, frame->index,
+			   (unsigned long long)frame->timestamp,
+			   (unsigned long long)frame->frame_number);
+
+	return send_all(sock, part, len) && send_all(sock, data, size) &&
+	       send_all(sock, "\r\n", 2);
+}
+
+static void send_stream(socket_t sock, struct http_server *server,
+			bool deltas)
+{
+	static const char header[] =
+		"HTTP/1.1 200 OK\r\n"
+		"Content-Type: multipart/x-mixed-replace; boundary=" BOUNDARY
+		"\r\n"
+		"Cache-Control: no-cache, no-store\r\n"
+		"Access-Control-Allow-Origin: *\r\n"
+		"Connection: close\r\n\r\n";
+
+	if (!send_all(sock, header, sizeof(header) - 1))
+		return;
+
+	/* start with the current frame so the viewer shows something right
+	 * away, then send each newer frame.  frames published while a part is
+	 * being sent are skipped.  a delta stream has to wait for a keyframe
+	 * instead, at the start and whenever a frame was skipped */
+	struct shared_frame *frame = get_latest(server, 0);
+	uint64_t seq = 0;
+	bool synced = false;
+
+	for (;;) {
+		if (!frame)
+			frame = wait_frame(server, seq);
+		if (!frame)
+			break;
+
+		bool success = true;
+		if (deltas && frame->delta) {
+			synced = frame->keyframe ||
+				 (synced && frame->seq == seq + 1);
+			if (synced)
+				success = send_part(sock, DELTA_CONTENT_TYPE,
+						    frame->delta,
+						    frame->delta_size, frame);
+		} else if (!deltas && frame->encoded) {
+			success = send_part(sock, frame->image.content_type,
+					    frame->image.data,
+					    frame->image.size, frame);
+		}
+
+		seq = frame->seq;
+		frame_release(frame);
+		frame = NULL;
+		if (!success)
+			break;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* clients                                                                    */
+
+/* reads the next request head into client->request, returns its length */
+static size_t read_request(struct server_client *client)
+{
+	for (;;) {
+		client->request[client->request_len] = 0;
+		char *end = strstr(client->request, "\r\n\r\n");
+		if (end)
+			return end + 4 - client->request;
+
+		size_t space = MAX_REQUEST - 1 - client->request_len;
+		if (!space)
+			return 0;
+
+		int received = recv(client->sock,
+				    client->request + client->request_len,
+				    (int)space, 0);
+		if (received <= 0)
+			return 0;
+		client->request_len += (size_t)received;
+	}
+}
+
+static bool has_token(const char *request, const char *header,
+		      const char *token)
+{
+	const char *line = request;
+	size_t len = strlen(header);
+
+	while ((line = strstr(line, "\r\n")) != NULL) {
+		line += 2;
+		if (astrcmpi_n(line, header, len) == 0 && line[len] == ':') {
+			const char *end = strstr(line, "\r\n");
+			size_t token_len = strlen(token);
+			for (const char *p = line + len + 1;
+			     end && p + token_len <= end; p++) {
+				if (astrcmpi_n(p, token, token_len) == 0)
+					return true;
+			}
+			return false;
+		}
+	}
+	return false;
+}
+
+/* parses /latest<level suffix>.<extension> */
+static bool parse_latest(const char *path, uint32_t *level,
+			 const char **extension)
+{
+	if (strncmp(path, "/latest", 7) != 0)
+		return false;
+	path += 7;
+
+	for (uint32_t i = 0; i < IMAGE_MAX_LEVELS; i++) {
+		const char *suffix = image_level_suffix(i);
+		size_t len = strlen(suffix);
+		if (strncmp(path, suffix, len) == 0 && path[len] == '.') {
+			*level = i;
+			*extension = path + len + 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void *client_thread(void *data)
+{
+	struct server_client *client = data;
+	struct http_server *server = client->server;
+
+	os_set_thread_name("screenshot-filter: http client");
+
+	for (;;) {
+		size_t len = read_request(client);
+		if (!len)
+			break;
+
+		char method[8] = {0};
+		char path[256] = {0};
+		int minor = 0;
+		if (sscanf(client->request, "%7s %255s HTTP/1.%d", method,
+			   path, &minor) != 3) {
+			send_error(client->sock, "400 Bad Request", false,
+				   false);
+			break;
+		}
+
+		bool keep_alive =
+			minor >= 1
+				? !has_token(client->request, "Connection",
+					     "close")
+				: has_token(client->request, "Connection",
+					    "keep-alive");
+		bool head_only = strcmp(method, "HEAD") == 0;
+
+		/* keep anything pipelined after this request */
+		memmove(client->request, client->request + len,
+			client->request_len - len);
+		client->request_len -= len;
+
+		char *query = strchr(path, '?');
+		if (query)
+			*query = 0;
+
+		uint32_t level;
+		const char *extension;
+		bool success;
+		if (!head_only && strcmp(method, "GET") != 0) {
+			success = send_error(client->sock,
+					     "405 Method Not Allowed",
+					     keep_alive, false);
+		} else if (strcmp(path, "/") == 0) {
+			success = send_index(client->sock, keep_alive,
+					     head_only);
+		} else if (parse_latest(path, &level, &extension)) {
+			success = send_latest(client->sock, server, level,
+					      extension, keep_alive, head_only);
+		} else if (strcmp(path, "/stream") == 0 && !head_only) {
+			send_stream(client->sock, server, false);
+			break;
+		} else if (strcmp(path, "/stream.delta") == 0 && !head_only) {
+			send_stream(client->sock, server, true);
+			break;
+		} else {
+			success = send_error(client->sock, "404 Not Found",
+					     keep_alive, head_only);
+		}
+
+		if (!success || !keep_alive)
+			break;
+	}
+
+	os_atomic_set_bool(&client->done, true);
+	return NULL;
+}
+
+static void join_client(struct server_client *client)
+{
+	pthread_join(client->thread, NULL);
+	close_socket(client->sock);
+	client->sock = INVALID_SOCKET;
+	client->active = false;
+}
+
+static void accept_client(struct http_server *server, socket_t sock)
+{
+	struct server_client *client = NULL;
+
+	for (size_t i = 0; i < HTTP_SERVER_MAX_CLIENTS; i++) {
+		if (!server->clients[i].active) {
+			client = &server->clients[i];
+			break;
+		}
+	}
+	if (!client) {
+		send_error(sock, "503 Service Unavailable", false, false);
+		close_socket(sock);
+		return;
+	}
+
+#ifdef _WIN32
+	DWORD timeout = TIMEOUT_MS;
+#else
+	struct timeval timeout = {TIMEOUT_MS / 1000,
+				  (TIMEOUT_MS % 1000) * 1000};
+#endif
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout,
+		   sizeof(timeout));
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout,
+		   sizeof(timeout));
+	int nodelay = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&nodelay,
+		   sizeof(nodelay));
+#ifdef SO_NOSIGPIPE
+	int one = 1;
+	setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+	client->server = server;
+	client->sock = sock;
+	client->done = false;
+	client->request_len = 0;
+	if (pthread_create(&client->thread, NULL, client_thread, client) != 0) {
+		close_socket(sock);
+		client->sock = INVALID_SOCKET;
+		return;
+	}
+	client->active = true;
+}
+
+static void *accept_thread(void *data)
+{
+	struct http_server *server = data;
+
+	os_set_thread_name("screenshot-filter: http server");
+
+	while (!os_atomic_load_bool(&server->stopping)) {
+		fd_set read_set;
+		struct timeval timeout = {0, ACCEPT_POLL_MS * 1000};
+
+		FD_ZERO(&read_set);
+		FD_SET(server->listen_sock, &read_set);
+		int ready = select((int)server->listen_sock + 1, &read_set,
+				   NULL, NULL, &timeout);
+
+		for (size_t i = 0; i < HTTP_SERVER_MAX_CLIENTS; i++) {
+			struct server_client *client = &server->clients[i];
+			if (client->active &&
+			    os_atomic_load_bool(&client->done))
+				join_client(client);
+		}
+
+		if (ready <= 0)
+			continue;
+
+		socket_t sock = accept(server->listen_sock, NULL, NULL);
+		if (sock != INVALID_SOCKET)
+			accept_client(server, sock);
+	}
+
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct http_server *http_server_create(void)
+{
+#ifdef _WIN32
+	WSADATA wsa_data;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+		warn("WSAStartup failed");
+		return NULL;
+	}
+#endif
+	struct http_server *server = bzalloc(sizeof(struct http_server));
+	pthread_mutex_init(&server->mutex, NULL);
+	pthread_cond_init(&server->frame_cond, NULL);
+	server->listen_sock = INVALID_SOCKET;
+	for (size_t i = 0; i < HTTP_SERVER_MAX_CLIENTS; i++)
+		server->clients[i].sock = INVALID_SOCKET;
+	return server;
+}
+
+void http_server_destroy(struct http_server *server)
+{
+	if (!server)
+		return;
+
+	http_server_stop(server);
+	for (size_t i = 0; i < IMAGE_MAX_LEVELS; i++)
+		frame_release(server->latest[i]);
+	pthread_cond_destroy(&server->frame_cond);
+	pthread_mutex_destroy(&server->mutex);
+	bfree(server);
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+bool http_server_start(struct http_server *server, int port, bool local_only)
+{
+	if (!server)
+		return false;
+	if (server->running && server->port == port &&
+	    server->local_only == local_only)
+		return true;
+
+	http_server_stop(server);
+
+	socket_t sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (sock == INVALID_SOCKET) {
+		warn("Failed to create server socket");
+		return false;
+	}
+
+#ifndef _WIN32
+	/* allows restarting on the same port while old connections linger */
+	int reuse = 1;
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+#endif
+
+	struct sockaddr_in addr = {0};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)port);
+	addr.sin_addr.s_addr = htonl(local_only ? INADDR_LOOPBACK : INADDR_ANY);
+
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    listen(sock, 16) != 0) {
+		warn("Failed to listen on port %d", port);
+		close_socket(sock);
+		return false;
+	}
+
+	server->listen_sock = sock;
+	server->port = port;
+	server->local_only = local_only;
+	server->stopping = false;
+	if (pthread_create(&server->accept_thread, NULL, accept_thread,
+			   server) != 0) {
+		close_socket(sock);
+		server->listen_sock = INVALID_SOCKET;
+		return false;
+	}
+
+	server->running = true;
+	info("Serving frames on http://%s:%d/",
+	     local_only ? "127.0.0.1" : "0.0.0.0", port);
+	return true;
+}
+
+void http_server_stop(struct http_server *server)
+{
+	if (!server || !server->running)
+		return;
+
+	pthread_mutex_lock(&server->mutex);
+	os_atomic_set_bool(&server->stopping, true);
+	pthread_cond_broadcast(&server->frame_cond);
+	pthread_mutex_unlock(&server->mutex);
+
+	pthread_join(server->accept_thread, NULL);
+
+	/* wakes clients blocked in recv or send */
+	for (size_t i = 0; i < HTTP_SERVER_MAX_CLIENTS; i++) {
+		if (server->clients[i].active)
+			shutdown(server->clients[i].sock, SHUT_RDWR);
+	}
+	for (size_t i = 0; i < HTTP_SERVER_MAX_CLIENTS; i++) {
+		if (server->clients[i].active)
+			join_client(&server->clients[i]);
+	}
+
+	close_socket(server->listen_sock);
+	server->listen_sock = INVALID_SOCKET;
+	server->running = false;
+	info("Stopped serving frames on port %d", server->port);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Embedded HTTP server that serves the latest frame to any number of
+ * clients:
+ *
+ *   /latest.<ext>  the latest encoded image, e.g. /latest.png
+ *   /latest.raw    the latest raw frame, with Image-Width, Image-Height,
+ *                  Image-Linesize and Image-Format headers
+ *   /latest-half.<ext>, /latest-quarter.<ext>, /latest-eighth.<ext>
+ *                  the levels of a thumbnail pyramid
+ *   /stream        multipart/x-mixed-replace stream of encoded images, an
+ *                  MJPEG stream when the images are JPEG
+ *   /stream.delta  multipart stream of delta frames (delta-frame.h), starting
+ *                  at the next keyframe
+ *
+ * Published frames are shared by reference between all clients, nothing is
+ * encoded or copied per client.  Each client is served by its own thread, a
+ * slow stream client skips frames instead of holding anyone else up.
+ */
+
+#define HTTP_SERVER_MAX_CLIENTS 32
+
+struct http_server;
+struct frame_buffer;
+struct encoded_image;
+
+extern struct http_server *http_server_create(void);
+extern void http_server_destroy(struct http_server *server);
+
+/* (re)starts listening, does nothing if already listening on this port */
+extern bool http_server_start(struct http_server *server, int port,
+			      bool local_only);
+/* stops listening and disconnects all clients */
+extern void http_server_stop(struct http_server *server);
+
+/* takes a reference to buffer and takes ownership of image, which may be
+ * NULL if the frame was not encoded.  delta is copied and may be NULL.
+ * level is the pyramid level, streams only send level 0.  publishing a NULL
+ * buffer removes the level.  index, timestamp and frame_number are sent as
+ * the Image-Index, Image-Timestamp and Image-Frame headers */
+extern void http_server_publish(struct http_server *server, uint32_t level,
+				struct frame_buffer *buffer,
+				struct encoded_image *image,
+				const uint8_t *delta, size_t delta_size,
+				uint32_t index, uint64_t timestamp,
+				uint64_t frame_number);
@@ -0,0 +1,463 @@
+#include "image-encoder.h"
+
+#include <obs-module.h>
+#include <util/bmem.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+
+#define do_log(level, format, ...) \
+	blog(level, "[screenshot-filter] " format, ##__VA_ARGS__)
+
+#define warn(format, ...) do_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define info(format, ...) do_log(LOG_INFO, format, ##__VA_ARGS__)
+
+#define ENCODER_CACHE_SIZE 4
+#define SCALER_CACHE_SIZE 4
+
+struct codec_info {
+	const char *encoder;
+	enum AVPixelFormat pix_fmt;
+	const char *content_type;
+	const char *extension;
+};
+
+static const struct codec_info codecs[] = {
+	[IMAGE_CODEC_PNG] = {"png", AV_PIX_FMT_RGBA, "image/png", "png"},
+	[IMAGE_CODEC_QOI] = {"qoi", AV_PIX_FMT_RGBA, "image/qoi", "qoi"},
+	[IMAGE_CODEC_JPEG] = {"mjpeg", AV_PIX_FMT_YUVJ420P, "image/jpeg",
+			      "jpg"},
+	/* libwebp takes AV_PIX_FMT_RGB32, which is BGRA in memory */
+	[IMAGE_CODEC_WEBP_LOSSLESS] = {"libwebp", AV_PIX_FMT_BGRA,
+				       "image/webp", "webp"},
+};
+
+#define NUM_CODECS (sizeof(codecs) / sizeof(codecs[0]))
+
+struct encoder_context {
+	struct image_codec_settings settings;
+	uint32_t width;
+	uint32_t height;
+	uint64_t last_used;
+
+	AVCodecContext *codec_context;
+	AVFrame *frame;
+
+	/* only used by codecs that don't take RGBA */
+	struct SwsContext *sws;
+	AVFrame *converted;
+};
+
+struct scaler_context {
+	uint32_t src_width;
+	uint32_t src_height;
+	uint32_t dst_width;
+	uint32_t dst_height;
+	uint64_t last_used;
+
+	struct SwsContext *sws;
+};
+
+/* contexts are cached by their settings and sizes, a miss replaces the least
+ * recently used one, so that alternating between a few sizes or codecs does
+ * not recreate them every frame */
+struct image_encoder {
+	struct encoder_context contexts[ENCODER_CACHE_SIZE];
+	struct scaler_context scalers[SCALER_CACHE_SIZE];
+	uint64_t uses;
+};
+
+static const char *level_suffixes[IMAGE_MAX_LEVELS] = {
+	"",
+	"-half",
+	"-quarter",
+	"-eighth",
+};
+
+void image_codec_settings_init(struct image_codec_settings *settings)
+{
+	settings->codec = IMAGE_CODEC_PNG;
+	settings->level = 6;
+	settings->png_prediction = IMAGE_PNG_PRED_NONE;
+	settings->jpeg_quality = 90;
+}
+
+bool image_codec_available(enum image_codec codec)
+{
+	if ((size_t)codec >= NUM_CODECS)
+		return false;
+	return avcodec_find_encoder_by_name(codecs[codec].encoder) != NULL;
+}
+
+/* clears the settings that don't apply to the codec so that they don't cause
+ * cache misses */
+static void normalize_settings(struct image_codec_settings *dst,
+			       const struct image_codec_settings *src)
+{
+	memset(dst, 0, sizeof(*dst));
+	dst->codec = src->codec;
+
+	switch (src->codec) {
+	case IMAGE_CODEC_PNG:
+		dst->level = src->level;
+		dst->png_prediction = src->png_prediction;
+		break;
+	case IMAGE_CODEC_WEBP_LOSSLESS:
+		dst->level = src->level;
+		break;
+	case IMAGE_CODEC_JPEG:
+		dst->jpeg_quality = src->jpeg_quality;
+		break;
+	case IMAGE_CODEC_QOI:
+		break;
+	}
+}
+
+static void free_context(struct encoder_context *ctx)
+{
+	if (ctx->converted)
+		av_frame_free(&ctx->converted);
+	if (ctx->sws)
+		sws_freeContext(ctx->sws);
+	if (ctx->frame)
+		av_frame_free(&ctx->frame);
+	if (ctx->codec_context) {
+		avcodec_close(ctx->codec_context);
+		avcodec_free_context(&ctx->codec_context);
+	}
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+static void set_codec_options(AVCodecContext *codec_context,
+			      const struct image_codec_settings *settings,
+			      AVDictionary **opts)
+{
+	int level = settings->level < 0 ? 0
+					: (settings->level > 9 ? 9
+							       : settings->level);
+
+	switch (settings->codec) {
+	case IMAGE_CODEC_PNG:
+		codec_context->compression_level = level;
+		av_dict_set_int(opts, "pred", settings->png_prediction, 0);
+		break;
+	case IMAGE_CODEC_JPEG: {
+		int quality = settings->jpeg_quality < 1 ? 1
+			      : settings->jpeg_quality > 100
+				      ? 100
+				      : settings->jpeg_quality;
+		/* map quality 1-100 onto qscale 31-1 */
+		int qscale = 1 + (100 - quality) * 30 / 99;
+		codec_context->flags |= AV_CODEC_FLAG_QSCALE;
+		codec_context->global_quality = FF_QP2LAMBDA * qscale;
+		codec_context->qmin = 1;
+		codec_context->qmax = 31;
+		codec_context->color_range = AVCOL_RANGE_JPEG;
+		break;
+	}
+	case IMAGE_CODEC_WEBP_LOSSLESS:
+		av_dict_set_int(opts, "lossless", 1, 0);
+		/* in lossless mode quality is the compression effort */
+		av_dict_set_int(opts, "quality", level * 100 / 9, 0);
+		codec_context->compression_level = level * 6 / 9;
+		break;
+	case IMAGE_CODEC_QOI:
+		break;
+	}
+}
+
+static bool init_context(struct encoder_context *ctx,
+			 const struct image_codec_settings *settings,
+			 uint32_t width, uint32_t height)
+{
+	const struct codec_info *info = &codecs[settings->codec];
+	AVDictionary *opts = NULL;
+
+	const AVCodec *codec = avcodec_find_encoder_by_name(info->encoder);
+	if (codec == NULL) {
+		warn("%s encoder not found", info->encoder);
+		return false;
+	}
+
+	ctx->codec_context = avcodec_alloc_context3(codec);
+	if (ctx->codec_context == NULL)
+		goto fail;
+
+	ctx->codec_context->bit_rate = 400000;
+	ctx->codec_context->width = width;
+	ctx->codec_context->height = height;
+	ctx->codec_context->time_base = (AVRational){1, 25};
+	ctx->codec_context->pix_fmt = info->pix_fmt;
+	set_codec_options(ctx->codec_context, settings, &opts);
+
+	int ret = avcodec_open2(ctx->codec_context, codec, &opts);
+	av_dict_free(&opts);
+	if (ret != 0) {
+		avcodec_free_context(&ctx->codec_context);
+		goto fail;
+	}
+
+	ctx->frame = av_frame_alloc();
+	if (ctx->frame == NULL)
+		goto fail;
+
+	ctx->frame->format = AV_PIX_FMT_RGBA;
+	ctx->frame->width = width;
+	ctx->frame->height = height;
+
+	if (info->pix_fmt != AV_PIX_FMT_RGBA) {
+		ctx->sws = sws_getContext(width, height, AV_PIX_FMT_RGBA, width,
+					  height, info->pix_fmt,
+					  SWS_BILINEAR, NULL, NULL, NULL);
+		ctx->converted = av_frame_alloc();
+		if (ctx->sws == NULL || ctx->converted == NULL)
+			goto fail;
+
+		ctx->converted->format = info->pix_fmt;
+		ctx->converted->width = width;
+		ctx->converted->height = height;
+		if (av_frame_get_buffer(ctx->converted, 32) < 0)
+			goto fail;
+	}
+
+	ctx->settings = *settings;
+	ctx->width = width;
+	ctx->height = height;
+	info("Created %s encoder context %ux%u", info->encoder, width, height);
+	return true;
+
+fail:
+	warn("Failed to create %s encoder context %ux%u", info->encoder, width,
+	     height);
+	free_context(ctx);
+	return false;
+}
+
+/* returns the encoder context for these settings and resolution */
+static struct encoder_context *
+get_context(struct image_encoder *encoder,
+	    const struct image_codec_settings *settings, uint32_t width,
+	    uint32_t height)
+{
+	struct encoder_context *lru = &encoder->contexts[0];
+
+	for (size_t i = 0; i < ENCODER_CACHE_SIZE; i++) {
+		struct encoder_context *ctx = &encoder->contexts[i];
+		if (ctx->codec_context && ctx->width == width &&
+		    ctx->height == height &&
+		    memcmp(&ctx->settings, settings, sizeof(*settings)) == 0) {
+			ctx->last_used = ++encoder->uses;
+			return ctx;
+		}
+		if (ctx->last_used < lru->last_used)
+			lru = ctx;
+	}
+
+	free_context(lru);
+	if (!init_context(lru, settings, width, height))
+		return NULL;
+
+	lru->last_used = ++encoder->uses;
+	return lru;
+}
+
+static void free_nothing(void *opaque, uint8_t *data)
+{
+	UNUSED_PARAMETER(opaque);
+	UNUSED_PARAMETER(data);
+}
+
+struct image_encoder *image_encoder_create(void)
+{
+	return bzalloc(sizeof(struct image_encoder));
+}
+
+void image_encoder_destroy(struct image_encoder *encoder)
+{
+	if (!encoder)
+		return;
+
+	for (size_t i = 0; i < ENCODER_CACHE_SIZE; i++)
+		free_context(&encoder->contexts[i]);
+	for (size_t i = 0; i < SCALER_CACHE_SIZE; i++)
+		sws_freeContext(encoder->scalers[i].sws);
+	bfree(encoder);
+}
+
+// code adapted from https://github.com/obsproject/obs-studio/pull/1269 and https://stackoverflow.com/a/12563019
+bool image_encoder_encode(struct image_encoder *encoder,
+			  const struct image_codec_settings *settings,
+			  const uint8_t *image_data,
+			  uint32_t image_data_linesize, uint32_t width,
+			  uint32_t height, struct encoded_image *out)
+{
+	struct image_codec_settings key;
+	int ret;
+
+	if (encoder == NULL || image_data == NULL ||
+	    (size_t)settings->codec >= NUM_CODECS)
+		return false;
+
+	normalize_settings(&key, settings);
+	struct encoder_context *ctx = get_context(encoder, &key, width, height);
+	if (ctx == NULL)
+		return false;
+
+	AVFrame *frame = ctx->frame;
+	AVPacket *pkt = av_packet_alloc();
+	if (pkt == NULL)
+		return false;
+
+	/* wrap the caller's buffer in a non-owning reference so that the
+	 * encoder does not take its own copy of a non-refcounted frame */
+	frame->buf[0] = av_buffer_create((uint8_t *)image_data,
+					 (size_t)image_data_linesize * height,
+					 free_nothing, NULL, 0);
+	if (frame->buf[0] == NULL) {
+		av_packet_free(&pkt);
+		return false;
+	}
+
+	frame->data[0] = (uint8_t *)image_data;
+	frame->linesize[0] = (int)image_data_linesize;
+
+	if (ctx->converted) {
+		ret = av_frame_make_writable(ctx->converted);
+		if (ret >= 0)
+			sws_scale(ctx->sws, (const uint8_t *const *)frame->data,
+				  frame->linesize, 0, height,
+				  ctx->converted->data,
+				  ctx->converted->linesize);
+		av_buffer_unref(&frame->buf[0]);
+		frame->data[0] = NULL;
+		frame = ctx->converted;
+
+		if (ret < 0)
+			goto finish;
+	}
+
+	frame->pts = 1;
+	frame->quality = ctx->codec_context->global_quality;
+
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(57, 40, 101)
+	int got_output = 0;
+	ret = avcodec_encode_video2(ctx->codec_context, pkt, frame,
+				    &got_output);
+	if (ret == 0 && !got_output)
+		ret = AVERROR(EAGAIN);
+#else
+	ret = avcodec_send_frame(ctx->codec_context, frame);
+	if (ret >= 0)
+		ret = avcodec_receive_packet(ctx->codec_context, pkt);
+#endif
+
+finish:
+	if (frame == ctx->frame) {
+		av_buffer_unref(&frame->buf[0]);
+		frame->data[0] = NULL;
+	}
+
+	if (ret < 0) {
+		warn("Failed to encode %ux%u image: %d", width, height, ret);
+		/* the context may be left in a bad state, rebuild it next
+		 * time */
+		free_context(ctx);
+		av_packet_free(&pkt);
+		return false;
+	}
+
+	out->data = pkt->data;
+	out->size = (size_t)pkt->size;
+	out->content_type = codecs[key.codec].content_type;
+	out->extension = codecs[key.codec].extension;
+	out->packet = pkt;
+	return true;
+}
+
+void encoded_image_free(struct encoded_image *image)
+{
+	AVPacket *pkt = image->packet;
+	if (pkt)
+		av_packet_free(&pkt);
+	memset(image, 0, sizeof(*image));
+}
+
+/* returns the scaling context for these sizes */
+static struct SwsContext *get_scaler(struct image_encoder *encoder,
+				     uint32_t src_width, uint32_t src_height,
+				     uint32_t dst_width, uint32_t dst_height)
+{
+	struct scaler_context *lru = &encoder->scalers[0];
+
+	for (size_t i = 0; i < SCALER_CACHE_SIZE; i++) {
+		struct scaler_context *ctx = &encoder->scalers[i];
+		if (ctx->sws && ctx->src_width == src_width &&
+		    ctx->src_height == src_height &&
+		    ctx->dst_width == dst_width &&
+		    ctx->dst_height == dst_height) {
+			ctx->last_used = ++encoder->uses;
+			return ctx->sws;
+		}
+		if (ctx->last_used < lru->last_used)
+			lru = ctx;
+	}
+
+	sws_freeContext(lru->sws);
+	memset(lru, 0, sizeof(*lru));
+
+	/* area averaging is both the cheapest and the best looking filter
+	 * for downscaling, which is what this is used for */
+	lru->sws = sws_getContext(src_width, src_height, AV_PIX_FMT_RGBA,
+				  dst_width, dst_height, AV_PIX_FMT_RGBA,
+				  SWS_AREA, NULL, NULL, NULL);
+	if (lru->sws == NULL) {
+		warn("Failed to create scaler %ux%u -> %ux%u", src_width,
+		     src_height, dst_width, dst_height);
+		return NULL;
+	}
+
+	lru->src_width = src_width;
+	lru->src_height = src_height;
+	lru->dst_width = dst_width;
+	lru->dst_height = dst_height;
+	lru->last_used = ++encoder->uses;
+	return lru->sws;
+}
+
+bool image_encoder_scale(struct image_encoder *encoder, const uint8_t *src,
+			 uint32_t src_linesize, uint32_t src_width,
+			 uint32_t src_height, uint8_t *dst,
+			 uint32_t dst_linesize, uint32_t dst_width,
+			 uint32_t dst_height)
+{
+	if (encoder == NULL || !src_width || !src_height || !dst_width ||
+	    !dst_height)
+		return false;
+
+	struct SwsContext *sws = get_scaler(encoder, src_width, src_height,
+					    dst_width, dst_height);
+	if (sws == NULL)
+		return false;
+
+	const uint8_t *src_data[4] = {src};
+	const int src_linesizes[4] = {(int)src_linesize};
+	uint8_t *dst_data[4] = {dst};
+	const int dst_linesizes[4] = {(int)dst_linesize};
+
+	return sws_scale(sws, src_data, src_linesizes, 0, (int)src_height,
+			 dst_data, dst_linesizes) == (int)dst_height;
+}
+
+void image_level_size(uint32_t width, uint32_t height, uint32_t level,
+		      uint32_t *level_width, uint32_t *level_height)
+{
+	*level_width = width >> level ? width >> level : 1;
+	*level_height = height >> level ? height >> level : 1;
+}
+
+const char *image_level_suffix(uint32_t level)
+{
+	return level < IMAGE_MAX_LEVELS ? level_suffixes[level] : "";
+}
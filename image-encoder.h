@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Image encoder that keeps its codec contexts and frames alive
+ * between calls.  Contexts are cached per codec settings and resolution, so a
+ * filter that keeps capturing at the same size never reopens the codec.  The
+ * caller's RGBA buffer is wrapped by the frame with its own linesize instead
+ * of being repacked; codecs that need a different pixel format convert it
+ * into a frame that is kept in the cache as well.
+ *
+ * The encoder also downscales RGBA images with swscale, caching a scaling
+ * context per source and destination size the same way.
+ *
+ * An encoder must only be used by one thread at a time, but the images it
+ * returns own their data and may be passed to other threads.
+ */
+
+enum image_codec {
+	IMAGE_CODEC_PNG,
+	IMAGE_CODEC_QOI,
+	IMAGE_CODEC_JPEG,
+	IMAGE_CODEC_WEBP_LOSSLESS,
+};
+
+/* PNG row filters, in the order of the png encoder's "pred" option */
+enum image_png_prediction {
+	IMAGE_PNG_PRED_NONE,
+	IMAGE_PNG_PRED_SUB,
+	IMAGE_PNG_PRED_UP,
+	IMAGE_PNG_PRED_AVG,
+	IMAGE_PNG_PRED_PAETH,
+	IMAGE_PNG_PRED_MIXED,
+};
+
+struct image_codec_settings {
+	enum image_codec codec;
+	/* zlib level for PNG, compression effort for lossless WebP, 0-9 */
+	int level;
+	enum image_png_prediction png_prediction;
+	/* 1-100 */
+	int jpeg_quality;
+};
+
+/* a scaled image plus its half, quarter and eighth size levels */
+#define IMAGE_MAX_LEVELS 4
+
+struct image_encoder;
+
+struct encoded_image {
+	const uint8_t *data;
+	size_t size;
+	const char *content_type;
+	const char *extension;
+
+	/* owns data, released with encoded_image_free() */
+	void *packet;
+};
+
+extern void image_codec_settings_init(struct image_codec_settings *settings);
+extern bool image_codec_available(enum image_codec codec);
+
+extern struct image_encoder *image_encoder_create(void);
+extern void image_encoder_destroy(struct image_encoder *encoder);
+
+extern bool image_encoder_encode(struct image_encoder *encoder,
+				 const struct image_codec_settings *settings,
+				 const uint8_t *image_data,
+				 uint32_t image_data_linesize, uint32_t width,
+				 uint32_t height, struct encoded_image *out);
+extern void encoded_image_free(struct encoded_image *image);
+
+/* scales an RGBA image into dst, averaging the source pixels that map to
+ * each destination pixel */
+extern bool image_encoder_scale(struct image_encoder *encoder,
+				const uint8_t *src, uint32_t src_linesize,
+				uint32_t src_width, uint32_t src_height,
+				uint8_t *dst, uint32_t dst_linesize,
+				uint32_t dst_width, uint32_t dst_height);
+
+/* size of pyramid level, each level is half the size of the one before */
+extern void image_level_size(uint32_t width, uint32_t height, uint32_t level,
+			     uint32_t *level_width, uint32_t *level_height);
+/* appended to output names of a pyramid level, "" for the first level */
+extern const char *image_level_suffix(uint32_t level);
@@ -0,0 +1,463 @@
+#include "pixel-format.h"
+
+#include <string.h>
+
+#include <util/threading.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define PIXEL_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define AVX2_FUNC
+#else
+#define AVX2_FUNC __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define PIXEL_NEON
+#include <arm_neon.h>
+#endif
+
+/* BT.601 coefficients scaled by 256 */
+#define GRAY_R 77
+#define GRAY_G 150
+#define GRAY_B 29
+
+#define Y_R 66
+#define Y_G 129
+#define Y_B 25
+#define Y_OFFSET 16
+
+const char *pixel_format_name(enum pixel_format format)
+{
+	switch (format) {
+	case PIXEL_FORMAT_RGBA:
+		return "RGBA";
+	case PIXEL_FORMAT_BGRA:
+		return "BGRA";
+	case PIXEL_FORMAT_RGB24:
+		return "RGB24";
+	case PIXEL_FORMAT_GRAY8:
+		return "GRAY8";
+	case PIXEL_FORMAT_YUV420:
+		return "YUV420";
+	}
+	return "unknown";
+}
+
+const char *pixel_format_content_type(enum pixel_format format)
+{
+	switch (format) {
+	case PIXEL_FORMAT_RGBA:
+		return "image/rgba32";
+	case PIXEL_FORMAT_BGRA:
+		return "image/bgra32";
+	case PIXEL_FORMAT_RGB24:
+		return "image/rgb24";
+	case PIXEL_FORMAT_GRAY8:
+		return "image/gray8";
+	case PIXEL_FORMAT_YUV420:
+		return "image/yuv420p";
+	}
+	return "application/octet-stream";
+}
+
+uint32_t pixel_format_bytes_per_pixel(enum pixel_format format)
+{
+	switch (format) {
+	case PIXEL_FORMAT_RGBA:
+	case PIXEL_FORMAT_BGRA:
+		return 4;
+	case PIXEL_FORMAT_RGB24:
+		return 3;
+	case PIXEL_FORMAT_GRAY8:
+		return 1;
+	case PIXEL_FORMAT_YUV420:
+		return 0;
+	}
+	return 0;
+}
+
+uint32_t pixel_format_linesize(enum pixel_format format, uint32_t width)
+{
+	uint32_t bpp = pixel_format_bytes_per_pixel(format);
+	return bpp ? width * bpp : width;
+}
+
+size_t pixel_format_size(enum pixel_format format, uint32_t width,
+			 uint32_t height)
+{
+	size_t size = (size_t)pixel_format_linesize(format, width) * height;
+	if (format == PIXEL_FORMAT_YUV420)
+		size += (size_t)((width + 1) / 2) * ((height + 1) / 2) * 2;
+	return size;
+}
+
+/* ------------------------------------------------------------------------- */
+/* scalar row kernels, also used for the ends of rows                         */
+
+static void bgra_row_c(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+	for (uint32_t x = 0; x < width; x++, src += 4, dst += 4) {
+		dst[0] = src[2];
+		dst[1] = src[1];
+		dst[2] = src[0];
+		dst[3] = src[3];
+	}
+}
+
+static void rgb24_row_c(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+	for (uint32_t x = 0; x < width; x++, src += 4, dst += 3) {
+		dst[0] = src[0];
+		dst[1] = src[1];
+		dst[2] = src[2];
+	}
+}
+
+static void luma_row_c(const uint8_t *src, uint8_t *dst, uint32_t width,
+		       int cr, int cg, int cb, int offset)
+{
+	for (uint32_t x = 0; x < width; x++, src += 4)
+		dst[x] = (uint8_t)(((src[0] * cr + src[1] * cg + src[2] * cb +
+				     128) >>
+				    8) +
+				   offset);
+}
+
+/* ------------------------------------------------------------------------- */
+/* SSE2 / AVX2                                                                */
+
+#ifdef PIXEL_X86
+
+static void bgra_row_sse2(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+	const __m128i rb_mask = _mm_set1_epi32(0x00FF00FF);
+	uint32_t x = 0;
+
+	for (; x + 4 <= width; x += 4) {
+		__m128i px = _mm_loadu_si128((const __m128i *)(src + x * 4));
+		__m128i rb = _mm_and_si128(px, rb_mask);
+		__m128i ga = _mm_andnot_si128(rb_mask, px);
+		rb = _mm_or_si128(_mm_slli_epi32(rb, 16),
+				  _mm_srli_epi32(rb, 16));
+		_mm_storeu_si128((__m128i *)(dst + x * 4),
+				 _mm_or_si128(rb, ga));
+	}
+	bgra_row_c(src + x * 4, dst + x * 4, width - x);
+}
+
+/* weighted sums of 4 RGBA pixels, (sum + 128) >> 8 in each 32 bit lane */
+static inline __m128i luma4_sse2(__m128i px, __m128i coef)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), coef);
+	__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), coef);
+
+	/* lo and hi hold R*cr + G*cg and B*cb for two pixels each */
+	__m128 even = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi),
+				     _MM_SHUFFLE(2, 0, 2, 0));
+	__m128 odd = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi),
+				    _MM_SHUFFLE(3, 1, 3, 1));
+	__m128i sum = _mm_add_epi32(_mm_castps_si128(even),
+				    _mm_castps_si128(odd));
+	return _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(128)), 8);
+}
+
+static void luma_row_sse2(const uint8_t *src, uint8_t *dst, uint32_t width,
+			  int cr, int cg, int cb, int offset)
+{
+	const __m128i coef = _mm_setr_epi16((short)cr, (short)cg, (short)cb, 0,
+					    (short)cr, (short)cg, (short)cb, 0);
+	const __m128i off = _mm_set1_epi16((short)offset);
+	uint32_t x = 0;
+
+	for (; x + 8 <= width; x += 8) {
+		__m128i s0 = luma4_sse2(
+			_mm_loadu_si128((const __m128i *)(src + x * 4)), coef);
+		__m128i s1 = luma4_sse2(
+			_mm_loadu_si128((const __m128i *)(src + x * 4 + 16)),
+			coef);
+		__m128i y = _mm_add_epi16(_mm_packs_epi32(s0, s1), off);
+		_mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(y, y));
+	}
+	luma_row_c(src + x * 4, dst + x, width - x, cr, cg, cb, offset);
+}
+
+AVX2_FUNC static void bgra_row_avx2(const uint8_t *src, uint8_t *dst,
+				    uint32_t width)
+{
+	const __m256i shuffle = _mm256_setr_epi8(
+		2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15, 2, 1, 0,
+		3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	uint32_t x = 0;
+
+	for (; x + 8 <= width; x += 8) {
+		__m256i px = _mm256_loadu_si256((const __m256i *)(src + x * 4));
+		_mm256_storeu_si256((__m256i *)(dst + x * 4),
+				    _mm256_shuffle_epi8(px, shuffle));
+	}
+	bgra_row_c(src + x * 4, dst + x * 4, width - x);
+}
+
+AVX2_FUNC static void rgb24_row_avx2(const uint8_t *src, uint8_t *dst,
+				     uint32_t width)
+{
+	const __m256i shuffle = _mm256_setr_epi8(
+		0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1, 0, 1, 2,
+		4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+	uint32_t x = 0;
+
+	/* each store writes 32 bytes of which 24 are used, stop while the
+	 * extra 8 bytes still land inside the row */
+	for (; x + 11 <= width; x += 8) {
+		__m256i px = _mm256_loadu_si256((const __m256i *)(src + x * 4));
+		px = _mm256_shuffle_epi8(px, shuffle);
+		px = _mm256_permutevar8x32_epi32(px, pack);
+		_mm256_storeu_si256((__m256i *)(dst + x * 3), px);
+	}
+	rgb24_row_c(src + x * 4, dst + x * 3, width - x);
+}
+
+AVX2_FUNC static inline __m256i luma8_avx2(__m256i px, __m256i coef)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(px, zero), coef);
+	__m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(px, zero), coef);
+
+	__m256 even = _mm256_shuffle_ps(_mm256_castsi256_ps(lo),
+					_mm256_castsi256_ps(hi),
+					_MM_SHUFFLE(2, 0, 2, 0));
+	__m256 odd = _mm256_shuffle_ps(_mm256_castsi256_ps(lo),
+				       _mm256_castsi256_ps(hi),
+				       _MM_SHUFFLE(3, 1, 3, 1));
+	__m256i sum = _mm256_add_epi32(_mm256_castps_si256(even),
+				       _mm256_castps_si256(odd));
+	return _mm256_srli_epi32(_mm256_add_epi32(sum, _mm256_set1_epi32(128)),
+				 8);
+}
+
+AVX2_FUNC static void luma_row_avx2(const uint8_t *src, uint8_t *dst,
+				    uint32_t width, int cr, int cg, int cb,
+				    int offset)
+{
+	const __m256i coef = _mm256_setr_epi16(
+		(short)cr, (short)cg, (short)cb, 0, (short)cr, (short)cg,
+		(short)cb, 0, (short)cr, (short)cg, (short)cb, 0, (short)cr,
+		(short)cg, (short)cb, 0);
+	const __m256i off = _mm256_set1_epi16((short)offset);
+	uint32_t x = 0;
+
+	for (; x + 16 <= width; x += 16) {
+		/* lanes hold pixels 0-3 | 4-7 and 8-11 | 12-15 */
+		__m256i s0 = luma8_avx2(
+			_mm256_loadu_si256((const __m256i *)(src + x * 4)),
+			coef);
+		__m256i s1 = luma8_avx2(
+			_mm256_loadu_si256((const __m256i *)(src + x * 4 + 32)),
+			coef);
+		__m256i y = _mm256_packs_epi32(s0, s1);
+		y = _mm256_permute4x64_epi64(y, _MM_SHUFFLE(3, 1, 2, 0));
+		y = _mm256_packus_epi16(_mm256_add_epi16(y, off),
+					_mm256_setzero_si256());
+		y = _mm256_permute4x64_epi64(y, _MM_SHUFFLE(3, 1, 2, 0));
+		_mm_storeu_si128((__m128i *)(dst + x),
+				 _mm256_castsi256_si128(y));
+	}
+	luma_row_sse2(src + x * 4, dst + x, width - x, cr, cg, cb, offset);
+}
+
+static bool cpu_has_avx2(void)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	/* the OS has to save the AVX registers too */
+	__cpuid(info, 1);
+	if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+/* ------------------------------------------------------------------------- */
+/* NEON                                                                       */
+
+#ifdef PIXEL_NEON
+
+static void bgra_row_neon(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+	uint32_t x = 0;
+	for (; x + 16 <= width; x += 16) {
+		uint8x16x4_t px = vld4q_u8(src + x * 4);
+		uint8x16_t r = px.val[0];
+		px.val[0] = px.val[2];
+		px.val[2] = r;
+		vst4q_u8(dst + x * 4, px);
+	}
+	bgra_row_c(src + x * 4, dst + x * 4, width - x);
+}
+
+static void rgb24_row_neon(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+	uint32_t x = 0;
+	for (; x + 16 <= width; x += 16) {
+		uint8x16x4_t px = vld4q_u8(src + x * 4);
+		uint8x16x3_t rgb = {{px.val[0], px.val[1], px.val[2]}};
+		vst3q_u8(dst + x * 3, rgb);
+	}
+	rgb24_row_c(src + x * 4, dst + x * 3, width - x);
+}
+
+static void luma_row_neon(const uint8_t *src, uint8_t *dst, uint32_t width,
+			  int cr, int cg, int cb, int offset)
+{
+	/* the coefficients are positive and sum to less than 256, so the
+	 * weighted sums fit in 16 bits */
+	const uint8x8_t r_coef = vdup_n_u8((uint8_t)cr);
+	const uint8x8_t g_coef = vdup_n_u8((uint8_t)cg);
+	const uint8x8_t b_coef = vdup_n_u8((uint8_t)cb);
+	const uint8x8_t off = vdup_n_u8((uint8_t)offset);
+	uint32_t x = 0;
+
+	for (; x + 8 <= width; x += 8) {
+		uint8x8x4_t px = vld4_u8(src + x * 4);
+		uint16x8_t sum = vmull_u8(px.val[0], r_coef);
+		sum = vmlal_u8(sum, px.val[1], g_coef);
+		sum = vmlal_u8(sum, px.val[2], b_coef);
+		vst1_u8(dst + x, vadd_u8(vrshrn_n_u16(sum, 8), off));
+	}
+	luma_row_c(src + x * 4, dst + x, width - x, cr, cg, cb, offset);
+}
+
+#endif
+
+/* ------------------------------------------------------------------------- */
+
+typedef void (*copy_row_t)(const uint8_t *src, uint8_t *dst, uint32_t width);
+typedef void (*luma_row_t)(const uint8_t *src, uint8_t *dst, uint32_t width,
+			   int cr, int cg, int cb, int offset);
+
+struct row_kernels {
+	copy_row_t bgra;
+	copy_row_t rgb24;
+	luma_row_t luma;
+};
+
+static const struct row_kernels *get_kernels(void)
+{
+#if defined(PIXEL_X86)
+	static const struct row_kernels sse2 = {bgra_row_sse2, rgb24_row_c,
+						luma_row_sse2};
+	static const struct row_kernels avx2 = {bgra_row_avx2, rgb24_row_avx2,
+						luma_row_avx2};
+	/* detected by the first conversion, atomically as the encoder
+	 * threads convert at the same time.  Threads racing to detect it all
+	 * store the same result */
+	static volatile long has_avx2 = -1;
+	long avx2_detected = os_atomic_load_long(&has_avx2);
+	if (avx2_detected < 0) {
+		avx2_detected = cpu_has_avx2() ? 1 : 0;
+		os_atomic_set_long(&has_avx2, avx2_detected);
+	}
+	return avx2_detected ? &avx2 : &sse2;
+#elif defined(PIXEL_NEON)
+	static const struct row_kernels neon = {bgra_row_neon, rgb24_row_neon,
+						luma_row_neon};
+	return &neon;
+#else
+	static const struct row_kernels c = {bgra_row_c, rgb24_row_c,
+					     luma_row_c};
+	return &c;
+#endif
+}
+
+/* averages 2x2 blocks into one U and one V sample, a quarter of the pixels
+ * so this stays scalar */
+static void chroma_rows(const uint8_t *row0, const uint8_t *row1,
+			uint32_t width, uint8_t *u, uint8_t *v)
+{
+	for (uint32_t x = 0; x < width; x += 2) {
+		uint32_t x1 = x + 1 < width ? x + 1 : x;
+		const uint8_t *p[4] = {row0 + x * 4, row0 + x1 * 4,
+				       row1 + x * 4, row1 + x1 * 4};
+		int r = (p[0][0] + p[1][0] + p[2][0] + p[3][0] + 2) >> 2;
+		int g = (p[0][1] + p[1][1] + p[2][1] + p[3][1] + 2) >> 2;
+		int b = (p[0][2] + p[1][2] + p[2][2] + p[3][2] + 2) >> 2;
+
+		/* + 128 << 8 keeps the sums positive before the shift */
+		*u++ = (uint8_t)((-38 * r - 74 * g + 112 * b + 32896) >> 8);
+		*v++ = (uint8_t)((112 * r - 94 * g - 18 * b + 32896) >> 8);
+	}
+}
+
+void pixel_format_convert(enum pixel_format format, const uint8_t *src,
+			  uint32_t src_linesize, uint32_t width,
+			  uint32_t height, uint8_t *dst)
+{
+	const struct row_kernels *kernels = get_kernels();
+	uint32_t dst_linesize = pixel_format_linesize(format, width);
+
+	switch (format) {
+	case PIXEL_FORMAT_RGBA:
+		for (uint32_t y = 0; y < height; y++)
+			memcpy(dst + (size_t)y * dst_linesize,
+			       src + (size_t)y * src_linesize, dst_linesize);
+		break;
+
+	case PIXEL_FORMAT_BGRA:
+		for (uint32_t y = 0; y < height; y++)
+			kernels->bgra(src + (size_t)y * src_linesize,
+				      dst + (size_t)y * dst_linesize, width);
+		break;
+
+	case PIXEL_FORMAT_RGB24:
+		for (uint32_t y = 0; y < height; y++)
+			kernels->rgb24(src + (size_t)y * src_linesize,
+				       dst + (size_t)y * dst_linesize, width);
+		break;
+
+	case PIXEL_FORMAT_GRAY8:
+		for (uint32_t y = 0; y < height; y++)
+			kernels->luma(src + (size_t)y * src_linesize,
+				      dst + (size_t)y * dst_linesize, width,
+				      GRAY_R, GRAY_G, GRAY_B, 0);
+		break;
+
+	case PIXEL_FORMAT_YUV420: {
+		uint32_t chroma_width = (width + 1) / 2;
+		uint8_t *u = dst + (size_t)width * height;
+		uint8_t *v = u + (size_t)chroma_width * ((height + 1) / 2);
+
+		for (uint32_t y = 0; y < height; y += 2) {
+			const uint8_t *row0 = src + (size_t)y * src_linesize;
+			const uint8_t *row1 = y + 1 < height
+						      ? row0 + src_linesize
+						      : row0;
+
+			kernels->luma(row0, dst + (size_t)y * width, width,
+				      Y_R, Y_G, Y_B, Y_OFFSET);
+			if (y + 1 < height)
+				kernels->luma(row1,
+					      dst + (size_t)(y + 1) * width,
+					      width, Y_R, Y_G, Y_B, Y_OFFSET);
+
+			chroma_rows(row0, row1, width, u, v);
+			u += chroma_width;
+			v += chroma_width;
+		}
+		break;
+	}
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Pixel formats raw frames can be output in, and conversion from the RGBA
+ * captured by the GPU.  Converted frames are tightly packed: the conversion
+ * reads the padded rows of the staging surface and writes packed rows, so it
+ * replaces the copy out of the surface instead of adding a pass.
+ *
+ * YUV420 is planar BT.601 limited range: a width x height Y plane followed by
+ * (width + 1) / 2 x (height + 1) / 2 U and V planes.  GRAY8 is full range
+ * BT.601 luma.
+ *
+ * The row kernels use AVX2 when the CPU has it, SSE2 or NEON otherwise, and
+ * plain C on other architectures.
+ */
+
+enum pixel_format {
+	PIXEL_FORMAT_RGBA,
+	PIXEL_FORMAT_BGRA,
+	PIXEL_FORMAT_RGB24,
+	PIXEL_FORMAT_GRAY8,
+	PIXEL_FORMAT_YUV420,
+};
+
+extern const char *pixel_format_name(enum pixel_format format);
+/* content type used when uploading raw frames */
+extern const char *pixel_format_content_type(enum pixel_format format);
+
+/* bytes per pixel of packed formats, 0 for planar ones */
+extern uint32_t pixel_format_bytes_per_pixel(enum pixel_format format);
+/* row size of the first plane */
+extern uint32_t pixel_format_linesize(enum pixel_format format,
+				      uint32_t width);
+extern size_t pixel_format_size(enum pixel_format format, uint32_t width,
+				uint32_t height);
+
+/* converts an RGBA image into a packed image of pixel_format_size() bytes */
+extern void pixel_format_convert(enum pixel_format format,
+				 const uint8_t *src, uint32_t src_linesize,
+				 uint32_t width, uint32_t height, uint8_t *dst);
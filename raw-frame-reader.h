@@ -0,0 +1,156 @@
+#pragma once
+
+/*
+ * Header-only reader for .raw files (raw-frame.h).
+ *
+ * The file is memory-mapped read only and the pixels are used in place,
+ * nothing is copied:
+ *
+ *   struct raw_frame_reader reader;
+ *   if (raw_frame_reader_open(&reader, "shot.raw", true)) {
+ *           use(reader.data, reader.header->width, reader.header->height,
+ *               reader.header->linesize);
+ *           raw_frame_reader_close(&reader);
+ *   } else {
+ *           fprintf(stderr, "%s\n", reader.error);
+ *   }
+ *
+ * The filter writes files to path.tmp and renames them (unless "Replace the
+ * file atomically" is off), so a file that is opened is always complete.
+ * Opening it again reads the newest frame.
+ */
+
+#include "raw-frame.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct raw_frame_reader {
+	const struct raw_frame_header *header;
+	const uint8_t *data;
+	/* why raw_frame_reader_open() failed */
+	const char *error;
+
+	/* private */
+	const void *map;
+	size_t size;
+};
+
+static inline void raw_frame_reader_close(struct raw_frame_reader *reader)
+{
+	if (reader->map) {
+#ifdef _WIN32
+		UnmapViewOfFile(reader->map);
+#else
+		munmap((void *)reader->map, reader->size);
+#endif
+	}
+	reader->map = NULL;
+	reader->size = 0;
+	reader->header = NULL;
+	reader->data = NULL;
+}
+
+static inline const void *raw_frame_reader_map(const char *path, size_t *size)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ,
+				  FILE_SHARE_READ | FILE_SHARE_WRITE |
+					  FILE_SHARE_DELETE,
+				  NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+				  NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	LARGE_INTEGER file_size;
+	HANDLE mapping = NULL;
+	const void *map = NULL;
+	if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0 &&
+	    (uint64_t)file_size.QuadPart <= SIZE_MAX)
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0,
+					     NULL);
+	if (mapping) {
+		map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		*size = (size_t)file_size.QuadPart;
+		// the view keeps the mapping and the file open
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+	return map;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	void *map = NULL;
+	if (fstat(fd, &st) == 0 && st.st_size > 0 &&
+	    (uint64_t)st.st_size <= SIZE_MAX) {
+		map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd,
+			   0);
+		if (map == MAP_FAILED)
+			map = NULL;
+		*size = (size_t)st.st_size;
+	}
+	// the mapping keeps the file open
+	close(fd);
+	return map;
+#endif
+}
+
+/* true if the open frame has no checksum or it matches, reads every pixel */
+static inline bool
+raw_frame_reader_verify(const struct raw_frame_reader *reader)
+{
+	return raw_frame_verify(reader->map);
+}
+
+/*
+ * Maps path and checks its header, the pixels are at reader->data.  Returns
+ * false with reader->error set if the file cannot be mapped, is not a raw
+ * frame, is truncated or its checksum does not match, reader is closed then.
+ * verify_checksum can be false to skip reading the whole file up front.
+ */
+static inline bool raw_frame_reader_open(struct raw_frame_reader *reader,
+					 const char *path, bool verify_checksum)
+{
+	memset(reader, 0, sizeof(*reader));
+
+	reader->map = raw_frame_reader_map(path, &reader->size);
+	if (!reader->map) {
+		reader->error = "cannot open or map the file";
+		return false;
+	}
+
+	reader->header = raw_frame_get_header(reader->map, reader->size);
+	if (!reader->header) {
+		raw_frame_reader_close(reader);
+		reader->error = "not a raw frame, or truncated";
+		return false;
+	}
+	if (verify_checksum && !raw_frame_reader_verify(reader)) {
+		raw_frame_reader_close(reader);
+		reader->error = "checksum mismatch";
+		return false;
+	}
+
+	reader->data = raw_frame_data(reader->map);
+	return true;
+}
+
+#ifdef __cplusplus
+}
+#endif
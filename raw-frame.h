@@ -0,0 +1,168 @@
+#pragma once
+
+/*
+ * Raw frame files.
+ *
+ * A .raw file is a raw_frame_header followed by the frame's pixels, starting
+ * header_size bytes into the file.  The header says how to read the pixels:
+ * their pixel format, width, height and linesize (rows may be padded past
+ * width), and when and in which video frame they were captured.  With
+ * RAW_FRAME_FLAG_CHECKSUM set, checksum is raw_frame_checksum() of the
+ * pixels.
+ *
+ * The header is 128 bytes, so the pixels of a file mapped at a page boundary
+ * are 64 byte aligned and can be used in place.  Readers must use
+ * header_size rather than sizeof(struct raw_frame_header) to find the
+ * pixels, later versions may add fields at the end.  All fields are little
+ * endian.  raw-frame-reader.h maps files and checks them with it.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RAW_FRAME_MAGIC 0x46525353 /* "SSRF" */
+#define RAW_FRAME_VERSION 1
+
+/* header flags */
+/* checksum holds the raw_frame_checksum() of the pixels */
+#define RAW_FRAME_FLAG_CHECKSUM 0x1
+
+/* pixel formats, the values of enum pixel_format in pixel-format.h, see
+ * shmem-ring.h for the layout of each */
+#define RAW_FRAME_FORMAT_RGBA 0
+#define RAW_FRAME_FORMAT_BGRA 1
+#define RAW_FRAME_FORMAT_RGB24 2
+#define RAW_FRAME_FORMAT_GRAY8 3
+#define RAW_FRAME_FORMAT_YUV420 4
+
+struct raw_frame_header {
+	uint32_t magic;
+	uint32_t version;
+	/* offset of the pixels from the start of the file */
+	uint32_t header_size;
+	uint32_t flags;
+
+	uint32_t width;
+	uint32_t height;
+	/* bytes from one row to the next, of the Y plane for YUV420 */
+	uint32_t linesize;
+	uint32_t pixel_format;
+	/* size of the pixels */
+	uint64_t data_size;
+
+	/* number of the frame in what the filter wrote to this destination */
+	uint32_t index;
+	uint32_t reserved;
+	/* monotonic time in ns of the video frame the image was captured in,
+	 * and the number of that video frame, see capture-schedule.h */
+	uint64_t timestamp;
+	uint64_t frame;
+	uint64_t checksum;
+
+	uint8_t reserved2[56];
+};
+
+/*
+ * Fletcher-64 of the data as little endian 32 bit words, zero padded to a
+ * multiple of 4 bytes.  Cheap enough to check every frame, it catches
+ * truncated and torn files rather than deliberate tampering.
+ */
+static inline uint64_t raw_frame_checksum(const void *data, size_t size)
+{
+	/* the most words that can be summed before the sums could overflow */
+	const size_t block = 92679;
+	const uint8_t *ptr = (const uint8_t *)data;
+	uint64_t sum1 = 0;
+	uint64_t sum2 = 0;
+
+	while (size >= 4) {
+		size_t words = size / 4 < block ? size / 4 : block;
+		size -= words * 4;
+
+		for (size_t i = 0; i < words; i++) {
+			uint32_t word;
+			memcpy(&word, ptr, 4);
+			ptr += 4;
+			sum1 += word;
+			sum2 += sum1;
+		}
+		sum1 %= 0xFFFFFFFF;
+		sum2 %= 0xFFFFFFFF;
+	}
+	if (size) {
+		uint32_t word = 0;
+		memcpy(&word, ptr, size);
+		sum1 = (sum1 + word) % 0xFFFFFFFF;
+		sum2 = (sum2 + sum1) % 0xFFFFFFFF;
+	}
+	return sum2 << 32 | sum1;
+}
+
+/* minimum size of the pixels of a frame, 0 if the format is unknown or the
+ * linesize is too short for the width */
+static inline uint64_t raw_frame_min_size(uint32_t pixel_format,
+					  uint32_t width, uint32_t height,
+					  uint32_t linesize)
+{
+	static const uint32_t bytes_per_pixel[] = {4, 4, 3, 1, 1};
+	if (pixel_format > RAW_FRAME_FORMAT_YUV420 ||
+	    linesize < (uint64_t)width * bytes_per_pixel[pixel_format])
+		return 0;
+
+	uint64_t size = (uint64_t)linesize * height;
+	if (pixel_format == RAW_FRAME_FORMAT_YUV420)
+		size += (uint64_t)((width + 1) / 2) * ((height + 1) / 2) * 2;
+	return size;
+}
+
+/* the header of a raw frame of size bytes, NULL if it is not one or is
+ * truncated.  the checksum is not verified */
+static inline const struct raw_frame_header *
+raw_frame_get_header(const void *frame, size_t size)
+{
+	const struct raw_frame_header *header =
+		(const struct raw_frame_header *)frame;
+	if (size < sizeof(*header) || header->magic != RAW_FRAME_MAGIC ||
+	    header->version != RAW_FRAME_VERSION ||
+	    header->header_size < sizeof(*header) ||
+	    header->header_size > size ||
+	    header->data_size > size - header->header_size)
+		return NULL;
+
+	uint64_t min_size =
+		raw_frame_min_size(header->pixel_format, header->width,
+				   header->height, header->linesize);
+	if (!min_size || header->data_size < min_size)
+		return NULL;
+	return header;
+}
+
+/* the pixels of a frame raw_frame_get_header() accepted */
+static inline const uint8_t *raw_frame_data(const void *frame)
+{
+	const struct raw_frame_header *header =
+		(const struct raw_frame_header *)frame;
+	return (const uint8_t *)frame + header->header_size;
+}
+
+/* true if the frame has no checksum or it matches */
+static inline bool raw_frame_verify(const void *frame)
+{
+	const struct raw_frame_header *header =
+		(const struct raw_frame_header *)frame;
+	if (!(header->flags & RAW_FRAME_FLAG_CHECKSUM))
+		return true;
+	return raw_frame_checksum(raw_frame_data(frame),
+				  (size_t)header->data_size) ==
+	       header->checksum;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,304 @@
+#include "readback-ring.h"
+
+#include <obs-module.h>
+#include <util/bmem.h>
+
+#include "capture-memory.h"
+
+#define do_log(level, format, ...) \
+	blog(level, "[screenshot-filter] " format, ##__VA_ARGS__)
+
+#define warn(format, ...) do_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define info(format, ...) do_log(LOG_INFO, format, ##__VA_ARGS__)
+
+struct readback_slot {
+	void *surface;
+	void *frame;
+	uint64_t staged_frame;
+	bool pending;
+};
+
+struct readback_ring {
+	const struct readback_ops *ops;
+	readback_discard_t discard;
+	void *param;
+
+	uint32_t width;
+	uint32_t height;
+	uint32_t count;
+	struct readback_slot slots[READBACK_MAX_SURFACES];
+
+	/* slots are staged and collected round-robin */
+	uint32_t stage_idx;
+	uint32_t collect_idx;
+	uint32_t pending;
+	struct readback_slot *mapped;
+
+	uint64_t frame;
+};
+
+/* ------------------------------------------------------------------------- */
+/* libobs staging surfaces                                                    */
+
+static void *gs_create(uint32_t width, uint32_t height)
+{
+	return gs_stagesurface_create(width, height, GS_RGBA);
+}
+
+static void gs_destroy(void *surface)
+{
+	gs_stagesurface_destroy(surface);
+}
+
+static void gs_stage(void *surface, void *texture)
+{
+	gs_stage_texture(surface, texture);
+}
+
+static bool gs_map(void *surface, uint8_t **data, uint32_t *linesize)
+{
+	return gs_stagesurface_map(surface, data, linesize);
+}
+
+static void gs_unmap(void *surface)
+{
+	gs_stagesurface_unmap(surface);
+}
+
+const struct readback_ops readback_gs_ops = {
+	.create = gs_create,
+	.destroy = gs_destroy,
+	.stage = gs_stage,
+	.map = gs_map,
+	.unmap = gs_unmap,
+};
+
+/* ------------------------------------------------------------------------- */
+/* CPU stand-in, stages from a readback_cpu_image                             */
+
+struct cpu_surface {
+	uint32_t width;
+	uint32_t height;
+	uint32_t linesize;
+	uint8_t *data;
+};
+
+static void *cpu_create(uint32_t width, uint32_t height)
+{
+	struct cpu_surface *surface = bzalloc(sizeof(struct cpu_surface));
+	surface->width = width;
+	surface->height = height;
+	/* pad rows the way GPU staging surfaces usually are */
+	surface->linesize = (width * 4 + 31) & ~31u;
+	surface->data = bzalloc((size_t)surface->linesize * height);
+	return surface;
+}
+
+static void cpu_destroy(void *data)
+{
+	struct cpu_surface *surface = data;
+	bfree(surface->data);
+	bfree(surface);
+}
+
+static void cpu_stage(void *data, void *texture)
+{
+	struct cpu_surface *surface = data;
+	struct readback_cpu_image *image = texture;
+
+	for (uint32_t y = 0; y < surface->height; y++)
+		memcpy(surface->data + (size_t)y * surface->linesize,
+		       image->data + (size_t)y * image->linesize,
+		       (size_t)surface->width * 4);
+}
+
+static bool cpu_map(void *data, uint8_t **ptr, uint32_t *linesize)
+{
+	struct cpu_surface *surface = data;
+	*ptr = surface->data;
+	*linesize = surface->linesize;
+	return true;
+}
+
+static void cpu_unmap(void *data)
+{
+	UNUSED_PARAMETER(data);
+}
+
+const struct readback_ops readback_cpu_ops = {
+	.create = cpu_create,
+	.destroy = cpu_destroy,
+	.stage = cpu_stage,
+	.map = cpu_map,
+	.unmap = cpu_unmap,
+};
+
+/* ------------------------------------------------------------------------- */
+
+struct readback_ring *readback_ring_create(const struct readback_ops *ops,
+					   readback_discard_t discard,
+					   void *param)
+{
+	struct readback_ring *ring = bzalloc(sizeof(struct readback_ring));
+	ring->ops = ops;
+	ring->discard = discard;
+	ring->param = param;
+	return ring;
+}
+
+void readback_ring_reset(struct readback_ring *ring)
+{
+	readback_ring_release(ring);
+
+	for (uint32_t i = 0; i < ring->count; i++) {
+		struct readback_slot *slot = &ring->slots[i];
+		if (slot->pending && ring->discard)
+			ring->discard(ring->param, slot->frame);
+		slot->pending = false;
+		slot->frame = NULL;
+	}
+	ring->stage_idx = 0;
+	ring->collect_idx = 0;
+	ring->pending = 0;
+}
+
+static int64_t surface_size(struct readback_ring *ring)
+{
+	return (int64_t)ring->width * ring->height * 4;
+}
+
+static void destroy_surfaces(struct readback_ring *ring)
+{
+	for (uint32_t i = 0; i < ring->count; i++) {
+		if (!ring->slots[i].surface)
+			continue;
+		ring->ops->destroy(ring->slots[i].surface);
+		ring->slots[i].surface = NULL;
+		capture_memory_add(CAPTURE_MEMORY_STAGING, -surface_size(ring));
+	}
+}
+
+static void free_surfaces(struct readback_ring *ring)
+{
+	readback_ring_reset(ring);
+	destroy_surfaces(ring);
+	ring->count = 0;
+	ring->width = 0;
+	ring->height = 0;
+}
+
+void readback_ring_destroy(struct readback_ring *ring)
+{
+	if (!ring)
+		return;
+
+	free_surfaces(ring);
+	bfree(ring);
+}
+
+void readback_ring_resize(struct readback_ring *ring, uint32_t width,
+			  uint32_t height, uint32_t count)
+{
+	if (count < 1)
+		count = 1;
+	if (count > READBACK_MAX_SURFACES)
+		count = READBACK_MAX_SURFACES;
+
+	if (ring->width == width && ring->height == height &&
+	    ring->count == count)
+		return;
+
+	free_surfaces(ring);
+	if (!width || !height)
+		return;
+
+	ring->count = count;
+	ring->width = width;
+	ring->height = height;
+}
+
+void readback_ring_next_frame(struct readback_ring *ring)
+{
+	ring->frame++;
+}
+
+bool readback_ring_stage(struct readback_ring *ring, void *texture,
+			 void *frame)
+{
+	if (!ring->count || ring->pending == ring->count)
+		return false;
+
+	struct readback_slot *slot = &ring->slots[ring->stage_idx];
+	if (slot == ring->mapped)
+		return false;
+
+	if (!slot->surface) {
+		slot->surface = ring->ops->create(ring->width, ring->height);
+		if (!slot->surface) {
+			warn("Failed to create %ux%u staging surface",
+			     ring->width, ring->height);
+			return false;
+		}
+		capture_memory_add(CAPTURE_MEMORY_STAGING, surface_size(ring));
+	}
+
+	ring->ops->stage(slot->surface, texture);
+	slot->frame = frame;
+	slot->staged_frame = ring->frame;
+	slot->pending = true;
+
+	ring->stage_idx = (ring->stage_idx + 1) % ring->count;
+	ring->pending++;
+	return true;
+}
+
+void *readback_ring_collect(struct readback_ring *ring, uint8_t **data,
+			    uint32_t *linesize)
+{
+	if (!ring->pending || ring->mapped)
+		return NULL;
+
+	struct readback_slot *slot = &ring->slots[ring->collect_idx];
+
+	/* give the copy count - 1 frames to complete, with a single surface
+	 * it is mapped right away like a plain staging surface */
+	if (ring->frame - slot->staged_frame < ring->count - 1)
+		return NULL;
+
+	void *frame = slot->frame;
+	slot->pending = false;
+	slot->frame = NULL;
+	ring->collect_idx = (ring->collect_idx + 1) % ring->count;
+	ring->pending--;
+
+	if (!ring->ops->map(slot->surface, data, linesize)) {
+		if (ring->discard)
+			ring->discard(ring->param, frame);
+		return NULL;
+	}
+
+	ring->mapped = slot;
+	return frame;
+}
+
+void readback_ring_release(struct readback_ring *ring)
+{
+	if (ring->mapped) {
+		ring->ops->unmap(ring->mapped->surface);
+		ring->mapped = NULL;
+	}
+}
+
+uint32_t readback_ring_pending(const struct readback_ring *ring)
+{
+	return ring->pending;
+}
+
+bool readback_ring_trim(struct readback_ring *ring)
+{
+	if (ring->pending || ring->mapped)
+		return false;
+
+	destroy_surfaces(ring);
+	return true;
+}
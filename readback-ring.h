@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Ring of staging surfaces used to read captured textures back from the GPU
+ * without waiting for the copy.  A texture staged in one frame is mapped
+ * count - 1 frames later, by which time the copy has normally completed, so
+ * the graphics thread does not stall in gs_stagesurface_map.  Frames are
+ * always collected in the order they were staged.
+ *
+ * Surfaces are only created when a frame is staged into them, and can be
+ * released while the ring is idle, so a filter that rarely captures does not
+ * hold them.  They count as staging memory in capture-memory.h.
+ *
+ * The surfaces are accessed through readback_ops.  readback_gs_ops uses
+ * libobs staging surfaces and must only be used inside the graphics context,
+ * readback_cpu_ops stages from plain memory so that the ring can be driven
+ * without a GPU.
+ */
+
+#define READBACK_MAX_SURFACES 4
+
+struct readback_ops {
+	void *(*create)(uint32_t width, uint32_t height);
+	void (*destroy)(void *surface);
+	void (*stage)(void *surface, void *texture);
+	bool (*map)(void *surface, uint8_t **data, uint32_t *linesize);
+	void (*unmap)(void *surface);
+};
+
+extern const struct readback_ops readback_gs_ops;
+extern const struct readback_ops readback_cpu_ops;
+
+/* texture type of readback_cpu_ops */
+struct readback_cpu_image {
+	const uint8_t *data;
+	uint32_t linesize;
+};
+
+struct readback_ring;
+
+/* called for frames that were staged but will never be collected */
+typedef void (*readback_discard_t)(void *param, void *frame);
+
+extern struct readback_ring *readback_ring_create(const struct readback_ops *ops,
+						  readback_discard_t discard,
+						  void *param);
+extern void readback_ring_destroy(struct readback_ring *ring);
+
+/* frees the surfaces if the size or surface count changed, discarding
+ * frames that were staged but not collected yet.  the new ones are created
+ * as they are needed */
+extern void readback_ring_resize(struct readback_ring *ring, uint32_t width,
+				 uint32_t height, uint32_t count);
+extern void readback_ring_reset(struct readback_ring *ring);
+
+/* advances the frame counter, call once per video frame before
+ * readback_ring_collect and readback_ring_stage */
+extern void readback_ring_next_frame(struct readback_ring *ring);
+
+/* stages texture into a free surface, frame is handed back by
+ * readback_ring_collect, returns false if every surface is in use */
+extern bool readback_ring_stage(struct readback_ring *ring, void *texture,
+				void *frame);
+
+/*
+ * Maps the oldest surface that was staged long enough ago.  Returns its frame
+ * pointer and mapped data, readback_ring_release must be called once the data
+ * is no longer needed.  Returns NULL if no surface is ready.
+ */
+extern void *readback_ring_collect(struct readback_ring *ring, uint8_t **data,
+				   uint32_t *linesize);
+extern void readback_ring_release(struct readback_ring *ring);
+
+extern uint32_t readback_ring_pending(const struct readback_ring *ring);
+
+/* frees the surfaces if no frame is staged or mapped, they are created again
+ * by the next frame staged.  returns false if the ring is busy */
+extern bool readback_ring_trim(struct readback_ring *ring);
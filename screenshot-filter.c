@@ -1,13 +1,21 @@
-#include <windows.h>
-#include <wininet.h>
 #include <obs-module.h>
 #include <util/threading.h>
+#include <util/platform.h>
+#include <util/dstr.h>
 #include <obs-hotkey.h>
 
-#include <libavcodec/avcodec.h>
-#include <libavformat/avformat.h>
-#include <libavutil/imgutils.h>
-#include <libswscale/swscale.h>
+#include "capture-memory.h"
+#include "capture-output.h"
+#include "capture-schedule.h"
+#include "capture-share.h"
+#include "capture-stats.h"
+#include "encode-pool.h"
+#include "file-sink.h"
+#include "http-server.h"
+#include "image-encoder.h"
+#include "pixel-format.h"
+#include "readback-ring.h"
+#include "shmem-ring.h"
 
 OBS_DECLARE_MODULE()
 OBS_MODULE_USE_DEFAULT_LOCALE("screenshot-filter", "en-US")
@@ -19,122 +27,455 @@ OBS_MODULE_USE_DEFAULT_LOCALE("screenshot-filter", "en-US")
 #define info(format, ...) do_log(LOG_INFO, format, ##__VA_ARGS__)
 #define debug(format, ...) do_log(LOG_DEBUG, format, ##__VA_ARGS__)
 
+#define SCREENSHOT_FILTER_ID "screenshot_filter"
+
 static void capture_key_callback(void *data, obs_hotkey_id id,
 				 obs_hotkey_t *key, bool pressed);
 
-static bool write_image(const char *destination, uint8_t *image_data_ptr,
-			uint32_t image_data_linesize, uint32_t width,
-			uint32_t height, int destination_type);
-static bool write_data(const char *destination, uint8_t *data, size_t len,
-		       char *content_type, uint32_t width, uint32_t height,
-		       int destination_type);
-static bool put_data(char *url, uint8_t *buf, size_t len, char *content_type,
-		     int width, int height);
-
 #define SETTING_DESTINATION_TYPE "destination_type"
 
 #define SETTING_DESTINATION_FOLDER "destination_folder"
 #define SETTING_DESTINATION_PATH "destinaton_path"
 #define SETTING_DESTINATION_URL "destination_url"
 #define SETTING_DESTINATION_SHMEM "destination_shmem"
+#define SETTING_DESTINATION_LOG "destination_log"
+#define SETTING_SERVER_PORT "server_port"
+#define SETTING_SERVER_LOCAL_ONLY "server_local_only"
 
-#define SETTING_DESTINATION_PATH_ID 0
-#define SETTING_DESTINATION_URL_ID 1
-#define SETTING_DESTINATION_SHMEM_ID 2
-#define SETTING_DESTINATION_FOLDER_ID 3
+#define SETTING_DESTINATION_PATH_ID CAPTURE_DESTINATION_PATH
+#define SETTING_DESTINATION_URL_ID CAPTURE_DESTINATION_URL
+#define SETTING_DESTINATION_SHMEM_ID CAPTURE_DESTINATION_SHMEM
+#define SETTING_DESTINATION_FOLDER_ID CAPTURE_DESTINATION_FOLDER
+#define SETTING_DESTINATION_SERVER_ID CAPTURE_DESTINATION_SERVER
+#define SETTING_DESTINATION_LOG_ID CAPTURE_DESTINATION_LOG
 
 #define SETTING_TIMER "timer"
+#define SETTING_SCHEDULE "schedule"
 #define SETTING_INTERVAL "interval"
+#define SETTING_SCHEDULE_RATE "schedule_rate"
+#define SETTING_SCHEDULE_FRAMES "schedule_frames"
+#define SETTING_BURST_FRAMES "burst_frames"
+#define SETTING_CHANGE_DETECT "change_detect"
+#define SETTING_CHANGE_THRESHOLD "change_threshold"
+#define SETTING_CHANGE_MASK "change_mask"
+#define SETTING_CHANGE_MAX_SILENCE "change_max_silence"
+#define SETTING_HISTORY "history"
+#define SETTING_HISTORY_BEFORE "history_before"
+#define SETTING_HISTORY_AFTER "history_after"
+#define SETTING_HISTORY_RATE "history_rate"
+#define SETTING_HISTORY_SCALE "history_scale"
+#define SETTING_HISTORY_CODEC "history_codec"
+#define SETTING_HISTORY_MEMORY "history_memory"
 #define SETTING_RAW "raw"
+#define SETTING_RAW_CHECKSUM "raw_checksum"
+#define SETTING_PIXEL_FORMAT "pixel_format"
+#define SETTING_SHMEM_SLOTS "shmem_slots"
+#define SETTING_ENCODER_THREADS "encoder_threads"
+#define SETTING_QUEUE_DEPTH "queue_depth"
+#define SETTING_QUEUE_POLICY "queue_policy"
+#define SETTING_READBACK_SURFACES "readback_surfaces"
+#define SETTING_IDLE_RELEASE "idle_release"
+#define SETTING_MEMORY_BUDGET "memory_budget"
+#define SETTING_CODEC "codec"
+#define SETTING_COMPRESSION_LEVEL "compression_level"
+#define SETTING_PNG_PREDICTION "png_prediction"
+#define SETTING_JPEG_QUALITY "jpeg_quality"
+#define SETTING_URL_CHUNKED "url_chunked"
+#define SETTING_DELTA "delta"
+#define SETTING_DELTA_KEYFRAME_INTERVAL "delta_keyframe_interval"
+#define SETTING_SCALE "scale"
+#define SETTING_SCALE_WIDTH "scale_width"
+#define SETTING_SCALE_HEIGHT "scale_height"
+#define SETTING_SCALE_FACTOR "scale_factor"
+#define SETTING_PYRAMID "pyramid"
+#define SETTING_LOG_SEGMENT_SIZE "log_segment_size"
+#define SETTING_LOG_SEGMENT_DURATION "log_segment_duration"
+#define SETTING_LOG_PREALLOCATE "log_preallocate"
+#define SETTING_ATOMIC_WRITE "atomic_write"
+#define SETTING_FSYNC_POLICY "fsync_policy"
+#define SETTING_FSYNC_FRAMES "fsync_frames"
+#define SETTING_STATS_INTERVAL "stats_interval"
+#define SETTING_STATS_FILE "stats_file"
+
+#define SETTING_SCALE_NONE_ID 0
+#define SETTING_SCALE_SIZE_ID 1
+#define SETTING_SCALE_FACTOR_ID 2
+
+#define SETTING_FSYNC_NONE_ID CAPTURE_FSYNC_NONE
+#define SETTING_FSYNC_FRAMES_ID CAPTURE_FSYNC_FRAMES
+#define SETTING_FSYNC_SEGMENT_ID CAPTURE_FSYNC_SEGMENT
+
+#define SETTING_SCHEDULE_INTERVAL_ID 0
+#define SETTING_SCHEDULE_RATE_ID 1
+#define SETTING_SCHEDULE_FRAMES_ID 2
+
+// per region settings are named "region<n>_<setting>"
+#define SETTING_REGION_COUNT "region_count"
+#define SETTING_REGION_X "x"
+#define SETTING_REGION_Y "y"
+#define SETTING_REGION_WIDTH "width"
+#define SETTING_REGION_HEIGHT "height"
+#define SETTING_REGION_DESTINATION_TYPE "destination_type"
+#define SETTING_REGION_DESTINATION "destination"
+#define SETTING_REGION_FORMAT "format"
+#define SETTING_REGION_INTERVAL "interval"
+
+// region formats are the image codecs plus raw
+#define SETTING_REGION_FORMAT_RAW_ID -1
+
+#define MAX_REGIONS 8
+
+// a crop rectangle of the source with its own destination, format and interval
+struct region_settings {
+	uint32_t x;
+	uint32_t y;
+	// 0 extends the region to the edge of the source
+	uint32_t width;
+	uint32_t height;
+	int destination_type;
+	char *destination;
+	int format;
+	// 0 captures whenever the filter does
+	float interval;
+};
 
-struct screenshot_filter_data {
-	obs_source_t *context;
-
-	HANDLE image_writer_thread;
-
+// everything update() sets.  it builds a new one every time and publishes it
+// whole, tick takes the latest and frees the one it replaces.  nothing changes
+// it after that, so the graphics thread reads it without locking
+struct filter_settings {
 	int destination_type;
 	char *destination;
 	bool timer;
-	float interval;
+	enum capture_schedule_mode schedule_mode;
+	uint64_t schedule_period;
+	// every capture of the whole source takes this many consecutive frames
+	uint32_t burst_frames;
+	bool change_detect;
+	uint32_t change_threshold;
+	uint64_t change_max_silence;
+	struct frame_diff_mask change_mask;
+	// the schedule captures small compressed frames that are kept in memory
+	// for history_before ns, the hotkey writes them and those of the
+	// history_after ns after it.  replaces the timer and bursts
+	bool history;
+	uint64_t history_before;
+	uint64_t history_after;
+	uint64_t history_max_bytes;
+	float history_scale;
+	enum image_codec history_codec;
 	bool raw;
+	bool raw_checksum;
+	enum pixel_format pixel_format;
+	struct image_codec_settings codec;
+	bool url_chunked;
+	bool delta;
+	uint32_t delta_keyframe_interval;
+	int scale;
+	uint32_t scale_width;
+	uint32_t scale_height;
+	float scale_factor;
+	bool pyramid;
+	uint32_t shmem_slots;
+	uint64_t log_segment_size;
+	uint64_t log_segment_duration;
+	bool log_preallocate;
+	bool atomic_write;
+	int fsync_policy;
+	uint32_t fsync_frames;
+	uint32_t readback_surfaces;
+	// what is only needed for captures is released after this many ns
+	// without one, see release_idle()
+	uint64_t idle_release;
+	uint64_t stats_interval;
+	char *stats_file;
+
+	uint32_t region_count;
+	struct region_settings regions[MAX_REGIONS];
+};
+
+// the state of a region, its settings are in filter_settings.regions
+struct capture_region {
+	struct capture_schedule schedule;
+	// set by tick and taken by render, see screenshot_filter_data.capture
+	volatile bool capture;
+
+	struct capture_output output;
+};
+
+struct screenshot_filter_data {
+	obs_source_t *context;
+
+	// the settings in use, only read and replaced by the graphics thread.
+	// NULL until tick takes the first
+	struct filter_settings *settings;
+	// published by update() for tick to take, see exchange_settings()
+	struct filter_settings *volatile pending_settings;
+
+	struct capture_output output;
+	struct capture_region regions[MAX_REGIONS];
+
+	struct capture_schedule schedule;
+	// the buffers of a burst need to be preallocated again
+	bool reserve;
 	obs_hotkey_id capture_hotkey_id;
 
-	float since_last;
-	bool capture;
+	struct capture_stats *stats;
+	uint64_t stats_report_time;
+	// created on the first write of the stats file
+	struct file_sink *stats_sink;
+
+	// requested by the hotkey or the schedule and taken by the render
+	// thread, atomic so that setting and taking it never waits
+	volatile bool capture;
+	// the capture was requested by the hotkey, it is taken even if the
+	// image did not change
+	volatile bool capture_forced;
+	// frames left of the burst being captured, only used by the graphics
+	// thread
+	uint32_t burst_remaining;
+	bool burst_forced;
+	// frames of the history are written instead of kept until then, only
+	// used by the graphics thread
+	uint64_t history_until;
+
+	// see release_idle(), only used by the graphics thread
+	uint64_t last_capture_time;
+	bool released;
 
 	uint32_t width;
 	uint32_t height;
+	uint32_t readback_count;
+	// created by the first capture after it was released
 	gs_texrender_t *texrender;
-	gs_stagesurf_t *staging_texture;
+	struct readback_ring *readback;
+};
 
-	uint8_t *data;
-	uint32_t linesize;
-	bool ready;
+// everything captured in one render, the readback ring hands it back once
+// the copy completes
+struct capture_job {
+	// the whole source, NULL if only regions are captured
+	struct capture_frame *frame;
+	struct capture_frame *regions[MAX_REGIONS];
+	// copied without the row padding of the staging surface, into buffers
+	// preallocated for bursts
+	bool packed;
+	// other filters capturing the same image, handed it on collection
+	struct capture_share *share;
+};
 
-	uint32_t index;
-	char shmem_name[256];
-	uint32_t shmem_size;
-	HANDLE shmem;
+static void reserve_buffers(struct screenshot_filter_data *filter);
 
-	HANDLE mutex;
-	bool exit;
-	bool exited;
+// the captures requested for a frame, taken from the flags at once
+struct capture_request {
+	bool frame;
+	bool forced;
+	bool regions[MAX_REGIONS];
 };
 
-static DWORD CALLBACK write_images_thread(struct screenshot_filter_data *filter)
-{
-	while (!filter->exit) {
-		WaitForSingleObject(filter->mutex, INFINITE);
-		// copy all props & data inside the mutex, then do the processing/write/put outside of the mutex
-		uint8_t *data = NULL;
-		char *destination = filter->destination;
-		int destination_type = filter->destination_type;
-		uint32_t width = filter->width;
-		uint32_t height = filter->height;
-		uint32_t linesize = filter->linesize;
-		bool raw = filter->raw;
-		if (filter->ready) {
-			data = bzalloc(linesize * height);
-			memcpy(data, filter->data, linesize * height);
-			filter->ready = false;
-		}
-		ReleaseMutex(filter->mutex);
-
-		if (data && width > 10 && height > 10) {
-			if (destination_type == SETTING_DESTINATION_SHMEM_ID) {
-				if (filter->shmem) {
-					uint32_t *buf =
-						(uint32_t *)MapViewOfFile(
-							filter->shmem,
-							FILE_MAP_ALL_ACCESS, 0,
-							0, filter->shmem_size);
-
-					if (buf) {
-						buf[0] = width;
-						buf[1] = height;
-						buf[2] = linesize;
-						buf[3] = filter->index;
-						memcpy(&buf[4], data,
-						       linesize * height);
-					}
-
-					UnmapViewOfFile(buf);
-				}
-			} else if (raw)
-				write_data(destination, data, linesize * height,
-					   "image/rgba32", width, height,
-					   destination_type);
-			else
-				write_image(destination, data, linesize, width,
-					    height, destination_type);
-			filter->index += 1;
-			bfree(data);
+static void free_job(void *param, void *data)
+{
+	struct capture_job *job = data;
+	UNUSED_PARAMETER(param);
+
+	capture_share_close(job->share);
+	if (job->frame)
+		capture_frame_free(job->frame);
+	for (size_t i = 0; i < MAX_REGIONS; i++) {
+		if (job->regions[i])
+			capture_frame_free(job->regions[i]);
+	}
+	bfree(job);
+}
+
+// counts dropped frames and reports them at most every 5 seconds
+static void report_dropped(struct capture_output *output, const char *name)
+{
+	uint64_t dropped = encode_client_dropped(output->encode_client);
+	uint64_t now = os_gettime_ns();
+	capture_stats_add(output->stats, CAPTURE_COUNTER_DROPPED,
+			  dropped - output->dropped_counted);
+	output->dropped_counted = dropped;
+
+	if (dropped != output->dropped_reported &&
+	    now - output->dropped_report_time > 5000000000ULL) {
+		warn("%s: encoders fell behind, dropped %llu frames (%llu total)",
+		     name,
+		     (unsigned long long)(dropped - output->dropped_reported),
+		     (unsigned long long)dropped);
+		output->dropped_reported = dropped;
+		output->dropped_report_time = now;
+	}
+}
+
+// appends str as a quoted JSON string
+static void json_cat_string(struct dstr *json, const char *str)
+{
+	dstr_cat_ch(json, '"');
+	for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+		if (*p == '"' || *p == '\\')
+			dstr_catf(json, "\\%c", *p);
+		else if (*p < 0x20)
+			dstr_catf(json, "\\u%04x", *p);
+		else
+			dstr_cat_ch(json, (char)*p);
+	}
+	dstr_cat_ch(json, '"');
+}
+
+// replaces path with the summary as JSON, through a file sink so that a slow
+// disk never holds up the graphics thread
+static void write_stats_file(struct screenshot_filter_data *filter,
+			     const char *name, const char *path,
+			     const struct capture_stats_summary *summary)
+{
+	struct dstr json = {0};
+	dstr_cat(&json, "{\n  \"source\": ");
+	json_cat_string(&json, name);
+	dstr_catf(&json,
+		  ",\n  \"time_ns\": %llu,\n  \"period_ns\": %llu,\n"
+		  "  \"stages\": {",
+		  (unsigned long long)filter->stats_report_time,
+		  (unsigned long long)summary->period_ns);
+	for (int i = 0; i < CAPTURE_STAGE_COUNT; i++) {
+		const struct capture_stage_summary *stage = &summary->stages[i];
+		dstr_catf(&json,
+			  "%s\n    \"%s\": {\"count\": %llu, "
+			  "\"mean_ns\": %llu, \"p50_ns\": %llu, "
+			  "\"p90_ns\": %llu, \"p99_ns\": %llu, "
+			  "\"max_ns\": %llu}",
+			  i ? "," : "", capture_stage_name(i),
+			  (unsigned long long)stage->count,
+			  (unsigned long long)stage->mean_ns,
+			  (unsigned long long)stage->p50_ns,
+			  (unsigned long long)stage->p90_ns,
+			  (unsigned long long)stage->p99_ns,
+			  (unsigned long long)stage->max_ns);
+	}
+	dstr_cat(&json, "\n  },\n  \"counters\": {");
+	for (int i = 0; i < CAPTURE_COUNTER_COUNT; i++)
+		dstr_catf(&json,
+			  "%s\n    \"%s\": {\"period\": %llu, "
+			  "\"total\": %llu}",
+			  i ? "," : "", capture_counter_name(i),
+			  (unsigned long long)summary->counters[i],
+			  (unsigned long long)summary->totals[i]);
+	dstr_cat(&json, "\n  },\n  \"gauges\": {");
+	for (int i = 0; i < CAPTURE_GAUGE_COUNT; i++)
+		dstr_catf(&json, "%s\n    \"%s\": %llu", i ? "," : "",
+			  capture_gauge_name(i),
+			  (unsigned long long)summary->gauges[i]);
+	dstr_cat(&json, "\n  },\n  \"memory\": {");
+	for (int i = 0; i < CAPTURE_MEMORY_KIND_COUNT; i++)
+		dstr_catf(&json, "\n    \"%s\": %llu,",
+			  capture_memory_kind_name(i),
+			  (unsigned long long)capture_memory_used(i));
+	dstr_catf(&json, "\n    \"total\": %llu,\n    \"budget\": %llu",
+		  (unsigned long long)capture_memory_total(),
+		  (unsigned long long)capture_memory_budget());
+	dstr_cat(&json, "\n  }\n}\n");
+
+	if (!filter->stats_sink)
+		filter->stats_sink = file_sink_create();
+	// copied, the sink skips it if the last one has not been written yet
+	if (!file_sink_write(filter->stats_sink, path, FILE_SINK_ATOMIC, NULL,
+			     0, (const uint8_t *)json.array, json.len, NULL,
+			     NULL))
+		warn("%s: could not queue the statistics file %s", name, path);
+	dstr_free(&json);
+}
+
+static double ns_to_ms(uint64_t ns)
+{
+	return (double)ns / 1000000.0;
+}
+
+static double bytes_to_mib(uint64_t bytes)
+{
+	return (double)bytes / (1024.0 * 1024.0);
+}
+
+// logs the memory held by all screenshot filters together
+static void report_memory(const char *name)
+{
+	struct dstr kinds = {0};
+	for (int i = 0; i < CAPTURE_MEMORY_KIND_COUNT; i++)
+		dstr_catf(&kinds, "%s%s %.1f", i ? ", " : "",
+			  capture_memory_kind_name(i),
+			  bytes_to_mib(capture_memory_used(i)));
+
+	uint64_t total = capture_memory_total();
+	uint64_t budget = capture_memory_budget();
+	if (!budget)
+		info("%s: all filters hold %.1f MiB (%s)", name,
+		     bytes_to_mib(total), kinds.array);
+	else if (total <= budget)
+		info("%s: all filters hold %.1f of %.0f MiB (%s)", name,
+		     bytes_to_mib(total), bytes_to_mib(budget), kinds.array);
+	else
+		warn("%s: all filters hold %.1f MiB, over the budget of "
+		     "%.0f MiB (%s)",
+		     name, bytes_to_mib(total), bytes_to_mib(budget),
+		     kinds.array);
+	dstr_free(&kinds);
+}
+
+// logs what was captured since the last report every stats_interval, and
+// writes the stats file
+static void report_stats(struct screenshot_filter_data *filter,
+			 const char *name)
+{
+	const struct filter_settings *settings = filter->settings;
+	uint64_t now = os_gettime_ns();
+
+	if (!settings->stats_interval ||
+	    now - filter->stats_report_time < settings->stats_interval)
+		return;
+	filter->stats_report_time = now;
+
+	struct capture_stats_summary summary;
+	if (capture_stats_collect(filter->stats, &summary)) {
+		const uint64_t *counters = summary.counters;
+		info("%s: in the last %.0f s captured %llu, encoded %llu, "
+		     "dropped %llu, failed %llu, left out %llu unchanged, "
+		     "wrote %.1f MiB",
+		     name, (double)summary.period_ns / 1000000000.0,
+		     (unsigned long long)counters[CAPTURE_COUNTER_CAPTURED],
+		     (unsigned long long)counters[CAPTURE_COUNTER_ENCODED],
+		     (unsigned long long)counters[CAPTURE_COUNTER_DROPPED],
+		     (unsigned long long)counters[CAPTURE_COUNTER_FAILED],
+		     (unsigned long long)counters[CAPTURE_COUNTER_UNCHANGED],
+		     (double)counters[CAPTURE_COUNTER_BYTES] /
+			     (1024.0 * 1024.0));
+
+		for (int i = 0; i < CAPTURE_STAGE_COUNT; i++) {
+			const struct capture_stage_summary *stage =
+				&summary.stages[i];
+			if (!stage->count)
+				continue;
+			info("%s:   %-6s %6llu x, mean %.2f ms, p50 %.2f, "
+			     "p90 %.2f, p99 %.2f, max %.2f",
+			     name, capture_stage_name(i),
+			     (unsigned long long)stage->count,
+			     ns_to_ms(stage->mean_ns), ns_to_ms(stage->p50_ns),
+			     ns_to_ms(stage->p90_ns), ns_to_ms(stage->p99_ns),
+			     ns_to_ms(stage->max_ns));
 		}
-		Sleep(200);
 	}
-	filter->exited = true;
 
-	return 0;
+	uint64_t history_max_bytes =
+		settings->history ? settings->history_max_bytes : 0;
+	if (history_max_bytes) {
+		const uint64_t *gauges = summary.gauges;
+		info("%s: history holds %llu frames in %.1f of %.0f MiB", name,
+		     (unsigned long long)gauges[CAPTURE_GAUGE_HISTORY_FRAMES],
+		     (double)gauges[CAPTURE_GAUGE_HISTORY_BYTES] /
+			     (1024.0 * 1024.0),
+		     (double)history_max_bytes / (1024.0 * 1024.0));
+	}
+	report_memory(name);
+
+	if (settings->stats_file && *settings->stats_file)
+		write_stats_file(filter, name, settings->stats_file, &summary);
 }
 
 static const char *screenshot_filter_get_name(void *unused)
@@ -143,6 +484,106 @@ static const char *screenshot_filter_get_name(void *unused)
 	return "Screenshot Filter";
 }
 
+static void update_schedule_visibility(obs_properties_t *props,
+				       obs_data_t *settings)
+{
+	int type = (int)obs_data_get_int(settings, SETTING_DESTINATION_TYPE);
+	bool history = obs_data_get_bool(settings, SETTING_HISTORY);
+	bool timer = !history &&
+		     (obs_data_get_bool(settings, SETTING_TIMER) ||
+		      type == SETTING_DESTINATION_SHMEM_ID);
+	int schedule = (int)obs_data_get_int(settings, SETTING_SCHEDULE);
+
+	obs_property_set_visible(obs_properties_get(props, SETTING_SCHEDULE),
+				 timer);
+	obs_property_set_visible(
+		obs_properties_get(props, SETTING_INTERVAL),
+		timer && schedule == SETTING_SCHEDULE_INTERVAL_ID);
+	obs_property_set_visible(
+		obs_properties_get(props, SETTING_SCHEDULE_RATE),
+		timer && schedule == SETTING_SCHEDULE_RATE_ID);
+	obs_property_set_visible(
+		obs_properties_get(props, SETTING_SCHEDULE_FRAMES),
+		timer && schedule == SETTING_SCHEDULE_FRAMES_ID);
+
+	bool change = obs_data_get_bool(settings, SETTING_CHANGE_DETECT);
+	obs_property_set_visible(
+		obs_properties_get(props, SETTING_CHANGE_THRESHOLD), change);
+	obs_property_set_visible(obs_properties_get(props, SETTING_CHANGE_MASK),
+				 change);
+	obs_property_set_visible(
+		obs_properties_get(props, SETTING_CHANGE_MAX_SILENCE), change);
+
+	obs_property_set_visible(obs_properties_get(props,
+						    SETTING_BURST_FRAMES),
+				 !history);
+	obs_property_set_visible(obs_properties_get(props,
+						    SETTING_HISTORY_BEFORE),
+				 history);
+	obs_property_set_visible(obs_properties_get(props,
+						    SETTING_HISTORY_AFTER),
+				 history);
+	obs_property_set_visible(obs_properties_get(props,
+						    SETTING_HISTORY_RATE),
+				 history);
+	obs_property_set_visible(obs_properties_get(props,
+						    SETTING_HISTORY_SCALE),
+				 history);
+	obs_property_set_visible(obs_properties_get(props,
+						    SETTING_HISTORY_CODEC),
+				 history);
+	obs_property_set_visible(obs_properties_get(props,
+						    SETTING_HISTORY_MEMORY),
+				 history);
+}
+
+static void update_codec_visibility(obs_properties_t *props,
+				    obs_data_t *settings)
+{
+	int type = (int)obs_data_get_int(settings, SETTING_DESTINATION_TYPE);
+	bool encoded = type != SETTING_DESTINATION_SHMEM_ID &&
+		       !obs_data_get_bool(settings, SETTING_RAW);
+	int codec = (int)obs_data_get_int(settings, SETTING_CODEC);
+	bool delta = obs_data_get_bool(settings, SETTING_DELTA);
+	enum pixel_format format = (enum pixel_format)obs_data_get_int(
+		settings, SETTING_PIXEL_FORMAT);
+	bool tiled = !encoded && pixel_format_bytes_per_pixel(format) == 4;
+
+	obs_property_set_visible(obs_properties_get(props,
+						    SETTING_PIXEL_FORMAT),
+				 !encoded);
+	obs_property_set_visible(
+		obs_properties_get(props, SETTING_RAW_CHECKSUM),
+		!encoded && type != SETTING_DESTINATION_SHMEM_ID);
+	obs_property_set_visible(obs_properties_get(props, SETTING_DELTA),
+				 tiled);
+	obs_property_set_visible(
+		obs_properties_get(props, SETTING_DELTA_KEYFRAME_INTERVAL),
+		tiled && delta);
+
+	obs_property_set_visible(obs_properties_get(props, SETTING_CODEC),
+				 encoded);
+	obs_property_set_visible(
+		obs_properties_get(props, SETTING_COMPRESSION_LEVEL),
+		encoded && (codec == IMAGE_CODEC_PNG ||
+			    codec == IMAGE_CODEC_WEBP_LOSSLESS));
+	obs_property_set_visible(obs_properties_get(props,
+						    SETTING_PNG_PREDICTION),
+				 encoded && codec == IMAGE_CODEC_PNG);
+	obs_property_set_visible(obs_properties_get(props,
+						    SETTING_JPEG_QUALITY),
+				 encoded && codec == IMAGE_CODEC_JPEG);
+}
+
+static bool is_codec_modified(obs_properties_t *props, obs_property_t *unused,
+			      obs_data_t *settings)
+{
+	UNUSED_PARAMETER(unused);
+
+	update_codec_visibility(props, settings);
+	return true;
+}
+
 static bool is_dest_modified(obs_properties_t *props, obs_property_t *unused,
 			     obs_data_t *settings)
 {
@@ -158,9 +599,43 @@ static bool is_dest_modified(obs_properties_t *props, obs_property_t *unused,
 	obs_property_set_visible(obs_properties_get(props,
 						    SETTING_DESTINATION_URL),
 				 type == SETTING_DESTINATION_URL_ID);
+	obs_property_set_visible(obs_properties_get(props, SETTING_URL_CHUNKED),
+				 type == SETTING_DESTINATION_URL_ID);
+	obs_property_set_visible(obs_properties_get(props, SETTING_SERVER_PORT),
+				 type == SETTING_DESTINATION_SERVER_ID);
+	obs_property_set_visible(obs_properties_get(props,
+						    SETTING_SERVER_LOCAL_ONLY),
+				 type == SETTING_DESTINATION_SERVER_ID);
 	obs_property_set_visible(obs_properties_get(props,
 						    SETTING_DESTINATION_SHMEM),
 				 type == SETTING_DESTINATION_SHMEM_ID);
+	obs_property_set_visible(obs_properties_get(props, SETTING_SHMEM_SLOTS),
+				 type == SETTING_DESTINATION_SHMEM_ID);
+	obs_property_set_visible(obs_properties_get(props,
+						    SETTING_DESTINATION_LOG),
+				 type == SETTING_DESTINATION_LOG_ID);
+	obs_property_set_visible(obs_properties_get(props,
+						    SETTING_LOG_SEGMENT_SIZE),
+				 type == SETTING_DESTINATION_LOG_ID);
+	obs_property_set_visible(
+		obs_properties_get(props, SETTING_LOG_SEGMENT_DURATION),
+		type == SETTING_DESTINATION_LOG_ID);
+	obs_property_set_visible(obs_properties_get(props,
+						    SETTING_LOG_PREALLOCATE),
+				 type == SETTING_DESTINATION_LOG_ID);
+	obs_property_set_visible(obs_properties_get(props,
+						    SETTING_ATOMIC_WRITE),
+				 type == SETTING_DESTINATION_PATH_ID);
+
+	bool files = capture_destination_is_file(type);
+	int fsync_policy =
+		(int)obs_data_get_int(settings, SETTING_FSYNC_POLICY);
+	obs_property_set_visible(obs_properties_get(props,
+						    SETTING_FSYNC_POLICY),
+				 files);
+	obs_property_set_visible(
+		obs_properties_get(props, SETTING_FSYNC_FRAMES),
+		files && fsync_policy == SETTING_FSYNC_FRAMES_ID);
 
 	obs_property_set_visible(obs_properties_get(props, SETTING_RAW),
 				 type != SETTING_DESTINATION_SHMEM_ID);
@@ -168,25 +643,125 @@ static bool is_dest_modified(obs_properties_t *props, obs_property_t *unused,
 	obs_property_set_visible(obs_properties_get(props, SETTING_TIMER),
 				 type != SETTING_DESTINATION_SHMEM_ID);
 
-	bool is_timer_enable = obs_data_get_bool(settings, SETTING_TIMER);
-	obs_property_set_visible(obs_properties_get(props, SETTING_INTERVAL),
-				 is_timer_enable ||
-					 type == SETTING_DESTINATION_SHMEM_ID);
+	update_schedule_visibility(props, settings);
+	update_codec_visibility(props, settings);
+
+	return true;
+}
+
+static bool is_scale_modified(obs_properties_t *props, obs_property_t *unused,
+			      obs_data_t *settings)
+{
+	UNUSED_PARAMETER(unused);
+
+	int scale = (int)obs_data_get_int(settings, SETTING_SCALE);
+	obs_property_set_visible(obs_properties_get(props, SETTING_SCALE_WIDTH),
+				 scale == SETTING_SCALE_SIZE_ID);
+	obs_property_set_visible(obs_properties_get(props,
+						    SETTING_SCALE_HEIGHT),
+				 scale == SETTING_SCALE_SIZE_ID);
+	obs_property_set_visible(obs_properties_get(props,
+						    SETTING_SCALE_FACTOR),
+				 scale == SETTING_SCALE_FACTOR_ID);
+
+	return true;
+}
+
+static void region_setting(char *name, size_t size, uint32_t region,
+			   const char *setting)
+{
+	snprintf(name, size, "region%u_%s", region + 1, setting);
+}
+
+static bool is_region_count_modified(obs_properties_t *props,
+				     obs_property_t *unused,
+				     obs_data_t *settings)
+{
+	UNUSED_PARAMETER(unused);
+
+	uint32_t count =
+		(uint32_t)obs_data_get_int(settings, SETTING_REGION_COUNT);
+	for (uint32_t i = 0; i < MAX_REGIONS; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "region%u", i + 1);
+		obs_property_set_visible(obs_properties_get(props, name),
+					 i < count);
+	}
 
 	return true;
 }
 
+static void add_region_properties(obs_properties_t *props, uint32_t i)
+{
+	obs_properties_t *group = obs_properties_create();
+	obs_property_t *p;
+	char name[64];
+	char description[32];
+
+	region_setting(name, sizeof(name), i, SETTING_REGION_X);
+	obs_properties_add_int(group, name, "X", 0, 16384, 1);
+	region_setting(name, sizeof(name), i, SETTING_REGION_Y);
+	obs_properties_add_int(group, name, "Y", 0, 16384, 1);
+	region_setting(name, sizeof(name), i, SETTING_REGION_WIDTH);
+	obs_properties_add_int(group, name, "Width (0 = to the edge)", 0,
+			       16384, 1);
+	region_setting(name, sizeof(name), i, SETTING_REGION_HEIGHT);
+	obs_properties_add_int(group, name, "Height (0 = to the edge)", 0,
+			       16384, 1);
+
+	region_setting(name, sizeof(name), i, SETTING_REGION_DESTINATION_TYPE);
+	p = obs_properties_add_list(group, name, "Destination Type",
+				    OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(p, "Output to folder",
+				  SETTING_DESTINATION_FOLDER_ID);
+	obs_property_list_add_int(p, "Output to file",
+				  SETTING_DESTINATION_PATH_ID);
+	obs_property_list_add_int(p, "Output to URL",
+				  SETTING_DESTINATION_URL_ID);
+	obs_property_list_add_int(p, "Output to Named Shared Memory",
+				  SETTING_DESTINATION_SHMEM_ID);
+	obs_property_list_add_int(p, "Output to frame log",
+				  SETTING_DESTINATION_LOG_ID);
+
+	region_setting(name, sizeof(name), i, SETTING_REGION_DESTINATION);
+	p = obs_properties_add_text(group, name, "Destination",
+				    OBS_TEXT_DEFAULT);
+	obs_property_set_long_description(
+		p,
+		"Folder, file path, URL, shared memory name or frame log folder");
+
+	region_setting(name, sizeof(name), i, SETTING_REGION_FORMAT);
+	p = obs_properties_add_list(group, name, "Image format",
+				    OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(p, "PNG", IMAGE_CODEC_PNG);
+	if (image_codec_available(IMAGE_CODEC_QOI))
+		obs_property_list_add_int(p, "QOI", IMAGE_CODEC_QOI);
+	if (image_codec_available(IMAGE_CODEC_JPEG))
+		obs_property_list_add_int(p, "JPEG", IMAGE_CODEC_JPEG);
+	if (image_codec_available(IMAGE_CODEC_WEBP_LOSSLESS))
+		obs_property_list_add_int(p, "WebP (lossless)",
+					  IMAGE_CODEC_WEBP_LOSSLESS);
+	obs_property_list_add_int(p, "Raw", SETTING_REGION_FORMAT_RAW_ID);
+
+	region_setting(name, sizeof(name), i, SETTING_REGION_INTERVAL);
+	p = obs_properties_add_float(group, name, "Interval (seconds)", 0,
+				     86400, 0.25);
+	obs_property_set_long_description(
+		p, "0 captures the region whenever the whole source is captured");
+
+	snprintf(name, sizeof(name), "region%u", i + 1);
+	snprintf(description, sizeof(description), "Region %u", i + 1);
+	obs_properties_add_group(props, name, description, OBS_GROUP_NORMAL,
+				 group);
+}
+
 static bool is_timer_enable_modified(obs_properties_t *props,
 				     obs_property_t *unused,
 				     obs_data_t *settings)
 {
 	UNUSED_PARAMETER(unused);
 
-	int type = (int)obs_data_get_int(settings, SETTING_DESTINATION_TYPE);
-	bool is_timer_enable = obs_data_get_bool(settings, SETTING_TIMER);
-	obs_property_set_visible(obs_properties_get(props, SETTING_INTERVAL),
-				 is_timer_enable ||
-					 type == SETTING_DESTINATION_SHMEM_ID);
+	update_schedule_visibility(props, settings);
 
 	return true;
 }
@@ -206,8 +781,12 @@ static obs_properties_t *screenshot_filter_properties(void *data)
 				  SETTING_DESTINATION_PATH_ID);
 	obs_property_list_add_int(p, "Output to URL",
 				  SETTING_DESTINATION_URL_ID);
+	obs_property_list_add_int(p, "Serve over HTTP",
+				  SETTING_DESTINATION_SERVER_ID);
 	obs_property_list_add_int(p, "Output to Named Shared Memory",
 				  SETTING_DESTINATION_SHMEM_ID);
+	obs_property_list_add_int(p, "Output to frame log",
+				  SETTING_DESTINATION_LOG_ID);
 
 	obs_property_set_modified_callback(p, is_dest_modified);
 	obs_properties_add_path(props, SETTING_DESTINATION_FOLDER,
@@ -217,18 +796,309 @@ static obs_properties_t *screenshot_filter_properties(void *data)
 				OBS_PATH_FILE_SAVE, "*.*", NULL);
 	obs_properties_add_text(props, SETTING_DESTINATION_URL,
 				"Destination (url)", OBS_TEXT_DEFAULT);
+	obs_property_t *p_chunked = obs_properties_add_bool(
+		props, SETTING_URL_CHUNKED, "Chunked upload of large images");
+	obs_property_set_long_description(
+		p_chunked,
+		"Send images larger than 256 KiB with chunked transfer encoding. The server must support chunked request bodies");
+	obs_properties_add_int(props, SETTING_SERVER_PORT, "Server port", 1,
+			       65535, 1);
+	obs_property_t *p_local = obs_properties_add_bool(
+		props, SETTING_SERVER_LOCAL_ONLY, "Only accept local connections");
+	obs_property_set_long_description(
+		p_local,
+		"Listen on 127.0.0.1 only. When unchecked, anyone on the network can view the source");
 	obs_properties_add_text(props, SETTING_DESTINATION_SHMEM,
 				"Shared Memory Name", OBS_TEXT_DEFAULT);
+	obs_properties_add_int(props, SETTING_SHMEM_SLOTS,
+			       "Shared Memory Slots", SHMEM_RING_MIN_SLOTS,
+			       SHMEM_RING_MAX_SLOTS, 1);
+	obs_property_t *p_log = obs_properties_add_path(
+		props, SETTING_DESTINATION_LOG, "Destination (frame log folder)",
+		OBS_PATH_DIRECTORY, "*.*", NULL);
+	obs_property_set_long_description(
+		p_log,
+		"Append frames to .sslog files with a .ssidx index of their offsets and timestamps, see frame-log.h for the format");
+	obs_properties_add_int(props, SETTING_LOG_SEGMENT_SIZE,
+			       "Segment size (MB)", 1, 1048576, 1);
+	obs_property_t *p_log_duration = obs_properties_add_int(
+		props, SETTING_LOG_SEGMENT_DURATION, "Segment length (minutes)",
+		0, 10080, 1);
+	obs_property_set_long_description(
+		p_log_duration, "0 only starts a new segment when one is full");
+	obs_property_t *p_preallocate = obs_properties_add_bool(
+		props, SETTING_LOG_PREALLOCATE, "Preallocate segments");
+	obs_property_set_long_description(
+		p_preallocate,
+		"Reserve the disk space of a full segment when it is started, so that it is less fragmented. Space that is not used is given back when the segment is closed");
+	obs_property_t *p_atomic = obs_properties_add_bool(
+		props, SETTING_ATOMIC_WRITE, "Replace the file atomically");
+	obs_property_set_long_description(
+		p_atomic,
+		"Write each image to a .tmp file next to the destination and rename it over the destination once complete, so programs reading the file never see a partial image");
+	obs_property_t *p_fsync = obs_properties_add_list(
+		props, SETTING_FSYNC_POLICY, "Flush to disk",
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(p_fsync, "Never (leave it to the system)",
+				  SETTING_FSYNC_NONE_ID);
+	obs_property_list_add_int(p_fsync, "Every N frames",
+				  SETTING_FSYNC_FRAMES_ID);
+	obs_property_list_add_int(p_fsync, "Every segment or file",
+				  SETTING_FSYNC_SEGMENT_ID);
+	obs_property_set_long_description(
+		p_fsync,
+		"How often written images are flushed to disk, so that they survive a crash or power loss. Flushing costs disk time but never holds up capturing");
+	obs_property_set_modified_callback(p_fsync, is_dest_modified);
+	obs_properties_add_int(props, SETTING_FSYNC_FRAMES,
+			       "Flush every (frames)", 1, 10000, 1);
 
 	obs_property_t *p_enable_timer =
 		obs_properties_add_bool(props, SETTING_TIMER, "Enable timer");
 	obs_property_set_modified_callback(p_enable_timer,
 					   is_timer_enable_modified);
 
+	obs_property_t *p_schedule = obs_properties_add_list(
+		props, SETTING_SCHEDULE, "Capture every", OBS_COMBO_TYPE_LIST,
+		OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(p_schedule, "Interval",
+				  SETTING_SCHEDULE_INTERVAL_ID);
+	obs_property_list_add_int(p_schedule, "Fixed rate",
+				  SETTING_SCHEDULE_RATE_ID);
+	obs_property_list_add_int(p_schedule, "N video frames",
+				  SETTING_SCHEDULE_FRAMES_ID);
+	obs_property_set_long_description(
+		p_schedule,
+		"Captures are timed by the video frames OBS renders, so they do not drift. An interval or rate that is not a whole number of frames is captured on the closest frame");
+	obs_property_set_modified_callback(p_schedule,
+					   is_timer_enable_modified);
+
 	obs_properties_add_float(props, SETTING_INTERVAL, "Interval (seconds)",
 				 0.25, 86400, 0.25);
-
-	obs_properties_add_bool(props, SETTING_RAW, "Raw image");
+	obs_properties_add_float(props, SETTING_SCHEDULE_RATE,
+				 "Captures per second", 0.01, 240, 1);
+	obs_property_t *p_frames = obs_properties_add_int(
+		props, SETTING_SCHEDULE_FRAMES, "Every N frames", 1, 100000, 1);
+	obs_property_set_long_description(
+		p_frames,
+		"1 captures every frame at the full frame rate, 2 every other frame and so on");
+
+	obs_property_t *p_burst = obs_properties_add_int(
+		props, SETTING_BURST_FRAMES, "Frames per capture", 1,
+		ENCODE_QUEUE_MAX_DEPTH, 1);
+	obs_property_set_long_description(
+		p_burst,
+		"Capture this many consecutive frames on every hotkey press or timer capture, at the full frame rate. Their memory is allocated ahead of time and they are encoded and written in the background. Use a folder, frame log, URL or the server as the destination, a file only keeps the last frame");
+
+	obs_property_t *p_change =
+		obs_properties_add_bool(props, SETTING_CHANGE_DETECT,
+					"Only capture when the image changes");
+	obs_property_set_long_description(
+		p_change,
+		"Compare every scheduled capture with the last image output and leave it out if nothing changed. Captures of the hotkey are always output");
+	obs_property_set_modified_callback(p_change, is_timer_enable_modified);
+	obs_property_t *p_threshold = obs_properties_add_int_slider(
+		props, SETTING_CHANGE_THRESHOLD, "Change threshold", 0, 64, 1);
+	obs_property_set_long_description(
+		p_threshold,
+		"How much a 16x16 pixel block must differ on average per color channel, out of 255, to count as changed. 0 counts any difference, raise it to ignore noise from video sources");
+	obs_property_t *p_mask = obs_properties_add_text(
+		props, SETTING_CHANGE_MASK, "Compared areas", OBS_TEXT_DEFAULT);
+	obs_property_set_long_description(
+		p_mask,
+		"Rectangles of the source as x,y,width,height separated by spaces, e.g. \"0,0,1920,980 -1800,0,120,40\". Only the rectangles are compared, or the whole source if there are none, and those starting with - are ignored. A width or height of 0 extends to the edge");
+	obs_property_t *p_silence = obs_properties_add_float(
+		props, SETTING_CHANGE_MAX_SILENCE,
+		"Capture anyway after (seconds)", 0, 86400, 1);
+	obs_property_set_long_description(
+		p_silence,
+		"Output a capture even if nothing changed once this long has passed since the last one, 0 never does");
+
+	obs_property_t *p_history = obs_properties_add_bool(
+		props, SETTING_HISTORY, "Keep a history before the hotkey");
+	obs_property_set_long_description(
+		p_history,
+		"Keep the last seconds of the source in memory as small compressed images, and write them together with the seconds after it when the hotkey is pressed. Replaces the timer, use a folder, frame log or URL as the destination");
+	obs_property_set_modified_callback(p_history, is_timer_enable_modified);
+	obs_properties_add_float(props, SETTING_HISTORY_BEFORE,
+				 "Seconds before the hotkey", 0, 600, 1);
+	obs_properties_add_float(props, SETTING_HISTORY_AFTER,
+				 "Seconds after the hotkey", 0, 600, 1);
+	obs_properties_add_float(props, SETTING_HISTORY_RATE,
+				 "History frames per second", 0.1, 60, 1);
+	obs_properties_add_float_slider(props, SETTING_HISTORY_SCALE,
+					"History scale factor", 0.05, 1.0, 0.05);
+	obs_property_t *p_history_codec = obs_properties_add_list(
+		props, SETTING_HISTORY_CODEC, "History image format",
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	if (image_codec_available(IMAGE_CODEC_QOI))
+		obs_property_list_add_int(p_history_codec, "QOI (lossless)",
+					  IMAGE_CODEC_QOI);
+	if (image_codec_available(IMAGE_CODEC_JPEG))
+		obs_property_list_add_int(p_history_codec, "JPEG",
+					  IMAGE_CODEC_JPEG);
+	obs_property_list_add_int(p_history_codec, "PNG", IMAGE_CODEC_PNG);
+	obs_property_set_long_description(
+		p_history_codec,
+		"QOI encodes fastest, JPEG at a high quality keeps the most frames in the same memory");
+	obs_property_t *p_history_memory = obs_properties_add_int(
+		props, SETTING_HISTORY_MEMORY, "History memory (MB)", 1, 65536,
+		1);
+	obs_property_set_long_description(
+		p_history_memory,
+		"The oldest frames are dropped to keep the compressed images under this size, which may shorten the history");
+
+	obs_property_t *p_raw =
+		obs_properties_add_bool(props, SETTING_RAW, "Raw image");
+	obs_property_set_modified_callback(p_raw, is_codec_modified);
+
+	obs_property_t *p_checksum = obs_properties_add_bool(
+		props, SETTING_RAW_CHECKSUM, "Checksum raw files");
+	obs_property_set_long_description(
+		p_checksum,
+		"Store a checksum of the pixels in the header of .raw files, so readers can detect torn or damaged frames, see raw-frame.h");
+
+	obs_property_t *p_format = obs_properties_add_list(
+		props, SETTING_PIXEL_FORMAT, "Pixel format",
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(p_format, "RGBA", PIXEL_FORMAT_RGBA);
+	obs_property_list_add_int(p_format, "BGRA", PIXEL_FORMAT_BGRA);
+	obs_property_list_add_int(p_format, "RGB (24 bit)", PIXEL_FORMAT_RGB24);
+	obs_property_list_add_int(p_format, "Grayscale (8 bit)",
+				  PIXEL_FORMAT_GRAY8);
+	obs_property_list_add_int(p_format, "YUV 4:2:0 (planar)",
+				  PIXEL_FORMAT_YUV420);
+	obs_property_set_long_description(
+		p_format,
+		"Pixel layout of raw frames. Frames other than RGBA are converted while they are copied from the GPU and are tightly packed");
+	obs_property_set_modified_callback(p_format, is_codec_modified);
+
+	obs_property_t *p_delta = obs_properties_add_bool(
+		props, SETTING_DELTA, "Only send changed tiles (delta)");
+	obs_property_set_long_description(
+		p_delta,
+		"Split frames into 32x32 tiles and only send the tiles that changed since the previous frame, see delta-frame.h for the format");
+	obs_property_set_modified_callback(p_delta, is_codec_modified);
+	obs_properties_add_int(props, SETTING_DELTA_KEYFRAME_INTERVAL,
+			       "Keyframe every (frames)", 1, 10000, 1);
+
+	obs_property_t *p_scale = obs_properties_add_list(
+		props, SETTING_SCALE, "Output size", OBS_COMBO_TYPE_LIST,
+		OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(p_scale, "Source size",
+				  SETTING_SCALE_NONE_ID);
+	obs_property_list_add_int(p_scale, "Fixed size", SETTING_SCALE_SIZE_ID);
+	obs_property_list_add_int(p_scale, "Scale factor",
+				  SETTING_SCALE_FACTOR_ID);
+	obs_property_set_modified_callback(p_scale, is_scale_modified);
+	obs_property_t *p_scale_width = obs_properties_add_int(
+		props, SETTING_SCALE_WIDTH, "Output width", 0, 16384, 1);
+	obs_property_set_long_description(
+		p_scale_width, "0 keeps the aspect ratio of the source");
+	obs_property_t *p_scale_height = obs_properties_add_int(
+		props, SETTING_SCALE_HEIGHT, "Output height", 0, 16384, 1);
+	obs_property_set_long_description(
+		p_scale_height, "0 keeps the aspect ratio of the source");
+	obs_properties_add_float_slider(props, SETTING_SCALE_FACTOR,
+					"Scale factor", 0.01, 1.0, 0.01);
+	obs_property_t *p_pyramid = obs_properties_add_bool(
+		props, SETTING_PYRAMID, "Also output 1/2, 1/4 and 1/8 size");
+	obs_property_set_long_description(
+		p_pyramid,
+		"Output a thumbnail pyramid of every frame, each level scaled from the one before. Levels are named with a -half, -quarter and -eighth suffix");
+
+	obs_property_t *p_codec = obs_properties_add_list(
+		props, SETTING_CODEC, "Image format", OBS_COMBO_TYPE_LIST,
+		OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(p_codec, "PNG", IMAGE_CODEC_PNG);
+	if (image_codec_available(IMAGE_CODEC_QOI))
+		obs_property_list_add_int(p_codec, "QOI", IMAGE_CODEC_QOI);
+	if (image_codec_available(IMAGE_CODEC_JPEG))
+		obs_property_list_add_int(p_codec, "JPEG", IMAGE_CODEC_JPEG);
+	if (image_codec_available(IMAGE_CODEC_WEBP_LOSSLESS))
+		obs_property_list_add_int(p_codec, "WebP (lossless)",
+					  IMAGE_CODEC_WEBP_LOSSLESS);
+	obs_property_set_modified_callback(p_codec, is_codec_modified);
+
+	obs_property_t *p_level = obs_properties_add_int_slider(
+		props, SETTING_COMPRESSION_LEVEL, "Compression level", 0, 9, 1);
+	obs_property_set_long_description(
+		p_level,
+		"Lower levels encode faster and produce larger files. For PNG this is the zlib level");
+
+	obs_property_t *p_pred = obs_properties_add_list(
+		props, SETTING_PNG_PREDICTION, "PNG prediction",
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(p_pred, "None", IMAGE_PNG_PRED_NONE);
+	obs_property_list_add_int(p_pred, "Sub", IMAGE_PNG_PRED_SUB);
+	obs_property_list_add_int(p_pred, "Up", IMAGE_PNG_PRED_UP);
+	obs_property_list_add_int(p_pred, "Average", IMAGE_PNG_PRED_AVG);
+	obs_property_list_add_int(p_pred, "Paeth", IMAGE_PNG_PRED_PAETH);
+	obs_property_list_add_int(p_pred, "Mixed", IMAGE_PNG_PRED_MIXED);
+
+	obs_properties_add_int_slider(props, SETTING_JPEG_QUALITY,
+				      "JPEG quality", 1, 100, 1);
+
+	obs_property_t *p_regions = obs_properties_add_int(
+		props, SETTING_REGION_COUNT, "Regions", 0, MAX_REGIONS, 1);
+	obs_property_set_long_description(
+		p_regions,
+		"Crop rectangles of the source that are output separately. They share one capture and readback with the whole source, leave the destination above empty to only output regions");
+	obs_property_set_modified_callback(p_regions, is_region_count_modified);
+	for (uint32_t i = 0; i < MAX_REGIONS; i++)
+		add_region_properties(props, i);
+
+	obs_property_t *p_threads = obs_properties_add_int(
+		props, SETTING_ENCODER_THREADS, "Encoder threads (0 = auto)", 0,
+		ENCODE_POOL_MAX_THREADS, 1);
+	obs_property_set_long_description(
+		p_threads,
+		"Encoder threads are shared by all screenshot filters, the largest value set on any filter is used");
+
+	obs_properties_add_int(props, SETTING_QUEUE_DEPTH,
+			       "Max frames in flight", 1, ENCODE_QUEUE_MAX_DEPTH,
+			       1);
+	obs_property_t *p_policy = obs_properties_add_list(
+		props, SETTING_QUEUE_POLICY, "When the encoders fall behind",
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(p_policy, "Drop the oldest waiting frame",
+				  ENCODE_QUEUE_DROP_OLDEST);
+	obs_property_list_add_int(p_policy, "Drop the new frame",
+				  ENCODE_QUEUE_DROP_NEWEST);
+	obs_property_list_add_int(p_policy, "Wait (stalls rendering)",
+				  ENCODE_QUEUE_BLOCK);
+
+	obs_property_t *p_readback = obs_properties_add_int(
+		props, SETTING_READBACK_SURFACES, "Readback latency (frames)", 1,
+		READBACK_MAX_SURFACES, 1);
+	obs_property_set_long_description(
+		p_readback,
+		"Number of staging surfaces. Frames are read back from the GPU this many frames minus one after they are captured, so that rendering does not wait for the copy");
+
+	obs_property_t *p_idle = obs_properties_add_int(
+		props, SETTING_IDLE_RELEASE,
+		"Release memory when idle for (seconds)", 0, 86400, 1);
+	obs_property_set_long_description(
+		p_idle,
+		"Free the staging surfaces, buffers and shared memory after this long without a capture, they are created again by the next one. 0 keeps them unless the memory budget is exceeded");
+	obs_property_t *p_budget = obs_properties_add_int(
+		props, SETTING_MEMORY_BUDGET, "Memory budget (MB)", 0, 65536,
+		1);
+	obs_property_set_long_description(
+		p_budget,
+		"Memory all screenshot filters together should stay under, the smallest budget of any filter applies. Over it, spare buffers are freed and idle filters release their memory after a second. 0 sets no budget");
+
+	obs_property_t *p_stats = obs_properties_add_int(
+		props, SETTING_STATS_INTERVAL,
+		"Report statistics every (seconds)", 0, 86400, 1);
+	obs_property_set_long_description(
+		p_stats,
+		"Log how long each stage of capturing took and how many frames were captured, dropped or failed. 0 turns reports off");
+	obs_property_t *p_stats_file = obs_properties_add_path(
+		props, SETTING_STATS_FILE, "Statistics file",
+		OBS_PATH_FILE_SAVE, "JSON (*.json)", NULL);
+	obs_property_set_long_description(
+		p_stats_file,
+		"Also replace this file with the statistics as JSON at every report, for other programs to read");
 
 	return props;
 }
@@ -238,8 +1108,166 @@ static void screenshot_filter_defaults(obs_data_t *settings)
 	obs_data_set_default_double(settings, SETTING_DESTINATION_TYPE,
 				    SETTING_DESTINATION_FOLDER_ID);
 	obs_data_set_default_bool(settings, SETTING_TIMER, false);
+	obs_data_set_default_int(settings, SETTING_SCHEDULE,
+				 SETTING_SCHEDULE_INTERVAL_ID);
 	obs_data_set_default_double(settings, SETTING_INTERVAL, 2.0f);
+	obs_data_set_default_double(settings, SETTING_SCHEDULE_RATE, 10.0);
+	obs_data_set_default_int(settings, SETTING_SCHEDULE_FRAMES, 1);
+	obs_data_set_default_int(settings, SETTING_BURST_FRAMES, 1);
+	obs_data_set_default_bool(settings, SETTING_CHANGE_DETECT, false);
+	obs_data_set_default_int(settings, SETTING_CHANGE_THRESHOLD, 2);
+	obs_data_set_default_double(settings, SETTING_CHANGE_MAX_SILENCE, 60.0);
+	obs_data_set_default_bool(settings, SETTING_HISTORY, false);
+	obs_data_set_default_double(settings, SETTING_HISTORY_BEFORE, 10.0);
+	obs_data_set_default_double(settings, SETTING_HISTORY_AFTER, 5.0);
+	obs_data_set_default_double(settings, SETTING_HISTORY_RATE, 10.0);
+	obs_data_set_default_double(settings, SETTING_HISTORY_SCALE, 0.5);
+	obs_data_set_default_int(settings, SETTING_HISTORY_CODEC,
+				 image_codec_available(IMAGE_CODEC_QOI)
+					 ? IMAGE_CODEC_QOI
+					 : IMAGE_CODEC_PNG);
+	obs_data_set_default_int(settings, SETTING_HISTORY_MEMORY, 256);
 	obs_data_set_default_bool(settings, SETTING_RAW, false);
+	obs_data_set_default_bool(settings, SETTING_RAW_CHECKSUM, false);
+	obs_data_set_default_int(settings, SETTING_PIXEL_FORMAT,
+				 PIXEL_FORMAT_RGBA);
+	obs_data_set_default_bool(settings, SETTING_URL_CHUNKED, false);
+	obs_data_set_default_int(settings, SETTING_SERVER_PORT, 8765);
+	obs_data_set_default_bool(settings, SETTING_DELTA, false);
+	obs_data_set_default_int(settings, SETTING_DELTA_KEYFRAME_INTERVAL, 30);
+	obs_data_set_default_int(settings, SETTING_SCALE,
+				 SETTING_SCALE_NONE_ID);
+	obs_data_set_default_int(settings, SETTING_SCALE_WIDTH, 512);
+	obs_data_set_default_int(settings, SETTING_SCALE_HEIGHT, 0);
+	obs_data_set_default_double(settings, SETTING_SCALE_FACTOR, 0.5);
+	obs_data_set_default_bool(settings, SETTING_PYRAMID, false);
+	obs_data_set_default_int(settings, SETTING_REGION_COUNT, 0);
+	for (uint32_t i = 0; i < MAX_REGIONS; i++) {
+		char name[64];
+		region_setting(name, sizeof(name), i,
+			       SETTING_REGION_DESTINATION_TYPE);
+		obs_data_set_default_int(settings, name,
+					 SETTING_DESTINATION_FOLDER_ID);
+		region_setting(name, sizeof(name), i, SETTING_REGION_FORMAT);
+		obs_data_set_default_int(settings, name, IMAGE_CODEC_PNG);
+	}
+	obs_data_set_default_bool(settings, SETTING_SERVER_LOCAL_ONLY, true);
+	obs_data_set_default_int(settings, SETTING_SHMEM_SLOTS, 3);
+	obs_data_set_default_int(settings, SETTING_LOG_SEGMENT_SIZE, 1024);
+	obs_data_set_default_int(settings, SETTING_LOG_SEGMENT_DURATION, 0);
+	obs_data_set_default_bool(settings, SETTING_LOG_PREALLOCATE, false);
+	obs_data_set_default_bool(settings, SETTING_ATOMIC_WRITE, true);
+	obs_data_set_default_int(settings, SETTING_FSYNC_POLICY,
+				 SETTING_FSYNC_NONE_ID);
+	obs_data_set_default_int(settings, SETTING_FSYNC_FRAMES, 30);
+	obs_data_set_default_int(settings, SETTING_ENCODER_THREADS, 0);
+	obs_data_set_default_int(settings, SETTING_QUEUE_DEPTH, 4);
+	obs_data_set_default_int(settings, SETTING_QUEUE_POLICY,
+				 ENCODE_QUEUE_DROP_OLDEST);
+	obs_data_set_default_int(settings, SETTING_READBACK_SURFACES, 2);
+	obs_data_set_default_int(settings, SETTING_IDLE_RELEASE, 60);
+	obs_data_set_default_int(settings, SETTING_MEMORY_BUDGET, 0);
+	obs_data_set_default_int(settings, SETTING_STATS_INTERVAL, 60);
+
+	struct image_codec_settings codec;
+	image_codec_settings_init(&codec);
+	obs_data_set_default_int(settings, SETTING_CODEC, codec.codec);
+	obs_data_set_default_int(settings, SETTING_COMPRESSION_LEVEL,
+				 codec.level);
+	obs_data_set_default_int(settings, SETTING_PNG_PREDICTION,
+				 codec.png_prediction);
+	obs_data_set_default_int(settings, SETTING_JPEG_QUALITY,
+				 codec.jpeg_quality);
+}
+
+static uint64_t seconds_to_ns(double seconds)
+{
+	return seconds > 0.0 ? (uint64_t)(seconds * 1000000000.0 + 0.5) : 0;
+}
+
+// the history is written as a sequence of images, a file would only keep the
+// last one and the server and shared memory only ever show the latest
+static bool history_supported(int type)
+{
+	return type == SETTING_DESTINATION_FOLDER_ID ||
+	       type == SETTING_DESTINATION_URL_ID ||
+	       type == SETTING_DESTINATION_LOG_ID;
+}
+
+static void update_region(struct region_settings *region, uint32_t i,
+			  obs_data_t *settings)
+{
+	char name[64];
+
+	region_setting(name, sizeof(name), i, SETTING_REGION_X);
+	region->x = (uint32_t)obs_data_get_int(settings, name);
+	region_setting(name, sizeof(name), i, SETTING_REGION_Y);
+	region->y = (uint32_t)obs_data_get_int(settings, name);
+	region_setting(name, sizeof(name), i, SETTING_REGION_WIDTH);
+	region->width = (uint32_t)obs_data_get_int(settings, name);
+	region_setting(name, sizeof(name), i, SETTING_REGION_HEIGHT);
+	region->height = (uint32_t)obs_data_get_int(settings, name);
+
+	region_setting(name, sizeof(name), i, SETTING_REGION_DESTINATION_TYPE);
+	region->destination_type = (int)obs_data_get_int(settings, name);
+	region_setting(name, sizeof(name), i, SETTING_REGION_DESTINATION);
+	region->destination = bstrdup(obs_data_get_string(settings, name));
+
+	region_setting(name, sizeof(name), i, SETTING_REGION_FORMAT);
+	region->format = (int)obs_data_get_int(settings, name);
+	if (region->format != SETTING_REGION_FORMAT_RAW_ID &&
+	    !image_codec_available((enum image_codec)region->format))
+		region->format = IMAGE_CODEC_PNG;
+
+	region_setting(name, sizeof(name), i, SETTING_REGION_INTERVAL);
+	region->interval = (float)obs_data_get_double(settings, name);
+}
+
+static void free_settings(struct filter_settings *settings)
+{
+	if (!settings)
+		return;
+	for (size_t i = 0; i < MAX_REGIONS; i++)
+		bfree(settings->regions[i].destination);
+	bfree(settings->destination);
+	bfree(settings->stats_file);
+	bfree(settings);
+}
+
+// replaces the pending settings and returns those it replaced.  update()
+// publishes with it and tick takes them by putting NULL in their place
+static struct filter_settings *
+exchange_settings(struct screenshot_filter_data *filter,
+		  struct filter_settings *settings)
+{
+#ifdef _MSC_VER
+	return _InterlockedExchangePointer(
+		(void *volatile *)&filter->pending_settings, settings);
+#else
+	return __atomic_exchange_n(&filter->pending_settings, settings,
+				   __ATOMIC_ACQ_REL);
+#endif
+}
+
+// makes the settings update() published last the ones in use, on the
+// graphics thread
+static void take_settings(struct screenshot_filter_data *filter)
+{
+	struct filter_settings *settings = exchange_settings(filter, NULL);
+	if (!settings)
+		return;
+
+	free_settings(filter->settings);
+	filter->settings = settings;
+
+	capture_schedule_set(&filter->schedule, settings->schedule_mode,
+			     settings->schedule_period);
+	for (uint32_t i = 0; i < MAX_REGIONS; i++)
+		capture_schedule_set(
+			&filter->regions[i].schedule,
+			CAPTURE_SCHEDULE_INTERVAL,
+			seconds_to_ns(settings->regions[i].interval));
+	filter->reserve = true;
 }
 
 static void screenshot_filter_update(void *data, obs_data_t *settings)
@@ -255,30 +1283,188 @@ static void screenshot_filter_update(void *data, obs_data_t *settings)
 		obs_data_get_string(settings, SETTING_DESTINATION_SHMEM);
 	const char *folder_path =
 		obs_data_get_string(settings, SETTING_DESTINATION_FOLDER);
+	const char *log_path =
+		obs_data_get_string(settings, SETTING_DESTINATION_LOG);
 	bool is_timer_enabled = obs_data_get_bool(settings, SETTING_TIMER);
 
-	WaitForSingleObject(filter->mutex, INFINITE);
+	enum capture_schedule_mode schedule_mode = CAPTURE_SCHEDULE_INTERVAL;
+	uint64_t schedule_period;
+	int schedule = (int)obs_data_get_int(settings, SETTING_SCHEDULE);
+	if (schedule == SETTING_SCHEDULE_FRAMES_ID) {
+		schedule_mode = CAPTURE_SCHEDULE_FRAMES;
+		schedule_period = (uint64_t)obs_data_get_int(
+			settings, SETTING_SCHEDULE_FRAMES);
+	} else if (schedule == SETTING_SCHEDULE_RATE_ID) {
+		double rate =
+			obs_data_get_double(settings, SETTING_SCHEDULE_RATE);
+		schedule_period = rate > 0.0 ? seconds_to_ns(1.0 / rate) : 0;
+	} else {
+		schedule_period = seconds_to_ns(
+			obs_data_get_double(settings, SETTING_INTERVAL));
+	}
+
+	bool history = obs_data_get_bool(settings, SETTING_HISTORY);
+	if (history && !history_supported(type)) {
+		warn("Not keeping a history, it can only be written to a "
+		     "folder, frame log or URL");
+		history = false;
+	}
+	if (history) {
+		double rate =
+			obs_data_get_double(settings, SETTING_HISTORY_RATE);
+		schedule_mode = CAPTURE_SCHEDULE_INTERVAL;
+		schedule_period = rate > 0.0 ? seconds_to_ns(1.0 / rate) : 0;
+	}
+	enum image_codec history_codec = (enum image_codec)obs_data_get_int(
+		settings, SETTING_HISTORY_CODEC);
+	if (!image_codec_available(history_codec))
+		history_codec = IMAGE_CODEC_PNG;
+
+	struct frame_diff_mask change_mask;
+	const char *mask_text =
+		obs_data_get_string(settings, SETTING_CHANGE_MASK);
+	if (!frame_diff_mask_parse(&change_mask, mask_text))
+		warn("Comparing the whole source, \"%s\" is not a list of up "
+		     "to %d rectangles of x,y,width,height",
+		     mask_text, FRAME_DIFF_MAX_RECTS);
+
+	struct image_codec_settings codec;
+	image_codec_settings_init(&codec);
+	codec.codec = (enum image_codec)obs_data_get_int(settings, SETTING_CODEC);
+	codec.level = (int)obs_data_get_int(settings, SETTING_COMPRESSION_LEVEL);
+	codec.png_prediction = (enum image_png_prediction)obs_data_get_int(
+		settings, SETTING_PNG_PREDICTION);
+	codec.jpeg_quality =
+		(int)obs_data_get_int(settings, SETTING_JPEG_QUALITY);
+	if (!image_codec_available(codec.codec)) {
+		warn("Image format %d is not available, using PNG",
+		     (int)codec.codec);
+		codec.codec = IMAGE_CODEC_PNG;
+	}
 
-	filter->destination_type = type;
+	encode_pool_reserve_threads(
+		(uint32_t)obs_data_get_int(settings, SETTING_ENCODER_THREADS));
+	uint32_t queue_depth =
+		(uint32_t)obs_data_get_int(settings, SETTING_QUEUE_DEPTH);
+	enum encode_queue_policy queue_policy =
+		(enum encode_queue_policy)obs_data_get_int(
+			settings, SETTING_QUEUE_POLICY);
+	// a whole burst is queued at once, it is not dropped for being fast
+	uint32_t burst_frames =
+		(uint32_t)obs_data_get_int(settings, SETTING_BURST_FRAMES);
+	if (queue_depth < burst_frames)
+		queue_depth = burst_frames;
+	encode_client_set_queue(filter->output.encode_client, queue_depth,
+				queue_policy);
+	for (uint32_t i = 0; i < MAX_REGIONS; i++)
+		encode_client_set_queue(filter->regions[i].output.encode_client,
+					queue_depth, queue_policy);
+
+	struct filter_settings *next = bzalloc(sizeof(struct filter_settings));
+	next->destination_type = type;
 	if (type == SETTING_DESTINATION_PATH_ID) {
-		filter->destination = (char *)path;
+		next->destination = bstrdup(path);
 	} else if (type == SETTING_DESTINATION_URL_ID) {
-		filter->destination = (char *)url;
+		next->destination = bstrdup(url);
 	} else if (type == SETTING_DESTINATION_SHMEM_ID) {
-		filter->destination = (char *)shmem_name;
+		next->destination = bstrdup(shmem_name);
 	} else if (type == SETTING_DESTINATION_FOLDER_ID) {
-		filter->destination = (char *)folder_path;
+		next->destination = bstrdup(folder_path);
+	} else if (type == SETTING_DESTINATION_LOG_ID) {
+		next->destination = bstrdup(log_path);
 	}
-	info("Set destination=%s, %d", filter->destination,
-	     filter->destination_type);
-
-	filter->timer = is_timer_enabled ||
-			type == SETTING_DESTINATION_SHMEM_ID;
-	filter->interval =
-		(float)obs_data_get_double(settings, SETTING_INTERVAL);
-	filter->raw = obs_data_get_bool(settings, SETTING_RAW);
-
-	ReleaseMutex(filter->mutex);
+	info("Set destination=%s, %d", next->destination,
+	     next->destination_type);
+
+	next->timer = is_timer_enabled || history ||
+		      type == SETTING_DESTINATION_SHMEM_ID;
+	next->schedule_mode = schedule_mode;
+	next->schedule_period = schedule_period;
+	next->burst_frames = burst_frames && !history ? burst_frames : 1;
+	next->change_detect =
+		obs_data_get_bool(settings, SETTING_CHANGE_DETECT);
+	next->change_threshold =
+		(uint32_t)obs_data_get_int(settings, SETTING_CHANGE_THRESHOLD);
+	next->change_max_silence = seconds_to_ns(
+		obs_data_get_double(settings, SETTING_CHANGE_MAX_SILENCE));
+	next->change_mask = change_mask;
+	next->history = history;
+	next->history_before = seconds_to_ns(
+		obs_data_get_double(settings, SETTING_HISTORY_BEFORE));
+	next->history_after = seconds_to_ns(
+		obs_data_get_double(settings, SETTING_HISTORY_AFTER));
+	next->history_max_bytes =
+		(uint64_t)obs_data_get_int(settings, SETTING_HISTORY_MEMORY)
+		<< 20;
+	next->history_scale =
+		(float)obs_data_get_double(settings, SETTING_HISTORY_SCALE);
+	next->history_codec = history_codec;
+	next->raw = obs_data_get_bool(settings, SETTING_RAW);
+	next->raw_checksum = obs_data_get_bool(settings, SETTING_RAW_CHECKSUM);
+	next->pixel_format = (enum pixel_format)obs_data_get_int(
+		settings, SETTING_PIXEL_FORMAT);
+	next->codec = codec;
+	next->url_chunked = obs_data_get_bool(settings, SETTING_URL_CHUNKED);
+	next->delta = obs_data_get_bool(settings, SETTING_DELTA);
+	next->delta_keyframe_interval = (uint32_t)obs_data_get_int(
+		settings, SETTING_DELTA_KEYFRAME_INTERVAL);
+	next->scale = (int)obs_data_get_int(settings, SETTING_SCALE);
+	next->scale_width =
+		(uint32_t)obs_data_get_int(settings, SETTING_SCALE_WIDTH);
+	next->scale_height =
+		(uint32_t)obs_data_get_int(settings, SETTING_SCALE_HEIGHT);
+	next->scale_factor =
+		(float)obs_data_get_double(settings, SETTING_SCALE_FACTOR);
+	next->pyramid = obs_data_get_bool(settings, SETTING_PYRAMID);
+	next->shmem_slots =
+		(uint32_t)obs_data_get_int(settings, SETTING_SHMEM_SLOTS);
+	next->log_segment_size =
+		(uint64_t)obs_data_get_int(settings, SETTING_LOG_SEGMENT_SIZE)
+		<< 20;
+	next->log_segment_duration =
+		(uint64_t)obs_data_get_int(settings,
+					   SETTING_LOG_SEGMENT_DURATION) *
+		60000000000ULL;
+	next->log_preallocate =
+		obs_data_get_bool(settings, SETTING_LOG_PREALLOCATE);
+	next->atomic_write = obs_data_get_bool(settings, SETTING_ATOMIC_WRITE);
+	next->fsync_policy =
+		(int)obs_data_get_int(settings, SETTING_FSYNC_POLICY);
+	next->fsync_frames =
+		(uint32_t)obs_data_get_int(settings, SETTING_FSYNC_FRAMES);
+	next->readback_surfaces = (uint32_t)obs_data_get_int(
+		settings, SETTING_READBACK_SURFACES);
+	next->idle_release =
+		(uint64_t)obs_data_get_int(settings, SETTING_IDLE_RELEASE) *
+		1000000000ULL;
+	next->stats_interval =
+		(uint64_t)obs_data_get_int(settings, SETTING_STATS_INTERVAL) *
+		1000000000ULL;
+	next->stats_file =
+		bstrdup(obs_data_get_string(settings, SETTING_STATS_FILE));
+
+	uint32_t region_count =
+		(uint32_t)obs_data_get_int(settings, SETTING_REGION_COUNT);
+	next->region_count = region_count < MAX_REGIONS ? region_count
+							: MAX_REGIONS;
+	for (uint32_t i = 0; i < MAX_REGIONS; i++)
+		update_region(&next->regions[i], i, settings);
+
+	// settings tick has not taken yet are never used
+	free_settings(exchange_settings(filter, next));
+
+	capture_memory_set_budget(
+		filter,
+		(uint64_t)obs_data_get_int(settings, SETTING_MEMORY_BUDGET)
+			<< 20);
+
+	if (type == SETTING_DESTINATION_SERVER_ID)
+		http_server_start(
+			filter->output.server,
+			(int)obs_data_get_int(settings, SETTING_SERVER_PORT),
+			obs_data_get_bool(settings, SETTING_SERVER_LOCAL_ONLY));
+	else
+		http_server_stop(filter->output.server);
 }
 
 static void *screenshot_filter_create(obs_data_t *settings,
@@ -290,22 +1476,16 @@ static void *screenshot_filter_create(obs_data_t *settings,
 
 	filter->context = context;
 
-	obs_enter_graphics();
-	filter->texrender = gs_texrender_create(GS_RGBA, GS_ZS_NONE);
-	obs_leave_graphics();
-
-	filter->image_writer_thread = CreateThread(NULL, 0, write_images_thread,
-						   (LPVOID)filter, 0, NULL);
-	if (!filter->image_writer_thread) {
-		//error("image_writer_thread: Failed to create thread: %d", GetLastError());
-		return NULL;
-	}
-	info("Created image writer thread %d", filter);
+	filter->stats = capture_stats_create();
+	capture_output_init(&filter->output, true, filter->stats);
+	for (size_t i = 0; i < MAX_REGIONS; i++)
+		capture_output_init(&filter->regions[i].output, false,
+				    filter->stats);
+	filter->readback =
+		readback_ring_create(&readback_gs_ops, free_job, filter);
 
-	filter->interval = 2.0f;
-	filter->shmem_name[0] = '\0';
-
-	filter->mutex = CreateMutexA(NULL, FALSE, NULL);
+	filter->stats_report_time = os_gettime_ns();
+	filter->last_capture_time = filter->stats_report_time;
 
 	obs_source_update(context, settings);
 
@@ -338,8 +1518,8 @@ static void make_hotkey(struct screenshot_filter_data *filter)
 	filter->capture_hotkey_id = obs_hotkey_register_frontend(
 		hotkey_name, hotkey_description, capture_key_callback, filter);
 
-	info("Registered hotkey on %s: %s %s, key=%d", filter_name, hotkey_name,
-	     hotkey_description, filter->capture_hotkey_id);
+	info("Registered hotkey on %s: %s %s, key=%zu", filter_name,
+	     hotkey_name, hotkey_description, filter->capture_hotkey_id);
 }
 
 static void screenshot_filter_load(void *data, obs_data_t *settings)
@@ -352,7 +1532,7 @@ static void screenshot_filter_load(void *data, obs_data_t *settings)
 	obs_data_array_t *hotkeys =
 		obs_data_get_array(settings, "capture_hotkey");
 	if (filter->capture_hotkey_id && obs_data_array_count(hotkeys)) {
-		info("Restoring hotkey settings for %d",
+		info("Restoring hotkey settings for %zu",
 		     filter->capture_hotkey_id);
 		obs_hotkey_load(filter->capture_hotkey_id, hotkeys);
 	}
@@ -363,33 +1543,28 @@ static void screenshot_filter_destroy(void *data)
 {
 	struct screenshot_filter_data *filter = data;
 
-	filter->exit = true;
-	for (int _ = 0; _ < 500 && !filter->exited; ++_) {
-		Sleep(10);
-	}
-	if (filter->exited) {
-		info("Image writer thread stopped");
-	} else {
-		// This is not good... Hopefully the thread has crashed, otherwise it's going to be working with filter after it has been free'd
-		warn("Image writer thread failed to stop");
-	}
+	// no other filter hands this one a capture after this
+	obs_enter_graphics();
+	capture_share_leave(filter);
+	obs_leave_graphics();
+	capture_memory_set_budget(filter, 0);
+
+	capture_output_stop(&filter->output);
+	for (size_t i = 0; i < MAX_REGIONS; i++)
+		capture_output_stop(&filter->regions[i].output);
 
-	WaitForSingleObject(filter->mutex, INFINITE);
 	obs_enter_graphics();
 	gs_texrender_destroy(filter->texrender);
-	if (filter->staging_texture) {
-		gs_stagesurface_destroy(filter->staging_texture);
-	}
+	readback_ring_destroy(filter->readback);
 	obs_leave_graphics();
-	if (filter->data) {
-		bfree(filter->data);
-	}
 
-	if (filter->shmem) {
-		CloseHandle(filter->shmem);
-	}
-	ReleaseMutex(filter->mutex);
-	CloseHandle(filter->mutex);
+	capture_output_free(&filter->output);
+	for (size_t i = 0; i < MAX_REGIONS; i++)
+		capture_output_free(&filter->regions[i].output);
+	file_sink_destroy(filter->stats_sink);
+	capture_stats_destroy(filter->stats);
+	free_settings(filter->settings);
+	free_settings(filter->pending_settings);
 
 	bfree(filter);
 }
@@ -397,33 +1572,74 @@ static void screenshot_filter_destroy(void *data)
 static void screenshot_filter_remove(void *data, obs_source_t *context)
 {
 	struct screenshot_filter_data *filter = data;
+	UNUSED_PARAMETER(context);
+
 	if (filter->capture_hotkey_id) {
 		obs_hotkey_unregister(filter->capture_hotkey_id);
 		filter->capture_hotkey_id = 0;
 	}
 }
 
+// frees the staging surfaces, texture, spare buffers and shared memory once
+// the filter has not captured for idle_release, or for a second while all
+// filters together are over the memory budget.  the next capture creates
+// them again
+static void release_idle(struct screenshot_filter_data *filter)
+{
+	uint64_t idle_release = filter->settings->idle_release;
+
+	if (filter->released)
+		return;
+	if (capture_memory_over_budget() &&
+	    (!idle_release || idle_release > 1000000000ULL))
+		idle_release = 1000000000ULL;
+	if (!idle_release ||
+	    os_gettime_ns() - filter->last_capture_time < idle_release)
+		return;
+
+	// frames still being read back or written are tried again next tick
+	obs_enter_graphics();
+	bool trimmed = readback_ring_trim(filter->readback);
+	if (trimmed) {
+		gs_texrender_destroy(filter->texrender);
+		filter->texrender = NULL;
+	}
+	obs_leave_graphics();
+
+	trimmed = capture_output_trim(&filter->output) && trimmed;
+	for (size_t i = 0; i < MAX_REGIONS; i++)
+		trimmed = capture_output_trim(&filter->regions[i].output) &&
+			  trimmed;
+	if (!trimmed)
+		return;
+
+	filter->released = true;
+	debug("%s: released the memory of the idle filter",
+	      obs_source_get_name(filter->context));
+}
+
 static void screenshot_filter_tick(void *data, float t)
 {
 	struct screenshot_filter_data *filter = data;
+	UNUSED_PARAMETER(t);
 
-	obs_source_t *target = obs_filter_get_target(filter->context);
+	// render can run several times a frame, for projectors, the studio
+	// mode preview and nested scenes, but the latency of the ring is
+	// counted in video frames
+	readback_ring_next_frame(filter->readback);
 
-	if (!target) {
-		filter->width = 0;
-		filter->height = 0;
+	take_settings(filter);
+	const struct filter_settings *settings = filter->settings;
+	obs_source_t *target = obs_filter_get_target(filter->context);
 
-		if (filter->staging_texture) {
+	if (!target || !settings) {
+		if (filter->width || filter->height) {
 			obs_enter_graphics();
-			gs_stagesurface_destroy(filter->staging_texture);
+			readback_ring_resize(filter->readback, 0, 0, 0);
 			obs_leave_graphics();
-			filter->staging_texture = NULL;
-		}
-		if (filter->data) {
-			bfree(filter->data);
-			filter->data = NULL;
 		}
-		filter->ready = false;
+		filter->width = 0;
+		filter->height = 0;
 
 		return;
 	}
@@ -431,66 +1647,515 @@ static void screenshot_filter_tick(void *data, float t)
 	uint32_t width = obs_source_get_base_width(target);
 	uint32_t height = obs_source_get_base_height(target);
 
-	WaitForSingleObject(filter->mutex, INFINITE);
-	bool update = false;
-	if (width != filter->width || height != filter->height) {
-		update = true;
+	const char *name = obs_source_get_name(filter->context);
+	report_dropped(&filter->output, name);
+	for (uint32_t i = 0; i < settings->region_count; i++) {
+		char region_name[256];
+		snprintf(region_name, sizeof(region_name), "%s region %u", name,
+			 i + 1);
+		report_dropped(&filter->regions[i].output, region_name);
+	}
+	report_stats(filter, name);
+	release_idle(filter);
 
+	bool resize = settings->readback_surfaces != filter->readback_count;
+	if (width != filter->width || height != filter->height) {
 		filter->width = width;
 		filter->height = height;
+		os_atomic_set_bool(&filter->capture, false);
+		os_atomic_set_bool(&filter->capture_forced, false);
+		capture_schedule_reset(&filter->schedule);
+		for (uint32_t i = 0; i < MAX_REGIONS; i++) {
+			os_atomic_set_bool(&filter->regions[i].capture, false);
+			capture_schedule_reset(&filter->regions[i].schedule);
+		}
+		resize = true;
+	}
 
+	if (resize) {
+		filter->readback_count = settings->readback_surfaces;
 		obs_enter_graphics();
-		if (filter->staging_texture) {
-			gs_stagesurface_destroy(filter->staging_texture);
-		}
-		filter->staging_texture = gs_stagesurface_create(
-			filter->width, filter->height, GS_RGBA);
+		readback_ring_resize(filter->readback, width, height,
+				     filter->readback_count);
 		obs_leave_graphics();
-		info("Created Staging texture %d by %d: %x", width, height,
-		     filter->staging_texture);
+		filter->burst_remaining = 0;
+		filter->reserve = true;
+	}
+
+	if (filter->reserve) {
+		filter->reserve = false;
+		reserve_buffers(filter);
+	}
+
+	// scheduled by the time of the frame about to be rendered, which
+	// create_job() stamps the capture with
+	uint64_t frame_time = obs_get_video_frame_time();
+	uint64_t frame_interval = obs_get_frame_interval_ns();
+
+	if (!settings->timer)
+		capture_schedule_reset(&filter->schedule);
+	else if (capture_schedule_due(&filter->schedule, frame_time,
+				      frame_interval))
+		os_atomic_set_bool(&filter->capture, true);
+
+	for (uint32_t i = 0; i < MAX_REGIONS; i++) {
+		struct capture_region *region = &filter->regions[i];
+		if (i >= settings->region_count ||
+		    settings->regions[i].interval <= 0.0f)
+			capture_schedule_reset(&region->schedule);
+		else if (capture_schedule_due(&region->schedule, frame_time,
+					      frame_interval))
+			os_atomic_set_bool(&region->capture, true);
+	}
+}
+
+// size of the first output level for the current settings, never larger
+// than the source
+static void get_output_size(struct screenshot_filter_data *filter,
+			    uint32_t *width, uint32_t *height)
+{
+	const struct filter_settings *settings = filter->settings;
+	uint64_t w = filter->width;
+	uint64_t h = filter->height;
+
+	if (settings->scale == SETTING_SCALE_SIZE_ID) {
+		if (settings->scale_width && settings->scale_height) {
+			w = settings->scale_width;
+			h = settings->scale_height;
+		} else if (settings->scale_width) {
+			h = (h * settings->scale_width + w / 2) / w;
+			w = settings->scale_width;
+		} else if (settings->scale_height) {
+			w = (w * settings->scale_height + h / 2) / h;
+			h = settings->scale_height;
+		}
+	} else if (settings->scale == SETTING_SCALE_FACTOR_ID &&
+		   settings->scale_factor > 0.0f &&
+		   settings->scale_factor < 1.0f) {
+		w = (uint64_t)(w * settings->scale_factor + 0.5f);
+		h = (uint64_t)(h * settings->scale_factor + 0.5f);
+	}
+
+	*width = (uint32_t)(w < 1 ? 1 : w > filter->width ? filter->width : w);
+	*height = (uint32_t)(h < 1 ? 1
+				   : h > filter->height ? filter->height : h);
+}
+
+static bool has_destination(int type, const char *destination)
+{
+	return type == SETTING_DESTINATION_SERVER_ID ||
+	       (destination && *destination);
+}
+
+// whether the filter or any of its regions wants a capture this frame
+static bool capture_due(struct screenshot_filter_data *filter)
+{
+	if (filter->burst_remaining || os_atomic_load_bool(&filter->capture))
+		return true;
+	for (uint32_t i = 0; i < filter->settings->region_count; i++) {
+		if (os_atomic_load_bool(&filter->regions[i].capture))
+			return true;
+	}
+	return false;
+}
+
+static void set_change_detection(const struct filter_settings *settings,
+				 struct capture_frame *frame)
+{
+	frame->change_detect = settings->change_detect;
+	frame->change_threshold = settings->change_threshold;
+	frame->change_max_silence = settings->change_max_silence;
+	frame->change_mask = settings->change_mask;
+}
+
+// frames of the history are kept as small encoded images, whatever the
+// output settings are
+static void set_history(const struct filter_settings *settings,
+			struct capture_frame *frame)
+{
+	frame->raw = false;
+	frame->pixel_format = PIXEL_FORMAT_RGBA;
+	frame->codec.codec = settings->history_codec;
+	frame->delta = false;
+	frame->change_detect = false;
+	frame->history_max_bytes = settings->history_max_bytes;
+	frame->history_duration = settings->history_before;
+
+	float scale = settings->history_scale;
+	if (scale <= 0.0f || scale > 1.0f)
+		scale = 1.0f;
+	uint32_t width = (uint32_t)(frame->width * scale + 0.5f);
+	uint32_t height = (uint32_t)(frame->height * scale + 0.5f);
+	frame->output_width = width ? width : 1;
+	frame->output_height = height ? height : 1;
+	frame->level_count = 1;
+}
+
+// snapshots the settings of a capture of the whole source
+static struct capture_frame *create_frame(struct screenshot_filter_data *filter)
+{
+	const struct filter_settings *settings = filter->settings;
+	struct capture_frame *frame = bzalloc(sizeof(struct capture_frame));
+	frame->width = filter->width;
+	frame->height = filter->height;
+
+	frame->destination = bstrdup(settings->destination);
+	frame->destination_type = settings->destination_type;
+	frame->raw = settings->raw;
+	frame->raw_checksum = settings->raw_checksum;
+	bool shmem = settings->destination_type == SETTING_DESTINATION_SHMEM_ID;
+	frame->pixel_format = settings->raw || shmem ? settings->pixel_format
+						     : PIXEL_FORMAT_RGBA;
+	frame->codec = settings->codec;
+	frame->url_chunked = settings->url_chunked;
+	frame->delta = settings->delta;
+	frame->delta_keyframe_interval = settings->delta_keyframe_interval;
+	frame->shmem_slots = settings->shmem_slots;
+	frame->log_segment_size = settings->log_segment_size;
+	frame->log_segment_duration = settings->log_segment_duration;
+	frame->log_preallocate = settings->log_preallocate;
+	frame->atomic_write = settings->atomic_write;
+	frame->fsync_policy = settings->fsync_policy;
+	frame->fsync_frames = settings->fsync_frames;
+	set_change_detection(settings, frame);
+
+	get_output_size(filter, &frame->output_width, &frame->output_height);
+	frame->level_count = settings->pyramid ? IMAGE_MAX_LEVELS : 1;
+	if (settings->history)
+		set_history(settings, frame);
+	frame->resample = frame->output_width != frame->width ||
+			  frame->output_height != frame->height ||
+			  frame->level_count > 1;
+	return frame;
+}
+
+// snapshots a region clipped to the source, NULL if nothing of it is visible
+static struct capture_frame *
+create_region_frame(struct screenshot_filter_data *filter,
+		    const struct region_settings *region)
+{
+	const struct filter_settings *settings = filter->settings;
+	if (region->x >= filter->width || region->y >= filter->height)
+		return NULL;
 
-		if (filter->data) {
-			bfree(filter->data);
+	uint32_t max_width = filter->width - region->x;
+	uint32_t max_height = filter->height - region->y;
+
+	struct capture_frame *frame = bzalloc(sizeof(struct capture_frame));
+	frame->x = region->x;
+	frame->y = region->y;
+	frame->width = region->width && region->width < max_width
+			       ? region->width
+			       : max_width;
+	frame->height = region->height && region->height < max_height
+				? region->height
+				: max_height;
+
+	// regions share the filter's codec options and pixel format
+	frame->destination = bstrdup(region->destination);
+	frame->destination_type = region->destination_type;
+	frame->raw = region->format == SETTING_REGION_FORMAT_RAW_ID;
+	frame->raw_checksum = settings->raw_checksum;
+	frame->pixel_format = frame->raw || region->destination_type ==
+						    SETTING_DESTINATION_SHMEM_ID
+				      ? settings->pixel_format
+				      : PIXEL_FORMAT_RGBA;
+	frame->codec = settings->codec;
+	if (!frame->raw)
+		frame->codec.codec = (enum image_codec)region->format;
+	frame->url_chunked = settings->url_chunked;
+	frame->shmem_slots = settings->shmem_slots;
+	frame->log_segment_size = settings->log_segment_size;
+	frame->log_segment_duration = settings->log_segment_duration;
+	frame->log_preallocate = settings->log_preallocate;
+	frame->atomic_write = settings->atomic_write;
+	frame->fsync_policy = settings->fsync_policy;
+	frame->fsync_frames = settings->fsync_frames;
+	set_change_detection(settings, frame);
+
+	frame->output_width = frame->width;
+	frame->output_height = frame->height;
+	frame->level_count = 1;
+	return frame;
+}
+
+// preallocates the buffers of a burst of the whole source and the regions
+// that follow it
+static void reserve_buffers(struct screenshot_filter_data *filter)
+{
+	const struct filter_settings *settings = filter->settings;
+	if (settings->burst_frames <= 1 || filter->width <= 10 ||
+	    filter->height <= 10)
+		return;
+
+	if (has_destination(settings->destination_type,
+			    settings->destination)) {
+		struct capture_frame *frame = create_frame(filter);
+		capture_output_reserve(&filter->output, frame,
+				       settings->burst_frames);
+		capture_frame_free(frame);
+	}
+
+	for (uint32_t i = 0; i < settings->region_count; i++) {
+		const struct region_settings *region = &settings->regions[i];
+		if (region->interval > 0.0f ||
+		    !has_destination(region->destination_type,
+				     region->destination))
+			continue;
+
+		struct capture_frame *frame =
+			create_region_frame(filter, region);
+		if (frame) {
+			capture_output_reserve(&filter->regions[i].output,
+					       frame, settings->burst_frames);
+			capture_frame_free(frame);
 		}
-		filter->data = bzalloc((width + 32) * height * 4);
-		filter->ready = false;
-		filter->capture = false;
-		filter->since_last = 0.0f;
-	}
-
-	if (filter->destination_type == SETTING_DESTINATION_SHMEM_ID &&
-	    filter->destination) {
-		if (update || strncmp(filter->destination, filter->shmem_name,
-				      sizeof(filter->shmem_name))) {
-			info("update shmem");
-			if (filter->shmem) {
-				info("Closing shmem \"%s\": %x",
-				     filter->shmem_name, filter->shmem);
-				CloseHandle(filter->shmem);
-			}
-			filter->shmem_size = 12 + (width + 32) * height * 4;
-			wchar_t name[256];
-			mbstowcs(name, filter->destination, sizeof(name));
-			filter->shmem = CreateFileMapping(INVALID_HANDLE_VALUE,
-							  NULL, PAGE_READWRITE,
-							  0, filter->shmem_size,
-							  name);
-			strncpy(filter->shmem_name, filter->destination,
-				sizeof(filter->shmem_name));
-			info("Created shmem \"%s\": %x", filter->shmem_name,
-			     filter->shmem);
+	}
+}
+
+// clears the capture flags and returns what they requested, a request made
+// after this is taken next frame
+static void take_request(struct screenshot_filter_data *filter,
+			 struct capture_request *request)
+{
+	request->frame = os_atomic_exchange_bool(&filter->capture, false);
+	// the hotkey sets capture_forced first, so it is seen with its capture
+	request->forced =
+		request->frame &&
+		os_atomic_exchange_bool(&filter->capture_forced, false);
+	for (uint32_t i = 0; i < MAX_REGIONS; i++)
+		request->regions[i] = os_atomic_exchange_bool(
+			&filter->regions[i].capture, false);
+
+	// a capture of the whole source starts a burst, the frames after it
+	// are captured as if they had been requested the same way
+	if (filter->burst_remaining) {
+		filter->burst_remaining--;
+		request->frame = true;
+		request->forced = request->forced || filter->burst_forced;
+	} else if (request->frame && filter->settings->burst_frames > 1) {
+		filter->burst_remaining = filter->settings->burst_frames - 1;
+		filter->burst_forced = request->forced;
+	}
+}
+
+// snapshots everything that is due
+static struct capture_job *
+create_job(struct screenshot_filter_data *filter,
+	   const struct capture_request *request)
+{
+	const struct filter_settings *settings = filter->settings;
+	struct capture_job *job = bzalloc(sizeof(struct capture_job));
+	uint64_t timestamp = obs_get_video_frame_time();
+	uint64_t frame_number = capture_schedule_frame_number(
+		timestamp, obs_get_frame_interval_ns());
+	bool burst = settings->burst_frames > 1;
+	bool empty = true;
+
+	job->packed = burst;
+	if (request->frame && has_destination(settings->destination_type,
+					      settings->destination)) {
+		job->frame = create_frame(filter);
+		job->frame->numbered = burst || settings->history;
+		job->frame->forced = request->forced;
+		job->frame->timestamp = timestamp;
+		job->frame->frame_number = frame_number;
+		empty = false;
+
+		// the hotkey writes the history before it, the frames after it
+		// are written as they come until history_until
+		if (settings->history && request->forced) {
+			job->frame->history_dump = true;
+			filter->history_until =
+				timestamp + settings->history_after;
+		} else if (settings->history) {
+			job->frame->history_keep =
+				timestamp > filter->history_until;
 		}
 	}
 
-	if (filter->timer) {
-		filter->since_last += t;
-		if (filter->since_last > filter->interval - 0.05) {
-			filter->capture = true;
-			filter->since_last = 0.0f;
+	for (uint32_t i = 0; i < settings->region_count; i++) {
+		const struct region_settings *region = &settings->regions[i];
+		// regions follow the hotkey, not the frames of the history
+		bool due = request->regions[i] ||
+			   (region->interval <= 0.0f && request->frame &&
+			    (!settings->history || request->forced));
+		if (!due || !has_destination(region->destination_type,
+					     region->destination))
+			continue;
+
+		job->regions[i] = create_region_frame(filter, region);
+		if (job->regions[i]) {
+			// regions that follow the filter follow the hotkey too
+			job->regions[i]->numbered = region->interval <= 0.0f &&
+						    burst;
+			job->regions[i]->forced = region->interval <= 0.0f &&
+						  request->forced;
+			job->regions[i]->timestamp = timestamp;
+			job->regions[i]->frame_number = frame_number;
+			empty = false;
 		}
 	}
 
-	ReleaseMutex(filter->mutex);
+	if (empty) {
+		bfree(job);
+		return NULL;
+	}
+
+	filter->last_capture_time = os_gettime_ns();
+	if (filter->released) {
+		// the buffers of bursts were released too
+		filter->released = false;
+		filter->reserve = true;
+	}
+	return job;
+}
+
+static uint64_t job_frames(const struct capture_job *job)
+{
+	uint64_t frames = job->frame ? 1 : 0;
+	for (uint32_t i = 0; i < MAX_REGIONS; i++)
+		frames += job->regions[i] ? 1 : 0;
+	return frames;
+}
+
+// the only copies of the image, everything after this shares the buffers.
+// regions of the same rectangle as a frame copied before share its copy
+static void copy_job(struct screenshot_filter_data *filter,
+		     struct capture_job *job, const uint8_t *data,
+		     uint32_t linesize)
+{
+	struct capture_frame *copied[MAX_REGIONS + 1];
+	uint32_t copied_count = 0;
+
+	if (job->frame) {
+		capture_output_copy(&filter->output, job->frame, data,
+				    linesize, !job->packed);
+		copied[copied_count++] = job->frame;
+	}
+	for (uint32_t i = 0; i < MAX_REGIONS; i++) {
+		struct capture_frame *frame = job->regions[i];
+		if (!frame)
+			continue;
+
+		uint32_t j = 0;
+		while (j < copied_count &&
+		       !capture_output_share(frame, copied[j]))
+			j++;
+		if (j < copied_count)
+			continue;
+
+		capture_output_copy(&filter->regions[i].output, frame, data,
+				    linesize, false);
+		copied[copied_count++] = frame;
+	}
+}
+
+static void submit_job(struct screenshot_filter_data *filter,
+		       struct capture_job *job)
+{
+	if (job->frame)
+		capture_output_submit(&filter->output, job->frame);
+	for (uint32_t i = 0; i < MAX_REGIONS; i++) {
+		if (job->regions[i])
+			capture_output_submit(&filter->regions[i].output,
+					      job->regions[i]);
+	}
+	bfree(job);
+}
+
+// a job that joined the capture of another filter, handed the image by it
+static void collect_shared(void *param, void *data, const uint8_t *image,
+			   uint32_t linesize)
+{
+	struct screenshot_filter_data *filter = param;
+	struct capture_job *job = data;
+
+	capture_stats_add(filter->stats, CAPTURE_COUNTER_SHARED,
+			  job_frames(job));
+	copy_job(filter, job, image, linesize);
+	submit_job(filter, job);
+}
+
+static void discard_shared(void *param, void *data)
+{
+	struct screenshot_filter_data *filter = param;
+	struct capture_job *job = data;
+
+	capture_stats_add(filter->stats, CAPTURE_COUNTER_DROPPED,
+			  job_frames(job));
+	free_job(filter, job);
+}
+
+static const struct capture_share_callbacks share_callbacks = {
+	.collect = collect_shared,
+	.discard = discard_shared,
+};
+
+// hands frames whose readback has completed to the encoders
+static void collect_readbacks(struct screenshot_filter_data *filter)
+{
+	struct capture_job *job;
+	uint8_t *data;
+	uint32_t linesize;
+	uint64_t start = os_gettime_ns();
+
+	while ((job = readback_ring_collect(filter->readback, &data,
+					    &linesize))) {
+		capture_stats_record(filter->stats, CAPTURE_STAGE_MAP,
+				     os_gettime_ns() - start);
+
+		copy_job(filter, job, data, linesize);
+		// the other filters copy it before it is unmapped
+		capture_share_collect(job->share, data, linesize);
+		job->share = NULL;
+		readback_ring_release(filter->readback);
+
+		submit_job(filter, job);
+		start = os_gettime_ns();
+	}
+}
+
+static void stage_job(struct screenshot_filter_data *filter,
+		      gs_texture_t *tex, struct capture_job *job)
+{
+	uint64_t start = os_gettime_ns();
+	bool staged = readback_ring_stage(filter->readback, tex, job);
+	capture_stats_record(filter->stats, CAPTURE_STAGE_STAGE,
+			     os_gettime_ns() - start);
+	if (staged)
+		return;
+
+	warn("All staging surfaces are busy, dropping capture");
+	capture_stats_add(filter->stats, CAPTURE_COUNTER_DROPPED,
+			  job_frames(job));
+	free_job(filter, job);
+}
+
+// the source whose image the filter captures.  screenshot filters draw their
+// target unchanged, so those stacked on top of each other capture the same
+static obs_source_t *capture_source(struct screenshot_filter_data *filter)
+{
+	obs_source_t *source = obs_filter_get_target(filter->context);
+	while (source &&
+	       obs_source_get_type(source) == OBS_SOURCE_TYPE_FILTER &&
+	       strcmp(obs_source_get_id(source), SCREENSHOT_FILTER_ID) == 0)
+		source = obs_filter_get_target(source);
+	return source;
+}
+
+// takes the requests for this frame into a job of the share, which another
+// filter renders and reads back
+static void join_share(struct screenshot_filter_data *filter,
+		       struct capture_share *share)
+{
+	struct capture_job *job = NULL;
+	struct capture_request request;
+	take_request(filter, &request);
+	if (filter->width > 10 && filter->height > 10)
+		job = create_job(filter, &request);
+	if (job)
+		capture_share_join(share, &share_callbacks, filter, job);
 }
 
 static void screenshot_filter_render(void *data, gs_effect_t *effect)
@@ -507,11 +2172,32 @@ static void screenshot_filter_render(void *data, gs_effect_t *effect)
 	obs_source_t *target = obs_filter_get_target(filter->context);
 	obs_source_t *parent = obs_filter_get_parent(filter->context);
 
-	if (!parent || !filter->width || !filter->height || !filter->capture) {
+	if (!parent || !filter->settings || !filter->width ||
+	    !filter->height || !capture_due(filter)) {
+		collect_readbacks(filter);
 		obs_source_skip_video_filter(filter->context);
 		return;
 	}
 
+	// another filter already reads this frame of the same image back
+	obs_source_t *source = capture_source(filter);
+	uint64_t timestamp = obs_get_video_frame_time();
+	struct capture_share *share = capture_share_find(
+		source, timestamp, filter->width, filter->height);
+	if (share) {
+		join_share(filter, share);
+		collect_readbacks(filter);
+		obs_source_skip_video_filter(filter->context);
+		return;
+	}
+	// opened before rendering, so that the filters below this one join it
+	share = capture_share_open(source, timestamp, filter->width,
+				   filter->height);
+
+	// only the time to queue the draw calls, the GPU runs them later
+	uint64_t render_start = os_gettime_ns();
+	if (!filter->texrender)
+		filter->texrender = gs_texrender_create(GS_RGBA, GS_ZS_NONE);
 	gs_texrender_reset(filter->texrender);
 
 	gs_blend_state_push();
@@ -539,26 +2225,30 @@ static void screenshot_filter_render(void *data, gs_effect_t *effect)
 	}
 
 	gs_blend_state_pop();
+	capture_stats_record(filter->stats, CAPTURE_STAGE_RENDER,
+			     os_gettime_ns() - render_start);
 
 	gs_effect_t *effect2 = obs_get_base_effect(OBS_EFFECT_DEFAULT);
 	gs_texture_t *tex = gs_texrender_get_texture(filter->texrender);
 
 	if (tex) {
-		gs_stage_texture(filter->staging_texture, tex);
-
-		uint8_t *data;
-		uint32_t linesize;
-		WaitForSingleObject(filter->mutex, INFINITE);
-		if (gs_stagesurface_map(filter->staging_texture, &data,
-					&linesize)) {
-			memcpy(filter->data, data, linesize * filter->height);
-			filter->linesize = linesize;
-			filter->ready = true;
-
-			gs_stagesurface_unmap(filter->staging_texture);
+		struct capture_job *job = NULL;
+		struct capture_request request;
+		take_request(filter, &request);
+		if (filter->width > 10 && filter->height > 10)
+			job = create_job(filter, &request);
+
+		// other filters may want the frame even if this one does not
+		if (!job && !capture_share_empty(share))
+			job = bzalloc(sizeof(struct capture_job));
+
+		// the data is collected once the copy has had time to complete
+		if (job) {
+			job->share = share;
+			share = NULL;
+			stage_job(filter, tex, job);
 		}
-		filter->capture = false;
-		ReleaseMutex(filter->mutex);
+		collect_readbacks(filter);
 
 		gs_eparam_t *image =
 			gs_effect_get_param_by_name(effect2, "image");
@@ -567,298 +2257,8 @@ static void screenshot_filter_render(void *data, gs_effect_t *effect)
 		while (gs_effect_loop(effect2, "Draw"))
 			gs_draw_sprite(tex, 0, filter->width, filter->height);
 	}
-}
-
-// code adapted from https://github.com/obsproject/obs-studio/pull/1269 and https://stackoverflow.com/a/12563019
-static bool write_image(const char *destination, uint8_t *image_data_ptr,
-			uint32_t image_data_linesize, uint32_t width,
-			uint32_t height, int destination_type)
-{
-	bool success = false;
-
-	int ret;
-	AVFrame *frame;
-	AVPacket pkt;
-
-	if (image_data_ptr == NULL)
-		goto err_no_image_data;
 
-	const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_PNG);
-	if (codec == NULL)
-		goto err_png_codec_not_found;
-
-	AVCodecContext *codec_context = avcodec_alloc_context3(codec);
-	if (codec_context == NULL)
-		goto err_png_encoder_context_alloc;
-
-	codec_context->bit_rate = 400000;
-	codec_context->width = width;
-	codec_context->height = height;
-	codec_context->time_base = (AVRational){1, 25};
-	codec_context->pix_fmt = AV_PIX_FMT_RGBA;
-
-	if (avcodec_open2(codec_context, codec, NULL) != 0)
-		goto err_png_encoder_open;
-
-	frame = av_frame_alloc();
-	if (frame == NULL)
-		goto err_av_frame_alloc;
-
-	frame->format = codec_context->pix_fmt;
-	frame->width = width;
-	frame->height = height;
-
-	ret = av_image_alloc(frame->data, frame->linesize, codec_context->width,
-			     codec_context->height, codec_context->pix_fmt, 4);
-	if (ret < 0)
-		goto err_av_image_alloc;
-
-	av_init_packet(&pkt);
-	pkt.data = NULL;
-	pkt.size = 0;
-
-	for (int y = 0; y < height; ++y)
-		memcpy(frame->data[0] + y * width * 4,
-		       image_data_ptr + y * image_data_linesize, width * 4);
-	frame->pts = 1;
-
-#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(57, 40, 101)
-	int got_output = 0;
-	ret = avcodec_encode_video2(codec_context, &pkt, frame, &got_output);
-	if (ret == 0 && got_output) {
-		success = write_data(destination, pkt.data, pkt.size,
-				     "image/png", width, height,
-				     destination_type);
-		av_free_packet(&pkt);
-	}
-#else
-	ret = avcodec_send_frame(codec_context, frame);
-	if (ret < 0)
-		goto err_av_image_alloc;
-	ret = avcodec_receive_packet(codec_context, &pkt);
-	if (ret < 0 || ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-		goto err_av_image_alloc;
-	} else {
-		success = write_data(destination, pkt.data, pkt.size,
-				     "image/png", width, height,
-				     destination_type);
-		av_packet_unref(&pkt);
-	}
-#endif
-
-	av_freep(frame->data);
-
-err_av_image_alloc:
-	// Failed allocating image data buffer
-	av_frame_free(&frame);
-	frame = NULL;
-
-err_av_frame_alloc:
-	// Failed allocating frame
-	avcodec_close(codec_context);
-
-err_png_encoder_open:
-	// Failed opening PNG encoder
-	avcodec_free_context(&codec_context);
-	codec_context = NULL;
-
-err_png_encoder_context_alloc:
-	// failed allocating PNG encoder context
-	// no need to free AVCodec* codec
-err_png_codec_not_found:
-	// PNG encoder not found
-err_no_image_data:
-	// image_data_ptr == NULL
-
-	return success;
-}
-
-static bool write_data(const char *destination, uint8_t *data, size_t len,
-		       char *content_type, uint32_t width, uint32_t height,
-		       int destination_type)
-{
-	bool success = false;
-
-	if (destination_type == SETTING_DESTINATION_PATH_ID) {
-		FILE *of = fopen(destination, "wb");
-
-		if (of != NULL) {
-			//info("write %s (%d bytes)", destination, len);
-			fwrite(data, 1, len, of);
-			fclose(of);
-			success = true;
-		}
-	}
-	if (destination_type == SETTING_DESTINATION_URL_ID) {
-		if (strstr(destination, "http://") != NULL ||
-		    strstr(destination, "https://") != NULL) {
-			//info("PUT %s (%d bytes)", destination, len);
-			success = put_data(destination, data, len, content_type,
-					   width, height);
-		}
-	}
-	if (destination_type == SETTING_DESTINATION_FOLDER_ID) {
-		FILE *of = fopen(destination, "rb");
-
-		if (of != NULL) {
-			fclose(of);
-		} else {
-			time_t nowunixtime = time(NULL);
-			struct tm *nowtime = localtime(&nowunixtime);
-			char _file_destination[260];
-			char file_destination[260];
-
-			int dest_length = snprintf(
-				_file_destination, 259,
-				"%s/%d-%02d-%02d_%02d-%02d-%02d", destination,
-				nowtime->tm_year + 1900, nowtime->tm_mon + 1,
-				nowtime->tm_mday, nowtime->tm_hour,
-				nowtime->tm_min, nowtime->tm_sec);
-
-			int repeat_count = 0;
-			while (true) {
-				if (repeat_count > 5) {
-					break;
-				}
-				dest_length = snprintf(file_destination, 259,
-						       "%s", _file_destination);
-				if (repeat_count > 0) {
-					dest_length = snprintf(
-						file_destination, 259,
-						"%s_%d.raw", _file_destination,
-						repeat_count);
-				}
-				repeat_count++;
-
-				if (!strcmp(content_type, "image/png")) {
-					dest_length = snprintf(
-						file_destination, 259, "%s.png",
-						file_destination);
-				}
-
-				if (dest_length <= 0) {
-					break;
-				}
-
-				of = fopen(file_destination, "rb");
-				if (of != NULL) {
-					fclose(of);
-					continue;
-				}
-
-				of = fopen(file_destination, "wb");
-				if (of == NULL) {
-					continue;
-				} else {
-					fwrite(data, 1, len, of);
-					fclose(of);
-					success = true;
-					break;
-				}
-			}
-		}
-	}
-
-	return success;
-}
-static bool put_data(char *url, uint8_t *buf, size_t len, char *content_type,
-		     int width, int height)
-{
-	bool success = false;
-
-	char *host_start = strstr(url, "://");
-	if (host_start == NULL)
-		return false;
-	host_start += 3;
-
-	char *host_end;
-	char *port_start = strchr(host_start, ':');
-	char *location_start = strchr(host_start, '/');
-	if (!location_start)
-		location_start = "";
-
-	int port;
-
-	char *https = NULL;
-	https = strstr(url, "https://");
-	if (https == url) {
-		port = 443;
-
-		// unsupported
-		warn("https unsupported");
-		return false;
-	} else {
-		port = 80;
-	}
-	host_end = location_start;
-
-	if (port_start != NULL) {
-		// have port specifier
-		host_end = port_start;
-
-		char port_str[16] = {0};
-		strncat(port_str, port_start + 1,
-			min(sizeof(port_str) - 1,
-			    (location_start - host_end) - 1));
-		if (strlen(port_str) == 0)
-			return false;
-		port = atoi(port_str);
-	}
-
-	char host[128] = {0};
-	strncat(host, host_start, min(sizeof(host) - 1, host_end - host_start));
-	char *location = location_start;
-
-	HINTERNET hIntrn = InternetOpenA(
-		"OBS Screenshot Plugin/1.2.1",
-		INTERNET_OPEN_TYPE_PRECONFIG_WITH_NO_AUTOPROXY, NULL, NULL, 0);
-	if (!hIntrn)
-		goto err_internet_open;
-
-	HINTERNET hConn = InternetConnectA(hIntrn, host, port, NULL, NULL,
-					   INTERNET_SERVICE_HTTP, 0, NULL);
-	if (!hConn)
-		goto err_internet_connect;
-
-	DWORD dwOpenRequestFlags = INTERNET_FLAG_KEEP_CONNECTION |
-				   INTERNET_FLAG_NO_COOKIES |
-				   INTERNET_FLAG_NO_CACHE_WRITE |
-				   INTERNET_FLAG_NO_UI | INTERNET_FLAG_RELOAD;
-
-	HINTERNET hReq = HttpOpenRequestA(hConn, "PUT", location, "HTTP/1.1",
-					  NULL, NULL, dwOpenRequestFlags, NULL);
-	if (!hReq)
-		goto err_http_open_request;
-
-	char header[1024] = {0};
-	snprintf(header, sizeof(header), "%sContent-Type: %s\r\n", header,
-		 content_type);
-	snprintf(header, sizeof(header), "%sImage-Width: %d\r\n", header,
-		 width);
-	snprintf(header, sizeof(header), "%sImage-Height: %d\r\n", header,
-		 height);
-
-	if (HttpSendRequestA(hReq, header, strnlen(header, sizeof(header)), buf,
-			     len)) {
-		success = true;
-		info("Uploaded file to %s:%d%s", host, port, location);
-	} else {
-		warn("Failed to upload file to http://%s:%d%s - %d", host, port,
-		     location, GetLastError());
-	}
-
-	InternetCloseHandle(hReq);
-
-err_http_open_request:
-	InternetCloseHandle(hConn);
-
-err_internet_connect:
-	InternetCloseHandle(hIntrn);
-
-err_internet_open:
-	// nothing to close
-
-	return success;
+	capture_share_close(share);
 }
 
 static void capture_key_callback(void *data, obs_hotkey_id id,
@@ -866,20 +2266,19 @@ static void capture_key_callback(void *data, obs_hotkey_id id,
 {
 	struct screenshot_filter_data *filter = data;
 	const char *filter_name = obs_source_get_name(filter->context);
-	info("Got capture_key pressed for %s, id: %d, key: %s, pressed: %d",
+	info("Got capture_key pressed for %s, id: %zu, key: %s, pressed: %d",
 	     filter_name, id, obs_hotkey_get_name(key), pressed);
 
 	if (id != filter->capture_hotkey_id || !pressed)
 		return;
 
 	info("Triggering capture");
-	WaitForSingleObject(filter->mutex, INFINITE);
-	filter->capture = true;
-	ReleaseMutex(filter->mutex);
+	os_atomic_set_bool(&filter->capture_forced, true);
+	os_atomic_set_bool(&filter->capture, true);
 }
 
 struct obs_source_info screenshot_filter = {
-	.id = "screenshot_filter",
+	.id = SCREENSHOT_FILTER_ID,
 
 	.type = OBS_SOURCE_TYPE_FILTER,
 	.output_flags = OBS_SOURCE_VIDEO,
@@ -903,6 +2302,14 @@ struct obs_source_info screenshot_filter = {
 
 bool obs_module_load(void)
 {
+	if (!encode_pool_init())
+		return false;
+
 	obs_register_source(&screenshot_filter);
 	return true;
 }
+
+void obs_module_unload(void)
+{
+	encode_pool_free();
+}
@@ -0,0 +1,258 @@
+#include "shmem-ring.h"
+
+#include <obs-module.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define do_log(level, format, ...) \
+	blog(level, "[screenshot-filter] " format, ##__VA_ARGS__)
+
+#define warn(format, ...) do_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define info(format, ...) do_log(LOG_INFO, format, ##__VA_ARGS__)
+
+struct shmem_ring {
+	char *name;
+	uint64_t size;
+	uint32_t slot_count;
+	uint64_t slot_capacity;
+
+	struct shmem_ring_control *control;
+	struct shmem_ring_slot *writing;
+	uint64_t writing_seq;
+
+#ifdef _WIN32
+	HANDLE mapping;
+#else
+	char *shm_path;
+	int fd;
+#endif
+};
+
+static inline uint64_t align_up(uint64_t size)
+{
+	return (size + SHMEM_RING_ALIGN - 1) & ~(uint64_t)(SHMEM_RING_ALIGN - 1);
+}
+
+#ifdef _WIN32
+static void *map_shared_memory(struct shmem_ring *ring)
+{
+	wchar_t name[256];
+	if (!os_utf8_to_wcs(ring->name, 0, name, sizeof(name) / sizeof(*name)))
+		return NULL;
+
+	ring->mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL,
+					   PAGE_READWRITE,
+					   (DWORD)(ring->size >> 32),
+					   (DWORD)(ring->size & 0xFFFFFFFF),
+					   name);
+	if (!ring->mapping) {
+		warn("CreateFileMapping \"%s\" failed: %lu", ring->name,
+		     GetLastError());
+		return NULL;
+	}
+
+	void *view = MapViewOfFile(ring->mapping, FILE_MAP_ALL_ACCESS, 0, 0,
+				   (SIZE_T)ring->size);
+	if (!view) {
+		warn("MapViewOfFile \"%s\" failed: %lu", ring->name,
+		     GetLastError());
+		CloseHandle(ring->mapping);
+		ring->mapping = NULL;
+	}
+	return view;
+}
+
+static void unmap_shared_memory(struct shmem_ring *ring)
+{
+	if (ring->control)
+		UnmapViewOfFile(ring->control);
+	if (ring->mapping)
+		CloseHandle(ring->mapping);
+}
+#else
+static void *map_shared_memory(struct shmem_ring *ring)
+{
+	/* POSIX shared memory object names must start with a single slash */
+	size_t len = strlen(ring->name);
+	ring->shm_path = bmalloc(len + 2);
+	snprintf(ring->shm_path, len + 2, "%s%s",
+		 ring->name[0] == '/' ? "" : "/", ring->name);
+
+	/* frames are only readable by the user OBS runs as, fchmod also
+	 * fixes the mode of a region left behind by an older version and
+	 * fails for a region someone else created */
+	ring->fd = shm_open(ring->shm_path, O_CREAT | O_RDWR, 0600);
+	if (ring->fd == -1) {
+		warn("shm_open \"%s\" failed: %d", ring->shm_path, errno);
+		return NULL;
+	}
+	if (fchmod(ring->fd, 0600) != 0) {
+		warn("fchmod \"%s\" failed: %d", ring->shm_path, errno);
+		/* not ours to unlink */
+		close(ring->fd);
+		ring->fd = -1;
+		return NULL;
+	}
+
+	if (ftruncate(ring->fd, (off_t)ring->size) != 0) {
+		warn("ftruncate \"%s\" failed: %d", ring->shm_path, errno);
+		return NULL;
+	}
+
+	void *view = mmap(NULL, (size_t)ring->size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED, ring->fd, 0);
+	if (view == MAP_FAILED) {
+		warn("mmap \"%s\" failed: %d", ring->shm_path, errno);
+		return NULL;
+	}
+	return view;
+}
+
+static void unmap_shared_memory(struct shmem_ring *ring)
+{
+	if (ring->control)
+		munmap(ring->control, (size_t)ring->size);
+	if (ring->fd != -1) {
+		close(ring->fd);
+		shm_unlink(ring->shm_path);
+	}
+	bfree(ring->shm_path);
+}
+#endif
+
+struct shmem_ring *shmem_ring_create(const char *name, uint32_t slot_count,
+				     uint64_t slot_capacity)
+{
+	if (!name || !*name)
+		return NULL;
+
+	if (slot_count < SHMEM_RING_MIN_SLOTS)
+		slot_count = SHMEM_RING_MIN_SLOTS;
+	if (slot_count > SHMEM_RING_MAX_SLOTS)
+		slot_count = SHMEM_RING_MAX_SLOTS;
+
+	struct shmem_ring *ring = bzalloc(sizeof(struct shmem_ring));
+	uint64_t slot_stride =
+		align_up(sizeof(struct shmem_ring_slot) + slot_capacity);
+
+	ring->name = bstrdup(name);
+	ring->slot_count = slot_count;
+	ring->slot_capacity = slot_capacity;
+	ring->size = sizeof(struct shmem_ring_control) +
+		     slot_stride * slot_count;
+#ifndef _WIN32
+	ring->fd = -1;
+#endif
+
+	ring->control = map_shared_memory(ring);
+	if (!ring->control) {
+		shmem_ring_destroy(ring);
+		return NULL;
+	}
+
+	struct shmem_ring_control *control = ring->control;
+	memset(control, 0, (size_t)ring->size);
+	control->version = SHMEM_RING_VERSION;
+	control->control_size = sizeof(struct shmem_ring_control);
+	control->slot_count = slot_count;
+	control->slot_stride = slot_stride;
+	control->slot_capacity = slot_capacity;
+	shmem_ring_fence();
+	control->magic = SHMEM_RING_MAGIC;
+
+	info("Created shmem ring \"%s\": %u slots of %llu bytes", name,
+	     slot_count, (unsigned long long)slot_capacity);
+	return ring;
+}
+
+void shmem_ring_destroy(struct shmem_ring *ring)
+{
+	if (!ring)
+		return;
+
+	if (ring->control) {
+		shmem_ring_store(&ring->control->closed, 1);
+		info("Closing shmem ring \"%s\"", ring->name);
+	}
+	unmap_shared_memory(ring);
+	bfree(ring->name);
+	bfree(ring);
+}
+
+const char *shmem_ring_name(const struct shmem_ring *ring)
+{
+	return ring ? ring->name : NULL;
+}
+
+uint32_t shmem_ring_slot_count(const struct shmem_ring *ring)
+{
+	return ring ? ring->slot_count : 0;
+}
+
+uint64_t shmem_ring_capacity(const struct shmem_ring *ring)
+{
+	return ring ? ring->slot_capacity : 0;
+}
+
+/*
+ * Claims the next slot for writing and returns its data pointer.  The slot
+ * is marked as in progress so that readers still holding the frame that was
+ * in it can detect that it is being overwritten.
+ */
+uint8_t *shmem_ring_begin(struct shmem_ring *ring)
+{
+	struct shmem_ring_control *control = ring->control;
+
+	ring->writing_seq = shmem_ring_load(&control->latest) + 1;
+	ring->writing = shmem_ring_get_slot(control, ring->writing_seq);
+
+	shmem_ring_store(&ring->writing->seq, ring->writing_seq * 2 + 1);
+	shmem_ring_fence();
+
+	return (uint8_t *)shmem_ring_slot_data(ring->writing);
+}
+
+void shmem_ring_commit(struct shmem_ring *ring,
+		       const struct shmem_ring_frame *frame)
+{
+	struct shmem_ring_slot *slot = ring->writing;
+	if (!slot)
+		return;
+
+	slot->width = frame->width;
+	slot->height = frame->height;
+	slot->linesize = frame->linesize;
+	slot->index = frame->index;
+	slot->size = frame->size;
+	slot->timestamp = frame->timestamp;
+	slot->frame = frame->frame;
+	slot->flags = frame->flags;
+	slot->format = frame->format;
+
+	shmem_ring_store(&slot->seq, ring->writing_seq * 2);
+	shmem_ring_store(&ring->control->latest, ring->writing_seq);
+	ring->writing = NULL;
+}
+
+bool shmem_ring_publish(struct shmem_ring *ring,
+			const struct shmem_ring_frame *frame,
+			const uint8_t *data)
+{
+	if (!ring || frame->size > ring->slot_capacity)
+		return false;
+
+	uint8_t *dst = shmem_ring_begin(ring);
+	memcpy(dst, data, (size_t)frame->size);
+	shmem_ring_commit(ring, frame);
+	return true;
+}
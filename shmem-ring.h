@@ -0,0 +1,207 @@
+#pragma once
+
+/*
+ * Named shared memory ring buffer.
+ *
+ * The mapping starts with a control block followed by slot_count slots, each
+ * holding a slot header and up to slot_capacity bytes of frame data.  The
+ * writer publishes frames round-robin using a per-slot sequence lock: the
+ * slot sequence is odd while the slot is being written and equal to
+ * 2 * frame_sequence once the frame is complete.  The control block's latest
+ * field is only advanced after a slot has been completed, so a reader that
+ * follows latest always lands on a complete frame.  The writer only reuses
+ * that slot after slot_count - 1 further frames, so with 3 or more slots a
+ * reader can use the data in place and call shmem_ring_slot_valid() when it
+ * is done instead of copying.
+ *
+ * This header has no OBS dependencies so that it can be included by
+ * consumers.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHMEM_RING_MAGIC 0x42525353 /* "SSRB" */
+#define SHMEM_RING_VERSION 1
+#define SHMEM_RING_ALIGN 64
+
+#define SHMEM_RING_MIN_SLOTS 2
+#define SHMEM_RING_MAX_SLOTS 16
+
+/* slot formats, the values of enum pixel_format in pixel-format.h.  YUV420
+ * is planar, linesize is the size of a Y row and the U and V planes of
+ * (width + 1) / 2 x (height + 1) / 2 follow the Y plane */
+#define SHMEM_RING_FORMAT_RGBA 0
+#define SHMEM_RING_FORMAT_BGRA 1
+#define SHMEM_RING_FORMAT_RGB24 2
+#define SHMEM_RING_FORMAT_GRAY8 3
+#define SHMEM_RING_FORMAT_YUV420 4
+
+/* slot flags */
+/* the data is a delta frame (delta-frame.h), not an image */
+#define SHMEM_RING_FLAG_DELTA 0x1
+
+struct shmem_ring_control {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t control_size;
+	uint32_t slot_count;
+	uint64_t slot_stride;
+	uint64_t slot_capacity;
+
+	/* sequence number of the newest complete frame, 0 if none yet */
+	volatile uint64_t latest;
+	/* set when the writer has released the mapping, reopen by name */
+	volatile uint64_t closed;
+
+	uint8_t reserved[SHMEM_RING_ALIGN - 48];
+};
+
+struct shmem_ring_slot {
+	volatile uint64_t seq;
+
+	uint32_t width;
+	uint32_t height;
+	uint32_t linesize;
+	uint32_t index;
+	uint64_t size;
+	/* monotonic time in ns of the video frame the image was captured in */
+	uint64_t timestamp;
+	uint32_t flags;
+	uint32_t format;
+	/* number of that video frame, see capture-schedule.h */
+	uint64_t frame;
+
+	uint8_t reserved[SHMEM_RING_ALIGN - 56];
+};
+
+/* information about a published frame */
+struct shmem_ring_frame {
+	uint32_t width;
+	uint32_t height;
+	uint32_t linesize;
+	uint32_t index;
+	uint64_t size;
+	uint64_t timestamp;
+	uint32_t flags;
+	uint32_t format;
+	uint64_t frame;
+};
+
+static inline uint64_t shmem_ring_load(const volatile uint64_t *ptr)
+{
+#ifdef _MSC_VER
+	return (uint64_t)_InterlockedCompareExchange64(
+		(volatile __int64 *)ptr, 0, 0);
+#else
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline void shmem_ring_store(volatile uint64_t *ptr, uint64_t val)
+{
+#ifdef _MSC_VER
+	_InterlockedExchange64((volatile __int64 *)ptr, (__int64)val);
+#else
+	__atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+#endif
+}
+
+static inline void shmem_ring_fence(void)
+{
+#ifdef _MSC_VER
+	volatile long barrier = 0;
+	_InterlockedExchange(&barrier, 0);
+#else
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline struct shmem_ring_slot *
+shmem_ring_get_slot(const struct shmem_ring_control *control, uint64_t seq)
+{
+	uint8_t *base = (uint8_t *)control + control->control_size;
+	return (struct shmem_ring_slot *)(base + (seq % control->slot_count) *
+							 control->slot_stride);
+}
+
+static inline const uint8_t *
+shmem_ring_slot_data(const struct shmem_ring_slot *slot)
+{
+	return (const uint8_t *)(slot + 1);
+}
+
+static inline bool
+shmem_ring_control_valid(const struct shmem_ring_control *control)
+{
+	return control->magic == SHMEM_RING_MAGIC &&
+	       control->version == SHMEM_RING_VERSION &&
+	       control->slot_count >= SHMEM_RING_MIN_SLOTS &&
+	       !shmem_ring_load(&control->closed);
+}
+
+/*
+ * Returns the slot holding the newest complete frame and stores its
+ * sequence number in *seq, or returns NULL if nothing was published yet or
+ * the writer closed the ring.
+ */
+static inline const struct shmem_ring_slot *
+shmem_ring_latest(const struct shmem_ring_control *control, uint64_t *seq)
+{
+	for (;;) {
+		uint64_t latest = shmem_ring_load(&control->latest);
+		if (!latest || shmem_ring_load(&control->closed))
+			return NULL;
+
+		const struct shmem_ring_slot *slot =
+			shmem_ring_get_slot(control, latest);
+		if (shmem_ring_load(&slot->seq) == latest * 2) {
+			*seq = latest;
+			return slot;
+		}
+		/* the writer lapped the whole ring while we looked */
+	}
+}
+
+/*
+ * Returns true if the frame read from slot is still the frame with sequence
+ * seq, i.e. the writer did not start overwriting it while it was being used.
+ */
+static inline bool shmem_ring_slot_valid(const struct shmem_ring_slot *slot,
+					 uint64_t seq)
+{
+	shmem_ring_fence();
+	return shmem_ring_load(&slot->seq) == seq * 2;
+}
+
+/* writer side, implemented in shmem-ring.c */
+struct shmem_ring;
+
+extern struct shmem_ring *shmem_ring_create(const char *name,
+					    uint32_t slot_count,
+					    uint64_t slot_capacity);
+extern void shmem_ring_destroy(struct shmem_ring *ring);
+
+extern const char *shmem_ring_name(const struct shmem_ring *ring);
+extern uint32_t shmem_ring_slot_count(const struct shmem_ring *ring);
+extern uint64_t shmem_ring_capacity(const struct shmem_ring *ring);
+
+extern uint8_t *shmem_ring_begin(struct shmem_ring *ring);
+extern void shmem_ring_commit(struct shmem_ring *ring,
+			      const struct shmem_ring_frame *frame);
+extern bool shmem_ring_publish(struct shmem_ring *ring,
+			       const struct shmem_ring_frame *frame,
+			       const uint8_t *data);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,332 @@
+// Runs the HTTP client against a scripted server on the loopback interface:
+// two PUTs share one connection, a request on a connection the server closed
+// while it was idle is retried on a new one, and a body above the chunk
+// threshold arrives intact.
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "http-client.h"
+
+#define MAX_REQUESTS 4
+
+static int failures;
+
+#define check(cond)                                                       \
+	do {                                                              \
+		if (!(cond)) {                                            \
+			fprintf(stderr, "%s:%d: check failed: %s\n",      \
+				__FILE__, __LINE__, #cond);               \
+			failures++;                                       \
+		}                                                         \
+	} while (0)
+
+struct request {
+	bool chunked;
+	uint8_t *body;
+	size_t size;
+};
+
+// answers requests with 200 and closes the connection after those in
+// close_after, until it has answered request_count of them
+struct server {
+	int listen_fd;
+	int port;
+	pthread_t thread;
+
+	int request_count;
+	bool close_after[MAX_REQUESTS];
+
+	// written by the server thread, read once it has been joined or
+	// through closed_count
+	int accepts;
+	struct request requests[MAX_REQUESTS];
+	volatile int closed_count;
+
+	int fd;
+	char buf[4096];
+	size_t buf_pos;
+	size_t buf_len;
+};
+
+static bool fill(struct server *server)
+{
+	ssize_t received =
+		recv(server->fd, server->buf, sizeof(server->buf), 0);
+	if (received <= 0)
+		return false;
+	server->buf_pos = 0;
+	server->buf_len = (size_t)received;
+	return true;
+}
+
+static bool read_line(struct server *server, char *line, size_t size)
+{
+	size_t len = 0;
+	for (;;) {
+		if (server->buf_pos == server->buf_len && !fill(server))
+			return false;
+		char c = server->buf[server->buf_pos++];
+		if (c == '\n')
+			break;
+		if (c != '\r' && len < size - 1)
+			line[len++] = c;
+	}
+	line[len] = 0;
+	return true;
+}
+
+static bool read_bytes(struct server *server, uint8_t *data, size_t size)
+{
+	while (size) {
+		if (server->buf_pos == server->buf_len && !fill(server))
+			return false;
+		size_t available = server->buf_len - server->buf_pos;
+		size_t n = size < available ? size : available;
+		memcpy(data, server->buf + server->buf_pos, n);
+		server->buf_pos += n;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool append_bytes(struct server *server, struct request *request,
+			 size_t size)
+{
+	request->body = realloc(request->body, request->size + size);
+	if (!read_bytes(server, request->body + request->size, size))
+		return false;
+	request->size += size;
+	return true;
+}
+
+static bool read_request(struct server *server, struct request *request)
+{
+	char line[1024];
+	size_t length = 0;
+
+	if (!read_line(server, line, sizeof(line)) ||
+	    strncmp(line, "PUT ", 4) != 0)
+		return false;
+	for (;;) {
+		if (!read_line(server, line, sizeof(line)))
+			return false;
+		if (!*line)
+			break;
+		if (strncasecmp(line, "Content-Length:", 15) == 0)
+			length = strtoull(line + 15, NULL, 10);
+		else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0)
+			request->chunked = strstr(line, "chunked") != NULL;
+	}
+
+	if (!request->chunked)
+		return append_bytes(server, request, length);
+
+	for (;;) {
+		if (!read_line(server, line, sizeof(line)))
+			return false;
+		size_t size = strtoull(line, NULL, 16);
+		if (!size)
+			break;
+		if (!append_bytes(server, request, size) ||
+		    !read_line(server, line, sizeof(line)) || *line)
+			return false;
+	}
+	// no trailers
+	return read_line(server, line, sizeof(line)) && !*line;
+}
+
+static void *server_thread(void *data)
+{
+	struct server *server = data;
+	const char *response = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+
+	server->fd = -1;
+	for (int i = 0; i < server->request_count; i++) {
+		if (server->fd < 0) {
+			server->fd = accept(server->listen_fd, NULL, NULL);
+			server->buf_pos = server->buf_len = 0;
+			server->accepts++;
+		}
+
+		if (!read_request(server, &server->requests[i]) ||
+		    send(server->fd, response, strlen(response), 0) < 0) {
+			close(server->fd);
+			server->fd = -1;
+			break;
+		}
+
+		if (server->close_after[i]) {
+			close(server->fd);
+			server->fd = -1;
+			__atomic_add_fetch(&server->closed_count, 1,
+					   __ATOMIC_SEQ_CST);
+		}
+	}
+	if (server->fd >= 0)
+		close(server->fd);
+	return NULL;
+}
+
+static bool server_start(struct server *server, int request_count)
+{
+	server->request_count = request_count;
+	server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	struct sockaddr_in addr = {0};
+	socklen_t len = sizeof(addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(server->listen_fd, (struct sockaddr *)&addr, len) != 0 ||
+	    listen(server->listen_fd, 4) != 0 ||
+	    getsockname(server->listen_fd, (struct sockaddr *)&addr, &len) !=
+		    0)
+		return false;
+	server->port = ntohs(addr.sin_port);
+	return pthread_create(&server->thread, NULL, server_thread, server) ==
+	       0;
+}
+
+static void server_stop(struct server *server)
+{
+	pthread_join(server->thread, NULL);
+	close(server->listen_fd);
+}
+
+static void server_free(struct server *server)
+{
+	for (int i = 0; i < MAX_REQUESTS; i++)
+		free(server->requests[i].body);
+}
+
+static uint8_t *make_body(size_t size, uint8_t seed)
+{
+	uint8_t *body = malloc(size);
+	for (size_t i = 0; i < size; i++)
+		body[i] = (uint8_t)(i * 31 + seed);
+	return body;
+}
+
+static bool received(const struct request *request, const uint8_t *body,
+		     size_t size)
+{
+	return request->size == size && memcmp(request->body, body, size) == 0;
+}
+
+static void test_keep_alive(void)
+{
+	struct server server = {0};
+	if (!server_start(&server, 2)) {
+		check(!"server started");
+		return;
+	}
+
+	char url[64];
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/shot", server.port);
+	uint8_t *first = make_body(1000, 1);
+	uint8_t *second = make_body(100 * 1024, 2);
+
+	struct http_client *client = http_client_create();
+	check(http_client_request(client, "PUT", url, NULL, first, 1000) ==
+	      200);
+	check(http_client_request(client, "PUT", url, NULL, second,
+				  100 * 1024) == 200);
+	http_client_destroy(client);
+	server_stop(&server);
+
+	check(server.accepts == 1);
+	check(received(&server.requests[0], first, 1000));
+	check(received(&server.requests[1], second, 100 * 1024));
+	check(!server.requests[0].chunked && !server.requests[1].chunked);
+	server_free(&server);
+	free(first);
+	free(second);
+}
+
+static void test_reconnect(void)
+{
+	struct server server = {0};
+	server.close_after[0] = true;
+	if (!server_start(&server, 2)) {
+		check(!"server started");
+		return;
+	}
+
+	char url[64];
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/shot", server.port);
+	uint8_t *first = make_body(1000, 3);
+	uint8_t *second = make_body(2000, 4);
+
+	struct http_client *client = http_client_create();
+	check(http_client_request(client, "PUT", url, NULL, first, 1000) ==
+	      200);
+	// the connection is idle and closed by the server before the next
+	// request, which the client only notices when it is reused
+	while (!__atomic_load_n(&server.closed_count, __ATOMIC_SEQ_CST))
+		usleep(1000);
+	check(http_client_request(client, "PUT", url, NULL, second, 2000) ==
+	      200);
+	http_client_destroy(client);
+	server_stop(&server);
+
+	check(server.accepts == 2);
+	check(received(&server.requests[0], first, 1000));
+	check(received(&server.requests[1], second, 2000));
+	server_free(&server);
+	free(first);
+	free(second);
+}
+
+static void test_chunked(void)
+{
+	struct server server = {0};
+	if (!server_start(&server, 2)) {
+		check(!"server started");
+		return;
+	}
+
+	char url[64];
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/shot", server.port);
+	// several full chunks and a partial one
+	size_t size = 3 * HTTP_CLIENT_CHUNK_SIZE + 12345;
+	uint8_t *body = make_body(size, 5);
+
+	struct http_client *client = http_client_create();
+	http_client_set_chunk_threshold(client, 64 * 1024);
+	check(http_client_request(client, "PUT", url, NULL, body, size) ==
+	      200);
+	// below the threshold it is sent with a Content-Length again
+	check(http_client_request(client, "PUT", url, NULL, body, 1000) ==
+	      200);
+	http_client_destroy(client);
+	server_stop(&server);
+
+	check(server.accepts == 1);
+	check(server.requests[0].chunked);
+	check(received(&server.requests[0], body, size));
+	check(!server.requests[1].chunked);
+	check(received(&server.requests[1], body, 1000));
+	server_free(&server);
+	free(body);
+}
+
+int main(void)
+{
+	test_keep_alive();
+	test_reconnect();
+	test_chunked();
+
+	if (failures) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	printf("http client: all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,245 @@
+// Streams delta frames from the HTTP server to a client on the loopback
+// interface: a keyframe and the delta after it are both sent, with every
+// frame published to a thumbnail level too, as the capture output does.
+
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "delta-frame.h"
+#include "frame-pool.h"
+#include "http-server.h"
+#include "image-encoder.h"
+
+#define WIDTH 64
+#define HEIGHT 64
+
+static int failures;
+
+#define check(cond)                                                       \
+	do {                                                              \
+		if (!(cond)) {                                            \
+			fprintf(stderr, "%s:%d: check failed: %s\n",      \
+				__FILE__, __LINE__, #cond);               \
+			failures++;                                       \
+		}                                                         \
+	} while (0)
+
+struct client {
+	int fd;
+	char buf[4096];
+	size_t buf_pos;
+	size_t buf_len;
+};
+
+static bool fill(struct client *client)
+{
+	ssize_t received =
+		recv(client->fd, client->buf, sizeof(client->buf), 0);
+	if (received <= 0)
+		return false;
+	client->buf_pos = 0;
+	client->buf_len = (size_t)received;
+	return true;
+}
+
+static bool read_line(struct client *client, char *line, size_t size)
+{
+	size_t len = 0;
+	for (;;) {
+		if (client->buf_pos == client->buf_len && !fill(client))
+			return false;
+		char c = client->buf[client->buf_pos++];
+		if (c == '\n')
+			break;
+		if (c != '\r' && len < size - 1)
+			line[len++] = c;
+	}
+	line[len] = 0;
+	return true;
+}
+
+static bool read_bytes(struct client *client, uint8_t *data, size_t size)
+{
+	while (size) {
+		if (client->buf_pos == client->buf_len && !fill(client))
+			return false;
+		size_t available = client->buf_len - client->buf_pos;
+		size_t n = size < available ? size : available;
+		memcpy(data, client->buf + client->buf_pos, n);
+		client->buf_pos += n;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+// a port nothing listens on, the server binds it with SO_REUSEADDR
+static int free_port(void)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr = {0};
+	socklen_t len = sizeof(addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int port = 0;
+	if (bind(fd, (struct sockaddr *)&addr, len) == 0 &&
+	    getsockname(fd, (struct sockaddr *)&addr, &len) == 0)
+		port = ntohs(addr.sin_port);
+	close(fd);
+	return port;
+}
+
+static bool connect_stream(struct client *client, int port)
+{
+	static const char request[] = "GET /stream.delta HTTP/1.1\r\n"
+				      "Host: 127.0.0.1\r\n\r\n";
+	char line[256];
+
+	client->fd = socket(AF_INET, SOCK_STREAM, 0);
+	// a frame that is never sent fails the test instead of hanging it
+	struct timeval timeout = {5, 0};
+	setsockopt(client->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+		   sizeof(timeout));
+
+	struct sockaddr_in addr = {0};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(client->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    send(client->fd, request, sizeof(request) - 1, 0) < 0 ||
+	    !read_line(client, line, sizeof(line)) ||
+	    strncmp(line, "HTTP/1.1 200", 12) != 0)
+		return false;
+	while (*line) {
+		if (!read_line(client, line, sizeof(line)))
+			return false;
+	}
+	return true;
+}
+
+// reads the next part of the multipart stream, NULL if there is none
+static uint8_t *read_part(struct client *client, size_t *size)
+{
+	char line[256];
+	size_t length = 0;
+
+	if (!read_line(client, line, sizeof(line)) ||
+	    strcmp(line, "--screenshotframe") != 0)
+		return NULL;
+	for (;;) {
+		if (!read_line(client, line, sizeof(line)))
+			return NULL;
+		if (!*line)
+			break;
+		if (strncasecmp(line, "Content-Length:", 15) == 0)
+			length = strtoull(line + 15, NULL, 10);
+	}
+
+	uint8_t *data = malloc(length ? length : 1);
+	if (!read_bytes(client, data, length) ||
+	    !read_line(client, line, sizeof(line)) || *line) {
+		free(data);
+		return NULL;
+	}
+	*size = length;
+	return data;
+}
+
+// publishes the image to level 0 as a delta frame and half of it to level 1,
+// returns the size of the delta frame in out
+static size_t publish(struct http_server *server, struct frame_pool *pool,
+		      struct delta_encoder *encoder, uint8_t value,
+		      uint32_t index, uint8_t *out)
+{
+	struct frame_buffer *buffer =
+		frame_pool_get(pool, PIXEL_FORMAT_RGBA, WIDTH, HEIGHT,
+			       WIDTH * 4, WIDTH * 4 * HEIGHT);
+	memset(buffer->data, value, buffer->size);
+	size_t size = delta_encoder_encode(encoder, buffer->data,
+					   buffer->linesize, WIDTH, HEIGHT,
+					   index, out);
+	http_server_publish(server, 0, buffer, NULL, out, size, index, index,
+			    index);
+	frame_buffer_release(buffer);
+
+	struct frame_buffer *half =
+		frame_pool_get(pool, PIXEL_FORMAT_RGBA, WIDTH / 2, HEIGHT / 2,
+			       WIDTH * 2, WIDTH * 2 * HEIGHT / 2);
+	memset(half->data, value, half->size);
+	http_server_publish(server, 1, half, NULL, NULL, 0, index, index,
+			    index);
+	frame_buffer_release(half);
+	for (uint32_t i = 2; i < IMAGE_MAX_LEVELS; i++)
+		http_server_publish(server, i, NULL, NULL, NULL, 0, index,
+				    index, index);
+	return size;
+}
+
+static bool is_keyframe(const uint8_t *data, size_t size)
+{
+	const struct delta_frame_header *header =
+		delta_frame_get_header(data, size);
+	return header && (header->flags & DELTA_FRAME_KEYFRAME) != 0;
+}
+
+static void test_delta_stream(void)
+{
+	int port = free_port();
+	struct http_server *server = http_server_create();
+	if (!port || !http_server_start(server, port, true)) {
+		check(!"server started");
+		http_server_destroy(server);
+		return;
+	}
+
+	struct frame_pool *pool = frame_pool_create(4);
+	struct delta_encoder *encoder =
+		delta_encoder_create(DELTA_FRAME_DEFAULT_TILE_SIZE);
+	size_t max_size = delta_encoder_max_size(encoder, WIDTH, HEIGHT);
+	uint8_t *keyframe = malloc(max_size);
+	uint8_t *delta = malloc(max_size);
+
+	// the stream starts with the frame published before it connected
+	size_t keyframe_size = publish(server, pool, encoder, 10, 0, keyframe);
+	check(is_keyframe(keyframe, keyframe_size));
+
+	struct client client = {0};
+	check(connect_stream(&client, port));
+	size_t size = 0;
+	uint8_t *part = read_part(&client, &size);
+	check(part && size == keyframe_size &&
+	      memcmp(part, keyframe, size) == 0);
+	free(part);
+
+	// published once the keyframe was sent, so it is not skipped
+	size_t delta_size = publish(server, pool, encoder, 20, 1, delta);
+	check(!is_keyframe(delta, delta_size));
+	part = read_part(&client, &size);
+	check(part && size == delta_size && memcmp(part, delta, size) == 0);
+	free(part);
+
+	close(client.fd);
+	http_server_destroy(server);
+	delta_encoder_destroy(encoder);
+	frame_pool_release(pool);
+	free(keyframe);
+	free(delta);
+}
+
+int main(void)
+{
+	test_delta_stream();
+
+	if (failures) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	printf("http server: all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,199 @@
+// Drives the readback ring through readback_cpu_ops: frames are collected in
+// the order they were staged and count - 1 frames after it, staging fails
+// while every surface is busy or mapped, and frames that will never be
+// collected are discarded.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "readback-ring.h"
+
+#define WIDTH 5
+#define HEIGHT 3
+
+static int failures;
+
+#define check(cond)                                                       \
+	do {                                                              \
+		if (!(cond)) {                                            \
+			fprintf(stderr, "%s:%d: check failed: %s\n",      \
+				__FILE__, __LINE__, #cond);               \
+			failures++;                                       \
+		}                                                         \
+	} while (0)
+
+static int discarded;
+
+static void discard(void *param, void *frame)
+{
+	(void)param;
+	(void)frame;
+	discarded++;
+}
+
+// frame ids start at 1 so that they are never NULL
+static void *frame_ptr(int id)
+{
+	return (void *)(intptr_t)id;
+}
+
+static int frame_id(void *frame)
+{
+	return (int)(intptr_t)frame;
+}
+
+// an image whose every byte is the id of the frame it was staged for
+static struct readback_cpu_image make_image(uint8_t *data, int id)
+{
+	struct readback_cpu_image image = {data, WIDTH * 4};
+	memset(data, id, WIDTH * 4 * HEIGHT);
+	return image;
+}
+
+static bool image_is(const uint8_t *data, uint32_t linesize, int id)
+{
+	for (uint32_t y = 0; y < HEIGHT; y++) {
+		for (uint32_t x = 0; x < WIDTH * 4; x++) {
+			if (data[y * linesize + x] != (uint8_t)id)
+				return false;
+		}
+	}
+	return true;
+}
+
+static void test_order_and_latency(uint32_t count)
+{
+	uint8_t pixels[WIDTH * 4 * HEIGHT];
+	struct readback_ring *ring =
+		readback_ring_create(&readback_cpu_ops, discard, NULL);
+	readback_ring_resize(ring, WIDTH, HEIGHT, count);
+
+	// staged every frame the way the filter does, the ring never fills
+	int next = 1;
+	for (int id = 1; id <= 20; id++) {
+		readback_ring_next_frame(ring);
+		struct readback_cpu_image image = make_image(pixels, id);
+		check(readback_ring_stage(ring, &image, frame_ptr(id)));
+
+		uint8_t *data;
+		uint32_t linesize;
+		void *frame;
+		while ((frame = readback_ring_collect(ring, &data,
+						      &linesize))) {
+			check(frame_id(frame) == next);
+			check(id - frame_id(frame) == (int)count - 1);
+			check(linesize >= WIDTH * 4);
+			check(image_is(data, linesize, frame_id(frame)));
+			readback_ring_release(ring);
+			next++;
+		}
+	}
+	check(next == 20 - (int)count + 2);
+	check(readback_ring_pending(ring) == count - 1);
+
+	discarded = 0;
+	readback_ring_destroy(ring);
+	check(discarded == (int)count - 1);
+}
+
+static void test_busy(uint32_t count)
+{
+	uint8_t pixels[WIDTH * 4 * HEIGHT];
+	struct readback_cpu_image image = make_image(pixels, 1);
+	struct readback_ring *ring =
+		readback_ring_create(&readback_cpu_ops, discard, NULL);
+	readback_ring_resize(ring, WIDTH, HEIGHT, count);
+
+	// every surface staged in one frame, the next one finds none free
+	readback_ring_next_frame(ring);
+	for (uint32_t i = 0; i < count; i++)
+		check(readback_ring_stage(ring, &image, frame_ptr(i + 1)));
+	check(!readback_ring_stage(ring, &image, frame_ptr(99)));
+	check(readback_ring_pending(ring) == count);
+
+	// the first frame is due count - 1 frames later, and its surface is
+	// the next to be staged into but stays in use while it is mapped
+	for (uint32_t i = 1; i < count; i++) {
+		uint8_t *data;
+		uint32_t linesize;
+		check(!readback_ring_collect(ring, &data, &linesize));
+		readback_ring_next_frame(ring);
+	}
+	uint8_t *data;
+	uint32_t linesize;
+	check(frame_id(readback_ring_collect(ring, &data, &linesize)) == 1);
+	check(readback_ring_pending(ring) == count - 1);
+	check(!readback_ring_stage(ring, &image, frame_ptr(99)));
+	// nothing else is collected while a surface is mapped
+	check(!readback_ring_collect(ring, &data, &linesize));
+
+	readback_ring_release(ring);
+	check(readback_ring_stage(ring, &image, frame_ptr(count + 1)));
+
+	discarded = 0;
+	readback_ring_destroy(ring);
+	check(discarded == (int)count);
+}
+
+static void test_discard(uint32_t count)
+{
+	uint8_t pixels[WIDTH * 4 * HEIGHT];
+	struct readback_cpu_image image = make_image(pixels, 1);
+	struct readback_ring *ring =
+		readback_ring_create(&readback_cpu_ops, discard, NULL);
+	readback_ring_resize(ring, WIDTH, HEIGHT, count);
+
+	readback_ring_next_frame(ring);
+	for (uint32_t i = 0; i < count; i++)
+		check(readback_ring_stage(ring, &image, frame_ptr(i + 1)));
+
+	// the same size and count keeps the staged frames
+	discarded = 0;
+	readback_ring_resize(ring, WIDTH, HEIGHT, count);
+	check(discarded == 0);
+	check(readback_ring_pending(ring) == count);
+
+	readback_ring_resize(ring, WIDTH + 1, HEIGHT, count);
+	check(discarded == (int)count);
+	check(readback_ring_pending(ring) == 0);
+
+	readback_ring_next_frame(ring);
+	readback_ring_resize(ring, WIDTH, HEIGHT, count);
+	for (uint32_t i = 0; i < count; i++)
+		check(readback_ring_stage(ring, &image, frame_ptr(i + 1)));
+
+	discarded = 0;
+	readback_ring_reset(ring);
+	check(discarded == (int)count);
+	check(readback_ring_pending(ring) == 0);
+
+	// after a reset the ring is staged and collected from the start
+	for (uint32_t i = 0; i < count; i++) {
+		readback_ring_next_frame(ring);
+		check(readback_ring_stage(ring, &image, frame_ptr(i + 1)));
+	}
+	uint8_t *data;
+	uint32_t linesize;
+	check(frame_id(readback_ring_collect(ring, &data, &linesize)) == 1);
+	readback_ring_release(ring);
+
+	discarded = 0;
+	readback_ring_destroy(ring);
+	check(discarded == (int)count - 1);
+}
+
+int main(void)
+{
+	for (uint32_t count = 1; count <= READBACK_MAX_SURFACES; count++) {
+		test_order_and_latency(count);
+		test_busy(count);
+		test_discard(count);
+	}
+
+	if (failures) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	printf("readback ring: all checks passed\n");
+	return 0;
+}
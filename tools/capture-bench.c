@@ -0,0 +1,577 @@
+/*
+ * Benchmarks the capture pipeline of capture-output.h outside of OBS.
+ *
+ *   capture-bench [OPTIONS]
+ *
+ * Every combination of source, codec and sink is run once: frames are
+ * copied and submitted the way the filter does after a readback, encoded on
+ * the shared encoder threads and written, and frames per second, bytes per
+ * frame and latency percentiles are printed for each run.
+ *
+ *   --sizes LIST    synthetic sources, of 720p, 1080p, 4k and 8k
+ *   --input FILE    a recorded .raw frame in RGBA or BGRA, repeat it for a
+ *                   sequence of frames of the same size, which then replaces
+ *                   the synthetic sources.  BGRA frames are swizzled to RGBA
+ *                   once when they are loaded, as the GPU hands out RGBA
+ *   --codecs LIST   of png, qoi, jpeg, webp, raw and delta
+ *   --sinks LIST    of memory (publishing to an HTTP server that is not
+ *                   started), file, log, shmem and url
+ *   --url URL       where the url sink uploads to, it is skipped without
+ *   --dir DIR       where files and frame logs are written, capture-bench.out
+ *   --keep          keep what was written, it is deleted after each run
+ *   --frames N      frames per run, 30
+ *   --rate N        submit N frames per second instead of as fast as the
+ *                   encoders take them, for latencies of a real capture rate
+ *   --threads N     encoder threads, 0 picks one less than the cores
+ *   --depth N       max frames in flight, 4
+ *
+ * LISTs are comma separated, everything is run by default.  Codecs a build
+ * of FFmpeg lacks are skipped, and so are encoded codecs with shmem, which
+ * only takes raw frames.
+ */
+
+#include "capture-output.h"
+#include "capture-stats.h"
+#include "encode-pool.h"
+#include "raw-frame-reader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <obs-module.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+
+#define MAX_INPUTS 64
+
+struct bench_size {
+	const char *name;
+	uint32_t width;
+	uint32_t height;
+};
+
+static const struct bench_size sizes[] = {
+	{"720p", 1280, 720},
+	{"1080p", 1920, 1080},
+	{"4k", 3840, 2160},
+	{"8k", 7680, 4320},
+};
+
+struct bench_codec {
+	const char *name;
+	enum image_codec codec;
+	bool raw;
+	bool delta;
+};
+
+static const struct bench_codec codecs[] = {
+	{"png", IMAGE_CODEC_PNG, false, false},
+	{"qoi", IMAGE_CODEC_QOI, false, false},
+	{"jpeg", IMAGE_CODEC_JPEG, false, false},
+	{"webp", IMAGE_CODEC_WEBP_LOSSLESS, false, false},
+	{"raw", IMAGE_CODEC_PNG, true, false},
+	{"delta", IMAGE_CODEC_PNG, true, true},
+};
+
+struct bench_sink {
+	const char *name;
+	enum capture_destination type;
+};
+
+static const struct bench_sink sinks[] = {
+	{"memory", CAPTURE_DESTINATION_SERVER},
+	{"file", CAPTURE_DESTINATION_PATH},
+	{"log", CAPTURE_DESTINATION_LOG},
+	{"shmem", CAPTURE_DESTINATION_SHMEM},
+	{"url", CAPTURE_DESTINATION_URL},
+};
+
+#define ARRAY_COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+struct bench_options {
+	const char *sizes;
+	const char *codecs;
+	const char *sinks;
+	const char *url;
+	const char *dir;
+	bool keep;
+	uint32_t frames;
+	double rate;
+	uint32_t threads;
+	uint32_t depth;
+	const char *inputs[MAX_INPUTS];
+	uint32_t input_count;
+};
+
+// the frames of a run, one synthetic image that changes every frame or a
+// sequence of recorded ones
+struct bench_source {
+	const char *name;
+	uint32_t width;
+	uint32_t height;
+	uint32_t linesize;
+	const uint8_t *images[MAX_INPUTS];
+	uint32_t image_count;
+
+	uint8_t *synthetic;
+	struct raw_frame_reader readers[MAX_INPUTS];
+	// RGBA copies of BGRA inputs
+	uint8_t *swizzled[MAX_INPUTS];
+};
+
+static bool in_list(const char *list, const char *name)
+{
+	if (!list)
+		return true;
+
+	size_t len = strlen(name);
+	for (const char *p = list; *p;) {
+		size_t item = strcspn(p, ",");
+		if (item == len && strncmp(p, name, len) == 0)
+			return true;
+		p += item;
+		if (*p == ',')
+			p++;
+	}
+	return false;
+}
+
+// something like a desktop: flat panels, gradients and a noisy photo, so
+// that every codec has some work to do
+static void fill_synthetic(uint8_t *data, uint32_t width, uint32_t height,
+			   uint32_t linesize)
+{
+	uint32_t seed = 1;
+
+	for (uint32_t y = 0; y < height; y++) {
+		uint8_t *row = data + (size_t)y * linesize;
+		for (uint32_t x = 0; x < width; x++) {
+			uint8_t *pixel = row + (size_t)x * 4;
+			if (x < width / 4) {
+				pixel[0] = 40;
+				pixel[1] = 44;
+				pixel[2] = 52;
+			} else if (y < height / 2) {
+				pixel[0] = (uint8_t)(x * 255 / width);
+				pixel[1] = (uint8_t)(y * 255 / height);
+				pixel[2] = 128;
+			} else {
+				seed = seed * 1103515245 + 12345;
+				uint8_t noise = (uint8_t)(seed >> 24) & 31;
+				pixel[0] = (uint8_t)(x / 8 + noise);
+				pixel[1] = (uint8_t)(y / 8 + noise);
+				pixel[2] = (uint8_t)(noise * 4);
+			}
+			pixel[3] = 255;
+		}
+	}
+}
+
+// moves a block across the synthetic image, so that consecutive frames
+// differ the way a screen with one moving window does
+static void animate(struct bench_source *source, uint32_t frame)
+{
+	uint32_t block_width = source->width / 8;
+	uint32_t block_height = source->height / 8;
+	uint32_t x0 = (frame * 37) % (source->width - block_width);
+	uint32_t y0 = (frame * 23) % (source->height - block_height);
+	uint8_t color = (uint8_t)(frame * 16);
+
+	for (uint32_t y = y0; y < y0 + block_height; y++) {
+		uint8_t *row = source->synthetic + (size_t)y * source->linesize;
+		for (uint32_t x = x0; x < x0 + block_width; x++) {
+			uint8_t *pixel = row + (size_t)x * 4;
+			pixel[0] = color;
+			pixel[1] = (uint8_t)(255 - color);
+			pixel[2] = (uint8_t)(x ^ y);
+		}
+	}
+}
+
+static bool init_synthetic(struct bench_source *source,
+			   const struct bench_size *size)
+{
+	memset(source, 0, sizeof(*source));
+	source->name = size->name;
+	source->width = size->width;
+	source->height = size->height;
+	source->linesize = size->width * 4;
+	source->synthetic =
+		malloc((size_t)source->linesize * source->height);
+	if (!source->synthetic)
+		return false;
+
+	fill_synthetic(source->synthetic, source->width, source->height,
+		       source->linesize);
+	source->images[0] = source->synthetic;
+	source->image_count = 1;
+	return true;
+}
+
+static void free_source(struct bench_source *source)
+{
+	free(source->synthetic);
+	for (uint32_t i = 0; i < MAX_INPUTS; i++) {
+		raw_frame_reader_close(&source->readers[i]);
+		free(source->swizzled[i]);
+	}
+}
+
+// copies a BGRA image with its row padding, swapping red and blue
+static uint8_t *swizzle_bgra(const uint8_t *data, uint32_t width,
+			     uint32_t height, uint32_t linesize)
+{
+	uint8_t *rgba = malloc((size_t)linesize * height);
+	if (!rgba)
+		return NULL;
+
+	memcpy(rgba, data, (size_t)linesize * height);
+	for (uint32_t y = 0; y < height; y++) {
+		uint8_t *row = rgba + (size_t)y * linesize;
+		for (uint32_t x = 0; x < width; x++) {
+			uint8_t *pixel = row + (size_t)x * 4;
+			uint8_t blue = pixel[0];
+			pixel[0] = pixel[2];
+			pixel[2] = blue;
+		}
+	}
+	return rgba;
+}
+
+static bool init_recorded(struct bench_source *source,
+			  const struct bench_options *opts)
+{
+	memset(source, 0, sizeof(*source));
+	source->name = "input";
+
+	for (uint32_t i = 0; i < opts->input_count; i++) {
+		struct raw_frame_reader *reader = &source->readers[i];
+		const char *path = opts->inputs[i];
+		if (!raw_frame_reader_open(reader, path, false)) {
+			fprintf(stderr, "%s: %s\n", path, reader->error);
+			return false;
+		}
+
+		const struct raw_frame_header *header = reader->header;
+		if (header->pixel_format != RAW_FRAME_FORMAT_RGBA &&
+		    header->pixel_format != RAW_FRAME_FORMAT_BGRA) {
+			fprintf(stderr, "%s: only RGBA and BGRA frames can be "
+					"fed to the pipeline\n",
+				path);
+			return false;
+		}
+		if (i == 0) {
+			source->width = header->width;
+			source->height = header->height;
+			source->linesize = header->linesize;
+		} else if (header->width != source->width ||
+			   header->height != source->height ||
+			   header->linesize != source->linesize) {
+			fprintf(stderr, "%s: not the size of %s\n", path,
+				opts->inputs[0]);
+			return false;
+		}
+		source->images[i] = reader->data;
+
+		// submitted as RGBA like a readback, so a recorded run
+		// encodes the same colors as the filter did
+		if (header->pixel_format == RAW_FRAME_FORMAT_BGRA) {
+			source->swizzled[i] =
+				swizzle_bgra(reader->data, header->width,
+					     header->height, header->linesize);
+			if (!source->swizzled[i]) {
+				fprintf(stderr, "%s: out of memory\n", path);
+				return false;
+			}
+			source->images[i] = source->swizzled[i];
+		}
+	}
+	source->image_count = opts->input_count;
+	return true;
+}
+
+static void remove_dir(const char *dir)
+{
+	char pattern[512];
+	snprintf(pattern, sizeof(pattern), "%s/*", dir);
+
+	os_glob_t *glob;
+	if (os_glob(pattern, 0, &glob) == 0) {
+		for (size_t i = 0; i < glob->gl_pathc; i++)
+			os_unlink(glob->gl_pathv[i].path);
+		os_globfree(glob);
+	}
+	os_rmdir(dir);
+}
+
+static struct capture_frame *create_frame(const struct bench_source *source,
+					  const struct bench_codec *codec,
+					  const struct bench_sink *sink,
+					  const char *destination)
+{
+	struct capture_frame *frame = bzalloc(sizeof(struct capture_frame));
+	frame->width = source->width;
+	frame->height = source->height;
+
+	frame->destination = bstrdup(destination);
+	frame->destination_type = sink->type;
+	frame->raw = codec->raw;
+	frame->pixel_format = PIXEL_FORMAT_RGBA;
+	image_codec_settings_init(&frame->codec);
+	frame->codec.codec = codec->codec;
+	frame->delta = codec->delta;
+	frame->delta_keyframe_interval = 30;
+	frame->shmem_slots = 3;
+	frame->log_segment_size = 1024ULL << 20;
+	frame->atomic_write = true;
+	frame->fsync_policy = CAPTURE_FSYNC_NONE;
+
+	frame->output_width = frame->width;
+	frame->output_height = frame->height;
+	frame->level_count = 1;
+	return frame;
+}
+
+static double ns_to_ms(uint64_t ns)
+{
+	return (double)ns / 1000000.0;
+}
+
+static void print_header(void)
+{
+	printf("%-8s %-6s %-7s %6s %8s %9s %10s %17s %17s %26s %5s %5s\n",
+	       "source", "codec", "sink", "frames", "fps", "MiB/s",
+	       "KiB/frame", "encode p50/p99", "write p50/p99",
+	       "total p50/p90/p99 (ms)", "drop", "fail");
+}
+
+static void print_result(const struct bench_source *source,
+			 const struct bench_codec *codec,
+			 const struct bench_sink *sink, uint64_t elapsed,
+			 const struct capture_stats_summary *summary)
+{
+	const struct capture_stage_summary *encode =
+		&summary->stages[CAPTURE_STAGE_ENCODE];
+	const struct capture_stage_summary *write =
+		&summary->stages[CAPTURE_STAGE_WRITE];
+	const struct capture_stage_summary *total =
+		&summary->stages[CAPTURE_STAGE_TOTAL];
+	uint64_t frames = summary->counters[CAPTURE_COUNTER_ENCODED];
+	double bytes = (double)summary->counters[CAPTURE_COUNTER_BYTES];
+	double seconds = (double)elapsed / 1000000000.0;
+
+	printf("%-8s %-6s %-7s %6llu %8.1f %9.1f %10.1f %8.2f %8.2f "
+	       "%8.2f %8.2f %8.2f %8.2f %8.2f %5llu %5llu\n",
+	       source->name, codec->name, sink->name,
+	       (unsigned long long)frames, (double)frames / seconds,
+	       bytes / (1024.0 * 1024.0) / seconds,
+	       frames ? bytes / 1024.0 / (double)frames : 0.0,
+	       ns_to_ms(encode->p50_ns), ns_to_ms(encode->p99_ns),
+	       ns_to_ms(write->p50_ns), ns_to_ms(write->p99_ns),
+	       ns_to_ms(total->p50_ns), ns_to_ms(total->p90_ns),
+	       ns_to_ms(total->p99_ns),
+	       (unsigned long long)summary->counters[CAPTURE_COUNTER_DROPPED],
+	       (unsigned long long)summary->counters[CAPTURE_COUNTER_FAILED]);
+	fflush(stdout);
+}
+
+static void run(const struct bench_options *opts, struct bench_source *source,
+		const struct bench_codec *codec, const struct bench_sink *sink)
+{
+	char dir[512];
+	char destination[512];
+	snprintf(dir, sizeof(dir), "%s/%s-%s-%s", opts->dir, source->name,
+		 codec->name, sink->name);
+
+	switch (sink->type) {
+	case CAPTURE_DESTINATION_PATH:
+		// named per frame in the loop, see there
+		os_mkdirs(dir);
+		break;
+	case CAPTURE_DESTINATION_LOG:
+		snprintf(destination, sizeof(destination), "%s", dir);
+		break;
+	case CAPTURE_DESTINATION_SHMEM:
+		snprintf(destination, sizeof(destination), "capture-bench");
+		break;
+	case CAPTURE_DESTINATION_URL:
+		snprintf(destination, sizeof(destination), "%s", opts->url);
+		break;
+	default:
+		destination[0] = 0;
+		break;
+	}
+
+	struct capture_stats *stats = capture_stats_create();
+	struct capture_output output = {0};
+	capture_output_init(&output, sink->type == CAPTURE_DESTINATION_SERVER,
+			    stats);
+	// every frame is measured, none are dropped
+	encode_client_set_queue(output.encode_client, opts->depth,
+				ENCODE_QUEUE_BLOCK);
+
+	uint64_t start = os_gettime_ns();
+	for (uint32_t i = 0; i < opts->frames; i++) {
+		if (opts->rate > 0.0)
+			os_sleepto_ns(start + (uint64_t)((double)i * 1e9 /
+							 opts->rate));
+		if (source->synthetic)
+			animate(source, i);
+		// a frame to the path of one still being written replaces
+		// it, and the older one is never written but was counted
+		if (sink->type == CAPTURE_DESTINATION_PATH)
+			snprintf(destination, sizeof(destination),
+				 "%s/frame-%06u", dir, i);
+
+		struct capture_frame *frame =
+			create_frame(source, codec, sink, destination);
+		frame->timestamp = os_gettime_ns();
+		frame->frame_number = i;
+		capture_output_copy(&output, frame,
+				    source->images[i % source->image_count],
+				    source->linesize, true);
+		capture_output_submit(&output, frame);
+	}
+
+	// stopping discards frames that are still queued, and freeing waits
+	// for the file sink to finish writing
+	encode_client_flush(output.encode_client);
+	capture_stats_add(stats, CAPTURE_COUNTER_DROPPED,
+			  encode_client_dropped(output.encode_client));
+	capture_output_stop(&output);
+	capture_output_free(&output);
+	uint64_t elapsed = os_gettime_ns() - start;
+
+	struct capture_stats_summary summary;
+	capture_stats_collect(stats, &summary);
+	capture_stats_destroy(stats);
+	print_result(source, codec, sink, elapsed, &summary);
+
+	if (!opts->keep &&
+	    (sink->type == CAPTURE_DESTINATION_PATH ||
+	     sink->type == CAPTURE_DESTINATION_LOG))
+		remove_dir(dir);
+}
+
+static void run_source(const struct bench_options *opts,
+		       struct bench_source *source)
+{
+	for (size_t i = 0; i < ARRAY_COUNT(codecs); i++) {
+		const struct bench_codec *codec = &codecs[i];
+		if (!in_list(opts->codecs, codec->name) ||
+		    (!codec->raw && !image_codec_available(codec->codec)))
+			continue;
+
+		for (size_t j = 0; j < ARRAY_COUNT(sinks); j++) {
+			const struct bench_sink *sink = &sinks[j];
+			if (!in_list(opts->sinks, sink->name) ||
+			    (sink->type == CAPTURE_DESTINATION_SHMEM &&
+			     !codec->raw) ||
+			    (sink->type == CAPTURE_DESTINATION_URL &&
+			     !opts->url))
+				continue;
+			run(opts, source, codec, sink);
+		}
+	}
+}
+
+static int usage(void)
+{
+	fprintf(stderr,
+		"usage: capture-bench [--sizes LIST] [--input FILE]... "
+		"[--codecs LIST] [--sinks LIST]\n"
+		"                     [--url URL] [--dir DIR] [--keep] "
+		"[--frames N] [--rate N]\n"
+		"                     [--threads N] [--depth N]\n");
+	return 2;
+}
+
+static bool parse_options(int argc, char **argv, struct bench_options *opts)
+{
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		if (strcmp(arg, "--keep") == 0) {
+			opts->keep = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+			return false;
+
+		const char *value = argv[++i];
+		if (strcmp(arg, "--sizes") == 0)
+			opts->sizes = value;
+		else if (strcmp(arg, "--codecs") == 0)
+			opts->codecs = value;
+		else if (strcmp(arg, "--sinks") == 0)
+			opts->sinks = value;
+		else if (strcmp(arg, "--url") == 0)
+			opts->url = value;
+		else if (strcmp(arg, "--dir") == 0)
+			opts->dir = value;
+		else if (strcmp(arg, "--frames") == 0)
+			opts->frames = (uint32_t)strtoul(value, NULL, 10);
+		else if (strcmp(arg, "--rate") == 0)
+			opts->rate = strtod(value, NULL);
+		else if (strcmp(arg, "--threads") == 0)
+			opts->threads = (uint32_t)strtoul(value, NULL, 10);
+		else if (strcmp(arg, "--depth") == 0)
+			opts->depth = (uint32_t)strtoul(value, NULL, 10);
+		else if (strcmp(arg, "--input") == 0 &&
+			 opts->input_count < MAX_INPUTS)
+			opts->inputs[opts->input_count++] = value;
+		else
+			return false;
+	}
+	return opts->frames > 0 && opts->depth > 0 &&
+	       opts->depth <= ENCODE_QUEUE_MAX_DEPTH;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_options opts = {
+		.dir = "capture-bench.out",
+		.frames = 30,
+		.depth = 4,
+	};
+	if (!parse_options(argc, argv, &opts))
+		return usage();
+
+	if (!encode_pool_init()) {
+		fprintf(stderr, "could not start the encoder threads\n");
+		return 1;
+	}
+	encode_pool_reserve_threads(opts.threads);
+
+	int result = 0;
+	print_header();
+
+	if (opts.input_count) {
+		struct bench_source source;
+		if (init_recorded(&source, &opts))
+			run_source(&opts, &source);
+		else
+			result = 1;
+		free_source(&source);
+	} else {
+		for (size_t i = 0; i < ARRAY_COUNT(sizes); i++) {
+			if (!in_list(opts.sizes, sizes[i].name))
+				continue;
+
+			struct bench_source source;
+			if (!init_synthetic(&source, &sizes[i])) {
+				fprintf(stderr, "%s: out of memory\n",
+					sizes[i].name);
+				result = 1;
+				continue;
+			}
+			run_source(&opts, &source);
+			free_source(&source);
+		}
+	}
+
+	if (!opts.keep)
+		os_rmdir(opts.dir);
+	encode_pool_free();
+	return result;
+}
@@ -0,0 +1,214 @@
+/*
+ * Checks and benchmarks .raw files with raw-frame-reader.h.
+ *
+ *   raw-frame-tool validate FILE...
+ *       prints the header of each file and checks it and its checksum,
+ *       exits with 1 if any file is not a valid raw frame
+ *   raw-frame-tool bench FILE [ITERATIONS]
+ *       times opening, checking and reading the pixels of FILE in place
+ *   raw-frame-tool generate FILE WIDTH HEIGHT [FORMAT]
+ *       writes a test frame with a checksum, FORMAT is one of rgba, bgra,
+ *       rgb24, gray8 and yuv420
+ *
+ * Only uses the consumer headers, it does not need OBS.
+ */
+
+#include "raw-frame-reader.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+static const char *format_names[] = {"rgba", "bgra", "rgb24", "gray8",
+				     "yuv420"};
+#define FORMAT_COUNT (sizeof(format_names) / sizeof(format_names[0]))
+
+// monotonic like the timestamps the filter writes, see raw-frame.h
+static uint64_t now_ns(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)((double)counter.QuadPart * 1e9 /
+			  (double)frequency.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static const char *format_name(uint32_t format)
+{
+	return format < FORMAT_COUNT ? format_names[format] : "unknown";
+}
+
+static int validate(int count, char **paths)
+{
+	int result = 0;
+
+	for (int i = 0; i < count; i++) {
+		struct raw_frame_reader reader;
+		if (!raw_frame_reader_open(&reader, paths[i], true)) {
+			printf("%s: invalid, %s\n", paths[i], reader.error);
+			result = 1;
+			continue;
+		}
+
+		const struct raw_frame_header *header = reader.header;
+		printf("%s: version %u, %ux%u %s, linesize %u, %" PRIu64
+		       " bytes, index %u, frame %" PRIu64
+		       ", timestamp %" PRIu64 ", %s\n",
+		       paths[i], header->version, header->width,
+		       header->height, format_name(header->pixel_format),
+		       header->linesize, header->data_size, header->index,
+		       header->frame, header->timestamp,
+		       (header->flags & RAW_FRAME_FLAG_CHECKSUM)
+			       ? "checksum ok"
+			       : "no checksum");
+		raw_frame_reader_close(&reader);
+	}
+	return result;
+}
+
+/* touches every cache line, the way a consumer reading the pixels would */
+static uint64_t read_pixels(const uint8_t *data, uint64_t size)
+{
+	uint64_t sum = 0;
+	for (uint64_t i = 0; i < size; i += 64)
+		sum += data[i];
+	return sum;
+}
+
+static int bench(const char *path, int iterations)
+{
+	uint64_t open_ns = 0;
+	uint64_t read_ns = 0;
+	uint64_t verify_ns = 0;
+	uint64_t sum = 0;
+	uint64_t size = 0;
+
+	for (int i = 0; i < iterations; i++) {
+		struct raw_frame_reader reader;
+		uint64_t start = now_ns();
+		if (!raw_frame_reader_open(&reader, path, false)) {
+			fprintf(stderr, "%s: %s\n", path, reader.error);
+			return 1;
+		}
+		uint64_t opened = now_ns();
+		sum += read_pixels(reader.data, reader.header->data_size);
+		uint64_t read = now_ns();
+		bool valid = raw_frame_reader_verify(&reader);
+		uint64_t verified = now_ns();
+
+		if (!valid) {
+			fprintf(stderr, "%s: checksum mismatch\n", path);
+			raw_frame_reader_close(&reader);
+			return 1;
+		}
+
+		size = reader.header->data_size;
+		open_ns += opened - start;
+		read_ns += read - opened;
+		verify_ns += verified - read;
+		raw_frame_reader_close(&reader);
+	}
+
+	double n = (double)iterations;
+	double mb = (double)size / (1024.0 * 1024.0);
+	printf("%s: %.1f MiB, %d iterations\n", path, mb, iterations);
+	printf("  open and parse  %10.1f us\n", open_ns / n / 1000.0);
+	printf("  read in place   %10.1f us  %8.1f MiB/s\n",
+	       read_ns / n / 1000.0, mb * n * 1e9 / (double)(read_ns + 1));
+	printf("  verify checksum %10.1f us  %8.1f MiB/s\n",
+	       verify_ns / n / 1000.0,
+	       mb * n * 1e9 / (double)(verify_ns + 1));
+	// keeps the reads from being optimized away
+	return sum == UINT64_MAX;
+}
+
+static int generate(const char *path, uint32_t width, uint32_t height,
+		    uint32_t format)
+{
+	static const uint32_t bytes_per_pixel[] = {4, 4, 3, 1, 1};
+	struct raw_frame_header header = {
+		.magic = RAW_FRAME_MAGIC,
+		.version = RAW_FRAME_VERSION,
+		.header_size = sizeof(header),
+		.flags = RAW_FRAME_FLAG_CHECKSUM,
+		.width = width,
+		.height = height,
+		.linesize = width * bytes_per_pixel[format],
+		.pixel_format = format,
+		.timestamp = now_ns(),
+	};
+	header.data_size = raw_frame_min_size(format, width, height,
+					      header.linesize);
+
+	uint8_t *data = malloc((size_t)header.data_size);
+	if (!data) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for (uint64_t i = 0; i < header.data_size; i++)
+		data[i] = (uint8_t)(i * 7 + i / 4096);
+	header.checksum = raw_frame_checksum(data, (size_t)header.data_size);
+
+	FILE *fp = fopen(path, "wb");
+	bool success = fp && fwrite(&header, sizeof(header), 1, fp) == 1 &&
+		       fwrite(data, 1, (size_t)header.data_size, fp) ==
+			       header.data_size;
+	if (fp && fclose(fp) != 0)
+		success = false;
+	free(data);
+
+	if (!success) {
+		fprintf(stderr, "%s: failed to write\n", path);
+		return 1;
+	}
+	return 0;
+}
+
+static int usage(void)
+{
+	fprintf(stderr,
+		"usage: raw-frame-tool validate FILE...\n"
+		"       raw-frame-tool bench FILE [ITERATIONS]\n"
+		"       raw-frame-tool generate FILE WIDTH HEIGHT [FORMAT]\n");
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc >= 3 && strcmp(argv[1], "validate") == 0)
+		return validate(argc - 2, argv + 2);
+
+	if ((argc == 3 || argc == 4) && strcmp(argv[1], "bench") == 0) {
+		int iterations = argc == 4 ? atoi(argv[3]) : 100;
+		return iterations > 0 ? bench(argv[2], iterations) : usage();
+	}
+
+	if ((argc == 5 || argc == 6) && strcmp(argv[1], "generate") == 0) {
+		uint32_t width = (uint32_t)strtoul(argv[3], NULL, 10);
+		uint32_t height = (uint32_t)strtoul(argv[4], NULL, 10);
+		uint32_t format = 0;
+		if (argc == 6) {
+			while (format < FORMAT_COUNT &&
+			       strcmp(argv[5], format_names[format]) != 0)
+				format++;
+		}
+		if (!width || !height || width > 65536 || height > 65536 ||
+		    format >= FORMAT_COUNT)
+			return usage();
+		return generate(argv[2], width, height, format);
+	}
+
+	return usage();
+}